@@ -7,8 +7,13 @@ import (
 	"io"
 	"io/ioutil"
 	"net/http"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"strings"
 	"syscall"
 	"testing"
+	"time"
 )
 
 // TestH1H2PlainGET tests whether simple HTTP/2 GET request works.
@@ -497,3 +502,55 @@ func TestH2H2ConnectFailure(t *testing.T) {
 		t.Errorf("status: %v; want %v", got, want)
 	}
 }
+
+// TestH2H1RecordReplay tests that bytes recorded by
+// --frontend-http2-record-dir can be replayed by h2replay.
+func TestH2H1RecordReplay(t *testing.T) {
+	dir, err := ioutil.TempDir("", "nghttpx-record")
+	if err != nil {
+		t.Fatalf("Error ioutil.TempDir() = %v", err)
+	}
+	defer os.RemoveAll(dir)
+
+	st := newServerTester([]string{"--frontend-http2-record-dir=" + dir}, t, noopHandler)
+	defer st.Close()
+
+	res, err := st.http2(requestParam{
+		name: "TestH2H1RecordReplay",
+	})
+	if err != nil {
+		t.Fatalf("Error st.http2() = %v", err)
+	}
+	if got, want := res.status, 200; got != want {
+		t.Errorf("status: %v; want %v", got, want)
+	}
+
+	// Recorded bytes are written when connection is closed.
+	st.conn.Close()
+	st.conn = nil
+
+	var files []string
+	for retry := 0; ; retry++ {
+		files, err = filepath.Glob(filepath.Join(dir, "h2-*.bin"))
+		if err != nil {
+			t.Fatalf("Error filepath.Glob() = %v", err)
+		}
+		if len(files) == 1 {
+			if fi, err := os.Stat(files[0]); err == nil && fi.Size() > 0 {
+				break
+			}
+		}
+		if retry >= 20 {
+			t.Fatalf("Error recorded file was not written; files = %v", files)
+		}
+		time.Sleep(100 * time.Millisecond)
+	}
+
+	out, err := exec.Command(buildDir+"/src/h2replay", files[0]).CombinedOutput()
+	if err != nil {
+		t.Fatalf("Error h2replay %v: %v\n%s", files[0], err, out)
+	}
+	if want := "sessions: 1 total, 0 errored"; !strings.Contains(string(out), want) {
+		t.Errorf("h2replay output = %s; want %v", out, want)
+	}
+}
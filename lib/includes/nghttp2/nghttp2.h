@@ -1869,6 +1869,32 @@ void nghttp2_option_set_peer_max_concurrent_streams(nghttp2_option *option,
  */
 void nghttp2_option_set_recv_client_preface(nghttp2_option *option, int val);
 
+/**
+ * @function
+ *
+ * This option enables adaptive DATA frame sizing, and sets the upper
+ * limit of DATA frame payload length to |val| bytes.  By default,
+ * DATA frame payload is capped so that a DATA frame fits into a
+ * single TLS record (16384 bytes including frame header), regardless
+ * of SETTINGS_MAX_FRAME_SIZE of the remote endpoint.
+ *
+ * If this option is used, first 64KiB of DATA payload of each stream
+ * is still sent in the default size so that the first bytes reach
+ * the remote endpoint as early as possible.  After that, DATA frame
+ * payload length is increased as more data is sent in the stream,
+ * up to the smaller of |val| and SETTINGS_MAX_FRAME_SIZE of the
+ * remote endpoint.  This reduces per-frame overhead for bulk
+ * transfer, especially over clear text or when the application
+ * writes multiple TLS records at once.
+ *
+ * The value less than or equal to the default payload length
+ * effectively disables this feature.  If
+ * :type:`nghttp2_data_source_read_length_callback` is set, its
+ * return value takes precedence over this option.
+ */
+void nghttp2_option_set_max_data_frame_size(nghttp2_option *option,
+                                            uint32_t val);
+
 /**
  * @function
  *
@@ -2212,6 +2238,53 @@ int nghttp2_session_recv(nghttp2_session *session);
 ssize_t nghttp2_session_mem_recv(nghttp2_session *session, const uint8_t *in,
                                  size_t inlen);
 
+/**
+ * @struct
+ *
+ * The chunk of input bytes passed to `nghttp2_session_mem_recvv()`.
+ */
+typedef struct {
+  /**
+   * The pointer to the input bytes.
+   */
+  const uint8_t *base;
+  /**
+   * The length of the |base|.
+   */
+  size_t len;
+} nghttp2_vec;
+
+/**
+ * @function
+ *
+ * Processes |veclen| chunks of data pointed by |vec| as an input from
+ * the remote endpoint.  The chunks are processed in the order they
+ * appear in |vec|, as if they were concatenated and passed to
+ * `nghttp2_session_mem_recv()`, but without requiring the application
+ * to copy them into a single contiguous buffer first.
+ *
+ * The memory pointed by each :member:`nghttp2_vec.base` is owned by
+ * the application.  The library does not keep any reference to it
+ * after this function returns, except for the case described below.
+ * DATA payload passed to :type:`nghttp2_on_data_chunk_recv_callback`
+ * and the opaque data of GOAWAY which fits in a single chunk refer
+ * to the input directly, and are only valid in the callback.
+ *
+ * If :enum:`NGHTTP2_ERR_PAUSE` is returned from
+ * :type:`nghttp2_on_header_callback` or
+ * :type:`nghttp2_on_data_chunk_recv_callback`, this function returns
+ * immediately, and the return value includes the number of bytes
+ * which was used to produce the data or frame for the callback.  The
+ * application must retain the unprocessed bytes and pass them again
+ * in the next invocation, just like `nghttp2_session_mem_recv()`.
+ *
+ * This function returns the total number of processed bytes, or one
+ * of the negative error codes described in
+ * `nghttp2_session_mem_recv()`.
+ */
+ssize_t nghttp2_session_mem_recvv(nghttp2_session *session,
+                                  const nghttp2_vec *vec, size_t veclen);
+
 /**
  * @function
  *
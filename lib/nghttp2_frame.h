@@ -60,6 +60,11 @@
 #define NGHTTP2_DATA_PAYLOADLEN                                                \
   ((NGHTTP2_MAX_FRAME_SIZE_MIN) - (NGHTTP2_FRAME_HDLEN))
 
+/* The number of bytes of DATA payload in a stream which are sent in
+   NGHTTP2_DATA_PAYLOADLEN before adaptive DATA frame sizing starts
+   to increase frame size. */
+#define NGHTTP2_DATA_RAMPUP_LENGTH (64 * 1024)
+
 /* Maximum headers payload length, calculated in compressed form.
    This applies to transmission only. */
 #define NGHTTP2_MAX_HEADERSLEN 65536
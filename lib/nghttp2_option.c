@@ -51,3 +51,9 @@ void nghttp2_option_set_recv_client_preface(nghttp2_option *option, int val) {
   option->opt_set_mask |= NGHTTP2_OPT_RECV_CLIENT_PREFACE;
   option->recv_client_preface = val;
 }
+
+void nghttp2_option_set_max_data_frame_size(nghttp2_option *option,
+                                            uint32_t val) {
+  option->opt_set_mask |= NGHTTP2_OPT_MAX_DATA_FRAME_SIZE;
+  option->max_data_frame_size = val;
+}
@@ -58,6 +58,7 @@ typedef enum {
    */
   NGHTTP2_OPT_PEER_MAX_CONCURRENT_STREAMS = 1 << 1,
   NGHTTP2_OPT_RECV_CLIENT_PREFACE = 1 << 2,
+  NGHTTP2_OPT_MAX_DATA_FRAME_SIZE = 1 << 3,
 } nghttp2_option_flag;
 
 /**
@@ -73,6 +74,10 @@ struct nghttp2_option {
    * NGHTTP2_OPT_PEER_MAX_CONCURRENT_STREAMS
    */
   uint32_t peer_max_concurrent_streams;
+  /**
+   * NGHTTP2_OPT_MAX_DATA_FRAME_SIZE
+   */
+  uint32_t max_data_frame_size;
   /**
    * NGHTTP2_OPT_NO_AUTO_WINDOW_UPDATE
    */
@@ -279,12 +279,36 @@ static void init_settings(nghttp2_settings_storage *settings) {
   settings->max_header_list_size = UINT32_MAX;
 }
 
-static void active_outbound_item_reset(nghttp2_active_outbound_item *aob,
-                                       nghttp2_mem *mem) {
+nghttp2_outbound_item *
+nghttp2_session_new_outbound_item(nghttp2_session *session) {
+  if (session->ob_item_cache_len) {
+    return session->ob_item_cache[--session->ob_item_cache_len];
+  }
+
+  return nghttp2_mem_malloc(&session->mem, sizeof(nghttp2_outbound_item));
+}
+
+void nghttp2_session_del_outbound_item(nghttp2_session *session,
+                                       nghttp2_outbound_item *item) {
+  if (item == NULL) {
+    return;
+  }
+
+  if (session->ob_item_cache_len < NGHTTP2_OB_ITEM_CACHE_MAX) {
+    session->ob_item_cache[session->ob_item_cache_len++] = item;
+    return;
+  }
+
+  nghttp2_mem_free(&session->mem, item);
+}
+
+static void active_outbound_item_reset(nghttp2_session *session) {
+  nghttp2_active_outbound_item *aob = &session->aob;
+
   DEBUGF(fprintf(stderr, "send: reset nghttp2_active_outbound_item\n"));
   DEBUGF(fprintf(stderr, "send: aob->item = %p\n", aob->item));
-  nghttp2_outbound_item_free(aob->item, mem);
-  nghttp2_mem_free(mem, aob->item);
+  nghttp2_outbound_item_free(aob->item, &session->mem);
+  nghttp2_session_del_outbound_item(session, aob->item);
   aob->item = NULL;
   nghttp2_bufs_reset(&aob->framebufs);
   aob->state = NGHTTP2_OB_POP_ITEM;
@@ -374,7 +398,7 @@ static int session_new(nghttp2_session **session_ptr,
     goto fail_aob_framebuf;
   }
 
-  active_outbound_item_reset(&(*session_ptr)->aob, mem);
+  active_outbound_item_reset(*session_ptr);
 
   init_settings(&(*session_ptr)->remote_settings);
   init_settings(&(*session_ptr)->local_settings);
@@ -396,6 +420,13 @@ static int session_new(nghttp2_session **session_ptr,
 
       (*session_ptr)->opt_flags |= NGHTTP2_OPTMASK_RECV_CLIENT_PREFACE;
     }
+
+    if ((option->opt_set_mask & NGHTTP2_OPT_MAX_DATA_FRAME_SIZE) &&
+        option->max_data_frame_size > NGHTTP2_DATA_PAYLOADLEN) {
+
+      (*session_ptr)->max_data_frame_size = nghttp2_min(
+          option->max_data_frame_size, NGHTTP2_MAX_FRAME_SIZE_MAX);
+    }
   }
 
   (*session_ptr)->callbacks = *callbacks;
@@ -517,7 +548,7 @@ static int free_streams(nghttp2_map_entry *entry, void *ptr) {
 
   if (item && !item->queued && item != session->aob.item) {
     nghttp2_outbound_item_free(item, mem);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_del_outbound_item(session, item);
   }
 
   nghttp2_stream_free(stream);
@@ -538,6 +569,7 @@ static void ob_pq_free(nghttp2_pq *pq, nghttp2_mem *mem) {
 
 void nghttp2_session_del(nghttp2_session *session) {
   nghttp2_mem *mem;
+  size_t i;
 
   if (session == NULL) {
     return;
@@ -557,11 +589,16 @@ void nghttp2_session_del(nghttp2_session *session) {
   ob_pq_free(&session->ob_pq, mem);
   ob_pq_free(&session->ob_ss_pq, mem);
   ob_pq_free(&session->ob_da_pq, mem);
-  active_outbound_item_reset(&session->aob, mem);
+  active_outbound_item_reset(session);
   session_inbound_frame_reset(session);
   nghttp2_hd_deflate_free(&session->hd_deflater);
   nghttp2_hd_inflate_free(&session->hd_inflater);
   nghttp2_bufs_free(&session->aob.framebufs);
+
+  for (i = 0; i < session->ob_item_cache_len; ++i) {
+    nghttp2_mem_free(mem, session->ob_item_cache[i]);
+  }
+
   nghttp2_mem_free(mem, session);
 }
 
@@ -787,15 +824,13 @@ int nghttp2_session_add_rst_stream(nghttp2_session *session, int32_t stream_id,
   nghttp2_outbound_item *item;
   nghttp2_frame *frame;
   nghttp2_stream *stream;
-  nghttp2_mem *mem;
 
-  mem = &session->mem;
   stream = nghttp2_session_get_stream(session, stream_id);
   if (stream && stream->state == NGHTTP2_STREAM_CLOSING) {
     return 0;
   }
 
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_new_outbound_item(session);
   if (item == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
@@ -808,7 +843,7 @@ int nghttp2_session_add_rst_stream(nghttp2_session *session, int32_t stream_id,
   rv = nghttp2_session_add_item(session, item);
   if (rv != 0) {
     nghttp2_frame_rst_stream_free(&frame->rst_stream);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_del_outbound_item(session, item);
     return rv;
   }
   return 0;
@@ -997,7 +1032,7 @@ int nghttp2_session_close_stream(nghttp2_session *session, int32_t stream_id,
        free the item. */
     if (!item->queued && item != session->aob.item) {
       nghttp2_outbound_item_free(item, mem);
-      nghttp2_mem_free(mem, item);
+      nghttp2_session_del_outbound_item(session, item);
     }
   }
 
@@ -1503,6 +1538,30 @@ nghttp2_session_enforce_flow_control_limits(nghttp2_session *session,
                      (int32_t)session->remote_settings.max_frame_size);
 }
 
+/*
+ * Returns the preferred length of next DATA payload for |stream|.
+ * Unless adaptive DATA frame sizing is enabled, this is always
+ * NGHTTP2_DATA_PAYLOADLEN.  Otherwise, first
+ * NGHTTP2_DATA_RAMPUP_LENGTH bytes are sent in
+ * NGHTTP2_DATA_PAYLOADLEN, and then the length grows with the number
+ * of bytes sent in |stream| so far, up to
+ * session->max_data_frame_size.
+ */
+static size_t session_data_payloadlen(nghttp2_session *session,
+                                      nghttp2_stream *stream) {
+  size_t payloadlen;
+
+  if (session->max_data_frame_size == 0 ||
+      stream->sent_data_length < NGHTTP2_DATA_RAMPUP_LENGTH) {
+    return NGHTTP2_DATA_PAYLOADLEN;
+  }
+
+  payloadlen = nghttp2_min(stream->sent_data_length,
+                           (size_t)session->max_data_frame_size);
+
+  return nghttp2_max(payloadlen, (size_t)NGHTTP2_DATA_PAYLOADLEN);
+}
+
 /*
  * Returns the maximum length of next data read. If the
  * connection-level and/or stream-wise flow control are enabled, the
@@ -1514,7 +1573,7 @@ static size_t nghttp2_session_next_data_read(nghttp2_session *session,
   ssize_t window_size;
 
   window_size = nghttp2_session_enforce_flow_control_limits(
-      session, stream, NGHTTP2_DATA_PAYLOADLEN);
+      session, stream, session_data_payloadlen(session, stream));
 
   DEBUGF(fprintf(stderr, "send: available window=%zd\n", window_size));
 
@@ -1656,9 +1715,7 @@ static int session_prep_frame(nghttp2_session *session,
   int framerv = 0;
   int rv;
   nghttp2_frame *frame;
-  nghttp2_mem *mem;
 
-  mem = &session->mem;
   frame = &item->frame;
 
   if (frame->hd.type != NGHTTP2_DATA) {
@@ -1926,7 +1983,7 @@ static int session_prep_frame(nghttp2_session *session,
       }
 
       session->aob.item = NULL;
-      active_outbound_item_reset(&session->aob, mem);
+      active_outbound_item_reset(session);
       return NGHTTP2_ERR_DEFERRED;
     }
 
@@ -1942,7 +1999,7 @@ static int session_prep_frame(nghttp2_session *session,
       }
 
       session->aob.item = NULL;
-      active_outbound_item_reset(&session->aob, mem);
+      active_outbound_item_reset(session);
       return NGHTTP2_ERR_DEFERRED;
     }
     if (framerv == NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE) {
@@ -2388,6 +2445,7 @@ static int session_after_frame_sent1(nghttp2_session *session) {
     session->remote_window_size -= frame->hd.length;
     if (stream) {
       stream->remote_window_size -= frame->hd.length;
+      stream->sent_data_length += frame->hd.length;
     }
 
     if (stream && aux_data->eof) {
@@ -2461,9 +2519,7 @@ static int session_after_frame_sent2(nghttp2_session *session) {
   nghttp2_outbound_item *item = aob->item;
   nghttp2_bufs *framebufs = &aob->framebufs;
   nghttp2_frame *frame;
-  nghttp2_mem *mem;
 
-  mem = &session->mem;
   frame = &item->frame;
 
   if (frame->hd.type != NGHTTP2_DATA) {
@@ -2481,7 +2537,7 @@ static int session_after_frame_sent2(nghttp2_session *session) {
       }
     }
 
-    active_outbound_item_reset(&session->aob, mem);
+    active_outbound_item_reset(session);
 
     return 0;
   } else {
@@ -2496,7 +2552,7 @@ static int session_after_frame_sent2(nghttp2_session *session) {
        on_frame_send_callback (call from session_after_frame_sent1),
        which attach data to stream.  We don't want to detach it. */
     if (aux_data->eof) {
-      active_outbound_item_reset(aob, mem);
+      active_outbound_item_reset(session);
 
       return 0;
     }
@@ -2514,7 +2570,7 @@ static int session_after_frame_sent2(nghttp2_session *session) {
         }
       }
 
-      active_outbound_item_reset(aob, mem);
+      active_outbound_item_reset(session);
 
       return 0;
     }
@@ -2560,7 +2616,7 @@ static int session_after_frame_sent2(nghttp2_session *session) {
         }
 
         aob->item = NULL;
-        active_outbound_item_reset(aob, mem);
+        active_outbound_item_reset(session);
 
         return 0;
       }
@@ -2581,7 +2637,7 @@ static int session_after_frame_sent2(nghttp2_session *session) {
         }
 
         aob->item = NULL;
-        active_outbound_item_reset(aob, mem);
+        active_outbound_item_reset(session);
 
         return 0;
       }
@@ -2602,7 +2658,7 @@ static int session_after_frame_sent2(nghttp2_session *session) {
           return rv;
         }
 
-        active_outbound_item_reset(aob, mem);
+        active_outbound_item_reset(session);
 
         return 0;
       }
@@ -2622,7 +2678,7 @@ static int session_after_frame_sent2(nghttp2_session *session) {
     }
 
     aob->item = NULL;
-    active_outbound_item_reset(&session->aob, mem);
+    active_outbound_item_reset(session);
     return 0;
   }
   /* Unreachable */
@@ -2690,15 +2746,15 @@ static ssize_t nghttp2_session_mem_send_internal(nghttp2_session *session,
                     session, frame, rv, session->user_data) != 0) {
 
               nghttp2_outbound_item_free(item, mem);
-              nghttp2_mem_free(mem, item);
+              nghttp2_session_del_outbound_item(session, item);
 
               return NGHTTP2_ERR_CALLBACK_FAILURE;
             }
           }
         }
         nghttp2_outbound_item_free(item, mem);
-        nghttp2_mem_free(mem, item);
-        active_outbound_item_reset(aob, mem);
+        nghttp2_session_del_outbound_item(session, item);
+        active_outbound_item_reset(session);
 
         if (rv == NGHTTP2_ERR_HEADER_COMP) {
           /* If header compression error occurred, should terminiate
@@ -4594,6 +4650,8 @@ ssize_t nghttp2_session_mem_recv(nghttp2_session *session, const uint8_t *in,
 
   mem = &session->mem;
 
+  session->paused = 0;
+
   for (;;) {
     switch (iframe->state) {
     case NGHTTP2_IB_READ_CLIENT_PREFACE:
@@ -5121,6 +5179,29 @@ ssize_t nghttp2_session_mem_recv(nghttp2_session *session, const uint8_t *in,
         /* 8 is Last-stream-ID + Error Code */
         debuglen = iframe->frame.hd.length - 8;
 
+        if (debuglen > 0 && (size_t)(last - in) >= debuglen) {
+          /* Whole debug data is available in the input.  Refer to it
+             directly instead of copying it into iframe->raw_lbuf. */
+          nghttp2_buf_wrap_init(&iframe->lbuf, (uint8_t *)in, debuglen);
+          iframe->lbuf.last += debuglen;
+
+          iframe->payloadleft -= debuglen;
+          in += debuglen;
+
+          rv = session_process_goaway_frame(session);
+
+          /* opaque_data is not owned by us */
+          iframe->frame.goaway.opaque_data = NULL;
+
+          if (nghttp2_is_fatal(rv)) {
+            return rv;
+          }
+
+          session_inbound_frame_reset(session);
+
+          break;
+        }
+
         if (debuglen > 0) {
           iframe->raw_lbuf = nghttp2_mem_malloc(mem, debuglen);
 
@@ -5193,6 +5274,7 @@ ssize_t nghttp2_session_mem_recv(nghttp2_session *session, const uint8_t *in,
         if (rv == NGHTTP2_ERR_PAUSE) {
           in += hd_proclen;
           iframe->payloadleft -= hd_proclen;
+          session->paused = 1;
 
           return in - first;
         }
@@ -5534,6 +5616,7 @@ ssize_t nghttp2_session_mem_recv(nghttp2_session *session, const uint8_t *in,
               session, iframe->frame.hd.flags, iframe->frame.hd.stream_id,
               in - readlen, data_readlen, session->user_data);
           if (rv == NGHTTP2_ERR_PAUSE) {
+            session->paused = 1;
             return in - first;
           }
 
@@ -5605,6 +5688,34 @@ ssize_t nghttp2_session_mem_recv(nghttp2_session *session, const uint8_t *in,
   return in - first;
 }
 
+ssize_t nghttp2_session_mem_recvv(nghttp2_session *session,
+                                  const nghttp2_vec *vec, size_t veclen) {
+  size_t i;
+  ssize_t proclen;
+  ssize_t nread = 0;
+
+  for (i = 0; i < veclen; ++i) {
+    if (vec[i].len == 0) {
+      continue;
+    }
+
+    proclen = nghttp2_session_mem_recv(session, vec[i].base, vec[i].len);
+    if (proclen < 0) {
+      return proclen;
+    }
+
+    nread += proclen;
+
+    /* A pause may consume exactly up to the end of vec[i], so we
+       cannot rely on proclen here. */
+    if (session->paused) {
+      break;
+    }
+  }
+
+  return nread;
+}
+
 int nghttp2_session_recv(nghttp2_session *session) {
   uint8_t buf[NGHTTP2_INBOUND_BUFFER_LENGTH];
   while (1) {
@@ -5699,10 +5810,8 @@ int nghttp2_session_add_ping(nghttp2_session *session, uint8_t flags,
   int rv;
   nghttp2_outbound_item *item;
   nghttp2_frame *frame;
-  nghttp2_mem *mem;
 
-  mem = &session->mem;
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_new_outbound_item(session);
   if (item == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
@@ -5717,7 +5826,7 @@ int nghttp2_session_add_ping(nghttp2_session *session, uint8_t flags,
 
   if (rv != 0) {
     nghttp2_frame_ping_free(&frame->ping);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_del_outbound_item(session, item);
     return rv;
   }
   return 0;
@@ -5750,7 +5859,7 @@ int nghttp2_session_add_goaway(nghttp2_session *session, int32_t last_stream_id,
     memcpy(opaque_data_copy, opaque_data, opaque_data_len);
   }
 
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_new_outbound_item(session);
   if (item == NULL) {
     nghttp2_mem_free(mem, opaque_data_copy);
     return NGHTTP2_ERR_NOMEM;
@@ -5773,7 +5882,7 @@ int nghttp2_session_add_goaway(nghttp2_session *session, int32_t last_stream_id,
   rv = nghttp2_session_add_item(session, item);
   if (rv != 0) {
     nghttp2_frame_goaway_free(&frame->goaway, mem);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_del_outbound_item(session, item);
     return rv;
   }
   return 0;
@@ -5785,10 +5894,8 @@ int nghttp2_session_add_window_update(nghttp2_session *session, uint8_t flags,
   int rv;
   nghttp2_outbound_item *item;
   nghttp2_frame *frame;
-  nghttp2_mem *mem;
 
-  mem = &session->mem;
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_new_outbound_item(session);
   if (item == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
@@ -5804,7 +5911,7 @@ int nghttp2_session_add_window_update(nghttp2_session *session, uint8_t flags,
 
   if (rv != 0) {
     nghttp2_frame_window_update_free(&frame->window_update);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_del_outbound_item(session, item);
     return rv;
   }
   return 0;
@@ -5833,7 +5940,7 @@ int nghttp2_session_add_settings(nghttp2_session *session, uint8_t flags,
     return NGHTTP2_ERR_INVALID_ARGUMENT;
   }
 
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_new_outbound_item(session);
   if (item == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
@@ -5841,7 +5948,7 @@ int nghttp2_session_add_settings(nghttp2_session *session, uint8_t flags,
   if (niv > 0) {
     iv_copy = nghttp2_frame_iv_copy(iv, niv, mem);
     if (iv_copy == NULL) {
-      nghttp2_mem_free(mem, item);
+      nghttp2_session_del_outbound_item(session, item);
       return NGHTTP2_ERR_NOMEM;
     }
   } else {
@@ -5854,7 +5961,7 @@ int nghttp2_session_add_settings(nghttp2_session *session, uint8_t flags,
 
       if (session->inflight_iv == NULL) {
         nghttp2_mem_free(mem, iv_copy);
-        nghttp2_mem_free(mem, item);
+        nghttp2_session_del_outbound_item(session, item);
         return NGHTTP2_ERR_NOMEM;
       }
     } else {
@@ -5881,7 +5988,7 @@ int nghttp2_session_add_settings(nghttp2_session *session, uint8_t flags,
     }
 
     nghttp2_frame_settings_free(&frame->settings, mem);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_del_outbound_item(session, item);
 
     return rv;
   }
@@ -5947,8 +6054,10 @@ int nghttp2_session_pack_data(nghttp2_session *session, nghttp2_bufs *bufs,
       if (rv != 0) {
         DEBUGF(fprintf(stderr, "send: realloc buffer failed rv=%d", rv));
         /* If reallocation failed, old buffers are still in tact.  So
-           use safe limit. */
-        payloadlen = datamax;
+           use safe limit.  datamax may exceed the current buffer if
+           adaptive DATA frame sizing is enabled. */
+        payloadlen =
+            (ssize_t)nghttp2_min(datamax, (size_t)NGHTTP2_DATA_PAYLOADLEN);
 
         DEBUGF(
             fprintf(stderr, "send: use safe limit payloadlen=%zd", payloadlen));
@@ -5959,6 +6068,21 @@ int nghttp2_session_pack_data(nghttp2_session *session, nghttp2_bufs *bufs,
       }
     }
     datamax = (size_t)payloadlen;
+  } else if (datamax > (size_t)nghttp2_buf_avail(buf)) {
+    /* Adaptive DATA frame sizing asked for larger payload than the
+       current buffer can hold. */
+    rv = nghttp2_bufs_realloc(&session->aob.framebufs,
+                              NGHTTP2_FRAME_HDLEN + 1 + datamax);
+
+    if (rv != 0) {
+      DEBUGF(fprintf(stderr, "send: realloc buffer failed rv=%d", rv));
+
+      datamax = NGHTTP2_DATA_PAYLOADLEN;
+    } else {
+      assert(&session->aob.framebufs == bufs);
+
+      buf = &bufs->cur->buf;
+    }
   }
 
   /* Current max DATA length is less then buffer chunk size */
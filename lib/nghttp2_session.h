@@ -49,6 +49,10 @@ typedef enum {
   NGHTTP2_OPTMASK_RECV_CLIENT_PREFACE = 1 << 1,
 } nghttp2_optmask;
 
+/* The maximum number of nghttp2_outbound_item objects kept in
+   nghttp2_session for reuse */
+#define NGHTTP2_OB_ITEM_CACHE_MAX 16
+
 typedef enum {
   NGHTTP2_OB_POP_ITEM,
   NGHTTP2_OB_SEND_DATA
@@ -147,6 +151,13 @@ struct nghttp2_session {
   /* QUeue for DATA frame */
   nghttp2_pq /* <nghttp2_outbound_item*> */ ob_da_pq;
   nghttp2_active_outbound_item aob;
+  /* Released nghttp2_outbound_item objects kept for reuse.  Sending
+     frames, especially small control frames like PING and
+     WINDOW_UPDATE, does not require memory allocation once this is
+     filled. */
+  nghttp2_outbound_item *ob_item_cache[NGHTTP2_OB_ITEM_CACHE_MAX];
+  /* The number of objects in |ob_item_cache| */
+  size_t ob_item_cache_len;
   nghttp2_inbound_frame iframe;
   nghttp2_hd_deflater hd_deflater;
   nghttp2_hd_inflater hd_inflater;
@@ -248,11 +259,17 @@ struct nghttp2_session {
   nghttp2_settings_storage local_settings;
   /* Option flags. This is bitwise-OR of 0 or more of nghttp2_optmask. */
   uint32_t opt_flags;
+  /* Upper limit of DATA payload length when adaptive DATA frame
+     sizing is enabled.  0 if it is disabled. */
+  uint32_t max_data_frame_size;
   /* Unacked local SETTINGS_MAX_CONCURRENT_STREAMS value. We use this
      to refuse the incoming stream if it exceeds this value. */
   uint32_t pending_local_max_concurrent_stream;
   /* Nonzero if the session is server side. */
   uint8_t server;
+  /* Nonzero if a callback returned NGHTTP2_ERR_PAUSE during the last
+     call of nghttp2_session_mem_recv(). */
+  uint8_t paused;
   /* Flags indicating GOAWAY is sent and/or recieved. The flags are
      composed by bitwise OR-ing nghttp2_goaway_flag. */
   uint8_t goaway_flags;
@@ -285,6 +302,25 @@ typedef struct {
 int nghttp2_session_is_my_stream_id(nghttp2_session *session,
                                     int32_t stream_id);
 
+/*
+ * Returns nghttp2_outbound_item object, which is taken from
+ * session->ob_item_cache if available, or is newly allocated.  The
+ * returned object is not initialized.  This function returns NULL if
+ * it fails to allocate memory.
+ */
+nghttp2_outbound_item *
+nghttp2_session_new_outbound_item(nghttp2_session *session);
+
+/*
+ * Releases |item|, which must be obtained by
+ * nghttp2_session_new_outbound_item().  The resources owned by its
+ * frame must be freed beforehand.  |item| is kept in
+ * session->ob_item_cache for reuse if it has room.  If |item| is
+ * NULL, this function does nothing.
+ */
+void nghttp2_session_del_outbound_item(nghttp2_session *session,
+                                       nghttp2_outbound_item *item);
+
 /*
  * Initializes |item|.  No memory allocation is done in this function.
  * Don't call nghttp2_outbound_item_free() until frame member is
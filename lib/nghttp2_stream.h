@@ -178,6 +178,9 @@ struct nghttp2_stream {
   /* sum of weight of direct descendants whose dpri value is
      NGHTTP2_STREAM_DPRI_TOP */
   int32_t sum_top_weight;
+  /* The number of bytes of DATA payload (including padding) sent in
+     this stream so far. */
+  size_t sent_data_length;
   nghttp2_stream_state state;
   /* This is bitwise-OR of 0 or more of nghttp2_stream_flag. */
   uint8_t flags;
@@ -735,6 +735,21 @@ int Http2Handler::submit_push_promise(Stream *stream,
         http2::get_header(stream->hdidx, http2::HD_HOST, stream->headers);
   }
 
+  auto url = std::string(get_config()->no_tls ? "http" : "https");
+  url += "://";
+  url += authority->value;
+  url += push_path;
+
+  // Don't push the resource which was already pushed in this
+  // connection, or the client already has in its cache.
+  if (pushed_urls_.count(url) || cache_digest_.contains(url)) {
+    if (get_config()->verbose) {
+      print_session_id(session_id_);
+      std::cout << "Skip push " << url << std::endl;
+    }
+    return 0;
+  }
+
   auto nva = std::vector<nghttp2_nv>{
       http2::make_nv_ll(":method", "GET"),
       http2::make_nv_ls(":path", push_path),
@@ -750,6 +765,8 @@ int Http2Handler::submit_push_promise(Stream *stream,
     return promised_stream_id;
   }
 
+  pushed_urls_.insert(std::move(url));
+
   auto promised_stream = util::make_unique<Stream>(this, promised_stream_id);
 
   append_nv(promised_stream.get(), nva);
@@ -758,6 +775,47 @@ int Http2Handler::submit_push_promise(Stream *stream,
   return 0;
 }
 
+namespace {
+// Returns the value of cookie |name| in |headers|, or empty string if
+// it is not found.
+std::string get_cookie(const Headers &headers, const std::string &name) {
+  for (auto &kv : headers) {
+    if (kv.name != "cookie") {
+      continue;
+    }
+    auto &v = kv.value;
+    for (size_t pos = 0; pos < v.size();) {
+      auto end = v.find(';', pos);
+      if (end == std::string::npos) {
+        end = v.size();
+      }
+      auto first = v.find_first_not_of(' ', pos);
+      if (first != std::string::npos && first + name.size() < end &&
+          v.compare(first, name.size(), name) == 0 &&
+          v[first + name.size()] == '=') {
+        first += name.size() + 1;
+        return v.substr(first, end - first);
+      }
+      pos = end + 1;
+    }
+  }
+  return "";
+}
+} // namespace
+
+void Http2Handler::update_cache_digest(const Stream *stream) {
+  auto digest = http2::get_header(stream->headers, "cache-digest");
+  if (digest) {
+    cache_digest_.decode_base64url(digest->value);
+    return;
+  }
+
+  auto cookie = get_cookie(stream->headers, "cache-digest");
+  if (!cookie.empty()) {
+    cache_digest_.decode_base64url(cookie);
+  }
+}
+
 int Http2Handler::submit_rst_stream(Stream *stream, uint32_t error_code) {
   remove_stream_read_timeout(stream);
   remove_stream_write_timeout(stream);
@@ -943,6 +1001,7 @@ void prepare_response(Stream *stream, Http2Handler *hd,
   }
   auto push_itr = hd->get_config()->push.find(url);
   if (allow_push && push_itr != std::end(hd->get_config()->push)) {
+    hd->update_cache_digest(stream);
     for (auto &push_path : (*push_itr).second) {
       rv = hd->submit_push_promise(stream, push_path);
       if (rv != 0) {
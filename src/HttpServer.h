@@ -35,6 +35,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <memory>
 
 #include <openssl/ssl.h>
@@ -45,6 +46,7 @@
 
 #include "http2.h"
 #include "ringbuf.h"
+#include "cache_digest.h"
 
 namespace nghttp2 {
 
@@ -117,6 +119,10 @@ public:
 
   int submit_push_promise(Stream *stream, const std::string &push_path);
 
+  // Updates cache digest of this connection from "cache-digest"
+  // header field or cookie in request |stream|.
+  void update_cache_digest(const Stream *stream);
+
   int submit_rst_stream(Stream *stream, uint32_t error_code);
 
   void add_stream(int32_t stream_id, std::unique_ptr<Stream> stream);
@@ -143,6 +149,10 @@ private:
   ev_io rev_;
   ev_timer settings_timerev_;
   std::map<int32_t, std::unique_ptr<Stream>> id2stream_;
+  // URLs already pushed in this connection
+  std::set<std::string> pushed_urls_;
+  // URLs the client claims to have in its cache
+  CacheDigest cache_digest_;
   RingBuf<65536> wb_;
   std::function<int(Http2Handler &)> read_, write_;
   int64_t session_id_;
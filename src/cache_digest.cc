@@ -0,0 +1,234 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "cache_digest.h"
+
+#include <algorithm>
+
+#include <openssl/evp.h>
+
+#include "base64.h"
+
+namespace nghttp2 {
+
+namespace {
+// Returns hash value of |url| truncated to |nbits| bits.  |nbits|
+// must be in [1, 62].
+uint64_t compute_hash(const std::string &url, uint32_t nbits) {
+  uint8_t md[EVP_MAX_MD_SIZE];
+  unsigned int mdlen;
+
+  if (EVP_Digest(url.c_str(), url.size(), md, &mdlen, EVP_sha256(),
+                 nullptr) != 1) {
+    return 0;
+  }
+
+  uint64_t v = 0;
+  for (size_t i = 0; i < 8; ++i) {
+    v = (v << 8) | md[i];
+  }
+
+  return v >> (64 - nbits);
+}
+} // namespace
+
+namespace {
+class BitReader {
+public:
+  BitReader(const uint8_t *data, size_t len)
+      : data_(data), len_(len), bitpos_(0) {}
+  // Reads |n| bits into |res|.  Returns false if input is exhausted.
+  bool read(uint64_t &res, uint32_t n) {
+    res = 0;
+    for (; n > 0; --n) {
+      if (bitpos_ >= len_ * 8) {
+        return false;
+      }
+      res = (res << 1) | ((data_[bitpos_ / 8] >> (7 - bitpos_ % 8)) & 1);
+      ++bitpos_;
+    }
+    return true;
+  }
+
+private:
+  const uint8_t *data_;
+  size_t len_;
+  size_t bitpos_;
+};
+} // namespace
+
+namespace {
+class BitWriter {
+public:
+  BitWriter() : nbits_(0) {}
+  void write(uint64_t v, uint32_t n) {
+    for (; n > 0; --n) {
+      if (nbits_ % 8 == 0) {
+        buf_ += '\0';
+      }
+      if ((v >> (n - 1)) & 1) {
+        buf_.back() |= 1 << (7 - nbits_ % 8);
+      }
+      ++nbits_;
+    }
+  }
+  const std::string &str() const { return buf_; }
+
+private:
+  std::string buf_;
+  size_t nbits_;
+};
+} // namespace
+
+CacheDigest::CacheDigest() : logn_(0), logp_(0) {}
+
+int CacheDigest::decode(const uint8_t *data, size_t len) {
+  clear();
+
+  BitReader br(data, len);
+  uint64_t logn, logp;
+
+  if (!br.read(logn, 5) || !br.read(logp, 5) || logp == 0) {
+    return -1;
+  }
+
+  auto nbits = logn + logp;
+  if (nbits > 62) {
+    return -1;
+  }
+
+  uint64_t last = 0;
+  for (;;) {
+    uint64_t q = 0;
+    uint64_t b;
+    // Quotient is unary coded.  If input is exhausted here, the
+    // remaining bits were padding.
+    for (;;) {
+      if (!br.read(b, 1)) {
+        logn_ = logn;
+        logp_ = logp;
+
+        return 0;
+      }
+      if (b) {
+        break;
+      }
+      ++q;
+    }
+
+    uint64_t r;
+    if (!br.read(r, logp)) {
+      clear();
+      return -1;
+    }
+
+    auto v = last + ((q << logp) | r);
+    if (v >> nbits) {
+      clear();
+      return -1;
+    }
+
+    keys_.push_back(v);
+    last = v;
+  }
+}
+
+int CacheDigest::decode_base64url(const std::string &s) {
+  auto t = s;
+  for (auto &c : t) {
+    if (c == '-') {
+      c = '+';
+    } else if (c == '_') {
+      c = '/';
+    }
+  }
+  if (t.size() % 4) {
+    t.append(4 - t.size() % 4, '=');
+  }
+
+  auto data = base64::decode(std::begin(t), std::end(t));
+  if (data.empty()) {
+    clear();
+    return -1;
+  }
+
+  return decode(reinterpret_cast<const uint8_t *>(data.c_str()), data.size());
+}
+
+bool CacheDigest::contains(const std::string &url) const {
+  if (keys_.empty()) {
+    return false;
+  }
+
+  auto v = compute_hash(url, logn_ + logp_);
+
+  return std::binary_search(std::begin(keys_), std::end(keys_), v);
+}
+
+bool CacheDigest::empty() const { return keys_.empty(); }
+
+void CacheDigest::clear() {
+  keys_.clear();
+  logn_ = 0;
+  logp_ = 0;
+}
+
+std::string CacheDigest::encode(const std::vector<std::string> &urls,
+                                uint32_t logp) {
+  uint32_t logn = 0;
+  for (; (1ULL << logn) < urls.size(); ++logn)
+    ;
+
+  logp = std::max(1u, std::min(logp, 31u));
+  logn = std::min(logn, 62 - logp);
+
+  std::vector<uint64_t> keys;
+  keys.reserve(urls.size());
+
+  for (auto &url : urls) {
+    keys.push_back(compute_hash(url, logn + logp));
+  }
+
+  std::sort(std::begin(keys), std::end(keys));
+  keys.erase(std::unique(std::begin(keys), std::end(keys)), std::end(keys));
+
+  BitWriter bw;
+  bw.write(logn, 5);
+  bw.write(logp, 5);
+
+  uint64_t last = 0;
+  for (auto v : keys) {
+    auto d = v - last;
+    for (auto q = d >> logp; q > 0; --q) {
+      bw.write(0, 1);
+    }
+    bw.write(1, 1);
+    bw.write(d & ((1ULL << logp) - 1), logp);
+    last = v;
+  }
+
+  return bw.str();
+}
+
+} // namespace nghttp2
@@ -0,0 +1,72 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CACHE_DIGEST_H
+#define CACHE_DIGEST_H
+
+#include "nghttp2_config.h"
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+namespace nghttp2 {
+
+// CacheDigest is a Golomb-coded set of URLs which the client claims
+// to have in its cache, as described in
+// draft-kazuho-h2-cache-digest.  The digest starts with 5 bits of
+// log2(N), where N is the number of entries, followed by 5 bits of
+// log2(P), where 1/P is the false positive probability.  Then sorted
+// hash values of URLs, truncated to log2(N) + log2(P) bits, are
+// Golomb-Rice coded with parameter log2(P) as deltas.
+class CacheDigest {
+public:
+  CacheDigest();
+  // Decodes digest |data| of length |len|.  The previous contents
+  // are discarded.  This function returns 0 if it succeeds, or -1.
+  // If it fails, the digest becomes empty.
+  int decode(const uint8_t *data, size_t len);
+  // Decodes base64url encoded digest |s|.  Trailing padding is
+  // optional.
+  int decode_base64url(const std::string &s);
+  // Returns true if |url| may be included in this digest.  False
+  // positive happens in the probability specified by the digest.
+  bool contains(const std::string &url) const;
+  bool empty() const;
+  void clear();
+  // Encodes |urls| into digest, using false positive probability
+  // 1/(2**|logp|).
+  static std::string encode(const std::vector<std::string> &urls,
+                            uint32_t logp);
+
+private:
+  // sorted hash values
+  std::vector<uint64_t> keys_;
+  uint32_t logn_;
+  uint32_t logp_;
+};
+
+} // namespace nghttp2
+
+#endif // CACHE_DIGEST_H
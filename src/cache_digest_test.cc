@@ -0,0 +1,95 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "cache_digest_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "cache_digest.h"
+#include "base64.h"
+
+namespace nghttp2 {
+
+void test_cache_digest_encode_decode(void) {
+  auto urls = std::vector<std::string>{"https://example.org/style.css",
+                                       "https://example.org/script.js",
+                                       "https://example.org/logo.png"};
+
+  auto s = CacheDigest::encode(urls, 8);
+
+  CacheDigest digest;
+
+  CU_ASSERT(0 == digest.decode(reinterpret_cast<const uint8_t *>(s.c_str()),
+                               s.size()));
+  CU_ASSERT(!digest.empty());
+
+  for (auto &url : urls) {
+    CU_ASSERT(digest.contains(url));
+  }
+
+  // Empty digest
+  s = CacheDigest::encode({}, 8);
+
+  CU_ASSERT(0 == digest.decode(reinterpret_cast<const uint8_t *>(s.c_str()),
+                               s.size()));
+  CU_ASSERT(digest.empty());
+  CU_ASSERT(!digest.contains(urls[0]));
+
+  // P must not be 0
+  const uint8_t bad[] = {0x00, 0x00};
+
+  CU_ASSERT(-1 == digest.decode(bad, sizeof(bad)));
+
+  // Truncated input
+  CU_ASSERT(-1 == digest.decode(bad, 1));
+}
+
+void test_cache_digest_decode_base64url(void) {
+  auto urls = std::vector<std::string>{"https://example.org/a.css",
+                                       "https://example.org/b.js"};
+
+  auto s = CacheDigest::encode(urls, 7);
+  auto b64 = base64::encode(std::begin(s), std::end(s));
+
+  // Convert to base64url without padding
+  for (auto &c : b64) {
+    if (c == '+') {
+      c = '-';
+    } else if (c == '/') {
+      c = '_';
+    }
+  }
+  b64.erase(b64.find_last_not_of('=') + 1);
+
+  CacheDigest digest;
+
+  CU_ASSERT(0 == digest.decode_base64url(b64));
+  CU_ASSERT(digest.contains(urls[0]));
+  CU_ASSERT(digest.contains(urls[1]));
+
+  CU_ASSERT(-1 == digest.decode_base64url("!!!!"));
+  CU_ASSERT(digest.empty());
+}
+
+} // namespace nghttp2
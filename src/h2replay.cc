@@ -0,0 +1,474 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "nghttp2_config.h"
+
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <cerrno>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <nghttp2/nghttp2.h>
+
+#include "util.h"
+
+using namespace nghttp2;
+
+namespace h2replay {
+
+namespace {
+struct Config {
+  Config() : read_size(16 * 1024), iterations(1), response(true) {}
+  // The maximum number of bytes passed to nghttp2_session_mem_recv()
+  // at once.
+  size_t read_size;
+  // The number of times the whole corpus is replayed.
+  size_t iterations;
+  // true if a response is submitted for each complete request.
+  bool response;
+};
+} // namespace
+
+namespace {
+Config config;
+} // namespace
+
+namespace {
+struct Stats {
+  Stats()
+      : bytes_recv(0), bytes_sent(0), frames_recv(0), frames_sent(0),
+        allocs(0), mem_current(0), mem_peak(0), sessions(0), errors(0) {}
+  // The number of bytes consumed by nghttp2_session_mem_recv()
+  uint64_t bytes_recv;
+  // The number of bytes produced by nghttp2_session_mem_send()
+  uint64_t bytes_sent;
+  uint64_t frames_recv;
+  uint64_t frames_sent;
+  // The number of malloc, calloc and realloc calls made by library
+  uint64_t allocs;
+  // The number of bytes currently allocated by library
+  size_t mem_current;
+  // The maximum value of mem_current
+  size_t mem_peak;
+  // The number of sessions replayed
+  size_t sessions;
+  // The number of sessions which ended with an error
+  size_t errors;
+};
+} // namespace
+
+namespace {
+// Each allocation is prefixed with this header to remember its size
+// so that we can keep track of the amount of memory in use.
+union MemHeader {
+  size_t size;
+  max_align_t align;
+};
+} // namespace
+
+namespace {
+void *replay_malloc(size_t size, void *mem_user_data) {
+  auto stats = static_cast<Stats *>(mem_user_data);
+
+  auto hd = static_cast<MemHeader *>(malloc(sizeof(MemHeader) + size));
+  if (hd == nullptr) {
+    return nullptr;
+  }
+
+  hd->size = size;
+
+  ++stats->allocs;
+  stats->mem_current += size;
+  stats->mem_peak = std::max(stats->mem_peak, stats->mem_current);
+
+  return hd + 1;
+}
+} // namespace
+
+namespace {
+void replay_free(void *ptr, void *mem_user_data) {
+  if (ptr == nullptr) {
+    return;
+  }
+
+  auto stats = static_cast<Stats *>(mem_user_data);
+  auto hd = static_cast<MemHeader *>(ptr) - 1;
+
+  stats->mem_current -= hd->size;
+
+  free(hd);
+}
+} // namespace
+
+namespace {
+void *replay_calloc(size_t nmemb, size_t size, void *mem_user_data) {
+  if (size != 0 && nmemb > (SIZE_MAX - sizeof(MemHeader)) / size) {
+    return nullptr;
+  }
+
+  auto p = replay_malloc(nmemb * size, mem_user_data);
+  if (p == nullptr) {
+    return nullptr;
+  }
+
+  memset(p, 0, nmemb * size);
+
+  return p;
+}
+} // namespace
+
+namespace {
+void *replay_realloc(void *ptr, size_t size, void *mem_user_data) {
+  if (ptr == nullptr) {
+    return replay_malloc(size, mem_user_data);
+  }
+
+  auto stats = static_cast<Stats *>(mem_user_data);
+  auto hd = static_cast<MemHeader *>(ptr) - 1;
+  auto oldsize = hd->size;
+
+  hd = static_cast<MemHeader *>(realloc(hd, sizeof(MemHeader) + size));
+  if (hd == nullptr) {
+    return nullptr;
+  }
+
+  hd->size = size;
+
+  ++stats->allocs;
+  stats->mem_current = stats->mem_current - oldsize + size;
+  stats->mem_peak = std::max(stats->mem_peak, stats->mem_current);
+
+  return hd + 1;
+}
+} // namespace
+
+namespace {
+int on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame *frame,
+                           void *user_data) {
+  auto stats = static_cast<Stats *>(user_data);
+
+  ++stats->frames_recv;
+
+  if (!config.response) {
+    return 0;
+  }
+
+  switch (frame->hd.type) {
+  case NGHTTP2_HEADERS:
+  case NGHTTP2_DATA:
+    break;
+  default:
+    return 0;
+  }
+
+  if ((frame->hd.flags & NGHTTP2_FLAG_END_STREAM) == 0) {
+    return 0;
+  }
+
+  nghttp2_nv nva[] = {{(uint8_t *)":status", (uint8_t *)"200", 7, 3,
+                       NGHTTP2_NV_FLAG_NONE}};
+  auto rv = nghttp2_submit_response(session, frame->hd.stream_id, nva,
+                                    util::array_size(nva), nullptr);
+  if (nghttp2_is_fatal(rv)) {
+    return NGHTTP2_ERR_CALLBACK_FAILURE;
+  }
+
+  return 0;
+}
+} // namespace
+
+namespace {
+int on_frame_send_callback(nghttp2_session *session, const nghttp2_frame *frame,
+                           void *user_data) {
+  auto stats = static_cast<Stats *>(user_data);
+
+  ++stats->frames_sent;
+
+  return 0;
+}
+} // namespace
+
+namespace {
+// Drains all pending outgoing data.  Returns 0 if it succeeds, or -1.
+int drain_send(nghttp2_session *session, Stats &stats) {
+  for (;;) {
+    const uint8_t *data;
+    auto nwrite = nghttp2_session_mem_send(session, &data);
+    if (nwrite < 0) {
+      std::cerr << "nghttp2_session_mem_send() returned error: "
+                << nghttp2_strerror(nwrite) << std::endl;
+      return -1;
+    }
+    if (nwrite == 0) {
+      return 0;
+    }
+    stats.bytes_sent += nwrite;
+  }
+}
+} // namespace
+
+namespace {
+// Replays |data| of length |len| into new server session.  Returns 0
+// if it succeeds, or -1.
+int replay(const nghttp2_session_callbacks *callbacks, nghttp2_mem *mem,
+           const uint8_t *data, size_t len, Stats &stats) {
+  int rv;
+  nghttp2_session *session;
+
+  rv = nghttp2_session_server_new3(&session, callbacks, &stats, nullptr, mem);
+  if (rv != 0) {
+    std::cerr << "nghttp2_session_server_new3() returned error: "
+              << nghttp2_strerror(rv) << std::endl;
+    return -1;
+  }
+
+  auto session_del = util::defer(session, nghttp2_session_del);
+
+  nghttp2_settings_entry iv[] = {
+      {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 100}};
+
+  rv = nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, iv,
+                               util::array_size(iv));
+  if (rv != 0) {
+    std::cerr << "nghttp2_submit_settings() returned error: "
+              << nghttp2_strerror(rv) << std::endl;
+    return -1;
+  }
+
+  for (size_t pos = 0; pos < len;) {
+    auto n = std::min(config.read_size, len - pos);
+    auto nread = nghttp2_session_mem_recv(session, data + pos, n);
+    if (nread < 0) {
+      std::cerr << "nghttp2_session_mem_recv() returned error: "
+                << nghttp2_strerror(nread) << std::endl;
+      return -1;
+    }
+
+    pos += nread;
+    stats.bytes_recv += nread;
+
+    if (drain_send(session, stats) != 0) {
+      return -1;
+    }
+
+    if (nghttp2_session_want_read(session) == 0 &&
+        nghttp2_session_want_write(session) == 0) {
+      break;
+    }
+  }
+
+  return 0;
+}
+} // namespace
+
+namespace {
+void print_version(std::ostream &out) {
+  out << "h2replay nghttp2/" NGHTTP2_VERSION << std::endl;
+}
+} // namespace
+
+namespace {
+void print_usage(std::ostream &out) {
+  out << R"(Usage: h2replay [OPTIONS]... <FILE>...
+HTTP/2 session replay and benchmark tool)" << std::endl;
+}
+} // namespace
+
+namespace {
+void print_help(std::ostream &out) {
+  print_usage(out);
+
+  out << R"(
+  <FILE>      Path to the file which contains raw bytes sent by HTTP/2
+              client, starting with connection preface.  Such file can
+              be recorded  by nghttpx  using --frontend-http2-record-dir
+              option.  Each file is replayed into its own server session
+              using   nghttp2_session_mem_recv()   and   all   outgoing
+              frames are drained  using nghttp2_session_mem_send().  No
+              I/O is involved.
+Options:
+  -b, --read-size=<SIZE>
+              The maximum number of  bytes passed to mem_recv at once.
+              Default: )" << config.read_size << R"(
+  -n, --iterations=<N>
+              The number of times the whole set of files is replayed.
+              Default: )" << config.iterations << R"(
+  --no-response
+              Do not  submit response.   By default,  response without
+              body is submitted for each complete request.
+  --version   Display version information and exit.
+  -h, --help  Display this help and exit.)" << std::endl;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  while (1) {
+    static int flag = 0;
+    static option long_options[] = {
+        {"read-size", required_argument, nullptr, 'b'},
+        {"iterations", required_argument, nullptr, 'n'},
+        {"help", no_argument, nullptr, 'h'},
+        {"no-response", no_argument, &flag, 1},
+        {"version", no_argument, &flag, 2},
+        {nullptr, 0, nullptr, 0}};
+    int option_index = 0;
+    auto c = getopt_long(argc, argv, "b:hn:", long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+    switch (c) {
+    case 'b': {
+      auto n = util::parse_uint_with_unit(optarg);
+      if (n <= 0) {
+        std::cerr << "-b: bad argument: " << optarg << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      config.read_size = n;
+      break;
+    }
+    case 'n': {
+      auto n = util::parse_uint(optarg);
+      if (n <= 0) {
+        std::cerr << "-n: bad argument: " << optarg << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      config.iterations = n;
+      break;
+    }
+    case 'h':
+      print_help(std::cout);
+      exit(EXIT_SUCCESS);
+    case '?':
+      util::show_candidates(argv[optind - 1], long_options);
+      exit(EXIT_FAILURE);
+    case 0:
+      switch (flag) {
+      case 1:
+        // no-response option
+        config.response = false;
+        break;
+      case 2:
+        // version option
+        print_version(std::cout);
+        exit(EXIT_SUCCESS);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  if (argc == optind) {
+    std::cerr << "no input file given" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  std::vector<std::vector<uint8_t>> corpus;
+  uint64_t corpus_bytes = 0;
+
+  for (auto i = optind; i < argc; ++i) {
+    std::ifstream f(argv[i], std::ios::binary);
+    if (!f) {
+      std::cerr << "Could not open file " << argv[i] << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    corpus.emplace_back(std::istreambuf_iterator<char>(f),
+                        std::istreambuf_iterator<char>());
+    corpus_bytes += corpus.back().size();
+  }
+
+  Stats stats;
+
+  nghttp2_mem mem = {&stats, replay_malloc, replay_free, replay_calloc,
+                     replay_realloc};
+
+  nghttp2_session_callbacks *callbacks;
+  nghttp2_session_callbacks_new(&callbacks);
+  auto cb_del = util::defer(callbacks, nghttp2_session_callbacks_del);
+
+  nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks,
+                                                       on_frame_recv_callback);
+  nghttp2_session_callbacks_set_on_frame_send_callback(callbacks,
+                                                       on_frame_send_callback);
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < config.iterations; ++i) {
+    for (auto &data : corpus) {
+      ++stats.sessions;
+      if (replay(callbacks, &mem, data.data(), data.size(), stats) != 0) {
+        ++stats.errors;
+      }
+    }
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                      end - start).count();
+
+  uint64_t fps, kbps;
+  if (duration > 0) {
+    auto secd = static_cast<double>(duration) / (1000 * 1000);
+    fps = (stats.frames_recv + stats.frames_sent) / secd;
+    kbps = (stats.bytes_recv + stats.bytes_sent) / secd / 1024;
+  } else {
+    fps = 0;
+    kbps = 0;
+  }
+
+  auto sec = duration / (1000 * 1000);
+  auto millisec = (duration / 1000) % 1000;
+  auto microsec = duration % 1000;
+
+  std::cout << "finished in " << sec << " sec, " << millisec << " millisec and "
+            << microsec << " microsec, " << fps << " frames/s, " << kbps
+            << " kbytes/s\n"
+            << "input: " << corpus.size() << " files, " << corpus_bytes
+            << " bytes, " << config.iterations << " iterations\n"
+            << "sessions: " << stats.sessions << " total, " << stats.errors
+            << " errored\n"
+            << "frames: " << stats.frames_recv << " received, "
+            << stats.frames_sent << " sent\n"
+            << "traffic: " << stats.bytes_recv << " bytes received, "
+            << stats.bytes_sent << " bytes sent\n"
+            << "memory: " << stats.allocs << " allocations, " << stats.mem_peak
+            << " bytes peak" << std::endl;
+
+  return stats.errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // namespace h2replay
+
+int main(int argc, char **argv) { return h2replay::main(argc, argv); }
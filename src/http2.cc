@@ -185,8 +185,11 @@ void add_header(Headers &nva, const uint8_t *name, size_t namelen,
   nva.push_back(to_header(name, namelen, value, valuelen, no_index));
 }
 
-const Headers::value_type *get_header(const Headers &nva, const char *name) {
-  const Headers::value_type *res = nullptr;
+namespace {
+template <typename HeadersT>
+const typename HeadersT::value_type *get_header_linear(const HeadersT &nva,
+                                                       const char *name) {
+  const typename HeadersT::value_type *res = nullptr;
   for (auto &nv : nva) {
     if (nv.name == name) {
       res = &nv;
@@ -194,6 +197,16 @@ const Headers::value_type *get_header(const Headers &nva, const char *name) {
   }
   return res;
 }
+} // namespace
+
+const Headers::value_type *get_header(const Headers &nva, const char *name) {
+  return get_header_linear(nva, name);
+}
+
+const HeaderRefs::value_type *get_header(const HeaderRefs &nva,
+                                         const char *name) {
+  return get_header_linear(nva, name);
+}
 
 std::string value_to_str(const Headers::value_type *nv) {
   if (nv) {
@@ -202,10 +215,21 @@ std::string value_to_str(const Headers::value_type *nv) {
   return "";
 }
 
+std::string value_to_str(const HeaderRefs::value_type *nv) {
+  if (nv) {
+    return nv->value.str();
+  }
+  return "";
+}
+
 bool non_empty_value(const Headers::value_type *nv) {
   return nv && !nv->value.empty();
 }
 
+bool non_empty_value(const HeaderRefs::value_type *nv) {
+  return nv && !nv->value.empty();
+}
+
 nghttp2_nv make_nv(const std::string &name, const std::string &value,
                    bool no_index) {
   uint8_t flags;
@@ -216,12 +240,26 @@ nghttp2_nv make_nv(const std::string &name, const std::string &value,
           value.size(), flags};
 }
 
-void copy_headers_to_nva(std::vector<nghttp2_nv> &nva, const Headers &headers) {
+nghttp2_nv make_nv(const StringRef &name, const StringRef &value,
+                   bool no_index) {
+  uint8_t flags;
+
+  flags = no_index ? NGHTTP2_NV_FLAG_NO_INDEX : NGHTTP2_NV_FLAG_NONE;
+
+  return {(uint8_t *)name.c_str(), (uint8_t *)value.c_str(), name.size(),
+          value.size(), flags};
+}
+
+namespace {
+template <typename HeadersT>
+void copy_headers_to_nva_impl(std::vector<nghttp2_nv> &nva,
+                              const HeadersT &headers) {
   for (auto &kv : headers) {
     if (kv.name.empty() || kv.name[0] == ':') {
       continue;
     }
-    switch (lookup_token(kv.name)) {
+    switch (lookup_token(reinterpret_cast<const uint8_t *>(kv.name.c_str()),
+                         kv.name.size())) {
     case HD_COOKIE:
     case HD_CONNECTION:
     case HD_HTTP2_SETTINGS:
@@ -239,14 +277,27 @@ void copy_headers_to_nva(std::vector<nghttp2_nv> &nva, const Headers &headers) {
     nva.push_back(make_nv(kv.name, kv.value, kv.no_index));
   }
 }
+} // namespace
 
-void build_http1_headers_from_headers(std::string &hdrs,
-                                      const Headers &headers) {
+void copy_headers_to_nva(std::vector<nghttp2_nv> &nva, const Headers &headers) {
+  copy_headers_to_nva_impl(nva, headers);
+}
+
+void copy_headers_to_nva(std::vector<nghttp2_nv> &nva,
+                         const HeaderRefs &headers) {
+  copy_headers_to_nva_impl(nva, headers);
+}
+
+namespace {
+template <typename HeadersT>
+void build_http1_headers_from_headers_impl(std::string &hdrs,
+                                           const HeadersT &headers) {
   for (auto &kv : headers) {
     if (kv.name.empty() || kv.name[0] == ':') {
       continue;
     }
-    switch (lookup_token(kv.name)) {
+    switch (lookup_token(reinterpret_cast<const uint8_t *>(kv.name.c_str()),
+                         kv.name.size())) {
     case HD_CONNECTION:
     case HD_COOKIE:
     case HD_HTTP2_SETTINGS:
@@ -260,13 +311,24 @@ void build_http1_headers_from_headers(std::string &hdrs,
     case HD_X_FORWARDED_PROTO:
       continue;
     }
-    hdrs += kv.name;
+    hdrs.append(kv.name.c_str(), kv.name.size());
     capitalize(hdrs, hdrs.size() - kv.name.size());
     hdrs += ": ";
-    hdrs += kv.value;
+    hdrs.append(kv.value.c_str(), kv.value.size());
     hdrs += "\r\n";
   }
 }
+} // namespace
+
+void build_http1_headers_from_headers(std::string &hdrs,
+                                      const Headers &headers) {
+  build_http1_headers_from_headers_impl(hdrs, headers);
+}
+
+void build_http1_headers_from_headers(std::string &hdrs,
+                                      const HeaderRefs &headers) {
+  build_http1_headers_from_headers_impl(hdrs, headers);
+}
 
 int32_t determine_window_update_transmission(nghttp2_session *session,
                                              int32_t stream_id) {
@@ -311,7 +373,8 @@ void dump_nv(FILE *out, const nghttp2_nv *nva, size_t nvlen) {
   fflush(out);
 }
 
-void dump_nv(FILE *out, const Headers &nva) {
+namespace {
+template <typename HeadersT> void dump_nv_impl(FILE *out, const HeadersT &nva) {
   for (auto &nv : nva) {
     fwrite(nv.name.c_str(), nv.name.size(), 1, out);
     fwrite(": ", 2, 1, out);
@@ -321,6 +384,11 @@ void dump_nv(FILE *out, const Headers &nva) {
   fwrite("\n", 1, 1, out);
   fflush(out);
 }
+} // namespace
+
+void dump_nv(FILE *out, const Headers &nva) { dump_nv_impl(out, nva); }
+
+void dump_nv(FILE *out, const HeaderRefs &nva) { dump_nv_impl(out, nva); }
 
 std::string rewrite_location_uri(const std::string &uri,
                                  const http_parser_url &u,
@@ -386,7 +454,7 @@ int check_nv(const uint8_t *name, size_t namelen, const uint8_t *value,
   return 1;
 }
 
-int parse_http_status_code(const std::string &src) {
+int parse_http_status_code(const StringRef &src) {
   if (src.size() != 3) {
     return -1;
   }
@@ -593,7 +661,9 @@ int lookup_token(const uint8_t *name, size_t namelen) {
 
 void init_hdidx(int *hdidx) { memset(hdidx, -1, sizeof(hdidx[0]) * HD_MAXIDX); }
 
-void index_headers(int *hdidx, const Headers &headers) {
+namespace {
+template <typename HeadersT>
+void index_headers_impl(int *hdidx, const HeadersT &headers) {
   for (size_t i = 0; i < headers.size(); ++i) {
     auto &kv = headers[i];
     auto token = lookup_token(
@@ -603,6 +673,15 @@ void index_headers(int *hdidx, const Headers &headers) {
     }
   }
 }
+} // namespace
+
+void index_headers(int *hdidx, const Headers &headers) {
+  index_headers_impl(hdidx, headers);
+}
+
+void index_headers(int *hdidx, const HeaderRefs &headers) {
+  index_headers_impl(hdidx, headers);
+}
 
 void index_header(int *hdidx, int token, size_t idx) {
   if (token == -1) {
@@ -664,6 +743,15 @@ const Headers::value_type *get_header(const int *hdidx, int token,
   return &nva[i];
 }
 
+const HeaderRefs::value_type *get_header(const int *hdidx, int token,
+                                         const HeaderRefs &nva) {
+  auto i = hdidx[token];
+  if (i == -1) {
+    return nullptr;
+  }
+  return &nva[i];
+}
+
 bool check_http2_te(const uint8_t *value, size_t valuelen) {
   auto first = value;
   auto last = first + valuelen;
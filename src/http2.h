@@ -36,6 +36,8 @@
 
 #include "http-parser/http_parser.h"
 
+#include "string_ref.h"
+
 namespace nghttp2 {
 
 struct Header {
@@ -59,6 +61,26 @@ struct Header {
 
 typedef std::vector<Header> Headers;
 
+// Header field whose name and value refer to the memory owned by
+// someone else, usually the BlockAllocator of nghttpx Downstream.
+struct HeaderRef {
+  HeaderRef(const StringRef &name, const StringRef &value,
+            bool no_index = false)
+      : name(name), value(value), no_index(no_index) {}
+
+  HeaderRef() : no_index(false) {}
+
+  bool operator==(const HeaderRef &other) const {
+    return name == other.name && value == other.value;
+  }
+
+  StringRef name;
+  StringRef value;
+  bool no_index;
+};
+
+typedef std::vector<HeaderRef> HeaderRefs;
+
 namespace http2 {
 
 std::string get_status_string(unsigned int status_code);
@@ -88,12 +110,16 @@ void add_header(Headers &nva, const uint8_t *name, size_t namelen,
 // more than one entries which have the name |name|, last occurrence
 // in |nva| is returned.  If no such entry exist, returns nullptr.
 const Headers::value_type *get_header(const Headers &nva, const char *name);
+const HeaderRefs::value_type *get_header(const HeaderRefs &nva,
+                                         const char *name);
 
 // Returns nv->second if nv is not nullptr. Otherwise, returns "".
 std::string value_to_str(const Headers::value_type *nv);
+std::string value_to_str(const HeaderRefs::value_type *nv);
 
 // Returns true if the value of |nv| is not empty.
 bool non_empty_value(const Headers::value_type *nv);
+bool non_empty_value(const HeaderRefs::value_type *nv);
 
 // Creates nghttp2_nv using |name| and |value| and returns it. The
 // returned value only references the data pointer to name.c_str() and
@@ -101,6 +127,8 @@ bool non_empty_value(const Headers::value_type *nv);
 // NGHTTP2_NV_FLAG_NO_INDEX flag set.
 nghttp2_nv make_nv(const std::string &name, const std::string &value,
                    bool no_index = false);
+nghttp2_nv make_nv(const StringRef &name, const StringRef &value,
+                   bool no_index = false);
 
 // Create nghttp2_nv from string literal |name| and |value|.
 template <size_t N, size_t M>
@@ -124,16 +152,27 @@ nghttp2_nv make_nv_ls(const char (&name)[N], const std::string &value) {
           NGHTTP2_NV_FLAG_NONE};
 }
 
+// Create nghttp2_nv from string literal |name| and StringRef |value|.
+template <size_t N>
+nghttp2_nv make_nv_ls(const char (&name)[N], const StringRef &value) {
+  return {(uint8_t *)name, (uint8_t *)value.c_str(), N - 1, value.size(),
+          NGHTTP2_NV_FLAG_NONE};
+}
+
 // Appends headers in |headers| to |nv|. Certain headers, including
 // disallowed headers in HTTP/2 spec and headers which require
 // special handling (i.e. via), are not copied.
 void copy_headers_to_nva(std::vector<nghttp2_nv> &nva, const Headers &headers);
+void copy_headers_to_nva(std::vector<nghttp2_nv> &nva,
+                         const HeaderRefs &headers);
 
 // Appends HTTP/1.1 style header lines to |hdrs| from headers in
 // |headers|. Certain headers, which requires special handling
 // (i.e. via and cookie), are not appended.
 void build_http1_headers_from_headers(std::string &hdrs,
                                       const Headers &headers);
+void build_http1_headers_from_headers(std::string &hdrs,
+                                      const HeaderRefs &headers);
 
 // Return positive window_size_increment if WINDOW_UPDATE should be
 // sent for the stream |stream_id|. If |stream_id| == 0, this function
@@ -153,6 +192,7 @@ void dump_nv(FILE *out, const nghttp2_nv *nva, size_t nvlen);
 
 // Dumps name/value pairs in |nva| to |out|.
 void dump_nv(FILE *out, const Headers &nva);
+void dump_nv(FILE *out, const HeaderRefs &nva);
 
 // Rewrites redirection URI which usually appears in location header
 // field. The |uri| is the URI in the location header field. The |u|
@@ -177,7 +217,7 @@ int check_nv(const uint8_t *name, size_t namelen, const uint8_t *value,
              size_t valuelen);
 
 // Returns parsed HTTP status code.  Returns -1 on failure.
-int parse_http_status_code(const std::string &src);
+int parse_http_status_code(const StringRef &src);
 
 // Header fields to be indexed, except HD_MAXIDX which is convenient
 // member to get maximum value.
@@ -223,6 +263,7 @@ void init_hdidx(int *hdidx);
 void index_header(int *hdidx, int token, size_t idx);
 // Iterates |headers| and for each element, call index_header.
 void index_headers(int *hdidx, const Headers &headers);
+void index_headers(int *hdidx, const HeaderRefs &headers);
 
 // Returns true if HTTP/2 request pseudo header |token| is not indexed
 // yet and not -1.
@@ -243,6 +284,8 @@ bool http2_mandatory_request_headers_presence(const int *hdidx);
 // Returns header denoted by |token| using index |hdidx|.
 const Headers::value_type *get_header(const int *hdidx, int token,
                                       const Headers &nva);
+const HeaderRefs::value_type *get_header(const int *hdidx, int token,
+                                         const HeaderRefs &nva);
 
 // Returns true if TE request header field value |value| of length
 // |valuelen| is empty or only contains "trailers".  The valid header
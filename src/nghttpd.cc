@@ -121,6 +121,9 @@ Options:
               This option  can be used repeatedly  to specify multiple
               push  configurations.    <PATH>  and   <PUSH_PATH>s  are
               relative  to   document  root.   See   --htdocs  option.
+              A resource is not  pushed if it was already pushed in the
+              same connection, or  the client claims to  have it in its
+              cache using "cache-digest" header field or cookie.
               Example: -p/=/foo.png -p/doc=/bar.css
   -b, --padding=<N>
               Add at  most <N>  bytes to a  frame payload  as padding.
@@ -35,11 +35,21 @@
 #include "shrpx_ssl_test.h"
 #include "shrpx_downstream_test.h"
 #include "shrpx_config_test.h"
+#include "shrpx_worker_test.h"
+#include "shrpx_consistent_hash_test.h"
+#include "shrpx_metrics_test.h"
+#include "shrpx_object_pool_test.h"
+#include "shrpx_http_cache_test.h"
+#include "shrpx_session_cache_test.h"
+#include "shrpx_downstream_connection_pool_test.h"
+#include "shrpx_splice_test.h"
+#include "shrpx_log_test.h"
 #include "http2_test.h"
 #include "util_test.h"
 #include "nghttp2_gzip_test.h"
 #include "ringbuf_test.h"
 #include "memchunk_test.h"
+#include "cache_digest_test.h"
 #include "shrpx_config.h"
 
 static int init_suite1(void) { return 0; }
@@ -117,6 +127,45 @@ int main(int argc, char *argv[]) {
                    shrpx::test_shrpx_config_parse_log_format) ||
       !CU_add_test(pSuite, "config_read_tls_ticket_key_file",
                    shrpx::test_shrpx_config_read_tls_ticket_key_file) ||
+      !CU_add_test(pSuite, "config_set_config",
+                   shrpx::test_shrpx_config_set_config) ||
+      !CU_add_test(pSuite, "worker_select_downstream_addr",
+                   shrpx::test_shrpx_worker_select_downstream_addr) ||
+      !CU_add_test(pSuite, "worker_update_downstream_latency",
+                   shrpx::test_shrpx_worker_update_downstream_latency) ||
+      !CU_add_test(pSuite, "worker_health_monitor",
+                   shrpx::test_shrpx_worker_health_monitor) ||
+      !CU_add_test(pSuite, "worker_reload", shrpx::test_shrpx_worker_reload) ||
+      !CU_add_test(pSuite, "consistent_hash_maglev_table",
+                   shrpx::test_shrpx_consistent_hash_maglev_table) ||
+      !CU_add_test(pSuite, "metrics_histogram",
+                   shrpx::test_shrpx_metrics_histogram) ||
+      !CU_add_test(pSuite, "metrics_format",
+                   shrpx::test_shrpx_metrics_format) ||
+      !CU_add_test(pSuite, "object_pool", shrpx::test_shrpx_object_pool) ||
+      !CU_add_test(pSuite, "capacity_pool",
+                   shrpx::test_shrpx_capacity_pool) ||
+      !CU_add_test(pSuite, "block_allocator",
+                   shrpx::test_shrpx_block_allocator) ||
+      !CU_add_test(pSuite, "http_cache_parse_cache_control",
+                   shrpx::test_shrpx_http_cache_parse_cache_control) ||
+      !CU_add_test(pSuite, "http_cache", shrpx::test_shrpx_http_cache) ||
+      !CU_add_test(pSuite, "http_cache_collapse",
+                   shrpx::test_shrpx_http_cache_collapse) ||
+      !CU_add_test(pSuite, "http_cache_collapse_timeout",
+                   shrpx::test_shrpx_http_cache_collapse_timeout) ||
+      !CU_add_test(pSuite, "http_cache_collapse_too_large",
+                   shrpx::test_shrpx_http_cache_collapse_too_large) ||
+      !CU_add_test(pSuite, "session_cache", shrpx::test_shrpx_session_cache) ||
+      !CU_add_test(pSuite, "downstream_connection_pool",
+                   shrpx::test_shrpx_downstream_connection_pool) ||
+      !CU_add_test(pSuite, "splice_pipe", shrpx::test_shrpx_splice_pipe) ||
+      !CU_add_test(pSuite, "splice_pipe_full",
+                   shrpx::test_shrpx_splice_pipe_full) ||
+      !CU_add_test(pSuite, "log_accesslog_json",
+                   shrpx::test_shrpx_log_accesslog_json) ||
+      !CU_add_test(pSuite, "log_accesslog_binary",
+                   shrpx::test_shrpx_log_accesslog_binary) ||
       !CU_add_test(pSuite, "util_streq", shrpx::test_util_streq) ||
       !CU_add_test(pSuite, "util_strieq", shrpx::test_util_strieq) ||
       !CU_add_test(pSuite, "util_inp_strlower",
@@ -144,7 +193,11 @@ int main(int argc, char *argv[]) {
       !CU_add_test(pSuite, "memchunk_drain", nghttp2::test_memchunks_drain) ||
       !CU_add_test(pSuite, "memchunk_riovec", nghttp2::test_memchunks_riovec) ||
       !CU_add_test(pSuite, "memchunk_recycle",
-                   nghttp2::test_memchunks_recycle)) {
+                   nghttp2::test_memchunks_recycle) ||
+      !CU_add_test(pSuite, "cache_digest_encode_decode",
+                   nghttp2::test_cache_digest_encode_decode) ||
+      !CU_add_test(pSuite, "cache_digest_decode_base64url",
+                   nghttp2::test_cache_digest_decode_base64url)) {
     CU_cleanup_registry();
     return CU_get_error();
   }
@@ -61,6 +61,10 @@
 #include "shrpx_worker_config.h"
 #include "shrpx_worker.h"
 #include "shrpx_accept_handler.h"
+#include "shrpx_stats_server.h"
+#include "shrpx_session_cache.h"
+#include "shrpx_key_offload.h"
+#include "shrpx_ocsp.h"
 #include "util.h"
 #include "app_helper.h"
 #include "ssl.h"
@@ -75,6 +79,7 @@ namespace {
 const int REOPEN_LOG_SIGNAL = SIGUSR1;
 const int EXEC_BINARY_SIGNAL = SIGUSR2;
 const int GRACEFUL_SHUTDOWN_SIGNAL = SIGQUIT;
+const int RELOAD_SIGNAL = SIGHUP;
 } // namespace
 
 // Environment variables to tell new binary the listening socket's
@@ -82,10 +87,26 @@ const int GRACEFUL_SHUTDOWN_SIGNAL = SIGQUIT;
 #define ENV_LISTENER4_FD "NGHTTPX_LISTENER4_FD"
 #define ENV_LISTENER6_FD "NGHTTPX_LISTENER6_FD"
 
+// Environment variables to tell new binary the comma separated list
+// of per-worker listening sockets' file descriptors when
+// --listener-reuseport is used.  They are not close-on-exec.
+#define ENV_WORKER_LISTENER4_FDS "NGHTTPX_WORKER_LISTENER4_FDS"
+#define ENV_WORKER_LISTENER6_FDS "NGHTTPX_WORKER_LISTENER6_FDS"
+
 // Environment variable to tell new binary the port number the current
 // binary is listening to.
 #define ENV_PORT "NGHTTPX_PORT"
 
+// Environment variable to tell new binary the file descriptor of
+// shared memory TLS session cache.  It is not close-on-exec.
+#define ENV_SESSION_CACHE_FD "NGHTTPX_SESSION_CACHE_FD"
+
+// Environment variables to tell new binary the file descriptor of
+// the listening socket for --stats-frontend, and the port it is
+// bound to.  The socket is not close-on-exec.
+#define ENV_STATS_LISTENER_FD "NGHTTPX_STATS_LISTENER_FD"
+#define ENV_STATS_PORT "NGHTTPX_STATS_PORT"
+
 namespace {
 int resolve_hostname(sockaddr_union *addr, size_t *addrlen,
                      const char *hostname, uint16_t port, int family) {
@@ -104,7 +125,7 @@ int resolve_hostname(sockaddr_union *addr, size_t *addrlen,
 
   rv = getaddrinfo(hostname, service.c_str(), &hints, &res);
   if (rv != 0) {
-    LOG(FATAL) << "Unable to resolve address for " << hostname << ": "
+    LOG(ERROR) << "Unable to resolve address for " << hostname << ": "
                << gai_strerror(rv);
     return -1;
   }
@@ -113,7 +134,7 @@ int resolve_hostname(sockaddr_union *addr, size_t *addrlen,
   rv = getnameinfo(res->ai_addr, res->ai_addrlen, host, sizeof(host), 0, 0,
                    NI_NUMERICHOST);
   if (rv != 0) {
-    LOG(FATAL) << "Address resolution for " << hostname
+    LOG(ERROR) << "Address resolution for " << hostname
                << " failed: " << gai_strerror(rv);
 
     freeaddrinfo(res);
@@ -134,37 +155,17 @@ int resolve_hostname(sockaddr_union *addr, size_t *addrlen,
 } // namespace
 
 namespace {
-std::unique_ptr<AcceptHandler> create_acceptor(ConnectionHandler *handler,
-                                               int family) {
-  {
-    auto envfd =
-        getenv(family == AF_INET ? ENV_LISTENER4_FD : ENV_LISTENER6_FD);
-    auto envport = getenv(ENV_PORT);
-
-    if (envfd && envport) {
-      auto fd = strtoul(envfd, nullptr, 10);
-      auto port = strtoul(envport, nullptr, 10);
-
-      // Only do this iff NGHTTPX_PORT == get_config()->port.
-      // Otherwise, close fd, and create server socket as usual.
-
-      if (port == get_config()->port) {
-        LOG(NOTICE) << "Listening on port " << get_config()->port;
-
-        return util::make_unique<AcceptHandler>(fd, handler);
-      }
-
-      LOG(WARN) << "Port was changed between old binary (" << port
-                << ") and new binary (" << get_config()->port << ")";
-      close(fd);
-    }
-  }
-
+// Creates listening socket for |family| bound to |hostname| and
+// |port|.  If |reuseport| is true, SO_REUSEPORT is set to the socket
+// so that several sockets can be bound to the same address.  Returns
+// the socket, or -1.
+int create_listen_socket(const char *hostname, uint16_t port, int family,
+                         bool reuseport) {
   addrinfo hints;
   int fd = -1;
   int rv;
 
-  auto service = util::utos(get_config()->port);
+  auto service = util::utos(port);
   memset(&hints, 0, sizeof(addrinfo));
   hints.ai_family = family;
   hints.ai_socktype = SOCK_STREAM;
@@ -173,19 +174,16 @@ std::unique_ptr<AcceptHandler> create_acceptor(ConnectionHandler *handler,
   hints.ai_flags |= AI_ADDRCONFIG;
 #endif // AI_ADDRCONFIG
 
-  auto node = strcmp("*", get_config()->host.get()) == 0
-                  ? nullptr
-                  : get_config()->host.get();
+  auto node = strcmp("*", hostname) == 0 ? nullptr : hostname;
 
   addrinfo *res, *rp;
   rv = getaddrinfo(node, service.c_str(), &hints, &res);
   if (rv != 0) {
     if (LOG_ENABLED(INFO)) {
       LOG(INFO) << "Unable to get IPv" << (family == AF_INET ? "4" : "6")
-                << " address for " << get_config()->host.get() << ": "
-                << gai_strerror(rv);
+                << " address for " << hostname << ": " << gai_strerror(rv);
     }
-    return nullptr;
+    return -1;
   }
   for (rp = res; rp; rp = rp->ai_next) {
 #ifdef SOCK_NONBLOCK
@@ -208,6 +206,15 @@ std::unique_ptr<AcceptHandler> create_acceptor(ConnectionHandler *handler,
       continue;
     }
 
+#ifdef SO_REUSEPORT
+    if (reuseport &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val,
+                   static_cast<socklen_t>(sizeof(val))) == -1) {
+      close(fd);
+      continue;
+    }
+#endif // SO_REUSEPORT
+
 #ifdef IPV6_V6ONLY
     if (family == AF_INET6) {
       if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &val,
@@ -230,7 +237,7 @@ std::unique_ptr<AcceptHandler> create_acceptor(ConnectionHandler *handler,
 
     freeaddrinfo(res);
 
-    return nullptr;
+    return -1;
   }
 
   char host[NI_MAXHOST];
@@ -244,15 +251,206 @@ std::unique_ptr<AcceptHandler> create_acceptor(ConnectionHandler *handler,
 
     close(fd);
 
-    return nullptr;
+    return -1;
+  }
+
+  LOG(NOTICE) << "Listening on " << host << ", port " << port;
+
+  return fd;
+}
+} // namespace
+
+namespace {
+std::unique_ptr<AcceptHandler> create_acceptor(ConnectionHandler *handler,
+                                               int family) {
+  {
+    auto envfd =
+        getenv(family == AF_INET ? ENV_LISTENER4_FD : ENV_LISTENER6_FD);
+    auto envport = getenv(ENV_PORT);
+
+    if (envfd && envport) {
+      auto fd = strtoul(envfd, nullptr, 10);
+      auto port = strtoul(envport, nullptr, 10);
+
+      // Only do this iff NGHTTPX_PORT == get_config()->port.
+      // Otherwise, close fd, and create server socket as usual.
+
+      if (port == get_config()->port) {
+        LOG(NOTICE) << "Listening on port " << get_config()->port;
+
+        return util::make_unique<AcceptHandler>(fd, handler);
+      }
+
+      LOG(WARN) << "Port was changed between old binary (" << port
+                << ") and new binary (" << get_config()->port << ")";
+      close(fd);
+    }
   }
 
-  LOG(NOTICE) << "Listening on " << host << ", port " << get_config()->port;
+  auto fd = create_listen_socket(get_config()->host.get(), get_config()->port,
+                                 family, false);
+  if (fd == -1) {
+    return nullptr;
+  }
 
   return util::make_unique<AcceptHandler>(fd, handler);
 }
 } // namespace
 
+namespace {
+// Creates listening socket for --stats-frontend.  The socket
+// inherited from old binary is used if it is bound to the same port.
+// Returns the socket, or -1.
+int create_stats_listener() {
+  auto envfd = getenv(ENV_STATS_LISTENER_FD);
+  auto envport = getenv(ENV_STATS_PORT);
+
+  if (envfd && envport) {
+    auto fd = strtoul(envfd, nullptr, 10);
+    auto port = strtoul(envport, nullptr, 10);
+
+    if (port == get_config()->stats_port) {
+      LOG(NOTICE) << "Listening on stats port " << get_config()->stats_port;
+
+      return fd;
+    }
+
+    LOG(WARN) << "Stats port was changed between old binary (" << port
+              << ") and new binary (" << get_config()->stats_port << ")";
+    close(fd);
+  }
+
+  return create_listen_socket(get_config()->stats_host.get(),
+                              get_config()->stats_port, AF_UNSPEC, false);
+}
+} // namespace
+
+namespace {
+// Returns file descriptors listed in environment variable |envname|.
+// If the old binary listened on different port, they are closed, and
+// empty vector is returned.
+std::vector<int> get_inherited_fds(const char *envname) {
+  std::vector<int> fds;
+
+  auto envfds = getenv(envname);
+  if (!envfds || !*envfds) {
+    return fds;
+  }
+
+  auto list = parse_config_str_list(envfds);
+  for (auto s : list) {
+    fds.push_back(strtoul(s, nullptr, 10));
+  }
+  clear_config_str_list(list);
+
+  auto envport = getenv(ENV_PORT);
+  if (envport && strtoul(envport, nullptr, 10) == get_config()->port) {
+    return fds;
+  }
+
+  for (auto fd : fds) {
+    close(fd);
+  }
+
+  return std::vector<int>();
+}
+} // namespace
+
+namespace {
+// Creates per-worker listening sockets for --listener-reuseport.
+// Sockets inherited from old binary are used first so that the
+// connections queued on them are not lost.
+std::vector<WorkerListener> create_worker_listeners() {
+  auto fd4s = get_inherited_fds(ENV_WORKER_LISTENER4_FDS);
+  auto fd6s = get_inherited_fds(ENV_WORKER_LISTENER6_FDS);
+
+  if (!fd4s.empty() || !fd6s.empty()) {
+    LOG(NOTICE) << "Inherited " << fd4s.size() << " IPv4 and " << fd6s.size()
+                << " IPv6 worker listening sockets";
+  }
+
+  std::vector<WorkerListener> listeners;
+
+  for (size_t i = 0; i < get_config()->num_worker; ++i) {
+    WorkerListener listener;
+
+    if (i < fd4s.size()) {
+      listener.fd4 = fd4s[i];
+    } else {
+      listener.fd4 = create_listen_socket(
+          get_config()->host.get(), get_config()->port, AF_INET, true);
+    }
+
+    if (i < fd6s.size()) {
+      listener.fd6 = fd6s[i];
+    } else {
+      listener.fd6 = create_listen_socket(
+          get_config()->host.get(), get_config()->port, AF_INET6, true);
+    }
+
+    if (listener.fd4 == -1 && listener.fd6 == -1) {
+      LOG(FATAL) << "Failed to listen on address " << get_config()->host.get()
+                 << ", port " << get_config()->port;
+      exit(EXIT_FAILURE);
+    }
+
+    listeners.push_back(listener);
+  }
+
+  // The number of workers was decreased.  The connections queued on
+  // these sockets are accepted by old binary.
+  for (size_t i = listeners.size(); i < fd4s.size(); ++i) {
+    close(fd4s[i]);
+  }
+  for (size_t i = listeners.size(); i < fd6s.size(); ++i) {
+    close(fd6s[i]);
+  }
+
+  return listeners;
+}
+} // namespace
+
+namespace {
+// Closes per-worker listening sockets inherited from old binary which
+// are not used because --listener-reuseport is not in effect.
+void close_inherited_worker_listeners() {
+  for (auto envname : {ENV_WORKER_LISTENER4_FDS, ENV_WORKER_LISTENER6_FDS}) {
+    for (auto fd : get_inherited_fds(envname)) {
+      close(fd);
+    }
+  }
+}
+} // namespace
+
+namespace {
+std::unique_ptr<SessionCache> create_session_cache() {
+  auto session_cache = util::make_unique<SessionCache>();
+
+  auto envfd = getenv(ENV_SESSION_CACHE_FD);
+  if (envfd) {
+    auto fd = strtoul(envfd, nullptr, 10);
+
+    // Keep sessions stored by old binary.
+    if (session_cache->attach(fd) == 0) {
+      LOG(NOTICE) << "Inherited TLS session cache, capacity="
+                  << session_cache->get_capacity();
+      return session_cache;
+    }
+
+    LOG(WARN) << "Could not use TLS session cache of old binary";
+    close(fd);
+  }
+
+  if (session_cache->init(get_config()->tls_session_cache_size) != 0) {
+    auto error = errno;
+    LOG(ERROR) << "Could not create TLS session cache: " << strerror(error);
+    return nullptr;
+  }
+
+  return session_cache;
+}
+} // namespace
+
 namespace {
 void drop_privileges() {
   if (getuid() == 0 && get_config()->uid != 0) {
@@ -308,6 +506,43 @@ void reopen_log_signal_cb(struct ev_loop *loop, ev_signal *w, int revents) {
   if (get_config()->num_worker > 1) {
     conn_handler->worker_reopen_log_files();
   }
+
+  auto ocsp_store = conn_handler->get_ocsp_store();
+  if (ocsp_store) {
+    ocsp_store->update();
+  }
+}
+} // namespace
+
+namespace {
+// Creates new Config from the configuration file and command-line
+// options as main() does.  Returns nullptr if it fails, or an option
+// which takes effect only at startup is changed.
+std::unique_ptr<Config> create_reloaded_config();
+} // namespace
+
+namespace {
+void reload_signal_cb(struct ev_loop *loop, ev_signal *w, int revents) {
+  auto conn_handler = static_cast<ConnectionHandler *>(w->data);
+
+  LOG(NOTICE) << "Reloading configuration";
+
+  // --log-level takes effect while configuration is parsed.
+  auto severity = Log::get_severity_level();
+
+  auto config = create_reloaded_config();
+  if (!config || conn_handler->reload_config(config.get()) != 0) {
+    Log::set_severity_level(severity);
+
+    LOG(ERROR) << "Reload failed; keep using the current configuration";
+    return;
+  }
+
+  // Workers and established connections may still refer to the
+  // previous configuration, so no configuration is ever freed.
+  config.release();
+
+  LOG(NOTICE) << "Configuration reloaded";
 }
 } // namespace
 
@@ -348,8 +583,9 @@ void exec_binary_signal_cb(struct ev_loop *loop, ev_signal *w, int revents) {
   size_t envlen = 0;
   for (char **p = environ; *p; ++p, ++envlen)
     ;
-  // 3 for missing fd4, fd6 and port.
-  auto envp = util::make_unique<char *[]>(envlen + 3 + 1);
+  // 8 for missing fd4, fd6, worker fd4s, worker fd6s, port, session
+  // cache fd, stats fd and stats port.
+  auto envp = util::make_unique<char *[]>(envlen + 8 + 1);
   size_t envidx = 0;
 
   auto acceptor4 = conn_handler->get_acceptor4();
@@ -366,14 +602,59 @@ void exec_binary_signal_cb(struct ev_loop *loop, ev_signal *w, int revents) {
     envp[envidx++] = strdup(fd6.c_str());
   }
 
+  auto &worker_listeners = conn_handler->get_worker_listeners();
+  if (!worker_listeners.empty()) {
+    std::string fd4s = ENV_WORKER_LISTENER4_FDS "=";
+    std::string fd6s = ENV_WORKER_LISTENER6_FDS "=";
+    for (auto &listener : worker_listeners) {
+      if (listener.fd4 != -1) {
+        if (fd4s.back() != '=') {
+          fd4s += ',';
+        }
+        fd4s += util::utos(listener.fd4);
+      }
+      if (listener.fd6 != -1) {
+        if (fd6s.back() != '=') {
+          fd6s += ',';
+        }
+        fd6s += util::utos(listener.fd6);
+      }
+    }
+    envp[envidx++] = strdup(fd4s.c_str());
+    envp[envidx++] = strdup(fd6s.c_str());
+  }
+
   std::string port = ENV_PORT "=";
   port += util::utos(get_config()->port);
   envp[envidx++] = strdup(port.c_str());
 
+  auto session_cache = conn_handler->get_session_cache();
+  if (session_cache) {
+    std::string fd = ENV_SESSION_CACHE_FD "=";
+    fd += util::utos(session_cache->get_fd());
+    envp[envidx++] = strdup(fd.c_str());
+  }
+
+  auto stats_server = conn_handler->get_stats_server();
+  if (stats_server) {
+    std::string fd = ENV_STATS_LISTENER_FD "=";
+    fd += util::utos(stats_server->get_fd());
+    envp[envidx++] = strdup(fd.c_str());
+
+    std::string port = ENV_STATS_PORT "=";
+    port += util::utos(get_config()->stats_port);
+    envp[envidx++] = strdup(port.c_str());
+  }
+
   for (size_t i = 0; i < envlen; ++i) {
     if (strcmp(ENV_LISTENER4_FD, environ[i]) == 0 ||
         strcmp(ENV_LISTENER6_FD, environ[i]) == 0 ||
-        strcmp(ENV_PORT, environ[i]) == 0) {
+        strcmp(ENV_WORKER_LISTENER4_FDS, environ[i]) == 0 ||
+        strcmp(ENV_WORKER_LISTENER6_FDS, environ[i]) == 0 ||
+        strcmp(ENV_PORT, environ[i]) == 0 ||
+        strcmp(ENV_SESSION_CACHE_FD, environ[i]) == 0 ||
+        strcmp(ENV_STATS_LISTENER_FD, environ[i]) == 0 ||
+        strcmp(ENV_STATS_PORT, environ[i]) == 0) {
       continue;
     }
 
@@ -433,6 +714,12 @@ void graceful_shutdown_signal_cb(struct ev_loop *loop, ev_signal *w,
 }
 } // namespace
 
+namespace {
+void accesslog_flush_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+  flush_accesslog();
+}
+} // namespace
+
 namespace {
 void refresh_cb(struct ev_loop *loop, ev_timer *w, int revents) {
   auto conn_handler = static_cast<ConnectionHandler *>(w->data);
@@ -447,6 +734,14 @@ void refresh_cb(struct ev_loop *loop, ev_timer *w, int revents) {
 }
 } // namespace
 
+namespace {
+void update_ocsp_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto conn_handler = static_cast<ConnectionHandler *>(w->data);
+
+  conn_handler->get_ocsp_store()->update();
+}
+} // namespace
+
 namespace {
 void renew_ticket_key_cb(struct ev_loop *loop, ev_timer *w, int revents) {
   auto conn_handler = static_cast<ConnectionHandler *>(w->data);
@@ -510,16 +805,44 @@ int event_loop() {
     save_pid();
   }
 
-  auto acceptor6 = create_acceptor(conn_handler.get(), AF_INET6);
-  auto acceptor4 = create_acceptor(conn_handler.get(), AF_INET);
-  if (!acceptor6 && !acceptor4) {
-    LOG(FATAL) << "Failed to listen on address " << get_config()->host.get()
-               << ", port " << get_config()->port;
-    exit(EXIT_FAILURE);
+  std::vector<WorkerListener> worker_listeners;
+
+  if (get_config()->listener_reuseport && get_config()->num_worker > 1) {
+    // Each worker accepts connections on its own socket, and kernel
+    // distributes incoming connections among them.
+    worker_listeners = create_worker_listeners();
+  } else {
+    close_inherited_worker_listeners();
+
+    auto acceptor6 = create_acceptor(conn_handler.get(), AF_INET6);
+    auto acceptor4 = create_acceptor(conn_handler.get(), AF_INET);
+    if (!acceptor6 && !acceptor4) {
+      LOG(FATAL) << "Failed to listen on address " << get_config()->host.get()
+                 << ", port " << get_config()->port;
+      exit(EXIT_FAILURE);
+    }
+
+    conn_handler->set_acceptor4(std::move(acceptor4));
+    conn_handler->set_acceptor6(std::move(acceptor6));
   }
 
-  conn_handler->set_acceptor4(std::move(acceptor4));
-  conn_handler->set_acceptor6(std::move(acceptor6));
+  if (get_config()->stats_host) {
+    auto fd = create_stats_listener();
+    if (fd == -1) {
+      LOG(FATAL) << "Failed to listen on stats address "
+                 << get_config()->stats_host.get() << ", port "
+                 << get_config()->stats_port;
+      exit(EXIT_FAILURE);
+    }
+
+    conn_handler->set_stats_server(
+        util::make_unique<StatsServer>(loop, fd, conn_handler.get()));
+  } else {
+    auto envfd = getenv(ENV_STATS_LISTENER_FD);
+    if (envfd) {
+      close(strtoul(envfd, nullptr, 10));
+    }
+  }
 
   // ListenHandler loads private key, and we listen on a priveleged port.
   // After that, we drop the root privileges if needed.
@@ -544,17 +867,48 @@ int event_loop() {
   sigaddset(&signals, REOPEN_LOG_SIGNAL);
   sigaddset(&signals, EXEC_BINARY_SIGNAL);
   sigaddset(&signals, GRACEFUL_SHUTDOWN_SIGNAL);
+  sigaddset(&signals, RELOAD_SIGNAL);
   rv = pthread_sigmask(SIG_BLOCK, &signals, nullptr);
   if (rv != 0) {
     LOG(ERROR) << "Blocking signals failed: " << strerror(rv);
   }
 #endif // !NOTHREADS
 
+  if (get_config()->downstream_health_check_interval > 0.) {
+    conn_handler->create_health_monitor();
+  }
+
+  if (!get_config()->client_mode && !get_config()->upstream_no_tls &&
+      get_config()->tls_session_cache_size > 0) {
+    conn_handler->set_session_cache(create_session_cache());
+  }
+
+  ev_timer update_ocsp_timer;
+  if (!get_config()->client_mode && !get_config()->upstream_no_tls &&
+      get_config()->ocsp_stapling) {
+    conn_handler->set_ocsp_store(create_ocsp_store());
+
+    ev_timer_init(&update_ocsp_timer, update_ocsp_cb, 0.,
+                  get_config()->ocsp_update_interval);
+    update_ocsp_timer.data = conn_handler.get();
+    ev_timer_again(loop, &update_ocsp_timer);
+  }
+
+  if (!get_config()->client_mode && !get_config()->upstream_no_tls &&
+      get_config()->tls_key_offload_threads > 0) {
+    // If this fails, enable_key_offload() leaves private keys as is.
+    if (ssl::start_key_offload(get_config()->tls_key_offload_threads) != 0) {
+      LOG(WARN) << "Private key offload is not available; private key "
+                   "operations are performed in worker threads";
+    }
+  }
+
   if (get_config()->num_worker > 1) {
     if (!get_config()->tls_ctx_per_worker) {
       conn_handler->create_ssl_context();
     }
-    conn_handler->create_worker_thread(get_config()->num_worker);
+    conn_handler->create_worker_thread(get_config()->num_worker,
+                                       worker_listeners);
   } else {
     conn_handler->create_ssl_context();
     if (get_config()->downstream_proto == PROTO_HTTP2) {
@@ -587,17 +941,32 @@ int event_loop() {
   graceful_shutdown_sig.data = conn_handler.get();
   ev_signal_start(loop, &graceful_shutdown_sig);
 
+  ev_signal reload_sig;
+  ev_signal_init(&reload_sig, reload_signal_cb, RELOAD_SIGNAL);
+  reload_sig.data = conn_handler.get();
+  ev_signal_start(loop, &reload_sig);
+
   ev_timer refresh_timer;
   ev_timer_init(&refresh_timer, refresh_cb, 0., 1.);
   refresh_timer.data = conn_handler.get();
   ev_timer_again(loop, &refresh_timer);
 
+  ev_timer accesslog_flush_timer;
+  if (get_config()->accesslog_buffer_size > 0 &&
+      get_config()->num_worker == 1) {
+    ev_timer_init(&accesslog_flush_timer, accesslog_flush_cb, 0.,
+                  get_config()->accesslog_flush_interval);
+    ev_timer_again(loop, &accesslog_flush_timer);
+  }
+
   if (LOG_ENABLED(INFO)) {
     LOG(INFO) << "Entering event loop";
   }
 
   ev_run(loop, 0);
 
+  flush_accesslog();
+
   conn_handler->join_worker();
 
   return 0;
@@ -671,6 +1040,7 @@ void fill_default_config() {
 
   // Timeout for pooled (idle) connections
   mod_config()->downstream_idle_read_timeout = 600.;
+  mod_config()->downstream_max_idle_connections = 100;
 
   // window bits for HTTP/2 and SPDY upstream/downstream connection
   // per stream. 2**16-1 = 64KiB-1, which is HTTP/2 default. Please
@@ -752,9 +1122,29 @@ void fill_default_config() {
   mod_config()->argv = nullptr;
   mod_config()->downstream_connections_per_host = 8;
   mod_config()->downstream_connections_per_frontend = 0;
+  mod_config()->downstream_http2_connections_per_worker = 1;
+  mod_config()->downstream_balancing = BALANCING_ROUND_ROBIN;
+  mod_config()->downstream_health_check_interval = 0.;
+  mod_config()->downstream_health_check_fall = 3;
+  mod_config()->downstream_health_check_rise = 2;
+  mod_config()->downstream_hash_key = HASH_KEY_NONE;
+  mod_config()->accesslog_buffer_size = 0;
+  mod_config()->accesslog_flush_interval = 1.;
+  mod_config()->accesslog_mode = ACCESSLOG_MODE_TEXT;
+  mod_config()->stats_port = 0;
+  mod_config()->cache_size = 0;
+  mod_config()->cache_max_object_size = 1024 * 1024;
+  mod_config()->cache_collapse_timeout = 5.;
+  mod_config()->tls_dyn_rec_warmup_threshold = 1024 * 1024;
+  mod_config()->tls_dyn_rec_idle_timeout = 1.;
+  mod_config()->tls_session_cache_size = 0;
+  mod_config()->tls_key_offload_threads = 0;
+  mod_config()->ocsp_stapling = false;
+  mod_config()->ocsp_update_interval = 3600.;
   mod_config()->listener_disable_timeout = 0.;
   mod_config()->auto_tls_ticket_key = true;
   mod_config()->tls_ctx_per_worker = false;
+  mod_config()->listener_reuseport = false;
   mod_config()->downstream_request_buffer_size = 16 * 1024;
   mod_config()->downstream_response_buffer_size = 16 * 1024;
 }
@@ -783,6 +1173,9 @@ void print_help(std::ostream &out) {
   <CERT>      Set path  to server's certificate.  Required  unless -p,
               --client or --frontend-no-tls are given.
 
+              Private  keys and certificates, including --subcert, are
+              read again on SIGHUP.  See --conf.
+
 Options:
   The options are categorized into several groups.
 
@@ -825,6 +1218,14 @@ Performance:
   -n, --workers=<N>
               Set the number of worker threads.
               Default: )" << get_config()->num_worker << R"(
+  --listener-reuseport
+              Each  worker  thread  opens  its  own  listening  socket
+              with SO_REUSEPORT and accepts connections directly, so
+              that kernel distributes incoming connections among worker
+              threads.  This  option is  ignored if  the number  of
+              worker threads is 1.  The listening sockets are passed
+              to new binary on  hot swapping, and new binary uses them
+              if  it  listens  on  the  same  port.
   --read-rate=<SIZE>
               Set maximum  average read  rate on  frontend connection.
               Setting 0 to this option means read rate is unlimited.
@@ -883,6 +1284,63 @@ Performance:
               (-s option), use --backend-http1-connections-per-host.
               Default: )" << get_config()->downstream_connections_per_frontend
       << R"(
+  --backend-http2-connections-per-worker=<N>
+              Set  maximum  number  of  HTTP/2  backend  connections per
+              worker.  The  connections are  spread across  all backend
+              addresses.   New request  is assigned  to the  connection
+              with the  least number  of active  streams, and  new
+              connection is made when all connections reach the limit
+              of concurrent streams advertised by backend.
+              Default: )"
+      << get_config()->downstream_http2_connections_per_worker << R"(
+  --backend-http1-balancing=<POLICY>
+              Set  the policy  to choose  backend address  for new HTTP/1
+              backend connection.  "round-robin" chooses addresses in
+              turn.  "least-inflight" chooses the address with the least
+              number  of  outstanding  requests.   "peak-ewma"  chooses
+              the address  with the  smallest peak EWMA  of response
+              latency multiplied  by the number of  outstanding requests
+              plus 1.  The address without sample is assumed to have
+              100ms latency, and  the failure before response header
+              counts as  at least  10 seconds  latency.   "p2c" picks
+              2 addresses at  random and chooses the one with less
+              outstanding requests.  The statistics
+              are maintained per worker.
+              Default: round-robin
+  --backend-health-check-interval=<SEC>
+              Probe each backend address every <SEC> seconds from the
+              main  thread, and stop  choosing the  address which is
+              ejected.   If all  addresses are ejected, all of them
+              are  used as  if they were healthy.  0 disables health
+              check.
+              Default: )" << get_config()->downstream_health_check_interval
+      << R"(
+  --backend-health-check-path=<PATH>
+              Send  HTTP/1.1 GET  request to  <PATH>  as health check,
+              and  treat  2xx  and 3xx  response  as success.  If this
+              option is not given,  or backend is HTTP/2, health check
+              succeeds if TCP connection is established.
+  --backend-health-check-fall=<N>
+              Eject  backend address after <N>  consecutive failures of
+              health check.
+              Default: )" << get_config()->downstream_health_check_fall << R"(
+  --backend-health-check-rise=<N>
+              Readmit ejected backend address after <N> consecutive
+              successes of health check.
+              Default: )" << get_config()->downstream_health_check_rise << R"(
+  --backend-hash-key=<KEY>
+              Choose  backend address  by consistent  hashing of the
+              request  field <KEY>, so that the  same key goes to the
+              same  backend  address.  <KEY> is one of  "path" (request
+              path),  "authority" (:authority or host header field),
+              "client-ip", and "cookie:<NAME>" (the value of cookie
+              <NAME>).   If the  field is  not found,  the policy  of
+              --backend-http1-balancing  is used.   When  health check
+              ejects or readmits  address, keys are remapped only for
+              that  address.  This  applies  to both  HTTP/1 and HTTP/2
+              backends.  For HTTP/2 backend, at least one session per
+              address is made.  "none" disables consistent hashing.
+              Default: none
   --rlimit-nofile=<N>
               Set maximum number of open files (RLIMIT_NOFILE) to <N>.
               If 0 is given, nghttpx does not set the limit.
@@ -926,6 +1384,13 @@ Timeout:
   --backend-keep-alive-timeout=<SEC>
               Specify keep-alive timeout for backend connection.
               Default: )" << get_config()->downstream_idle_read_timeout << R"(
+  --backend-keep-alive-max-idle=<N>
+              Set the maximum number  of idle HTTP/1 connections kept
+              for each backend address in each worker.  When exceeded,
+              the  connection  which  has been  idle for  the  longest
+              time is closed.  0 disables connection reuse.
+              Default: )" << get_config()->downstream_max_idle_connections
+      << R"(
   --listener-disable-timeout=<SEC>
               After accepting  connection failed,  connection listener
               is disabled for  a given time in  seconds.  Specifying 0
@@ -1016,6 +1481,56 @@ SSL/TLS:
               objects, which means session  ID generated by one worker
               is not acceptable by another worker.  On the other hand,
               session ticket key is shared across all worker threads.
+  --tls-dyn-rec-warmup-threshold=<SIZE>
+              Specify the  threshold size for TLS  dynamic record size
+              behaviour.  During  a TLS session, after  the threshold
+              number of bytes  have been written, the  TLS record size
+              will be increased to the maximum allowed (16K).  The max
+              record size will  continue to be used on  the active TLS
+              session.  After  --tls-dyn-rec-idle-timeout has elapsed,
+              the record size is reduced  to 1300 bytes.  Specify 0 to
+              always use the maximum record size.
+              Default: )"
+      << util::utos_with_unit(get_config()->tls_dyn_rec_warmup_threshold)
+      << R"(
+  --tls-dyn-rec-idle-timeout=<SEC>
+              Specify TLS dynamic record  size behaviour timeout.  See
+              --tls-dyn-rec-warmup-threshold  for   more  information.
+              This behaviour applies to TLS sessions only.
+              Default: )" << get_config()->tls_dyn_rec_idle_timeout << R"(
+  --tls-session-cache-size=<SIZE>
+              Store TLS sessions in  shared memory of the given size,
+              so that session ID based resumption works regardless of
+              the worker which accepted the connection.  The cache is
+              also inherited by new binary started by SIGUSR2.  Each
+              session takes about 1K.   Specifying 0 uses per SSL_CTX
+              session cache of OpenSSL.
+              Default: )"
+      << util::utos_with_unit(get_config()->tls_session_cache_size) << R"(
+  --tls-key-offload-threads=<N>
+              Perform RSA  private key operations of  TLS handshake,
+              signing and decryption, in <N> dedicated threads instead
+              of worker  threads, so  that they  do not  block other
+              connections.  The handshake is resumed when the operation
+              completes.  This requires OpenSSL  1.1.0 or later.  With
+              OpenSSL 3.0  or later,  cipher suites  using RSA  key
+              exchange are disabled.  0 disables this feature.
+              Default: )" << get_config()->tls_key_offload_threads << R"(
+  --ocsp-stapling
+              Staple OCSP  response to  TLS handshake.   The response
+              for each certificate, including --subcert, is read from
+              the file  named <CERTPATH>.ocsp, which must contain DER
+              encoded OCSP  response.  The certificate file must also
+              contain  the  issuer  certificate  right after  server
+              certificate,  so  that  nghttpx  can  check  that  the
+              response is for the certificate.  nghttpx does not fetch
+              responses  itself;  external  program  should keep  the
+              files  updated.  The  files are  reloaded  every
+              --ocsp-update-interval and on SIGUSR1 and SIGHUP.
+              Expired response is not stapled.
+  --ocsp-update-interval=<SEC>
+              Set interval to reload OCSP response files.
+              Default: )" << get_config()->ocsp_update_interval << R"(
 
 HTTP/2 and SPDY:
   -c, --http2-max-concurrent-streams=<N>
@@ -1113,8 +1628,45 @@ Logging:
               * $alpn: ALPN identifier of the protocol which generates
                 the response.   For HTTP/1,  ALPN is  always http/1.1,
                 regardless of minor version.
+              * $request_body_bytes: the number of bytes received from
+                client as request body.
+              * $ttfb: time  from the beginning  of request  until the
+                response header  is received  from backend, in seconds
+                with milliseconds resolution.
+              * $backend_addr: address of backend which served request.
+              * $backend_proto: protocol  used to  talk to backend; h2
+                or http/1.1.
 
               Default: )" << DEFAULT_ACCESSLOG_FORMAT << R"(
+  --accesslog-buffer-size=<SIZE>
+              Buffer  access log  in each worker  up to <SIZE> bytes,
+              and write  it  when buffer gets full, or every  interval
+              given by --accesslog-flush-interval.  If write fails, the
+              buffered lines are dropped and the number of dropped
+              lines  is logged.  This  option has no effect  with
+              --accesslog-syslog.  0 disables buffering.
+              Default: )" << get_config()->accesslog_buffer_size << R"(
+  --accesslog-flush-interval=<SEC>
+              Set interval to write buffered access log.
+              Default: )" << get_config()->accesslog_flush_interval << R"(
+  --accesslog-mode=<MODE>
+              Set output  format of access  log.  <MODE> is one of the
+              following:
+
+              * text:  line formatted  by --accesslog-format.
+              * json:  one  JSON object  per line.   The variables  in
+                --accesslog-format  become  keys without leading  '$',
+                and literal strings are ignored.   Control characters
+                and bytes  not in ASCII  are escaped as \u00XX.
+              * binary: length prefixed  record.  Each record  begins
+                with 4 bytes length  of the rest of record, followed by
+                the variables in --accesslog-format in order.  Integers
+                and times in milliseconds are encoded as 8 bytes, and
+                strings as 2  bytes length followed by the string.  All
+                integers are in network byte order.  binary mode cannot
+                be used with --accesslog-syslog.
+
+              Default: text
   --errorlog-file=<PATH>
               Set path to write error  log.  To reopen file, send USR1
               signal to nghttpx.
@@ -1126,6 +1678,12 @@ Logging:
               Set syslog facility to <FACILITY>.
               Default: )" << str_syslog_facility(get_config()->syslog_facility)
       << R"(
+  --stats-frontend=<HOST>,<PORT>
+              Serve  runtime metrics  aggregated from all  workers  in
+              Prometheus text  format on  plain HTTP/1 endpoint  at
+              <HOST>  and  <PORT>.   Metrics are  available  at  path
+              "/metrics".  Since  this endpoint  has no access control,
+              <HOST> should be local address.
 
 HTTP:
   --add-x-forwarded-for
@@ -1154,6 +1712,27 @@ HTTP:
               won't replace anything already  set.  This option can be
               used several  times to  specify multiple  header fields.
               Example: --add-response-header="foo: bar"
+  --cache-size=<SIZE>
+              Set the  size  of in-memory  response cache  per  worker.
+              GET  responses  from  backend  are  stored  if they  have
+              Cache-Control max-age or  s-maxage,  and  do  not  have
+              no-store, no-cache, private or Set-Cookie.  Cached entries
+              are keyed by  method, authority, path  and header fields
+              listed in Vary, and the least recently used entries are
+              evicted when the  size  is  exceeded.   Specifying  0
+              disables the cache.
+              Default: )" << util::utos_with_unit(get_config()->cache_size)
+      << R"(
+  --cache-max-object-size=<SIZE>
+              Set  the maximum size  of response  body  stored  in the
+              cache.
+              Default: )"
+      << util::utos_with_unit(get_config()->cache_max_object_size) << R"(
+  --cache-collapse-timeout=<SEC>
+              Set the maximum time a request waits for the same request
+              in flight to backend.  After that, the request is sent to
+              backend by itself.  Specifying 0 removes the limit.
+              Default: )" << get_config()->cache_collapse_timeout << R"(
 
 Debug:
   --frontend-http2-dump-request-header=<PATH>
@@ -1172,6 +1751,12 @@ Debug:
               Print HTTP/2 frames in  frontend to stderr.  This option
               is  not thread  safe and  MUST NOT  be used  with option
               -n=N, where N >= 2.
+  --frontend-http2-record-dir=<DIR>
+              Records raw  bytes received by HTTP/2  frontend into the
+              directory denoted in <DIR>.  One file is created for each
+              connection.  The  recorded files  can be replayed  using
+              h2replay tool.  Since the  recorded files contain request
+              data as is, use this option with care.
 
 Process:
   -D, --daemon
@@ -1185,7 +1770,29 @@ Process:
 
 Misc:
   --conf=<PATH>
-              Load configuration from <PATH>.
+              Load  configuration  from  <PATH>.   On  SIGHUP, nghttpx
+              reads   the  configuration  file  and  the  command-line
+              options  again,  and  switches  to the new configuration
+              without restart.  Private keys and certificates are also
+              read  again.  New connections use the new configuration,
+              and  established connections use it for new requests and
+              backend   connections.    For  HTTP/1  backend,  backend
+              addresses  can  be added and removed; unchanged backends
+              keep their idle connections, statistics and health check
+              results.   If  the  new  configuration  is  invalid, the
+              current configuration is kept.  Some options take effect
+              only  at  startup, and reload fails if they are changed:
+              --frontend,  --backlog, --workers, --listener-reuseport,
+              --user,  --daemon,  --pid-file,  the proxy mode options,
+              --frontend-no-tls,   --backend-no-tls,   --backend   for
+              HTTP/2  backend,  TLS  options  for backend connections,
+              --tls-ctx-per-worker,          --tls-session-cache-size,
+              --tls-key-offload-threads,   --tls-ticket-key-file,  the
+              OCSP   options,  --stats-frontend,  the  cache  options,
+              --accesslog-buffer-size, --accesslog-flush-interval, the
+              syslog      options,     --frontend-http2-dump-*-header,
+              --frontend-frame-debug and --rlimit-nofile.  Use SIGUSR2
+              to change them without downtime.
               Default: )" << get_config()->conf_path.get() << R"(
   -v, --version
               Print version and exit.
@@ -1196,29 +1803,409 @@ Misc:
 }
 } // namespace
 
-int main(int argc, char **argv) {
-  Log::set_severity_level(NOTICE);
-  create_config();
-  fill_default_config();
+namespace {
+// Options given in command-line, in order.  They are applied again
+// when configuration is reloaded.
+std::vector<std::pair<const char *, const char *>> cmdcfgs;
+} // namespace
 
-  // We have to copy argv, since getopt_long may change its content.
-  mod_config()->argc = argc;
-  mod_config()->argv = new char *[argc];
+namespace {
+// Fills the options of mod_config() which are derived from the
+// other options, and resolves backend addresses.  This function
+// returns 0 if it succeeds, or -1.
+int process_options() {
+  if (get_config()->accesslog_syslog &&
+      get_config()->accesslog_mode == ACCESSLOG_MODE_BINARY) {
+    LOG(ERROR) << "--accesslog-mode=binary cannot be used with "
+                  "--accesslog-syslog";
+    return -1;
+  }
 
-  for (int i = 0; i < argc; ++i) {
-    mod_config()->argv[i] = strdup(argv[i]);
+  if (get_config()->npn_list.empty()) {
+    mod_config()->npn_list = parse_config_str_list(DEFAULT_NPN_LIST);
+  }
+  if (get_config()->tls_proto_list.empty()) {
+    mod_config()->tls_proto_list =
+        parse_config_str_list(DEFAULT_TLS_PROTO_LIST);
   }
 
-  mod_config()->cwd = getcwd(nullptr, 0);
-  if (mod_config()->cwd == nullptr) {
-    auto error = errno;
-    LOG(FATAL) << "failed to get current working directory: errno=" << error;
-    exit(EXIT_FAILURE);
+  mod_config()->tls_proto_mask =
+      ssl::create_tls_proto_mask(get_config()->tls_proto_list);
+
+  mod_config()->alpn_prefs = ssl::set_alpn_prefs(get_config()->npn_list);
+
+  if (get_config()->backend_ipv4 && get_config()->backend_ipv6) {
+    LOG(ERROR) << "--backend-ipv4 and --backend-ipv6 cannot be used at the "
+               << "same time.";
+    return -1;
   }
 
-  std::vector<std::pair<const char *, const char *>> cmdcfgs;
-  while (1) {
-    static int flag = 0;
+  if (get_config()->worker_frontend_connections == 0) {
+    mod_config()->worker_frontend_connections =
+        std::numeric_limits<size_t>::max();
+  }
+
+  if (get_config()->http2_proxy + get_config()->http2_bridge +
+          get_config()->client_proxy + get_config()->client >
+      1) {
+    LOG(ERROR) << "--http2-proxy, --http2-bridge, --client-proxy and --client "
+               << "cannot be used at the same time.";
+    return -1;
+  }
+
+  if (get_config()->client || get_config()->client_proxy) {
+    mod_config()->client_mode = true;
+  }
+
+  if (get_config()->client_mode || get_config()->http2_bridge) {
+    mod_config()->downstream_proto = PROTO_HTTP2;
+  } else {
+    mod_config()->downstream_proto = PROTO_HTTP;
+  }
+
+  if (get_config()->downstream_addrs.empty()) {
+    DownstreamAddr addr;
+    addr.host = strcopy(DEFAULT_DOWNSTREAM_HOST);
+    addr.port = DEFAULT_DOWNSTREAM_PORT;
+
+    mod_config()->downstream_addrs.push_back(std::move(addr));
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    LOG(INFO) << "Resolving backend address";
+  }
+
+  for (auto &addr : mod_config()->downstream_addrs) {
+    auto ipv6 = util::ipv6_numeric_addr(addr.host.get());
+    std::string hostport;
+
+    if (ipv6) {
+      hostport += "[";
+    }
+
+    hostport += addr.host.get();
+
+    if (ipv6) {
+      hostport += "]";
+    }
+
+    hostport += ":";
+    hostport += util::utos(addr.port);
+
+    addr.hostport = strcopy(hostport);
+
+    if (resolve_hostname(
+            &addr.addr, &addr.addrlen, addr.host.get(), addr.port,
+            get_config()->backend_ipv4
+                ? AF_INET
+                : (get_config()->backend_ipv6 ? AF_INET6 : AF_UNSPEC)) == -1) {
+      return -1;
+    }
+  }
+
+  if (get_config()->downstream_http_proxy_host) {
+    if (LOG_ENABLED(INFO)) {
+      LOG(INFO) << "Resolving backend http proxy address";
+    }
+    if (resolve_hostname(&mod_config()->downstream_http_proxy_addr,
+                         &mod_config()->downstream_http_proxy_addrlen,
+                         get_config()->downstream_http_proxy_host.get(),
+                         get_config()->downstream_http_proxy_port,
+                         AF_UNSPEC) == -1) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+} // namespace
+
+namespace {
+// Returns true if |a| and |b| are both nullptr, or the same string.
+bool opt_streq(const std::unique_ptr<char[]> &a,
+               const std::unique_ptr<char[]> &b) {
+  if (!a || !b) {
+    return a == b;
+  }
+  return strcmp(a.get(), b.get()) == 0;
+}
+} // namespace
+
+namespace {
+// Returns true if |a| and |b| have the same backend addresses in the
+// same order.
+bool same_downstream_addrs(const Config *a, const Config *b) {
+  if (a->downstream_addrs.size() != b->downstream_addrs.size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < a->downstream_addrs.size(); ++i) {
+    if (strcmp(a->downstream_addrs[i].hostport.get(),
+               b->downstream_addrs[i].hostport.get()) != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+} // namespace
+
+namespace {
+// Returns the name of option which is set differently in |a| and |b|,
+// and takes effect only at startup.  Returns nullptr if there is no
+// such option.
+const char *find_startup_option_change(const Config *a, const Config *b) {
+  if (!opt_streq(a->host, b->host) || a->port != b->port) {
+    return SHRPX_OPT_FRONTEND;
+  }
+  if (a->backlog != b->backlog) {
+    return SHRPX_OPT_BACKLOG;
+  }
+  if (a->num_worker != b->num_worker) {
+    return SHRPX_OPT_WORKERS;
+  }
+  if (a->listener_reuseport != b->listener_reuseport) {
+    return SHRPX_OPT_LISTENER_REUSEPORT;
+  }
+  if (a->uid != b->uid || a->gid != b->gid) {
+    return SHRPX_OPT_USER;
+  }
+  if (a->daemon != b->daemon) {
+    return SHRPX_OPT_DAEMON;
+  }
+  if (!opt_streq(a->pid_file, b->pid_file)) {
+    return SHRPX_OPT_PID_FILE;
+  }
+  if (a->upstream_no_tls != b->upstream_no_tls) {
+    return SHRPX_OPT_FRONTEND_NO_TLS;
+  }
+  if (a->downstream_no_tls != b->downstream_no_tls) {
+    return SHRPX_OPT_BACKEND_NO_TLS;
+  }
+  if (a->http2_proxy != b->http2_proxy) {
+    return SHRPX_OPT_HTTP2_PROXY;
+  }
+  if (a->http2_bridge != b->http2_bridge) {
+    return SHRPX_OPT_HTTP2_BRIDGE;
+  }
+  if (a->client != b->client) {
+    return SHRPX_OPT_CLIENT;
+  }
+  if (a->client_proxy != b->client_proxy) {
+    return SHRPX_OPT_CLIENT_PROXY;
+  }
+  // HTTP/2 backend sessions are made to the fixed addresses.
+  if (a->downstream_proto == PROTO_HTTP2 && !same_downstream_addrs(a, b)) {
+    return SHRPX_OPT_BACKEND;
+  }
+  // TLS context for backend connections is created at startup.
+  if (!opt_streq(a->cacert, b->cacert)) {
+    return SHRPX_OPT_CACERT;
+  }
+  if (!opt_streq(a->client_private_key_file, b->client_private_key_file)) {
+    return SHRPX_OPT_CLIENT_PRIVATE_KEY_FILE;
+  }
+  if (!opt_streq(a->client_cert_file, b->client_cert_file)) {
+    return SHRPX_OPT_CLIENT_CERT_FILE;
+  }
+  if (a->insecure != b->insecure) {
+    return SHRPX_OPT_INSECURE;
+  }
+  if (a->tls_ctx_per_worker != b->tls_ctx_per_worker) {
+    return SHRPX_OPT_TLS_CTX_PER_WORKER;
+  }
+  if (a->tls_session_cache_size != b->tls_session_cache_size) {
+    return SHRPX_OPT_TLS_SESSION_CACHE_SIZE;
+  }
+  if (a->tls_key_offload_threads != b->tls_key_offload_threads) {
+    return SHRPX_OPT_TLS_KEY_OFFLOAD_THREADS;
+  }
+  if (a->tls_ticket_key_files != b->tls_ticket_key_files) {
+    return SHRPX_OPT_TLS_TICKET_KEY_FILE;
+  }
+  if (a->ocsp_stapling != b->ocsp_stapling) {
+    return SHRPX_OPT_OCSP_STAPLING;
+  }
+  if (a->ocsp_update_interval != b->ocsp_update_interval) {
+    return SHRPX_OPT_OCSP_UPDATE_INTERVAL;
+  }
+  if (!opt_streq(a->stats_host, b->stats_host) ||
+      a->stats_port != b->stats_port) {
+    return SHRPX_OPT_STATS_FRONTEND;
+  }
+  if (a->cache_size != b->cache_size) {
+    return SHRPX_OPT_CACHE_SIZE;
+  }
+  if (a->cache_max_object_size != b->cache_max_object_size) {
+    return SHRPX_OPT_CACHE_MAX_OBJECT_SIZE;
+  }
+  if (a->cache_collapse_timeout != b->cache_collapse_timeout) {
+    return SHRPX_OPT_CACHE_COLLAPSE_TIMEOUT;
+  }
+  if (a->accesslog_buffer_size != b->accesslog_buffer_size) {
+    return SHRPX_OPT_ACCESSLOG_BUFFER_SIZE;
+  }
+  if (a->accesslog_flush_interval != b->accesslog_flush_interval) {
+    return SHRPX_OPT_ACCESSLOG_FLUSH_INTERVAL;
+  }
+  if (a->accesslog_syslog != b->accesslog_syslog) {
+    return SHRPX_OPT_ACCESSLOG_SYSLOG;
+  }
+  if (a->errorlog_syslog != b->errorlog_syslog) {
+    return SHRPX_OPT_ERRORLOG_SYSLOG;
+  }
+  if (a->syslog_facility != b->syslog_facility) {
+    return SHRPX_OPT_SYSLOG_FACILITY;
+  }
+  if (!opt_streq(a->http2_upstream_dump_request_header_file,
+                 b->http2_upstream_dump_request_header_file)) {
+    return SHRPX_OPT_FRONTEND_HTTP2_DUMP_REQUEST_HEADER;
+  }
+  if (!opt_streq(a->http2_upstream_dump_response_header_file,
+                 b->http2_upstream_dump_response_header_file)) {
+    return SHRPX_OPT_FRONTEND_HTTP2_DUMP_RESPONSE_HEADER;
+  }
+  if (a->upstream_frame_debug != b->upstream_frame_debug) {
+    return SHRPX_OPT_FRONTEND_FRAME_DEBUG;
+  }
+  if (a->rlimit_nofile != b->rlimit_nofile) {
+    return SHRPX_OPT_RLIMIT_NOFILE;
+  }
+
+  return nullptr;
+}
+} // namespace
+
+namespace {
+// Reorders backend addresses of |config| so that the address which
+// is also in |old_config| has the same index in both.  Workers keep
+// per address state by index.  The address which is only in
+// |old_config| is kept, marked as removed.  The new addresses come
+// last.
+void merge_downstream_addrs(Config *config, const Config *old_config) {
+  auto &addrs = config->downstream_addrs;
+  std::vector<DownstreamAddr> merged;
+  std::vector<bool> taken(addrs.size());
+
+  for (auto &old_addr : old_config->downstream_addrs) {
+    size_t i;
+    for (i = 0; i < addrs.size(); ++i) {
+      if (!taken[i] &&
+          strcmp(addrs[i].hostport.get(), old_addr.hostport.get()) == 0) {
+        break;
+      }
+    }
+
+    if (i < addrs.size()) {
+      taken[i] = true;
+      merged.push_back(std::move(addrs[i]));
+      continue;
+    }
+
+    DownstreamAddr addr;
+    addr.addr = old_addr.addr;
+    addr.host = strcopy(old_addr.host.get());
+    addr.hostport = strcopy(old_addr.hostport.get());
+    addr.addrlen = old_addr.addrlen;
+    addr.port = old_addr.port;
+    addr.removed = true;
+
+    merged.push_back(std::move(addr));
+  }
+
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    if (!taken[i]) {
+      merged.push_back(std::move(addrs[i]));
+    }
+  }
+
+  addrs = std::move(merged);
+}
+} // namespace
+
+namespace {
+std::unique_ptr<Config> create_reloaded_config() {
+  auto old_config = mod_config();
+  auto config = util::make_unique<Config>();
+
+  // Options are parsed into mod_config().
+  set_config(config.get());
+  auto config_restorer = util::defer(old_config, set_config);
+
+  Log::set_severity_level(NOTICE);
+  fill_default_config();
+
+  // These are not options, and set only at startup.
+  mod_config()->argc = old_config->argc;
+  mod_config()->argv = old_config->argv;
+  mod_config()->cwd = old_config->cwd;
+  mod_config()->pid = old_config->pid;
+  mod_config()->conf_path = strcopy(old_config->conf_path.get());
+  mod_config()->auto_tls_ticket_key = old_config->auto_tls_ticket_key;
+  mod_config()->http2_upstream_dump_request_header =
+      old_config->http2_upstream_dump_request_header;
+  mod_config()->http2_upstream_dump_response_header =
+      old_config->http2_upstream_dump_response_header;
+
+  if (conf_exists(get_config()->conf_path.get()) &&
+      load_config(get_config()->conf_path.get()) == -1) {
+    LOG(ERROR) << "Failed to load configuration from "
+               << get_config()->conf_path.get();
+    return nullptr;
+  }
+
+  for (auto &cmdcfg : cmdcfgs) {
+    if (parse_config(cmdcfg.first, cmdcfg.second) == -1) {
+      LOG(ERROR) << "Failed to parse command-line argument.";
+      return nullptr;
+    }
+  }
+
+  if (process_options() != 0) {
+    return nullptr;
+  }
+
+  if (!get_config()->client_mode && !get_config()->upstream_no_tls &&
+      (!get_config()->private_key_file || !get_config()->cert_file)) {
+    LOG(ERROR) << "Private key and certificate are required";
+    return nullptr;
+  }
+
+  auto opt = find_startup_option_change(get_config(), old_config);
+  if (opt) {
+    LOG(ERROR) << "--" << opt << " cannot be changed by reload; restart "
+               << "nghttpx, or start new binary with SIGUSR2";
+    return nullptr;
+  }
+
+  merge_downstream_addrs(mod_config(), old_config);
+
+  return config;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Log::set_severity_level(NOTICE);
+  create_config();
+  fill_default_config();
+
+  // We have to copy argv, since getopt_long may change its content.
+  mod_config()->argc = argc;
+  mod_config()->argv = new char *[argc];
+
+  for (int i = 0; i < argc; ++i) {
+    mod_config()->argv[i] = strdup(argv[i]);
+  }
+
+  mod_config()->cwd = getcwd(nullptr, 0);
+  if (mod_config()->cwd == nullptr) {
+    auto error = errno;
+    LOG(FATAL) << "failed to get current working directory: errno=" << error;
+    exit(EXIT_FAILURE);
+  }
+
+  while (1) {
+    static int flag = 0;
     static option long_options[] = {
         {"daemon", no_argument, nullptr, 'D'},
         {"log-level", required_argument, nullptr, 'L'},
@@ -1301,6 +2288,30 @@ int main(int argc, char **argv) {
         {"tls-ctx-per-worker", no_argument, &flag, 70},
         {"backend-response-buffer", required_argument, &flag, 71},
         {"backend-request-buffer", required_argument, &flag, 72},
+        {"frontend-http2-record-dir", required_argument, &flag, 73},
+        {"listener-reuseport", no_argument, &flag, 74},
+        {"backend-http2-connections-per-worker", required_argument, &flag,
+         75},
+        {"backend-http1-balancing", required_argument, &flag, 76},
+        {"backend-health-check-interval", required_argument, &flag, 77},
+        {"backend-health-check-path", required_argument, &flag, 78},
+        {"backend-health-check-fall", required_argument, &flag, 79},
+        {"backend-health-check-rise", required_argument, &flag, 80},
+        {"backend-hash-key", required_argument, &flag, 81},
+        {"accesslog-buffer-size", required_argument, &flag, 82},
+        {"accesslog-flush-interval", required_argument, &flag, 83},
+        {"accesslog-mode", required_argument, &flag, 84},
+        {"stats-frontend", required_argument, &flag, 85},
+        {"cache-size", required_argument, &flag, 86},
+        {"cache-max-object-size", required_argument, &flag, 87},
+        {"tls-dyn-rec-warmup-threshold", required_argument, &flag, 88},
+        {"tls-dyn-rec-idle-timeout", required_argument, &flag, 89},
+        {"tls-session-cache-size", required_argument, &flag, 90},
+        {"tls-key-offload-threads", required_argument, &flag, 91},
+        {"ocsp-stapling", no_argument, &flag, 92},
+        {"ocsp-update-interval", required_argument, &flag, 93},
+        {"backend-keep-alive-max-idle", required_argument, &flag, 94},
+        {"cache-collapse-timeout", required_argument, &flag, 95},
         {nullptr, 0, nullptr, 0}};
 
     int option_index = 0;
@@ -1630,6 +2641,99 @@ int main(int argc, char **argv) {
         // --backend-request-buffer
         cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_REQUEST_BUFFER, optarg);
         break;
+      case 73:
+        // --frontend-http2-record-dir
+        cmdcfgs.emplace_back(SHRPX_OPT_FRONTEND_HTTP2_RECORD_DIR, optarg);
+        break;
+      case 74:
+        // --listener-reuseport
+        cmdcfgs.emplace_back(SHRPX_OPT_LISTENER_REUSEPORT, "yes");
+        break;
+      case 75:
+        // --backend-http2-connections-per-worker
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HTTP2_CONNECTIONS_PER_WORKER,
+                             optarg);
+        break;
+      case 76:
+        // --backend-http1-balancing
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HTTP1_BALANCING, optarg);
+        break;
+      case 77:
+        // --backend-health-check-interval
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HEALTH_CHECK_INTERVAL, optarg);
+        break;
+      case 78:
+        // --backend-health-check-path
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HEALTH_CHECK_PATH, optarg);
+        break;
+      case 79:
+        // --backend-health-check-fall
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HEALTH_CHECK_FALL, optarg);
+        break;
+      case 80:
+        // --backend-health-check-rise
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HEALTH_CHECK_RISE, optarg);
+        break;
+      case 81:
+        // --backend-hash-key
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HASH_KEY, optarg);
+        break;
+      case 82:
+        // --accesslog-buffer-size
+        cmdcfgs.emplace_back(SHRPX_OPT_ACCESSLOG_BUFFER_SIZE, optarg);
+        break;
+      case 83:
+        // --accesslog-flush-interval
+        cmdcfgs.emplace_back(SHRPX_OPT_ACCESSLOG_FLUSH_INTERVAL, optarg);
+        break;
+      case 84:
+        // --accesslog-mode
+        cmdcfgs.emplace_back(SHRPX_OPT_ACCESSLOG_MODE, optarg);
+        break;
+      case 85:
+        // --stats-frontend
+        cmdcfgs.emplace_back(SHRPX_OPT_STATS_FRONTEND, optarg);
+        break;
+      case 86:
+        // --cache-size
+        cmdcfgs.emplace_back(SHRPX_OPT_CACHE_SIZE, optarg);
+        break;
+      case 87:
+        // --cache-max-object-size
+        cmdcfgs.emplace_back(SHRPX_OPT_CACHE_MAX_OBJECT_SIZE, optarg);
+        break;
+      case 88:
+        // --tls-dyn-rec-warmup-threshold
+        cmdcfgs.emplace_back(SHRPX_OPT_TLS_DYN_REC_WARMUP_THRESHOLD, optarg);
+        break;
+      case 89:
+        // --tls-dyn-rec-idle-timeout
+        cmdcfgs.emplace_back(SHRPX_OPT_TLS_DYN_REC_IDLE_TIMEOUT, optarg);
+        break;
+      case 90:
+        // --tls-session-cache-size
+        cmdcfgs.emplace_back(SHRPX_OPT_TLS_SESSION_CACHE_SIZE, optarg);
+        break;
+      case 91:
+        // --tls-key-offload-threads
+        cmdcfgs.emplace_back(SHRPX_OPT_TLS_KEY_OFFLOAD_THREADS, optarg);
+        break;
+      case 92:
+        // --ocsp-stapling
+        cmdcfgs.emplace_back(SHRPX_OPT_OCSP_STAPLING, "yes");
+        break;
+      case 93:
+        // --ocsp-update-interval
+        cmdcfgs.emplace_back(SHRPX_OPT_OCSP_UPDATE_INTERVAL, optarg);
+        break;
+      case 94:
+        // --backend-keep-alive-max-idle
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_KEEP_ALIVE_MAX_IDLE, optarg);
+        break;
+      case 95:
+        // --cache-collapse-timeout
+        cmdcfgs.emplace_back(SHRPX_OPT_CACHE_COLLAPSE_TIMEOUT, optarg);
+        break;
       default:
         break;
       }
@@ -1746,19 +2850,6 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (get_config()->npn_list.empty()) {
-    mod_config()->npn_list = parse_config_str_list(DEFAULT_NPN_LIST);
-  }
-  if (get_config()->tls_proto_list.empty()) {
-    mod_config()->tls_proto_list =
-        parse_config_str_list(DEFAULT_TLS_PROTO_LIST);
-  }
-
-  mod_config()->tls_proto_mask =
-      ssl::create_tls_proto_mask(get_config()->tls_proto_list);
-
-  mod_config()->alpn_prefs = ssl::set_alpn_prefs(get_config()->npn_list);
-
   if (!get_config()->tls_ticket_key_files.empty()) {
     auto ticket_keys =
         read_tls_ticket_key_file(get_config()->tls_ticket_key_files);
@@ -1770,35 +2861,10 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (get_config()->backend_ipv4 && get_config()->backend_ipv6) {
-    LOG(FATAL) << "--backend-ipv4 and --backend-ipv6 cannot be used at the "
-               << "same time.";
-    exit(EXIT_FAILURE);
-  }
-
-  if (get_config()->worker_frontend_connections == 0) {
-    mod_config()->worker_frontend_connections =
-        std::numeric_limits<size_t>::max();
-  }
-
-  if (get_config()->http2_proxy + get_config()->http2_bridge +
-          get_config()->client_proxy + get_config()->client >
-      1) {
-    LOG(FATAL) << "--http2-proxy, --http2-bridge, --client-proxy and --client "
-               << "cannot be used at the same time.";
+  if (process_options() != 0) {
     exit(EXIT_FAILURE);
   }
 
-  if (get_config()->client || get_config()->client_proxy) {
-    mod_config()->client_mode = true;
-  }
-
-  if (get_config()->client_mode || get_config()->http2_bridge) {
-    mod_config()->downstream_proto = PROTO_HTTP2;
-  } else {
-    mod_config()->downstream_proto = PROTO_HTTP;
-  }
-
   if (!get_config()->client_mode && !get_config()->upstream_no_tls) {
     if (!get_config()->private_key_file || !get_config()->cert_file) {
       print_usage(std::cerr);
@@ -1807,59 +2873,6 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (get_config()->downstream_addrs.empty()) {
-    DownstreamAddr addr;
-    addr.host = strcopy(DEFAULT_DOWNSTREAM_HOST);
-    addr.port = DEFAULT_DOWNSTREAM_PORT;
-
-    mod_config()->downstream_addrs.push_back(std::move(addr));
-  }
-
-  if (LOG_ENABLED(INFO)) {
-    LOG(INFO) << "Resolving backend address";
-  }
-
-  for (auto &addr : mod_config()->downstream_addrs) {
-    auto ipv6 = util::ipv6_numeric_addr(addr.host.get());
-    std::string hostport;
-
-    if (ipv6) {
-      hostport += "[";
-    }
-
-    hostport += addr.host.get();
-
-    if (ipv6) {
-      hostport += "]";
-    }
-
-    hostport += ":";
-    hostport += util::utos(addr.port);
-
-    addr.hostport = strcopy(hostport);
-
-    if (resolve_hostname(
-            &addr.addr, &addr.addrlen, addr.host.get(), addr.port,
-            get_config()->backend_ipv4
-                ? AF_INET
-                : (get_config()->backend_ipv6 ? AF_INET6 : AF_UNSPEC)) == -1) {
-      exit(EXIT_FAILURE);
-    }
-  }
-
-  if (get_config()->downstream_http_proxy_host) {
-    if (LOG_ENABLED(INFO)) {
-      LOG(INFO) << "Resolving backend http proxy address";
-    }
-    if (resolve_hostname(&mod_config()->downstream_http_proxy_addr,
-                         &mod_config()->downstream_http_proxy_addrlen,
-                         get_config()->downstream_http_proxy_host.get(),
-                         get_config()->downstream_http_proxy_port,
-                         AF_UNSPEC) == -1) {
-      exit(EXIT_FAILURE);
-    }
-  }
-
   if (get_config()->rlimit_nofile) {
     struct rlimit lim = {get_config()->rlimit_nofile,
                          get_config()->rlimit_nofile};
@@ -32,10 +32,15 @@
 namespace shrpx {
 
 class ConnectionHandler;
+class Worker;
 
 class AcceptHandler {
 public:
   AcceptHandler(int fd, ConnectionHandler *h);
+  // Accepts connections on |worker|'s event loop and hands them to
+  // |worker| directly.  This is used when each worker has its own
+  // listening socket with SO_REUSEPORT.
+  AcceptHandler(int fd, Worker *worker, struct ev_loop *loop);
   ~AcceptHandler();
   void accept_connection();
   void enable();
@@ -44,7 +49,9 @@ public:
 
 private:
   ev_io wev_;
+  struct ev_loop *loop_;
   ConnectionHandler *conn_hnr_;
+  Worker *worker_;
   int fd_;
 };
 
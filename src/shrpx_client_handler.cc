@@ -33,11 +33,13 @@
 #include "shrpx_config.h"
 #include "shrpx_http_downstream_connection.h"
 #include "shrpx_http2_downstream_connection.h"
+#include "shrpx_http2_session_pool.h"
 #include "shrpx_ssl.h"
 #include "shrpx_worker.h"
 #include "shrpx_worker_config.h"
 #include "shrpx_downstream_connection_pool.h"
 #include "shrpx_downstream.h"
+#include "shrpx_error.h"
 #ifdef HAVE_SPDYLAY
 #include "shrpx_spdy_upstream.h"
 #endif // HAVE_SPDYLAY
@@ -82,6 +84,18 @@ void readcb(struct ev_loop *loop, ev_io *w, int revents) {
 }
 } // namespace
 
+namespace {
+void asynccb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto handler = static_cast<ClientHandler *>(w->data);
+
+  // Private key operation has completed.  Resume TLS handshake.
+  if (handler->do_read() != 0) {
+    delete handler;
+    return;
+  }
+}
+} // namespace
+
 namespace {
 void writecb(struct ev_loop *loop, ev_io *w, int revents) {
   auto handler = static_cast<ClientHandler *>(w->data);
@@ -128,6 +142,7 @@ int ClientHandler::read_clear() {
 
     rb_.write(nread);
     rlimit_.drain(nread);
+    worker_stat_->metrics.frontend_bytes_in.add(nread);
   }
 
   return 0;
@@ -158,6 +173,7 @@ int ClientHandler::write_clear() {
       }
       wb_.drain(nwrite);
       wlimit_.drain(nwrite);
+      worker_stat_->metrics.frontend_bytes_out.add(nwrite);
       continue;
     }
     wb_.reset();
@@ -175,8 +191,89 @@ int ClientHandler::write_clear() {
   return 0;
 }
 
+int ClientHandler::read_splice() {
+  ev_timer_again(loop_, &rt_);
+
+  for (;;) {
+    // Let backend consume buffered bytes first.  If it cannot, the
+    // upstream pauses reading until pipe is drained.
+    if (rpipe_->rleft() && on_read() != 0) {
+      return -1;
+    }
+    if (rpipe_->full()) {
+      return 0;
+    }
+    auto avail = rlimit_.avail();
+    if (avail == 0) {
+      break;
+    }
+
+    auto nread = rpipe_->read_from(fd_, avail);
+    if (nread == 0) {
+      if (rpipe_->rleft() && on_read() != 0) {
+        return -1;
+      }
+      break;
+    }
+    if (nread == SHRPX_ERR_EOF && rpipe_->rleft()) {
+      // Backend has not consumed all bytes yet, and upstream has
+      // paused reading.  Once pipe is drained, reading is resumed,
+      // and we see EOF again with empty pipe.
+      return 0;
+    }
+    if (nread < 0) {
+      return -1;
+    }
+
+    rlimit_.drain(nread);
+    worker_stat_->metrics.frontend_bytes_in.add(nread);
+    worker_stat_->metrics.spliced_bytes.add(nread);
+  }
+
+  return 0;
+}
+
+int ClientHandler::write_splice() {
+  ev_timer_again(loop_, &rt_);
+
+  for (;;) {
+    if (wpipe_->rleft() > 0) {
+      auto avail = wlimit_.avail();
+      if (avail == 0) {
+        return 0;
+      }
+
+      auto nwrite = wpipe_->write_to(fd_, avail);
+      if (nwrite < 0) {
+        return -1;
+      }
+      if (nwrite == 0) {
+        wlimit_.startw();
+        ev_timer_again(loop_, &wt_);
+        return 0;
+      }
+      wlimit_.drain(nwrite);
+      worker_stat_->metrics.frontend_bytes_out.add(nwrite);
+      worker_stat_->metrics.spliced_bytes.add(nwrite);
+      continue;
+    }
+    if (on_write() != 0) {
+      return -1;
+    }
+    if (wpipe_->rleft() == 0) {
+      break;
+    }
+  }
+
+  wlimit_.stopw();
+  ev_timer_stop(loop_, &wt_);
+
+  return 0;
+}
+
 int ClientHandler::tls_handshake() {
   ev_timer_again(loop_, &rt_);
+  ev_io_stop(loop_, &asyncev_);
 
   ERR_clear_error();
 
@@ -197,6 +294,19 @@ int ClientHandler::tls_handshake() {
       wlimit_.startw();
       ev_timer_again(loop_, &wt_);
       return 0;
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    case SSL_ERROR_WANT_ASYNC: {
+      // Private key operation is in progress in offload thread.
+      OSSL_ASYNC_FD fd;
+      size_t numfds = 1;
+      if (SSL_get_all_async_fds(ssl_, &fd, &numfds) != 1 || numfds != 1) {
+        return -1;
+      }
+      ev_io_set(&asyncev_, fd, EV_READ);
+      ev_io_start(loop_, &asyncev_);
+      return 0;
+    }
+#endif // OPENSSL_VERSION_NUMBER >= 0x10100000L
     default:
       return -1;
     }
@@ -212,8 +322,11 @@ int ClientHandler::tls_handshake() {
   if (validate_next_proto() != 0) {
     return -1;
   }
-  if (LOG_ENABLED(INFO)) {
-    if (SSL_session_reused(ssl_)) {
+  worker_stat_->metrics.tls_handshakes.add();
+  if (SSL_session_reused(ssl_)) {
+    worker_stat_->metrics.tls_resumptions.add();
+
+    if (LOG_ENABLED(INFO)) {
       CLOG(INFO, this) << "SSL/TLS session reused";
     }
   }
@@ -284,6 +397,7 @@ int ClientHandler::read_tls() {
 
     rb_.write(rv);
     rlimit_.drain(rv);
+    worker_stat_->metrics.frontend_bytes_in.add(rv);
   }
 }
 
@@ -327,8 +441,6 @@ int ClientHandler::write_tls() {
         return -1;
       }
 
-      update_last_write_time();
-
       if (rv < 0) {
         auto err = SSL_get_error(ssl_, rv);
         switch (err) {
@@ -352,7 +464,14 @@ int ClientHandler::write_tls() {
 
       wb_.drain(rv);
       wlimit_.drain(rv);
+      worker_stat_->metrics.frontend_bytes_out.add(rv);
 
+      // Each SSL_write() writes one record, since its length never
+      // exceeds maximum record size.
+      ++tls_records_;
+      worker_stat_->metrics.tls_records.add();
+
+      last_write_idle_ = -1.;
       update_warmup_writelen(rv);
 
       continue;
@@ -366,6 +485,8 @@ int ClientHandler::write_tls() {
     }
   }
 
+  start_write_idle();
+
   wlimit_.stopw();
   ev_timer_stop(loop_, &wt_);
 
@@ -388,7 +509,8 @@ int ClientHandler::upstream_write() {
     return -1;
   }
 
-  if (get_should_close_after_write() && wb_.rleft() == 0) {
+  if (get_should_close_after_write() && wb_.rleft() == 0 &&
+      (!wpipe_ || wpipe_->rleft() == 0)) {
     return -1;
   }
 
@@ -487,11 +609,12 @@ ClientHandler::ClientHandler(struct ev_loop *loop, int fd, SSL *ssl,
     : ipaddr_(ipaddr), port_(port),
       wlimit_(loop, &wev_, get_config()->write_rate, get_config()->write_burst),
       rlimit_(loop, &rev_, get_config()->read_rate, get_config()->read_burst),
-      loop_(loop), dconn_pool_(dconn_pool), http2session_(nullptr),
+      loop_(loop), dconn_pool_(dconn_pool), http2session_pool_(nullptr),
       http1_connect_blocker_(nullptr), ssl_(ssl), worker_stat_(worker_stat),
-      last_write_time_(0.), warmup_writelen_(0),
+      last_write_idle_(-1.), warmup_writelen_(0),
       left_connhd_len_(NGHTTP2_CLIENT_CONNECTION_PREFACE_LEN),
-      tls_last_writelen_(0), tls_last_readlen_(0), fd_(fd),
+      tls_last_writelen_(0), tls_last_readlen_(0), tls_records_(0),
+      tls_records_logged_(0), fd_(fd),
       should_close_after_write_(false), tls_handshake_(false),
       tls_renegotiation_(false) {
 
@@ -499,9 +622,11 @@ ClientHandler::ClientHandler(struct ev_loop *loop, int fd, SSL *ssl,
 
   ev_io_init(&wev_, writecb, fd_, EV_WRITE);
   ev_io_init(&rev_, readcb, fd_, EV_READ);
+  ev_io_init(&asyncev_, asynccb, -1, EV_READ);
 
   wev_.data = this;
   rev_.data = this;
+  asyncev_.data = this;
 
   ev_timer_init(&wt_, timeoutcb, 0., get_config()->upstream_write_timeout);
   ev_timer_init(&rt_, timeoutcb, 0., get_config()->upstream_read_timeout);
@@ -552,6 +677,7 @@ ClientHandler::~ClientHandler() {
 
   ev_io_stop(loop_, &rev_);
   ev_io_stop(loop_, &wev_);
+  ev_io_stop(loop_, &asyncev_);
 
   // TODO If backend is http/2, and it is in CONNECTED state, signal
   // it and make it loopbreak when output is zero.
@@ -735,6 +861,12 @@ void ClientHandler::set_should_close_after_write(bool f) {
 
 void ClientHandler::pool_downstream_connection(
     std::unique_ptr<DownstreamConnection> dconn) {
+  if (http2session_pool_) {
+    // Http2DownstreamConnection is cheap to create, and keeping it
+    // would bind the next request to the same HTTP/2 session.
+    return;
+  }
+
   if (LOG_ENABLED(INFO)) {
     CLOG(INFO, this) << "Pooling downstream connection DCONN:" << dconn.get();
   }
@@ -751,27 +883,45 @@ void ClientHandler::remove_downstream_connection(DownstreamConnection *dconn) {
 }
 
 std::unique_ptr<DownstreamConnection>
-ClientHandler::get_downstream_connection() {
-  auto dconn = dconn_pool_->pop_downstream_connection();
+ClientHandler::get_downstream_connection(const Downstream *downstream) {
+  if (http2session_pool_) {
+    // Http2DownstreamConnection is not pooled so that HTTP/2 session
+    // is chosen for each request.
+    size_t addr_idx;
+    Http2Session *http2session;
+    if (select_downstream_addr_by_hash(&addr_idx, worker_stat_, downstream) ==
+        0) {
+      http2session = http2session_pool_->select(addr_idx);
+    } else {
+      http2session = http2session_pool_->select();
+    }
+    auto dconn =
+        util::make_unique<Http2DownstreamConnection>(dconn_pool_, http2session);
+    dconn->set_client_handler(this);
+    return std::move(dconn);
+  }
+
+  auto addr_idx = select_downstream_addr(worker_stat_, downstream);
+  auto dconn = dconn_pool_->pop_downstream_connection(addr_idx);
 
   if (!dconn) {
     if (LOG_ENABLED(INFO)) {
-      CLOG(INFO, this) << "Downstream connection pool is empty."
-                       << " Create new one";
+      CLOG(INFO, this) << "Downstream connection pool for backend #"
+                       << addr_idx << " is empty. Create new one";
     }
 
-    if (http2session_) {
-      dconn = util::make_unique<Http2DownstreamConnection>(dconn_pool_,
-                                                           http2session_);
-    } else {
-      dconn = util::make_unique<HttpDownstreamConnection>(dconn_pool_, loop_);
-    }
+    worker_stat_->metrics.pool_misses.add();
+
+    dconn = util::make_unique<HttpDownstreamConnection>(dconn_pool_, loop_,
+                                                         addr_idx);
     dconn->set_client_handler(this);
     return dconn;
   }
 
   dconn->set_client_handler(this);
 
+  worker_stat_->metrics.pool_hits.add();
+
   if (LOG_ENABLED(INFO)) {
     CLOG(INFO, this) << "Reuse downstream connection DCONN:" << dconn.get()
                      << " from pool";
@@ -782,11 +932,14 @@ ClientHandler::get_downstream_connection() {
 
 SSL *ClientHandler::get_ssl() const { return ssl_; }
 
-void ClientHandler::set_http2_session(Http2Session *http2session) {
-  http2session_ = http2session;
+void ClientHandler::set_http2_session_pool(
+    Http2SessionPool *http2session_pool) {
+  http2session_pool_ = http2session_pool;
 }
 
-Http2Session *ClientHandler::get_http2_session() const { return http2session_; }
+Http2SessionPool *ClientHandler::get_http2_session_pool() const {
+  return http2session_pool_;
+}
 
 void ClientHandler::set_http1_connect_blocker(
     ConnectBlocker *http1_connect_blocker) {
@@ -828,6 +981,32 @@ int ClientHandler::perform_http2_upgrade(HttpsUpstream *http) {
 
 bool ClientHandler::get_http2_upgrade_allowed() const { return !ssl_; }
 
+bool ClientHandler::get_splice_allowed() const { return !ssl_; }
+
+int ClientHandler::start_splice() {
+  assert(rb_.rleft() == 0);
+  assert(wb_.rleft() == 0);
+
+  auto rpipe = util::make_unique<SplicePipe>();
+  auto wpipe = util::make_unique<SplicePipe>();
+
+  if (rpipe->init() != 0 || wpipe->init() != 0) {
+    return -1;
+  }
+
+  rpipe_ = std::move(rpipe);
+  wpipe_ = std::move(wpipe);
+
+  read_ = &ClientHandler::read_splice;
+  write_ = &ClientHandler::write_splice;
+
+  if (LOG_ENABLED(INFO)) {
+    CLOG(INFO, this) << "Relaying tunneled connection with splice";
+  }
+
+  return 0;
+}
+
 std::string ClientHandler::get_upstream_scheme() const {
   if (ssl_) {
     return "https";
@@ -855,8 +1034,11 @@ void ClientHandler::set_tls_renegotiation(bool f) {
 bool ClientHandler::get_tls_renegotiation() const { return tls_renegotiation_; }
 
 namespace {
+// Record payload size which fits in one TCP segment together with
+// TLS overhead.
 const size_t SHRPX_SMALL_WRITE_LIMIT = 1300;
-const size_t SHRPX_WARMUP_THRESHOLD = 1 << 20;
+// Maximum TLS record payload size
+const size_t SHRPX_MAX_WRITE_LIMIT = 16384;
 } // namespace
 
 ssize_t ClientHandler::get_write_limit() {
@@ -864,35 +1046,78 @@ ssize_t ClientHandler::get_write_limit() {
     return -1;
   }
 
-  auto t = ev_now(loop_);
+  auto threshold = get_config()->tls_dyn_rec_warmup_threshold;
 
-  if (t - last_write_time_ > 1.0) {
-    // Time out, use small record size
-    warmup_writelen_ = 0;
-    return SHRPX_SMALL_WRITE_LIMIT;
+  if (threshold == 0) {
+    return SHRPX_MAX_WRITE_LIMIT;
   }
 
-  // If event_base_gettimeofday_cached() failed, we just skip timer
-  // checking.  Don't know how to treat this.
+  if (last_write_idle_ >= 0. &&
+      ev_now(loop_) - last_write_idle_ >
+          get_config()->tls_dyn_rec_idle_timeout) {
+    // Congestion window may have shrunk while idle.  Start over with
+    // small records.
+    warmup_writelen_ = 0;
+  }
 
-  if (warmup_writelen_ >= SHRPX_WARMUP_THRESHOLD) {
-    return -1;
+  if (warmup_writelen_ >= threshold) {
+    return SHRPX_MAX_WRITE_LIMIT;
   }
 
   return SHRPX_SMALL_WRITE_LIMIT;
 }
 
 void ClientHandler::update_warmup_writelen(size_t n) {
-  if (warmup_writelen_ < SHRPX_WARMUP_THRESHOLD) {
+  if (warmup_writelen_ < get_config()->tls_dyn_rec_warmup_threshold) {
     warmup_writelen_ += n;
   }
 }
 
-void ClientHandler::update_last_write_time() {
-  last_write_time_ = ev_now(loop_);
+void ClientHandler::start_write_idle() {
+  if (last_write_idle_ < 0.) {
+    last_write_idle_ = ev_now(loop_);
+  }
+}
+
+namespace {
+uint64_t to_usec(const std::chrono::high_resolution_clock::duration &d) {
+  auto t = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  return std::max(t, static_cast<decltype(t)>(0));
+}
+} // namespace
+
+namespace {
+void record_request_metrics(
+    WorkerMetrics &metrics, Downstream *downstream,
+    const std::chrono::high_resolution_clock::time_point &request_end_time) {
+  auto start_time = downstream->get_request_start_time();
+
+  auto status = downstream->get_response_http_status();
+  metrics.requests[status < 600 ? status / 100 : 0].add();
+
+  metrics.request_time.record(to_usec(request_end_time - start_time));
+
+  auto header_time = downstream->get_response_header_time();
+  if (header_time != std::chrono::high_resolution_clock::time_point()) {
+    metrics.ttfb.record(to_usec(header_time - start_time));
+  }
 }
+} // namespace
 
 void ClientHandler::write_accesslog(Downstream *downstream) {
+  auto request_end_time = std::chrono::high_resolution_clock::now();
+
+  // This is called once for each finished request.
+  record_request_metrics(worker_stat_->metrics, downstream, request_end_time);
+
+  if (ssl_) {
+    // With multiplexed streams, records are attributed to the
+    // response which finished next.
+    worker_stat_->metrics.tls_records_per_response.record(
+        tls_records_ - tls_records_logged_);
+    tls_records_logged_ = tls_records_;
+  }
+
   LogSpec lgsp = {
       downstream, ipaddr_.c_str(), downstream->get_request_method().c_str(),
 
@@ -903,8 +1128,8 @@ void ClientHandler::write_accesslog(Downstream *downstream) {
       alpn_.c_str(),
 
       std::chrono::system_clock::now(),          // time_now
-      downstream->get_request_start_time(),      // request_start_time
-      std::chrono::high_resolution_clock::now(), // request_end_time
+      downstream->get_request_start_time(), // request_start_time
+      request_end_time,                     // request_end_time
 
       downstream->get_request_major(), downstream->get_request_minor(),
       downstream->get_response_http_status(),
@@ -944,6 +1169,10 @@ ClientHandler::ReadBuf *ClientHandler::get_rb() { return &rb_; }
 
 void ClientHandler::signal_write() { wlimit_.startw(); }
 
+SplicePipe *ClientHandler::get_rpipe() { return rpipe_.get(); }
+
+SplicePipe *ClientHandler::get_wpipe() { return wpipe_.get(); }
+
 RateLimit *ClientHandler::get_rlimit() { return &rlimit_; }
 RateLimit *ClientHandler::get_wlimit() { return &wlimit_; }
 
@@ -34,6 +34,7 @@
 #include <openssl/ssl.h>
 
 #include "shrpx_rate_limit.h"
+#include "shrpx_splice.h"
 #include "ringbuf.h"
 
 using namespace nghttp2;
@@ -42,7 +43,7 @@ namespace shrpx {
 
 class Upstream;
 class DownstreamConnection;
-class Http2Session;
+class Http2SessionPool;
 class HttpsUpstream;
 class ConnectBlocker;
 class DownstreamConnectionPool;
@@ -63,6 +64,9 @@ public:
   // Performs TLS I/O
   int read_tls();
   int write_tls();
+  // Relays tunneled bytes through pipes using splice(2)
+  int read_splice();
+  int write_splice();
 
   int upstream_noop();
   int upstream_read();
@@ -90,10 +94,13 @@ public:
 
   void pool_downstream_connection(std::unique_ptr<DownstreamConnection> dconn);
   void remove_downstream_connection(DownstreamConnection *dconn);
-  std::unique_ptr<DownstreamConnection> get_downstream_connection();
+  // Returns DownstreamConnection for |downstream|.  |downstream| is
+  // used to choose backend by consistent hashing.
+  std::unique_ptr<DownstreamConnection>
+  get_downstream_connection(const Downstream *downstream);
   SSL *get_ssl() const;
-  void set_http2_session(Http2Session *http2session);
-  Http2Session *get_http2_session() const;
+  void set_http2_session_pool(Http2SessionPool *http2session_pool);
+  Http2SessionPool *get_http2_session_pool() const;
   void set_http1_connect_blocker(ConnectBlocker *http1_connect_blocker);
   ConnectBlocker *get_http1_connect_blocker() const;
   // Call this function when HTTP/2 connection header is received at
@@ -104,26 +111,33 @@ public:
   // terminated. This function returns 0 if it succeeds, or -1.
   int perform_http2_upgrade(HttpsUpstream *http);
   bool get_http2_upgrade_allowed() const;
+  // Returns true if the bytes of this connection can be relayed by
+  // splice(2), that is, TLS is not used.
+  bool get_splice_allowed() const;
+  // Switches I/O to splice(2) based relay for tunneled connection.
+  // The caller must ensure that rb_ and wb_ are empty.  This function
+  // returns 0 if it succeeds, or -1.
+  int start_splice();
   // Returns upstream scheme, either "http" or "https"
   std::string get_upstream_scheme() const;
   void set_tls_handshake(bool f);
   bool get_tls_handshake() const;
   void set_tls_renegotiation(bool f);
   bool get_tls_renegotiation() const;
-  // Returns maximum chunk size for one evbuffer_add().  The intention
-  // of this chunk size is control the TLS record size.  The actual
-  // SSL_write() call is done under libevent control.  In
-  // libevent-2.0.21, libevent calls SSL_write() for each chunk inside
-  // evbuffer.  This means that we can control TLS record size by
-  // adjusting the chunk size to evbuffer_add().
+  // Returns maximum length of one SSL_write(), which is the size of
+  // TLS record.  Small records are used at the start of connection
+  // and after idle period, so that client can process the first
+  // bytes without waiting for the whole record.  Once
+  // Config::tls_dyn_rec_warmup_threshold bytes are written, the
+  // maximum record size is used.
   //
-  // This function returns -1, if TLS is not enabled or no limitation
-  // is required.
+  // This function returns -1, if TLS is not enabled.
   ssize_t get_write_limit();
   // Updates the number of bytes written in warm up period.
   void update_warmup_writelen(size_t n);
-  // Updates the time when last write was done.
-  void update_last_write_time();
+  // Records the time when connection became idle, that is, all
+  // pending data are written.
+  void start_write_idle();
 
   // Writes upstream accesslog using |downstream|.  The |downstream|
   // must not be nullptr.
@@ -144,11 +158,20 @@ public:
   RateLimit *get_rlimit();
   RateLimit *get_wlimit();
 
+  // Returns the pipe which holds bytes read from client, or the pipe
+  // which holds bytes to be written to client.  They are nullptr
+  // unless start_splice() succeeded.
+  SplicePipe *get_rpipe();
+  SplicePipe *get_wpipe();
+
   void signal_write();
 
 private:
   ev_io wev_;
   ev_io rev_;
+  // Watches completion of private key operation offloaded to another
+  // thread during TLS handshake.
+  ev_io asyncev_;
   ev_timer wt_;
   ev_timer rt_;
   ev_timer reneg_shutdown_timer_;
@@ -163,24 +186,31 @@ private:
   RateLimit rlimit_;
   struct ev_loop *loop_;
   DownstreamConnectionPool *dconn_pool_;
-  // Shared HTTP2 session for each thread. NULL if backend is not
+  // Shared HTTP2 sessions for each thread. NULL if backend is not
   // HTTP2. Not deleted by this object.
-  Http2Session *http2session_;
+  Http2SessionPool *http2session_pool_;
   ConnectBlocker *http1_connect_blocker_;
   SSL *ssl_;
   WorkerStat *worker_stat_;
-  double last_write_time_;
+  // The time when connection became idle, or -1 if there is data to
+  // write.
+  ev_tstamp last_write_idle_;
   size_t warmup_writelen_;
   // The number of bytes of HTTP/2 client connection header to read
   size_t left_connhd_len_;
   size_t tls_last_writelen_;
   size_t tls_last_readlen_;
+  // The number of TLS records written, and the value of it when
+  // previous response finished.
+  size_t tls_records_;
+  size_t tls_records_logged_;
   int fd_;
   bool should_close_after_write_;
   bool tls_handshake_;
   bool tls_renegotiation_;
   WriteBuf wb_;
   ReadBuf rb_;
+  std::unique_ptr<SplicePipe> rpipe_, wpipe_;
 };
 
 } // namespace shrpx
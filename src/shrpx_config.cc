@@ -36,6 +36,7 @@
 #include <cerrno>
 #include <limits>
 #include <fstream>
+#include <algorithm>
 
 #include <nghttp2/nghttp2.h>
 
@@ -143,14 +144,51 @@ const char SHRPX_OPT_RLIMIT_NOFILE[] = "rlimit-nofile";
 const char SHRPX_OPT_TLS_CTX_PER_WORKER[] = "tls-ctx-per-worker";
 const char SHRPX_OPT_BACKEND_REQUEST_BUFFER[] = "backend-request-buffer";
 const char SHRPX_OPT_BACKEND_RESPONSE_BUFFER[] = "backend-response-buffer";
+const char SHRPX_OPT_FRONTEND_HTTP2_RECORD_DIR[] = "frontend-http2-record-dir";
+const char SHRPX_OPT_LISTENER_REUSEPORT[] = "listener-reuseport";
+const char SHRPX_OPT_BACKEND_HTTP2_CONNECTIONS_PER_WORKER[] =
+    "backend-http2-connections-per-worker";
+const char SHRPX_OPT_BACKEND_HTTP1_BALANCING[] = "backend-http1-balancing";
+const char SHRPX_OPT_BACKEND_HEALTH_CHECK_INTERVAL[] =
+    "backend-health-check-interval";
+const char SHRPX_OPT_BACKEND_HEALTH_CHECK_PATH[] = "backend-health-check-path";
+const char SHRPX_OPT_BACKEND_HEALTH_CHECK_FALL[] = "backend-health-check-fall";
+const char SHRPX_OPT_BACKEND_HEALTH_CHECK_RISE[] = "backend-health-check-rise";
+const char SHRPX_OPT_BACKEND_HASH_KEY[] = "backend-hash-key";
+const char SHRPX_OPT_ACCESSLOG_BUFFER_SIZE[] = "accesslog-buffer-size";
+const char SHRPX_OPT_ACCESSLOG_FLUSH_INTERVAL[] = "accesslog-flush-interval";
+const char SHRPX_OPT_ACCESSLOG_MODE[] = "accesslog-mode";
+const char SHRPX_OPT_STATS_FRONTEND[] = "stats-frontend";
+const char SHRPX_OPT_CACHE_SIZE[] = "cache-size";
+const char SHRPX_OPT_CACHE_MAX_OBJECT_SIZE[] = "cache-max-object-size";
+const char SHRPX_OPT_TLS_DYN_REC_WARMUP_THRESHOLD[] =
+    "tls-dyn-rec-warmup-threshold";
+const char SHRPX_OPT_TLS_DYN_REC_IDLE_TIMEOUT[] = "tls-dyn-rec-idle-timeout";
+const char SHRPX_OPT_TLS_SESSION_CACHE_SIZE[] = "tls-session-cache-size";
+const char SHRPX_OPT_TLS_KEY_OFFLOAD_THREADS[] = "tls-key-offload-threads";
+const char SHRPX_OPT_OCSP_STAPLING[] = "ocsp-stapling";
+const char SHRPX_OPT_OCSP_UPDATE_INTERVAL[] = "ocsp-update-interval";
+const char SHRPX_OPT_BACKEND_KEEP_ALIVE_MAX_IDLE[] =
+    "backend-keep-alive-max-idle";
+const char SHRPX_OPT_CACHE_COLLAPSE_TIMEOUT[] = "cache-collapse-timeout";
 
 namespace {
 Config *config = nullptr;
+
+// Configuration used by the current thread instead of config.  Each
+// worker thread keeps the snapshot it was given until the next
+// reload.
+#ifndef NOTHREADS
+thread_local
+#endif // NOTHREADS
+    Config *thread_config = nullptr;
 } // namespace
 
-const Config *get_config() { return config; }
+const Config *get_config() { return thread_config ? thread_config : config; }
+
+Config *mod_config() { return thread_config ? thread_config : config; }
 
-Config *mod_config() { return config; }
+void set_config(Config *conf) { thread_config = conf; }
 
 void create_config() { config = new Config(); }
 
@@ -403,7 +441,19 @@ int parse_int(T *dest, const char *opt, const char *optarg) {
 namespace {
 LogFragment make_log_fragment(LogFragmentType type,
                               std::unique_ptr<char[]> value = nullptr) {
-  return LogFragment{type, std::move(value)};
+  auto valuelen = value ? strlen(value.get()) : 0;
+  auto token = -1;
+
+  if (type == SHRPX_LOGF_HTTP) {
+    // Header field names are stored in lower case, so that they can
+    // be looked up by token.
+    std::transform(value.get(), value.get() + valuelen, value.get(),
+                   util::lowcase);
+    token = http2::lookup_token(reinterpret_cast<uint8_t *>(value.get()),
+                                valuelen);
+  }
+
+  return LogFragment{type, std::move(value), valuelen, token};
 }
 } // namespace
 
@@ -465,6 +515,14 @@ std::vector<LogFragment> parse_log_format(const char *optarg) {
       type = SHRPX_LOGF_PID;
     } else if (util::strieq("$alpn", var_start, varlen)) {
       type = SHRPX_LOGF_ALPN;
+    } else if (util::strieq("$request_body_bytes", var_start, varlen)) {
+      type = SHRPX_LOGF_REQUEST_BODY_BYTES;
+    } else if (util::strieq("$ttfb", var_start, varlen)) {
+      type = SHRPX_LOGF_TTFB;
+    } else if (util::strieq("$backend_addr", var_start, varlen)) {
+      type = SHRPX_LOGF_BACKEND_ADDR;
+    } else if (util::strieq("$backend_proto", var_start, varlen)) {
+      type = SHRPX_LOGF_BACKEND_PROTO;
     } else {
       LOG(WARN) << "Unrecognized log format variable: "
                 << std::string(var_start, varlen);
@@ -665,6 +723,11 @@ int parse_config(const char *opt, const char *optarg) {
                          optarg);
   }
 
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_KEEP_ALIVE_MAX_IDLE)) {
+    return parse_uint(&mod_config()->downstream_max_idle_connections, opt,
+                      optarg);
+  }
+
   if (util::strieq(opt, SHRPX_OPT_FRONTEND_HTTP2_WINDOW_BITS) ||
       util::strieq(opt, SHRPX_OPT_BACKEND_HTTP2_WINDOW_BITS)) {
 
@@ -1101,6 +1164,191 @@ int parse_config(const char *opt, const char *optarg) {
                       optarg);
   }
 
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HTTP2_CONNECTIONS_PER_WORKER)) {
+    size_t n;
+
+    if (parse_uint(&n, opt, optarg) != 0) {
+      return -1;
+    }
+
+    if (n == 0) {
+      LOG(ERROR) << opt << ": specify an integer strictly more than 0";
+
+      return -1;
+    }
+
+    mod_config()->downstream_http2_connections_per_worker = n;
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HTTP1_BALANCING)) {
+    if (util::strieq(optarg, "round-robin")) {
+      mod_config()->downstream_balancing = BALANCING_ROUND_ROBIN;
+    } else if (util::strieq(optarg, "least-inflight")) {
+      mod_config()->downstream_balancing = BALANCING_LEAST_INFLIGHT;
+    } else if (util::strieq(optarg, "peak-ewma")) {
+      mod_config()->downstream_balancing = BALANCING_PEAK_EWMA;
+    } else if (util::strieq(optarg, "p2c")) {
+      mod_config()->downstream_balancing = BALANCING_P2C;
+    } else {
+      LOG(ERROR) << opt << ": unknown policy: " << optarg;
+
+      return -1;
+    }
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HEALTH_CHECK_INTERVAL)) {
+    return parse_timeval(&mod_config()->downstream_health_check_interval, opt,
+                         optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HEALTH_CHECK_PATH)) {
+    if (optarg[0] != '/') {
+      LOG(ERROR) << opt << ": path must start with '/'";
+
+      return -1;
+    }
+
+    mod_config()->downstream_health_check_path = strcopy(optarg);
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HEALTH_CHECK_FALL) ||
+      util::strieq(opt, SHRPX_OPT_BACKEND_HEALTH_CHECK_RISE)) {
+    size_t n;
+
+    if (parse_uint(&n, opt, optarg) != 0) {
+      return -1;
+    }
+
+    if (n == 0) {
+      LOG(ERROR) << opt << ": specify an integer strictly more than 0";
+
+      return -1;
+    }
+
+    if (util::strieq(opt, SHRPX_OPT_BACKEND_HEALTH_CHECK_FALL)) {
+      mod_config()->downstream_health_check_fall = n;
+    } else {
+      mod_config()->downstream_health_check_rise = n;
+    }
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HASH_KEY)) {
+    if (util::strieq(optarg, "none")) {
+      mod_config()->downstream_hash_key = HASH_KEY_NONE;
+    } else if (util::strieq(optarg, "path")) {
+      mod_config()->downstream_hash_key = HASH_KEY_PATH;
+    } else if (util::strieq(optarg, "authority")) {
+      mod_config()->downstream_hash_key = HASH_KEY_AUTHORITY;
+    } else if (util::strieq(optarg, "client-ip")) {
+      mod_config()->downstream_hash_key = HASH_KEY_CLIENT_IP;
+    } else if (util::istartsWith(optarg, "cookie:") && optarg[7] != '\0') {
+      mod_config()->downstream_hash_key = HASH_KEY_COOKIE;
+      mod_config()->downstream_hash_cookie = strcopy(optarg + 7);
+    } else {
+      LOG(ERROR) << opt << ": unknown key: " << optarg;
+
+      return -1;
+    }
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_ACCESSLOG_BUFFER_SIZE)) {
+    return parse_uint_with_unit(&mod_config()->accesslog_buffer_size, opt,
+                                optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_ACCESSLOG_FLUSH_INTERVAL)) {
+    if (parse_timeval(&mod_config()->accesslog_flush_interval, opt, optarg) !=
+        0) {
+      return -1;
+    }
+
+    if (get_config()->accesslog_flush_interval == 0.) {
+      LOG(ERROR) << opt << ": specify an integer strictly more than 0";
+
+      return -1;
+    }
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_ACCESSLOG_MODE)) {
+    if (util::strieq(optarg, "text")) {
+      mod_config()->accesslog_mode = ACCESSLOG_MODE_TEXT;
+    } else if (util::strieq(optarg, "json")) {
+      mod_config()->accesslog_mode = ACCESSLOG_MODE_JSON;
+    } else if (util::strieq(optarg, "binary")) {
+      mod_config()->accesslog_mode = ACCESSLOG_MODE_BINARY;
+    } else {
+      LOG(ERROR) << opt << ": unknown mode: " << optarg;
+
+      return -1;
+    }
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_STATS_FRONTEND)) {
+    if (split_host_port(host, sizeof(host), &port, optarg) == -1) {
+      return -1;
+    }
+
+    mod_config()->stats_host = strcopy(host);
+    mod_config()->stats_port = port;
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_CACHE_SIZE)) {
+    return parse_uint_with_unit(&mod_config()->cache_size, opt, optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_CACHE_MAX_OBJECT_SIZE)) {
+    return parse_uint_with_unit(&mod_config()->cache_max_object_size, opt,
+                                optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_CACHE_COLLAPSE_TIMEOUT)) {
+    return parse_timeval(&mod_config()->cache_collapse_timeout, opt, optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_TLS_DYN_REC_WARMUP_THRESHOLD)) {
+    return parse_uint_with_unit(&mod_config()->tls_dyn_rec_warmup_threshold,
+                                opt, optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_TLS_DYN_REC_IDLE_TIMEOUT)) {
+    return parse_timeval(&mod_config()->tls_dyn_rec_idle_timeout, opt, optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_TLS_SESSION_CACHE_SIZE)) {
+    return parse_uint_with_unit(&mod_config()->tls_session_cache_size, opt,
+                                optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_TLS_KEY_OFFLOAD_THREADS)) {
+    return parse_uint(&mod_config()->tls_key_offload_threads, opt, optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_OCSP_STAPLING)) {
+    mod_config()->ocsp_stapling = util::strieq(optarg, "yes");
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_OCSP_UPDATE_INTERVAL)) {
+    return parse_timeval(&mod_config()->ocsp_update_interval, opt, optarg);
+  }
+
   if (util::strieq(opt, SHRPX_OPT_LISTENER_DISABLE_TIMEOUT)) {
     return parse_timeval(&mod_config()->listener_disable_timeout, opt, optarg);
   }
@@ -1156,6 +1404,24 @@ int parse_config(const char *opt, const char *optarg) {
     return 0;
   }
 
+  if (util::strieq(opt, SHRPX_OPT_FRONTEND_HTTP2_RECORD_DIR)) {
+    mod_config()->http2_upstream_record_dir = strcopy(optarg);
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_LISTENER_REUSEPORT)) {
+#ifdef SO_REUSEPORT
+    mod_config()->listener_reuseport = util::strieq(optarg, "yes");
+
+    return 0;
+#else  // !SO_REUSEPORT
+    LOG(ERROR) << opt << ": SO_REUSEPORT is not supported on this platform";
+
+    return -1;
+#endif // !SO_REUSEPORT
+  }
+
   if (util::strieq(opt, "conf")) {
     LOG(WARN) << "conf: ignored";
 
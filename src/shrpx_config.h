@@ -131,6 +131,29 @@ extern const char SHRPX_OPT_RLIMIT_NOFILE[];
 extern const char SHRPX_OPT_TLS_CTX_PER_WORKER[];
 extern const char SHRPX_OPT_BACKEND_REQUEST_BUFFER[];
 extern const char SHRPX_OPT_BACKEND_RESPONSE_BUFFER[];
+extern const char SHRPX_OPT_FRONTEND_HTTP2_RECORD_DIR[];
+extern const char SHRPX_OPT_LISTENER_REUSEPORT[];
+extern const char SHRPX_OPT_BACKEND_HTTP2_CONNECTIONS_PER_WORKER[];
+extern const char SHRPX_OPT_BACKEND_HTTP1_BALANCING[];
+extern const char SHRPX_OPT_BACKEND_HEALTH_CHECK_INTERVAL[];
+extern const char SHRPX_OPT_BACKEND_HEALTH_CHECK_PATH[];
+extern const char SHRPX_OPT_BACKEND_HEALTH_CHECK_FALL[];
+extern const char SHRPX_OPT_BACKEND_HEALTH_CHECK_RISE[];
+extern const char SHRPX_OPT_BACKEND_HASH_KEY[];
+extern const char SHRPX_OPT_ACCESSLOG_BUFFER_SIZE[];
+extern const char SHRPX_OPT_ACCESSLOG_FLUSH_INTERVAL[];
+extern const char SHRPX_OPT_ACCESSLOG_MODE[];
+extern const char SHRPX_OPT_STATS_FRONTEND[];
+extern const char SHRPX_OPT_CACHE_SIZE[];
+extern const char SHRPX_OPT_CACHE_MAX_OBJECT_SIZE[];
+extern const char SHRPX_OPT_TLS_DYN_REC_WARMUP_THRESHOLD[];
+extern const char SHRPX_OPT_TLS_DYN_REC_IDLE_TIMEOUT[];
+extern const char SHRPX_OPT_TLS_SESSION_CACHE_SIZE[];
+extern const char SHRPX_OPT_TLS_KEY_OFFLOAD_THREADS[];
+extern const char SHRPX_OPT_OCSP_STAPLING[];
+extern const char SHRPX_OPT_OCSP_UPDATE_INTERVAL[];
+extern const char SHRPX_OPT_BACKEND_KEEP_ALIVE_MAX_IDLE[];
+extern const char SHRPX_OPT_CACHE_COLLAPSE_TIMEOUT[];
 
 union sockaddr_union {
   sockaddr_storage storage;
@@ -141,6 +164,43 @@ union sockaddr_union {
 
 enum shrpx_proto { PROTO_HTTP2, PROTO_HTTP };
 
+// Load balancing policies for HTTP/1 backends
+enum shrpx_balancing {
+  // Round robin
+  BALANCING_ROUND_ROBIN,
+  // The least number of outstanding requests
+  BALANCING_LEAST_INFLIGHT,
+  // Peak EWMA of response latency weighted by outstanding requests
+  BALANCING_PEAK_EWMA,
+  // The less loaded of 2 randomly chosen backends
+  BALANCING_P2C,
+};
+
+// Request field used as the key of consistent hashing
+enum shrpx_hash_key {
+  HASH_KEY_NONE,
+  HASH_KEY_PATH,
+  HASH_KEY_AUTHORITY,
+  HASH_KEY_CLIENT_IP,
+  HASH_KEY_COOKIE,
+};
+
+// Output format of access log
+enum shrpx_accesslog_mode {
+  // Text line formatted by accesslog_format
+  ACCESSLOG_MODE_TEXT,
+  // JSON object per line.  Variables in accesslog_format become keys,
+  // and literals are ignored.
+  ACCESSLOG_MODE_JSON,
+  // Length prefixed binary record.  It begins with 4 bytes length of
+  // the rest of record in network byte order.  Then variables in
+  // accesslog_format follow in order; integers and times (in
+  // milliseconds) are 8 bytes unsigned integer in network byte
+  // order, and strings are 2 bytes length in network byte order
+  // followed by the string.
+  ACCESSLOG_MODE_BINARY,
+};
+
 struct AltSvc {
   AltSvc()
       : protocol_id(nullptr), host(nullptr), origin(nullptr),
@@ -158,12 +218,16 @@ struct AltSvc {
 };
 
 struct DownstreamAddr {
-  DownstreamAddr() : addr{{0}}, addrlen(0), port(0) {}
+  DownstreamAddr() : addr{{0}}, addrlen(0), port(0), removed(false) {}
   sockaddr_union addr;
   std::unique_ptr<char[]> host;
   std::unique_ptr<char[]> hostport;
   size_t addrlen;
   uint16_t port;
+  // true if this address was removed from configuration by reload.
+  // It is kept so that the other addresses retain their indices, and
+  // is never chosen.
+  bool removed;
 };
 
 struct TicketKey {
@@ -197,6 +261,17 @@ struct Config {
   ev_tstamp stream_write_timeout;
   ev_tstamp downstream_idle_read_timeout;
   ev_tstamp listener_disable_timeout;
+  // Interval of backend health check.  0 disables health check.
+  ev_tstamp downstream_health_check_interval;
+  // Interval to flush buffered access log
+  ev_tstamp accesslog_flush_interval;
+  // Idle time after which frontend TLS record size is reset to small
+  ev_tstamp tls_dyn_rec_idle_timeout;
+  // Interval to reload OCSP response files
+  ev_tstamp ocsp_update_interval;
+  // Maximum time a request waits for the same request in flight.  0
+  // means no limit.
+  ev_tstamp cache_collapse_timeout;
   std::unique_ptr<char[]> host;
   std::unique_ptr<char[]> private_key_file;
   std::unique_ptr<char[]> private_key_passwd;
@@ -214,6 +289,17 @@ struct Config {
   std::unique_ptr<char[]> downstream_http_proxy_host;
   std::unique_ptr<char[]> http2_upstream_dump_request_header_file;
   std::unique_ptr<char[]> http2_upstream_dump_response_header_file;
+  // Directory where raw bytes received by HTTP/2 frontend are
+  // recorded, one file per connection.
+  std::unique_ptr<char[]> http2_upstream_record_dir;
+  // Request path of HTTP/1 health check.  If nullptr, health check
+  // only makes TCP connection.
+  std::unique_ptr<char[]> downstream_health_check_path;
+  // Cookie name used as consistent hashing key if
+  // downstream_hash_key is HASH_KEY_COOKIE.
+  std::unique_ptr<char[]> downstream_hash_cookie;
+  // Host of stats endpoint.  If nullptr, stats endpoint is disabled.
+  std::unique_ptr<char[]> stats_host;
   // // Rate limit configuration per connection
   // ev_token_bucket_cfg *rate_limit_cfg;
   // // Rate limit configuration per worker (thread)
@@ -245,6 +331,13 @@ struct Config {
   size_t http2_downstream_connection_window_bits;
   size_t downstream_connections_per_host;
   size_t downstream_connections_per_frontend;
+  // The maximum number of HTTP/2 backend connections per worker
+  size_t downstream_http2_connections_per_worker;
+  // The number of consecutive health check failures to eject backend
+  size_t downstream_health_check_fall;
+  // The number of consecutive health check successes to readmit
+  // ejected backend
+  size_t downstream_health_check_rise;
   // actual size of downstream_http_proxy_addr
   size_t downstream_http_proxy_addrlen;
   size_t read_rate;
@@ -260,11 +353,32 @@ struct Config {
   size_t rlimit_nofile;
   size_t downstream_request_buffer_size;
   size_t downstream_response_buffer_size;
+  // Size of per thread access log buffer.  0 disables buffering.
+  size_t accesslog_buffer_size;
+  // Byte budget of per worker response cache.  0 disables caching.
+  size_t cache_size;
+  // Maximum size of response body which is stored in cache.
+  size_t cache_max_object_size;
+  // The number of bytes written in small TLS records before record
+  // size is increased to maximum.  0 disables dynamic record sizing.
+  size_t tls_dyn_rec_warmup_threshold;
+  // Size of shared memory TLS session cache.  0 disables it, and
+  // OpenSSL's internal session cache is used instead.
+  size_t tls_session_cache_size;
+  // The number of threads which perform RSA private key operations.
+  // 0 performs them in worker threads.
+  size_t tls_key_offload_threads;
+  // The maximum number of idle HTTP/1 backend connections kept for
+  // each backend address in each worker.
+  size_t downstream_max_idle_connections;
   // Bit mask to disable SSL/TLS protocol versions.  This will be
   // passed to SSL_CTX_set_options().
   long int tls_proto_mask;
   // downstream protocol; this will be determined by given options.
   shrpx_proto downstream_proto;
+  shrpx_balancing downstream_balancing;
+  shrpx_hash_key downstream_hash_key;
+  shrpx_accesslog_mode accesslog_mode;
   int syslog_facility;
   int backlog;
   int argc;
@@ -274,6 +388,8 @@ struct Config {
   uint16_t port;
   // port in http proxy URI
   uint16_t downstream_http_proxy_port;
+  // port of stats endpoint
+  uint16_t stats_port;
   bool verbose;
   bool daemon;
   bool verify_client;
@@ -300,12 +416,22 @@ struct Config {
   bool no_location_rewrite;
   bool auto_tls_ticket_key;
   bool tls_ctx_per_worker;
+  bool ocsp_stapling;
+  // true if each worker has its own listening socket with
+  // SO_REUSEPORT.
+  bool listener_reuseport;
 };
 
 const Config *get_config();
 Config *mod_config();
 void create_config();
 
+// Makes get_config() and mod_config() return |conf| in the calling
+// thread.  If |conf| is nullptr, they return the Config object
+// created by create_config().  |conf| must outlive its users in the
+// thread.
+void set_config(Config *conf);
+
 // Parses option name |opt| and value |optarg|.  The results are
 // stored into statically allocated Config object. This function
 // returns 0 if it succeeds, or -1.
@@ -27,10 +27,17 @@
 #include <unistd.h>
 
 #include <cstdlib>
+#ifndef NOTHREADS
+#include <future>
+#endif // !NOTHREADS
 
 #include <CUnit/CUnit.h>
 
 #include "shrpx_config.h"
+#include "shrpx_log.h"
+#include "http2.h"
+
+using namespace nghttp2;
 
 namespace shrpx {
 
@@ -131,9 +138,24 @@ void test_shrpx_config_parse_log_format(void) {
 
   CU_ASSERT(SHRPX_LOGF_HTTP == res[12].type);
   CU_ASSERT(0 == strcmp("user-agent", res[12].value.get()));
+  CU_ASSERT(10 == res[12].valuelen);
+  CU_ASSERT(-1 == res[12].token);
 
   CU_ASSERT(SHRPX_LOGF_LITERAL == res[13].type);
   CU_ASSERT(0 == strcmp("\"", res[13].value.get()));
+
+  res = parse_log_format("$request_body_bytes $ttfb $backend_addr "
+                         "$backend_proto $http_Host");
+  CU_ASSERT(9 == res.size());
+
+  CU_ASSERT(SHRPX_LOGF_REQUEST_BODY_BYTES == res[0].type);
+  CU_ASSERT(SHRPX_LOGF_TTFB == res[2].type);
+  CU_ASSERT(SHRPX_LOGF_BACKEND_ADDR == res[4].type);
+  CU_ASSERT(SHRPX_LOGF_BACKEND_PROTO == res[6].type);
+
+  CU_ASSERT(SHRPX_LOGF_HTTP == res[8].type);
+  CU_ASSERT(0 == strcmp("host", res[8].value.get()));
+  CU_ASSERT(http2::HD_HOST == res[8].token);
 }
 
 void test_shrpx_config_read_tls_ticket_key_file(void) {
@@ -170,4 +192,25 @@ void test_shrpx_config_read_tls_ticket_key_file(void) {
             memcmp("a..............b", key->hmac_key, sizeof(key->hmac_key)));
 }
 
+void test_shrpx_config_set_config(void) {
+  auto global = get_config();
+  Config config;
+
+  set_config(&config);
+
+  CU_ASSERT(&config == get_config());
+  CU_ASSERT(&config == mod_config());
+
+#ifndef NOTHREADS
+  // The other threads still use the process-wide configuration.
+  auto other = std::async(std::launch::async, [] { return get_config(); });
+
+  CU_ASSERT(global == other.get());
+#endif // !NOTHREADS
+
+  set_config(nullptr);
+
+  CU_ASSERT(global == get_config());
+}
+
 } // namespace shrpx
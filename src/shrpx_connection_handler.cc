@@ -34,10 +34,14 @@
 #include "shrpx_worker.h"
 #include "shrpx_worker_config.h"
 #include "shrpx_config.h"
-#include "shrpx_http2_session.h"
+#include "shrpx_http2_session_pool.h"
 #include "shrpx_connect_blocker.h"
 #include "shrpx_downstream_connection.h"
 #include "shrpx_accept_handler.h"
+#include "shrpx_health_monitor.h"
+#include "shrpx_session_cache.h"
+#include "shrpx_ocsp.h"
+#include "shrpx_stats_server.h"
 #include "util.h"
 
 using namespace nghttp2;
@@ -59,7 +63,7 @@ void acceptor_disable_cb(struct ev_loop *loop, ev_timer *w, int revent) {
 } // namespace
 
 ConnectionHandler::ConnectionHandler(struct ev_loop *loop)
-    : loop_(loop), sv_ssl_ctx_(nullptr), cl_ssl_ctx_(nullptr),
+    : loop_(loop), cl_ssl_ctx_(nullptr),
       // rate_limit_group_(bufferevent_rate_limit_group_new(
       //     evbase, get_config()->worker_rate_limit_cfg)),
       worker_stat_(util::make_unique<WorkerStat>()),
@@ -75,13 +79,99 @@ ConnectionHandler::~ConnectionHandler() {
 
 void ConnectionHandler::create_ssl_context() {
   sv_ssl_ctx_ = ssl::setup_server_ssl_context();
+  if (!get_config()->upstream_no_tls && !sv_ssl_ctx_) {
+    LOG(FATAL) << "Could not create server SSL/TLS context";
+    DIE();
+  }
   cl_ssl_ctx_ = ssl::setup_client_ssl_context();
+  worker_config->cert_tree = sv_ssl_ctx_ ? sv_ssl_ctx_->cert_tree : nullptr;
+}
+
+int ConnectionHandler::reload_config(Config *config) {
+  auto old_config = mod_config();
+  auto old_ocsp_store = worker_config->ocsp_store;
+
+  set_config(config);
+
+  // SSL_CTX refers to OCSP responses of its certificates.
+  std::unique_ptr<OCSPStore> ocsp_store;
+  if (ocsp_store_) {
+    ocsp_store = create_ocsp_store();
+    worker_config->ocsp_store = ocsp_store.get();
+  }
+
+  std::shared_ptr<ssl::ServerSSLContext> sv_ssl_ctx;
+
+  if (!get_config()->client_mode && !get_config()->upstream_no_tls) {
+    // Do not replace working SSL_CTX with the one which cannot be
+    // created.  If workers create their own, just check that they
+    // can.
+    int rv;
+    if (workers_.empty() || !get_config()->tls_ctx_per_worker) {
+      sv_ssl_ctx = ssl::setup_server_ssl_context();
+      rv = sv_ssl_ctx ? 0 : -1;
+    } else {
+      rv = ssl::check_server_certificates();
+    }
+
+    if (rv != 0) {
+      LOG(ERROR) << "Could not create server SSL/TLS context";
+
+      set_config(old_config);
+      worker_config->ocsp_store = old_ocsp_store;
+
+      return -1;
+    }
+
+    sv_ssl_ctx_ = sv_ssl_ctx;
+    worker_config->cert_tree = sv_ssl_ctx_ ? sv_ssl_ctx_->cert_tree : nullptr;
+  }
+
+  if (ocsp_store) {
+    old_ocsp_stores_.push_back(std::move(ocsp_store_));
+    ocsp_store_ = std::move(ocsp_store);
+  }
+
+  std::unique_ptr<HealthMonitor> health_monitor;
+  if (get_config()->downstream_health_check_interval > 0.) {
+    health_monitor =
+        util::make_unique<HealthMonitor>(loop_, health_monitor_.get());
+  }
+
+  if (health_monitor_) {
+    health_monitor_->stop();
+    old_health_monitors_.push_back(std::move(health_monitor_));
+  }
+
+  health_monitor_ = std::move(health_monitor);
+  worker_config->health_monitor = health_monitor_.get();
+
+  if (health_monitor_) {
+    health_monitor_->start();
+  }
+
+  reload_worker_stat(worker_stat_.get());
+
+  (void)reopen_log_files();
+
+  WorkerEvent wev{};
+
+  wev.type = RELOAD_CONFIG;
+  wev.config = config;
+  wev.sv_ssl_ctx = sv_ssl_ctx;
+  wev.health_monitor = health_monitor_.get();
+  wev.ocsp_store = ocsp_store_.get();
+
+  for (auto &worker : workers_) {
+    worker->send(wev);
+  }
+
+  return 0;
 }
 
 void ConnectionHandler::worker_reopen_log_files() {
-  WorkerEvent wev;
+  WorkerEvent wev{};
 
-  memset(&wev, 0, sizeof(wev));
   wev.type = REOPEN_LOG;
 
   for (auto &worker : workers_) {
@@ -91,9 +181,8 @@ void ConnectionHandler::worker_reopen_log_files() {
 
 void ConnectionHandler::worker_renew_ticket_keys(
     const std::shared_ptr<TicketKeys> &ticket_keys) {
-  WorkerEvent wev;
+  WorkerEvent wev{};
 
-  memset(&wev, 0, sizeof(wev));
   wev.type = RENEW_TICKET_KEYS;
   wev.ticket_keys = ticket_keys;
 
@@ -102,14 +191,20 @@ void ConnectionHandler::worker_renew_ticket_keys(
   }
 }
 
-void ConnectionHandler::create_worker_thread(size_t num) {
+void ConnectionHandler::create_worker_thread(
+    size_t num, const std::vector<WorkerListener> &listeners) {
 #ifndef NOTHREADS
   assert(workers_.size() == 0);
+  assert(listeners.empty() || listeners.size() == num);
+
+  worker_listeners_ = listeners;
 
   for (size_t i = 0; i < num; ++i) {
-    workers_.push_back(util::make_unique<Worker>(sv_ssl_ctx_, cl_ssl_ctx_,
-                                                 worker_config->cert_tree,
-                                                 worker_config->ticket_keys));
+    auto listener = listeners.empty() ? WorkerListener{-1, -1} : listeners[i];
+    workers_.push_back(util::make_unique<Worker>(
+        sv_ssl_ctx_, cl_ssl_ctx_, worker_config->ticket_keys,
+        worker_config->health_monitor, worker_config->session_cache,
+        worker_config->ocsp_store, listener));
 
     if (LOG_ENABLED(INFO)) {
       LLOG(INFO, this) << "Created thread #" << workers_.size() - 1;
@@ -118,6 +213,11 @@ void ConnectionHandler::create_worker_thread(size_t num) {
 #endif // NOTHREADS
 }
 
+const std::vector<WorkerListener> &
+ConnectionHandler::get_worker_listeners() const {
+  return worker_listeners_;
+}
+
 void ConnectionHandler::join_worker() {
 #ifndef NOTHREADS
   int n = 0;
@@ -142,8 +242,7 @@ void ConnectionHandler::graceful_shutdown_worker() {
     return;
   }
 
-  WorkerEvent wev;
-  memset(&wev, 0, sizeof(wev));
+  WorkerEvent wev{};
   wev.type = GRACEFUL_SHUTDOWN;
 
   if (LOG_ENABLED(INFO)) {
@@ -175,8 +274,9 @@ int ConnectionHandler::handle_connection(int fd, sockaddr *addr, int addrlen) {
       return -1;
     }
 
-    auto client = ssl::accept_connection(loop_, sv_ssl_ctx_, fd, addr, addrlen,
-                                         worker_stat_.get(), &dconn_pool_);
+    auto client = ssl::accept_connection(
+        loop_, sv_ssl_ctx_ ? sv_ssl_ctx_->ssl_ctx : nullptr, fd, addr, addrlen,
+        worker_stat_.get(), &dconn_pool_);
     if (!client) {
       LLOG(ERROR, this) << "ClientHandler creation failed";
 
@@ -184,7 +284,7 @@ int ConnectionHandler::handle_connection(int fd, sockaddr *addr, int addrlen) {
       return -1;
     }
 
-    client->set_http2_session(http2session_.get());
+    client->set_http2_session_pool(http2session_pool_.get());
     client->set_http1_connect_blocker(http1_connect_blocker_.get());
 
     return 0;
@@ -192,8 +292,7 @@ int ConnectionHandler::handle_connection(int fd, sockaddr *addr, int addrlen) {
 
   size_t idx = worker_round_robin_cnt_ % workers_.size();
   ++worker_round_robin_cnt_;
-  WorkerEvent wev;
-  memset(&wev, 0, sizeof(wev));
+  WorkerEvent wev{};
   wev.type = NEW_CONNECTION;
   wev.client_fd = fd;
   memcpy(&wev.client_addr, addr, addrlen);
@@ -209,17 +308,64 @@ struct ev_loop *ConnectionHandler::get_loop() const {
 }
 
 void ConnectionHandler::create_http2_session() {
-  http2session_ = util::make_unique<Http2Session>(loop_, cl_ssl_ctx_);
+  http2session_pool_ = util::make_unique<Http2SessionPool>(loop_, cl_ssl_ctx_,
+                                                          worker_stat_.get());
 }
 
 void ConnectionHandler::create_http1_connect_blocker() {
   http1_connect_blocker_ = util::make_unique<ConnectBlocker>(loop_);
 }
 
+void ConnectionHandler::create_health_monitor() {
+  health_monitor_ = util::make_unique<HealthMonitor>(loop_, nullptr);
+  worker_config->health_monitor = health_monitor_.get();
+
+  health_monitor_->start();
+}
+
+void ConnectionHandler::set_session_cache(
+    std::unique_ptr<SessionCache> session_cache) {
+  session_cache_ = std::move(session_cache);
+  worker_config->session_cache = session_cache_.get();
+}
+
+SessionCache *ConnectionHandler::get_session_cache() const {
+  return session_cache_.get();
+}
+
+void ConnectionHandler::set_stats_server(
+    std::unique_ptr<StatsServer> stats_server) {
+  stats_server_ = std::move(stats_server);
+}
+
+StatsServer *ConnectionHandler::get_stats_server() const {
+  return stats_server_.get();
+}
+
+void ConnectionHandler::set_ocsp_store(std::unique_ptr<OCSPStore> ocsp_store) {
+  ocsp_store_ = std::move(ocsp_store);
+  worker_config->ocsp_store = ocsp_store_.get();
+}
+
+OCSPStore *ConnectionHandler::get_ocsp_store() const {
+  return ocsp_store_.get();
+}
+
 const WorkerStat *ConnectionHandler::get_worker_stat() const {
   return worker_stat_.get();
 }
 
+void ConnectionHandler::get_metrics(MetricsSnapshot *dest) const {
+  if (get_config()->num_worker == 1) {
+    merge_metrics(dest, worker_stat_->metrics);
+    return;
+  }
+
+  for (auto &worker : workers_) {
+    merge_metrics(dest, worker->get_worker_stat()->metrics);
+  }
+}
+
 void ConnectionHandler::set_acceptor4(std::unique_ptr<AcceptHandler> h) {
   acceptor4_ = std::move(h);
 }
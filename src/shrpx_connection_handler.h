@@ -41,13 +41,24 @@
 
 namespace shrpx {
 
-class Http2Session;
+class Http2SessionPool;
+class HealthMonitor;
+class SessionCache;
+class OCSPStore;
+class StatsServer;
 class ConnectBlocker;
 class AcceptHandler;
 class Worker;
+struct Config;
 struct WorkerStat;
+struct MetricsSnapshot;
+struct WorkerListener;
 struct TicketKeys;
 
+namespace ssl {
+struct ServerSSLContext;
+} // namespace ssl
+
 // TODO should be renamed as ConnectionHandler
 class ConnectionHandler {
 public:
@@ -55,13 +66,44 @@ public:
   ~ConnectionHandler();
   int handle_connection(int fd, sockaddr *addr, int addrlen);
   void create_ssl_context();
-  void create_worker_thread(size_t num);
+  // Creates |num| worker threads.  If |listeners| is not empty, it
+  // must have |num| elements, and i-th worker accepts connections on
+  // its own listening sockets listeners[i].
+  void create_worker_thread(size_t num,
+                            const std::vector<WorkerListener> &listeners);
+  // Returns listening sockets given to workers in
+  // create_worker_thread().
+  const std::vector<WorkerListener> &get_worker_listeners() const;
   void worker_reopen_log_files();
   void worker_renew_ticket_keys(const std::shared_ptr<TicketKeys> &ticket_keys);
+  // Makes |config| the configuration of the main thread and all
+  // workers.  Server SSL_CTX, OCSP responses and backend health check
+  // are created again for |config|.  This function returns 0 if it
+  // succeeds, or -1, and then the current configuration is kept.  If
+  // it succeeds, |config| must not be freed, since workers use it.
+  int reload_config(Config *config);
   struct ev_loop *get_loop() const;
   void create_http2_session();
   void create_http1_connect_blocker();
+  // Creates HealthMonitor and starts backend health check.  This
+  // must be called before create_worker_thread().
+  void create_health_monitor();
+  // Sets TLS session cache shared by all workers.  This must be
+  // called before create_worker_thread().
+  void set_session_cache(std::unique_ptr<SessionCache> session_cache);
+  SessionCache *get_session_cache() const;
+  // Sets OCSP responses shared by all workers.  This must be called
+  // before create_ssl_context() and create_worker_thread().
+  void set_ocsp_store(std::unique_ptr<OCSPStore> ocsp_store);
+  OCSPStore *get_ocsp_store() const;
+  // Sets the server for --stats-frontend.  It runs in the main
+  // thread.
+  void set_stats_server(std::unique_ptr<StatsServer> stats_server);
+  StatsServer *get_stats_server() const;
   const WorkerStat *get_worker_stat() const;
+  // Adds metrics of all workers to |dest|.  This must be called in
+  // the main thread.
+  void get_metrics(MetricsSnapshot *dest) const;
   void set_acceptor4(std::unique_ptr<AcceptHandler> h);
   AcceptHandler *get_acceptor4() const;
   void set_acceptor6(std::unique_ptr<AcceptHandler> h);
@@ -76,15 +118,26 @@ public:
 private:
   DownstreamConnectionPool dconn_pool_;
   std::vector<std::unique_ptr<Worker>> workers_;
+  // Per-worker listening sockets if --listener-reuseport is used.
+  // They are owned by workers.
+  std::vector<WorkerListener> worker_listeners_;
   struct ev_loop *loop_;
   // The frontend server SSL_CTX
-  SSL_CTX *sv_ssl_ctx_;
+  std::shared_ptr<ssl::ServerSSLContext> sv_ssl_ctx_;
   // The backend server SSL_CTX
   SSL_CTX *cl_ssl_ctx_;
-  // Shared backend HTTP2 session. NULL if multi-threaded. In
+  // Shared backend HTTP2 sessions. NULL if multi-threaded. In
   // multi-threaded case, see shrpx_worker.cc.
-  std::unique_ptr<Http2Session> http2session_;
+  std::unique_ptr<Http2SessionPool> http2session_pool_;
   std::unique_ptr<ConnectBlocker> http1_connect_blocker_;
+  std::unique_ptr<HealthMonitor> health_monitor_;
+  std::unique_ptr<SessionCache> session_cache_;
+  std::unique_ptr<OCSPStore> ocsp_store_;
+  // HealthMonitor and OCSPStore replaced by reload.  Workers and
+  // SSL_CTX may still refer to them, so they are kept until exit.
+  std::vector<std::unique_ptr<HealthMonitor>> old_health_monitors_;
+  std::vector<std::unique_ptr<OCSPStore>> old_ocsp_stores_;
+  std::unique_ptr<StatsServer> stats_server_;
   // bufferevent_rate_limit_group *rate_limit_group_;
   std::unique_ptr<AcceptHandler> acceptor4_;
   std::unique_ptr<AcceptHandler> acceptor6_;
@@ -0,0 +1,208 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_consistent_hash.h"
+
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include "shrpx_config.h"
+#include "shrpx_downstream.h"
+#include "shrpx_upstream.h"
+#include "shrpx_client_handler.h"
+#include "http2.h"
+#include "util.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+namespace {
+// The size of lookup table.  This must be prime, and much larger
+// than the number of backends.
+constexpr uint32_t MAGLEV_TABLE_SIZE = 65537;
+} // namespace
+
+namespace {
+// A seed for the hash of backend name to compute skip, which must be
+// different from the default.
+constexpr uint64_t SKIP_SEED = 0x9e3779b97f4a7c15ULL;
+} // namespace
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+  auto p = static_cast<const uint8_t *>(data);
+  auto h = seed;
+
+  for (size_t i = 0; i < len; ++i) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+
+  return h;
+}
+
+void MaglevTable::build(const std::vector<std::string> &names,
+                        const std::vector<bool> &usable) {
+  constexpr uint32_t M = MAGLEV_TABLE_SIZE;
+  constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+
+  std::vector<uint32_t> offsets, skips, nexts;
+  std::vector<uint32_t> backends;
+
+  // If no backend is usable, distribute keys among all of them
+  // rather than leaving the table empty.
+  auto all = std::find(std::begin(usable), std::end(usable), true) ==
+             std::end(usable);
+
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (!all && !usable[i]) {
+      continue;
+    }
+
+    auto &name = names[i];
+
+    backends.push_back(i);
+    offsets.push_back(hash_bytes(name.c_str(), name.size()) % M);
+    skips.push_back(hash_bytes(name.c_str(), name.size(), SKIP_SEED) %
+                        (M - 1) +
+                    1);
+    nexts.push_back(0);
+  }
+
+  table_.assign(M, EMPTY);
+
+  if (backends.empty()) {
+    return;
+  }
+
+  // Each backend takes turns to fill the next empty entry in its own
+  // permutation of table entries.
+  for (uint32_t n = 0;;) {
+    for (size_t i = 0; i < backends.size(); ++i) {
+      uint32_t c;
+      do {
+        c = (offsets[i] + static_cast<uint64_t>(skips[i]) * nexts[i]) % M;
+        ++nexts[i];
+      } while (table_[c] != EMPTY);
+
+      table_[c] = backends[i];
+
+      if (++n == M) {
+        return;
+      }
+    }
+  }
+}
+
+bool MaglevTable::empty() const { return table_.empty(); }
+
+size_t MaglevTable::lookup(uint64_t hash) const {
+  if (table_.empty()) {
+    return NO_BACKEND;
+  }
+
+  auto idx = table_[hash % table_.size()];
+  if (idx == std::numeric_limits<uint32_t>::max()) {
+    return NO_BACKEND;
+  }
+
+  return idx;
+}
+
+namespace {
+// Finds the value of cookie |name| in Cookie header fields in
+// |headers|.  Returns 0 if it is found, and assigns the range of the
+// value to |*first| and |*last|.  Otherwise returns -1.
+int find_cookie(const char **first, const char **last,
+                const HeaderRefs &headers, const char *name) {
+  auto namelen = strlen(name);
+
+  for (auto &kv : headers) {
+    if (kv.name != "cookie") {
+      continue;
+    }
+
+    auto end = kv.value.c_str() + kv.value.size();
+    for (auto p = kv.value.c_str(); p != end;) {
+      for (; p != end && (*p == ' ' || *p == ';'); ++p)
+        ;
+      auto next = std::find(p, end, ';');
+      if (static_cast<size_t>(next - p) > namelen && p[namelen] == '=' &&
+          memcmp(p, name, namelen) == 0) {
+        *first = p + namelen + 1;
+        *last = next;
+        return 0;
+      }
+      p = next;
+    }
+  }
+
+  return -1;
+}
+} // namespace
+
+int hash_downstream(uint64_t *dest, const Downstream *downstream) {
+  switch (get_config()->downstream_hash_key) {
+  case HASH_KEY_NONE:
+    return -1;
+  case HASH_KEY_PATH: {
+    auto &path = downstream->get_request_path();
+    *dest = hash_bytes(path.c_str(), path.size());
+    return 0;
+  }
+  case HASH_KEY_AUTHORITY: {
+    auto &authority = downstream->get_request_http2_authority();
+    if (!authority.empty()) {
+      *dest = hash_bytes(authority.c_str(), authority.size());
+      return 0;
+    }
+    auto host = downstream->get_request_header(http2::HD_HOST);
+    if (!host) {
+      return -1;
+    }
+    *dest = hash_bytes(host->value.c_str(), host->value.size());
+    return 0;
+  }
+  case HASH_KEY_CLIENT_IP: {
+    auto &ipaddr =
+        downstream->get_upstream()->get_client_handler()->get_ipaddr();
+    *dest = hash_bytes(ipaddr.c_str(), ipaddr.size());
+    return 0;
+  }
+  case HASH_KEY_COOKIE: {
+    const char *first, *last;
+    if (find_cookie(&first, &last, downstream->get_request_headers(),
+                    get_config()->downstream_hash_cookie.get()) != 0) {
+      return -1;
+    }
+    *dest = hash_bytes(first, last - first);
+    return 0;
+  }
+  }
+
+  return -1;
+}
+
+} // namespace shrpx
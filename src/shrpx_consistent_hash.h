@@ -0,0 +1,75 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_CONSISTENT_HASH_H
+#define SHRPX_CONSISTENT_HASH_H
+
+#include "shrpx.h"
+
+#include <vector>
+#include <string>
+#include <limits>
+
+namespace shrpx {
+
+class Downstream;
+
+// Lookup table of Maglev consistent hashing (Eisenbud et al., "Maglev:
+// A Fast and Reliable Software Network Load Balancer", NSDI 2016).
+// Each backend gets almost equal share of table entries, and when a
+// backend is added or removed, most of the keys keep mapping to the
+// same backend.
+class MaglevTable {
+public:
+  // Returned by lookup() if no backend is found.
+  static constexpr size_t NO_BACKEND = std::numeric_limits<size_t>::max();
+
+  // Builds lookup table for backends whose names are |names|.  The
+  // backend i is excluded if |usable[i]| is false.  If no backend is
+  // usable, all backends are included.
+  void build(const std::vector<std::string> &names,
+             const std::vector<bool> &usable);
+  // Returns true if table has not been built yet.
+  bool empty() const;
+  // Returns the index of backend for |hash|, or NO_BACKEND if table
+  // has no backend.
+  size_t lookup(uint64_t hash) const;
+
+private:
+  std::vector<uint32_t> table_;
+};
+
+// Returns 64 bits FNV-1a hash of |len| bytes pointed by |data|,
+// starting with |seed| as offset basis.
+uint64_t hash_bytes(const void *data, size_t len,
+                    uint64_t seed = 14695981039346656037ULL);
+
+// Computes hash of request field of |downstream| configured by
+// Config::downstream_hash_key, and assigns it to |*dest|.  Returns 0
+// if it succeeds, or -1 if the field is not found in the request.
+int hash_downstream(uint64_t *dest, const Downstream *downstream);
+
+} // namespace shrpx
+
+#endif // SHRPX_CONSISTENT_HASH_H
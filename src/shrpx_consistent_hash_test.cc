@@ -0,0 +1,104 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_consistent_hash_test.h"
+
+#include <algorithm>
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_consistent_hash.h"
+
+namespace shrpx {
+
+void test_shrpx_consistent_hash_maglev_table(void) {
+  std::vector<std::string> names{"10.0.0.1:80", "10.0.0.2:80", "10.0.0.3:80",
+                                 "10.0.0.4:80"};
+  std::vector<bool> usable(names.size(), true);
+  MaglevTable table;
+
+  CU_ASSERT(table.empty());
+
+  table.build(names, usable);
+
+  CU_ASSERT(!table.empty());
+
+  constexpr size_t NKEYS = 10000;
+  std::vector<size_t> before, counts(names.size());
+
+  for (size_t i = 0; i < NKEYS; ++i) {
+    auto key = std::to_string(i);
+    auto idx = table.lookup(hash_bytes(key.c_str(), key.size()));
+    CU_ASSERT(idx < names.size());
+    before.push_back(idx);
+    ++counts[idx];
+  }
+
+  // Keys are spread almost evenly.
+  for (auto n : counts) {
+    CU_ASSERT(n > NKEYS / names.size() / 2);
+  }
+
+  // Removing a backend only remaps keys of that backend, apart from
+  // small disruption.
+  usable[1] = false;
+  table.build(names, usable);
+
+  size_t nmoved = 0;
+  for (size_t i = 0; i < NKEYS; ++i) {
+    auto key = std::to_string(i);
+    auto idx = table.lookup(hash_bytes(key.c_str(), key.size()));
+    CU_ASSERT(1 != idx);
+    if (before[i] != 1 && idx != before[i]) {
+      ++nmoved;
+    }
+  }
+
+  CU_ASSERT(nmoved < NKEYS / 20);
+
+  // Readmitted backend gets the same keys back.
+  usable[1] = true;
+  table.build(names, usable);
+
+  for (size_t i = 0; i < NKEYS; ++i) {
+    auto key = std::to_string(i);
+    CU_ASSERT(before[i] == table.lookup(hash_bytes(key.c_str(), key.size())));
+  }
+
+  // If no backend is usable, all of them are used.
+  std::fill(std::begin(usable), std::end(usable), false);
+  table.build(names, usable);
+
+  for (size_t i = 0; i < NKEYS; ++i) {
+    auto key = std::to_string(i);
+    CU_ASSERT(before[i] == table.lookup(hash_bytes(key.c_str(), key.size())));
+  }
+
+  // Table without backend finds nothing.
+  table.build({}, {});
+
+  CU_ASSERT(MaglevTable::NO_BACKEND == table.lookup(0));
+}
+
+} // namespace shrpx
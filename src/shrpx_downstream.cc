@@ -33,14 +33,88 @@
 #include "shrpx_config.h"
 #include "shrpx_error.h"
 #include "shrpx_downstream_connection.h"
+#include "shrpx_worker.h"
+#include "shrpx_worker_config.h"
+#include "shrpx_http_cache.h"
 #include "util.h"
 #include "http2.h"
 
 namespace shrpx {
 
+namespace {
+void init_timer(StreamTimer *t, Downstream *downstream,
+                void (*cb)(struct ev_loop *, ev_timer *, int),
+                ev_tstamp timeout) {
+  ev_timer_init(&t->w, cb, 0., timeout);
+  t->w.data = t;
+  t->downstream = downstream;
+  t->last_reset = 0.;
+  t->timeout = timeout;
+}
+} // namespace
+
+namespace {
+void reset_timer(struct ev_loop *loop, StreamTimer *t) {
+  t->last_reset = ev_now(loop);
+  if (!ev_is_active(&t->w)) {
+    ev_timer_again(loop, &t->w);
+  }
+}
+} // namespace
+
+namespace {
+void try_reset_timer(struct ev_loop *loop, StreamTimer *t) {
+  if (!ev_is_active(&t->w)) {
+    return;
+  }
+  t->last_reset = ev_now(loop);
+}
+} // namespace
+
+namespace {
+void ensure_timer(struct ev_loop *loop, StreamTimer *t) {
+  if (ev_is_active(&t->w)) {
+    return;
+  }
+  t->last_reset = ev_now(loop);
+  ev_timer_again(loop, &t->w);
+}
+} // namespace
+
+namespace {
+void disable_timer(struct ev_loop *loop, StreamTimer *t) {
+  ev_timer_stop(loop, &t->w);
+}
+} // namespace
+
+namespace {
+// Returns true if timeout of |t| has passed since it was reset last
+// time.  Otherwise re-arms |t| for the rest of timeout, and returns
+// false.
+bool timer_expired(struct ev_loop *loop, StreamTimer *t) {
+  auto rest = t->last_reset + t->timeout - ev_now(loop);
+  if (rest <= 0.) {
+    return true;
+  }
+
+  // ev_timer_again() uses repeat as the next timeout.
+  t->w.repeat = rest;
+  ev_timer_again(loop, &t->w);
+  t->w.repeat = t->timeout;
+
+  return false;
+}
+} // namespace
+
 namespace {
 void upstream_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
-  auto downstream = static_cast<Downstream *>(w->data);
+  auto t = static_cast<StreamTimer *>(w->data);
+
+  if (!timer_expired(loop, t)) {
+    return;
+  }
+
+  auto downstream = t->downstream;
   auto upstream = downstream->get_upstream();
 
   auto which = revents == EV_READ ? "read" : "write";
@@ -71,7 +145,13 @@ void upstream_wtimeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
 
 namespace {
 void downstream_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
-  auto downstream = static_cast<Downstream *>(w->data);
+  auto t = static_cast<StreamTimer *>(w->data);
+
+  if (!timer_expired(loop, t)) {
+    return;
+  }
+
+  auto downstream = t->downstream;
 
   auto which = revents == EV_READ ? "read" : "write";
 
@@ -106,40 +186,50 @@ void downstream_wtimeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
 
 // upstream could be nullptr for unittests
 Downstream::Downstream(Upstream *upstream, int32_t stream_id, int32_t priority)
-    : request_start_time_(std::chrono::high_resolution_clock::now()),
+    : balloc_(&worker_config->arena_pool),
+      request_start_time_(std::chrono::high_resolution_clock::now()),
       request_buf_(upstream ? upstream->get_mcpool() : nullptr),
       response_buf_(upstream ? upstream->get_mcpool() : nullptr),
       request_bodylen_(0), response_bodylen_(0), response_sent_bodylen_(0),
       request_content_length_(-1), response_content_length_(-1),
+      downstream_addr_idx_(-1),
       upstream_(upstream), request_headers_sum_(0), response_headers_sum_(0),
       request_datalen_(0), response_datalen_(0), stream_id_(stream_id),
       priority_(priority), downstream_stream_id_(-1),
       response_rst_stream_error_code_(NGHTTP2_NO_ERROR),
       request_state_(INITIAL), request_major_(1), request_minor_(1),
-      response_state_(INITIAL), response_http_status_(0), response_major_(1),
-      response_minor_(1), upgrade_request_(false), upgraded_(false),
+      response_state_(INITIAL), response_http_status_(0),
+      cache_state_(CACHE_NONE), response_major_(1), response_minor_(1),
+      upgrade_request_(false), upgraded_(false),
       http2_upgrade_seen_(false), chunked_request_(false),
       request_connection_close_(false), request_header_key_prev_(false),
       request_http2_expect_body_(false), chunked_response_(false),
       response_connection_close_(false), response_header_key_prev_(false),
       expect_final_response_(false) {
 
-  ev_timer_init(&upstream_rtimer_, &upstream_rtimeoutcb, 0.,
-                get_config()->stream_read_timeout);
-  ev_timer_init(&upstream_wtimer_, &upstream_wtimeoutcb, 0.,
-                get_config()->stream_write_timeout);
-  ev_timer_init(&downstream_rtimer_, &downstream_rtimeoutcb, 0.,
-                get_config()->stream_read_timeout);
-  ev_timer_init(&downstream_wtimer_, &downstream_wtimeoutcb, 0.,
-                get_config()->stream_write_timeout);
-
-  upstream_rtimer_.data = this;
-  upstream_wtimer_.data = this;
-  downstream_rtimer_.data = this;
-  downstream_wtimer_.data = this;
+  init_timer(&upstream_rtimer_, this, &upstream_rtimeoutcb,
+             get_config()->stream_read_timeout);
+  init_timer(&upstream_wtimer_, this, &upstream_wtimeoutcb,
+             get_config()->stream_write_timeout);
+  init_timer(&downstream_rtimer_, this, &downstream_rtimeoutcb,
+             get_config()->stream_read_timeout);
+  init_timer(&downstream_wtimer_, this, &downstream_wtimeoutcb,
+             get_config()->stream_write_timeout);
 
   http2::init_hdidx(request_hdidx_);
   http2::init_hdidx(response_hdidx_);
+
+  worker_config->headers_pool.get(request_headers_);
+  worker_config->headers_pool.get(response_headers_);
+  worker_config->string_pool.get(request_path_);
+  worker_config->string_pool.get(assembled_request_cookie_);
+
+  // check nullptr for unittest
+  if (upstream_) {
+    upstream_->get_client_handler()
+        ->get_worker_stat()
+        ->metrics.active_streams.add();
+  }
 }
 
 Downstream::~Downstream() {
@@ -147,21 +237,40 @@ Downstream::~Downstream() {
     DLOG(INFO, this) << "Deleting";
   }
 
+  http_cache_detach(this);
+
   // check nullptr for unittest
   if (upstream_) {
     auto loop = upstream_->get_client_handler()->get_loop();
 
-    ev_timer_stop(loop, &upstream_rtimer_);
-    ev_timer_stop(loop, &upstream_wtimer_);
-    ev_timer_stop(loop, &downstream_rtimer_);
-    ev_timer_stop(loop, &downstream_wtimer_);
+    disable_timer(loop, &upstream_rtimer_);
+    disable_timer(loop, &upstream_wtimer_);
+    disable_timer(loop, &downstream_rtimer_);
+    disable_timer(loop, &downstream_wtimer_);
+
+    upstream_->get_client_handler()
+        ->get_worker_stat()
+        ->metrics.active_streams.sub();
   }
 
+  worker_config->headers_pool.put(request_headers_);
+  worker_config->headers_pool.put(response_headers_);
+  worker_config->string_pool.put(request_path_);
+  worker_config->string_pool.put(assembled_request_cookie_);
+
   if (LOG_ENABLED(INFO)) {
     DLOG(INFO, this) << "Deleted";
   }
 }
 
+void *Downstream::operator new(size_t n) {
+  return worker_config->downstream_pool.allocate(n);
+}
+
+void Downstream::operator delete(void *p, size_t n) {
+  worker_config->downstream_pool.deallocate(p, n);
+}
+
 int Downstream::attach_downstream_connection(
     std::unique_ptr<DownstreamConnection> dconn) {
   if (dconn->attach_downstream(this) != 0) {
@@ -217,9 +326,29 @@ void Downstream::force_resume_read() {
 }
 
 namespace {
-const Headers::value_type *get_header_linear(const Headers &headers,
-                                             const std::string &name) {
-  const Headers::value_type *res = nullptr;
+// Adds header field to |headers|, copying name and value using
+// |balloc|.  White spaces around |value| are stripped.
+void add_header(BlockAllocator &balloc, HeaderRefs &headers,
+                const uint8_t *name, size_t namelen, const uint8_t *value,
+                size_t valuelen, bool no_index) {
+  if (valuelen > 0) {
+    size_t i, j;
+    for (i = 0; i < valuelen && (value[i] == ' ' || value[i] == '\t'); ++i)
+      ;
+    for (j = valuelen - 1; j > i && (value[j] == ' ' || value[j] == '\t'); --j)
+      ;
+    value += i;
+    valuelen -= i + (valuelen - j - 1);
+  }
+  headers.emplace_back(
+      make_string_ref(balloc, reinterpret_cast<const char *>(name), namelen),
+      make_string_ref(balloc, reinterpret_cast<const char *>(value), valuelen),
+      no_index);
+}
+
+const HeaderRefs::value_type *get_header_linear(const HeaderRefs &headers,
+                                                const std::string &name) {
+  const HeaderRefs::value_type *res = nullptr;
   for (auto &kv : headers) {
     if (kv.name == name) {
       res = &kv;
@@ -229,7 +358,7 @@ const Headers::value_type *get_header_linear(const Headers &headers,
 }
 } // namespace
 
-const Headers &Downstream::get_request_headers() const {
+const HeaderRefs &Downstream::get_request_headers() const {
   return request_headers_;
 }
 
@@ -242,11 +371,15 @@ void Downstream::assemble_request_cookie() {
       continue;
     }
 
-    auto end = kv.value.find_last_not_of(" ;");
-    if (end == std::string::npos) {
-      cookie += kv.value;
+    auto end = std::end(kv.value);
+    for (; end != std::begin(kv.value) && (*(end - 1) == ' ' ||
+                                           *(end - 1) == ';');
+         --end)
+      ;
+    if (end == std::begin(kv.value)) {
+      cookie.append(std::begin(kv.value), std::end(kv.value));
     } else {
-      cookie.append(std::begin(kv.value), std::begin(kv.value) + end + 1);
+      cookie.append(std::begin(kv.value), end);
     }
     cookie += "; ";
   }
@@ -255,29 +388,27 @@ void Downstream::assemble_request_cookie() {
   }
 }
 
-Headers Downstream::crumble_request_cookie() {
-  Headers cookie_hdrs;
+HeaderRefs Downstream::crumble_request_cookie() {
+  HeaderRefs cookie_hdrs;
   for (auto &kv : request_headers_) {
     if (kv.name.size() != 6 || kv.name[5] != 'e' ||
         !util::streq("cooki", kv.name.c_str(), 5)) {
       continue;
     }
-    size_t last = kv.value.size();
+    auto last = std::end(kv.value);
 
-    for (size_t j = 0; j < last;) {
-      j = kv.value.find_first_not_of("\t ;", j);
-      if (j == std::string::npos) {
+    for (auto p = std::begin(kv.value); p != last;) {
+      for (; p != last && (*p == '\t' || *p == ' ' || *p == ';'); ++p)
+        ;
+      if (p == last) {
         break;
       }
-      auto first = j;
+      auto first = p;
 
-      j = kv.value.find(';', j);
-      if (j == std::string::npos) {
-        j = last;
-      }
+      p = std::find(p, last, ';');
 
-      cookie_hdrs.push_back(
-          Header("cookie", kv.value.substr(first, j - first), kv.no_index));
+      cookie_hdrs.emplace_back(StringRef::from_lit("cookie"),
+                               StringRef(first, p - first), kv.no_index);
     }
   }
   return cookie_hdrs;
@@ -288,10 +419,13 @@ const std::string &Downstream::get_assembled_request_cookie() const {
 }
 
 namespace {
-int index_headers(int *hdidx, Headers &headers, int64_t &content_length) {
+int index_headers(int *hdidx, HeaderRefs &headers, int64_t &content_length) {
   for (size_t i = 0; i < headers.size(); ++i) {
     auto &kv = headers[i];
-    util::inp_strlower(kv.name);
+    // Header field names are allocated by Downstream::balloc_, and
+    // writable.
+    auto name = const_cast<char *>(kv.name.c_str());
+    std::transform(name, name + kv.name.size(), name, util::lowcase);
 
     auto token = http2::lookup_token(
         reinterpret_cast<const uint8_t *>(kv.name.c_str()), kv.name.size());
@@ -302,7 +436,7 @@ int index_headers(int *hdidx, Headers &headers, int64_t &content_length) {
     http2::index_header(hdidx, token, i);
 
     if (token == http2::HD_CONTENT_LENGTH) {
-      auto len = util::parse_uint(kv.value);
+      auto len = util::parse_uint(kv.value.byte(), kv.value.size());
       if (len == -1) {
         return -1;
       }
@@ -321,26 +455,29 @@ int Downstream::index_request_headers() {
                        request_content_length_);
 }
 
-const Headers::value_type *Downstream::get_request_header(int token) const {
+const HeaderRefs::value_type *Downstream::get_request_header(int token) const {
   return http2::get_header(request_hdidx_, token, request_headers_);
 }
 
-const Headers::value_type *
+const HeaderRefs::value_type *
 Downstream::get_request_header(const std::string &name) const {
   return get_header_linear(request_headers_, name);
 }
 
-void Downstream::add_request_header(std::string name, std::string value) {
+void Downstream::add_request_header(const StringRef &name,
+                                    const StringRef &value) {
   request_header_key_prev_ = true;
   request_headers_sum_ += name.size() + value.size();
-  request_headers_.emplace_back(std::move(name), std::move(value));
+  request_headers_.emplace_back(
+      make_string_ref(balloc_, name.c_str(), name.size()),
+      make_string_ref(balloc_, value.c_str(), value.size()));
 }
 
-void Downstream::set_last_request_header_value(std::string value) {
+void Downstream::set_last_request_header_value(const char *data, size_t len) {
   request_header_key_prev_ = false;
-  request_headers_sum_ += value.size();
-  Headers::value_type &item = request_headers_.back();
-  item.value = std::move(value);
+  request_headers_sum_ += len;
+  auto &item = request_headers_.back();
+  item.value = make_string_ref(balloc_, data, len);
 }
 
 void Downstream::add_request_header(const uint8_t *name, size_t namelen,
@@ -348,7 +485,8 @@ void Downstream::add_request_header(const uint8_t *name, size_t namelen,
                                     bool no_index, int token) {
   http2::index_header(request_hdidx_, token, request_headers_.size());
   request_headers_sum_ += namelen + valuelen;
-  http2::add_header(request_headers_, name, namelen, value, valuelen, no_index);
+  add_header(balloc_, request_headers_, name, namelen, value, valuelen,
+             no_index);
 }
 
 bool Downstream::get_request_header_key_prev() const {
@@ -359,7 +497,7 @@ void Downstream::append_last_request_header_key(const char *data, size_t len) {
   assert(request_header_key_prev_);
   request_headers_sum_ += len;
   auto &item = request_headers_.back();
-  item.name.append(data, len);
+  item.name = concat_string_ref(balloc_, item.name, data, len);
 }
 
 void Downstream::append_last_request_header_value(const char *data,
@@ -367,11 +505,11 @@ void Downstream::append_last_request_header_value(const char *data,
   assert(!request_header_key_prev_);
   request_headers_sum_ += len;
   auto &item = request_headers_.back();
-  item.value.append(data, len);
+  item.value = concat_string_ref(balloc_, item.value, data, len);
 }
 
 void Downstream::clear_request_headers() {
-  Headers().swap(request_headers_);
+  HeaderRefs().swap(request_headers_);
   http2::init_hdidx(request_hdidx_);
 }
 
@@ -515,7 +653,7 @@ int Downstream::end_upload_data() {
   return dconn_->end_upload_data();
 }
 
-const Headers &Downstream::get_response_headers() const {
+const HeaderRefs &Downstream::get_response_headers() const {
   return response_headers_;
 }
 
@@ -524,7 +662,8 @@ int Downstream::index_response_headers() {
                        response_content_length_);
 }
 
-const Headers::value_type *Downstream::get_response_header(int token) const {
+const HeaderRefs::value_type *
+Downstream::get_response_header(int token) const {
   return http2::get_header(response_hdidx_, token, response_headers_);
 }
 
@@ -545,35 +684,40 @@ Downstream::rewrite_location_response_header(const std::string &upstream_scheme,
   }
   std::string new_uri;
   if (!request_http2_authority_.empty()) {
-    new_uri =
-        http2::rewrite_location_uri((*hd).value, u, request_http2_authority_,
-                                    upstream_scheme, upstream_port);
+    new_uri = http2::rewrite_location_uri((*hd).value.str(), u,
+                                          request_http2_authority_,
+                                          upstream_scheme, upstream_port);
   }
   if (new_uri.empty()) {
     auto host = get_request_header(http2::HD_HOST);
     if (!host) {
       return;
     }
-    new_uri = http2::rewrite_location_uri((*hd).value, u, (*host).value,
-                                          upstream_scheme, upstream_port);
+    new_uri = http2::rewrite_location_uri((*hd).value.str(), u,
+                                          (*host).value.str(), upstream_scheme,
+                                          upstream_port);
   }
   if (!new_uri.empty()) {
     auto idx = response_hdidx_[http2::HD_LOCATION];
-    response_headers_[idx].value = std::move(new_uri);
+    response_headers_[idx].value = make_string_ref(balloc_, new_uri);
   }
 }
 
-void Downstream::add_response_header(std::string name, std::string value) {
+void Downstream::add_response_header(const StringRef &name,
+                                     const StringRef &value) {
   response_header_key_prev_ = true;
   response_headers_sum_ += name.size() + value.size();
-  response_headers_.emplace_back(std::move(name), std::move(value));
+  response_headers_.emplace_back(
+      make_string_ref(balloc_, name.c_str(), name.size()),
+      make_string_ref(balloc_, value.c_str(), value.size()));
 }
 
-void Downstream::set_last_response_header_value(std::string value) {
+void Downstream::set_last_response_header_value(const char *data,
+                                                size_t len) {
   response_header_key_prev_ = false;
-  response_headers_sum_ += value.size();
+  response_headers_sum_ += len;
   auto &item = response_headers_.back();
-  item.value = std::move(value);
+  item.value = make_string_ref(balloc_, data, len);
 }
 
 void Downstream::add_response_header(const uint8_t *name, size_t namelen,
@@ -581,8 +725,8 @@ void Downstream::add_response_header(const uint8_t *name, size_t namelen,
                                      bool no_index, int token) {
   http2::index_header(response_hdidx_, token, response_headers_.size());
   response_headers_sum_ += namelen + valuelen;
-  http2::add_header(response_headers_, name, namelen, value, valuelen,
-                    no_index);
+  add_header(balloc_, response_headers_, name, namelen, value, valuelen,
+             no_index);
 }
 
 bool Downstream::get_response_header_key_prev() const {
@@ -593,7 +737,7 @@ void Downstream::append_last_response_header_key(const char *data, size_t len) {
   assert(response_header_key_prev_);
   response_headers_sum_ += len;
   auto &item = response_headers_.back();
-  item.name.append(data, len);
+  item.name = concat_string_ref(balloc_, item.name, data, len);
 }
 
 void Downstream::append_last_response_header_value(const char *data,
@@ -601,11 +745,11 @@ void Downstream::append_last_response_header_value(const char *data,
   assert(!response_header_key_prev_);
   response_headers_sum_ += len;
   auto &item = response_headers_.back();
-  item.value.append(data, len);
+  item.value = concat_string_ref(balloc_, item.value, data, len);
 }
 
 void Downstream::clear_response_headers() {
-  Headers().swap(response_headers_);
+  HeaderRefs().swap(response_headers_);
   http2::init_hdidx(response_hdidx_);
 }
 
@@ -661,7 +805,33 @@ int Downstream::change_priority(int32_t pri) {
   return dconn_->on_priority_change(pri);
 }
 
-void Downstream::set_response_state(int state) { response_state_ = state; }
+const std::chrono::high_resolution_clock::time_point &
+Downstream::get_response_header_time() const {
+  return response_header_time_;
+}
+
+int64_t Downstream::get_request_bodylen() const { return request_bodylen_; }
+
+void Downstream::set_downstream_addr_idx(ssize_t idx) {
+  downstream_addr_idx_ = idx;
+}
+
+ssize_t Downstream::get_downstream_addr_idx() const {
+  return downstream_addr_idx_;
+}
+
+void Downstream::set_response_state(int state) {
+  if (state == HEADER_COMPLETE && response_state_ != HEADER_COMPLETE) {
+    response_header_time_ = std::chrono::high_resolution_clock::now();
+  }
+
+  response_state_ = state;
+
+  if (state == MSG_COMPLETE &&
+      (cache_entry_ || cache_state_ == CACHE_LEADER)) {
+    http_cache_end_store(this);
+  }
+}
 
 int Downstream::get_response_state() const { return response_state_; }
 
@@ -821,14 +991,10 @@ bool Downstream::get_http2_upgrade_request() const {
          request_hdidx_[http2::HD_HTTP2_SETTINGS] != -1;
 }
 
-namespace {
-const std::string EMPTY;
-} // namespace
-
-const std::string &Downstream::get_http2_settings() const {
+StringRef Downstream::get_http2_settings() const {
   auto idx = request_hdidx_[http2::HD_HTTP2_SETTINGS];
   if (idx == -1) {
-    return EMPTY;
+    return StringRef();
   }
   return request_headers_[idx].value;
 }
@@ -883,7 +1049,7 @@ bool Downstream::expect_response_body() const {
 }
 
 namespace {
-bool pseudo_header_allowed(const Headers &headers) {
+bool pseudo_header_allowed(const HeaderRefs &headers) {
   if (headers.empty()) {
     return true;
   }
@@ -906,34 +1072,6 @@ bool Downstream::response_pseudo_header_allowed(int token) const {
   return http2::check_http2_response_pseudo_header(response_hdidx_, token);
 }
 
-namespace {
-void reset_timer(struct ev_loop *loop, ev_timer *w) { ev_timer_again(loop, w); }
-} // namespace
-
-namespace {
-void try_reset_timer(struct ev_loop *loop, ev_timer *w) {
-  if (!ev_is_active(w)) {
-    return;
-  }
-  ev_timer_again(loop, w);
-}
-} // namespace
-
-namespace {
-void ensure_timer(struct ev_loop *loop, ev_timer *w) {
-  if (ev_is_active(w)) {
-    return;
-  }
-  ev_timer_again(loop, w);
-}
-} // namespace
-
-namespace {
-void disable_timer(struct ev_loop *loop, ev_timer *w) {
-  ev_timer_stop(loop, w);
-}
-} // namespace
-
 void Downstream::reset_upstream_rtimer() {
   if (get_config()->stream_read_timeout == 0.) {
     return;
@@ -1020,4 +1158,33 @@ void Downstream::disable_downstream_wtimer() {
 
 bool Downstream::accesslog_ready() const { return response_http_status_ > 0; }
 
+void Downstream::set_cache_key(std::string key) { cache_key_ = std::move(key); }
+
+const std::string &Downstream::get_cache_key() const { return cache_key_; }
+
+void Downstream::set_cache_entry(std::unique_ptr<CacheEntry> ent) {
+  cache_entry_ = std::move(ent);
+}
+
+void Downstream::set_cache_state(int state) { cache_state_ = state; }
+
+int Downstream::get_cache_state() const { return cache_state_; }
+
+std::unique_ptr<CacheEntry> Downstream::pop_cache_entry() {
+  return std::move(cache_entry_);
+}
+
+void Downstream::add_cache_body(const uint8_t *data, size_t len) {
+  if (!cache_entry_) {
+    return;
+  }
+
+  if (cache_entry_->body.size() + len > get_config()->cache_max_object_size) {
+    http_cache_abort_store(this);
+    return;
+  }
+
+  cache_entry_->body.append(reinterpret_cast<const char *>(data), len);
+}
+
 } // namespace shrpx
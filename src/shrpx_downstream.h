@@ -41,6 +41,7 @@
 #include "shrpx_io_control.h"
 #include "http2.h"
 #include "memchunk.h"
+#include "shrpx_object_pool.h"
 
 using namespace nghttp2;
 
@@ -48,11 +49,28 @@ namespace shrpx {
 
 class Upstream;
 class DownstreamConnection;
+class Downstream;
+struct CacheEntry;
+
+// Timer of stream read or write timeout.  Resetting timeout only
+// records the time in last_reset, and does not update libev's timer
+// heap.  When ev_timer fires, it is re-armed for the rest of timeout
+// if it has been reset since it was started.
+struct StreamTimer {
+  ev_timer w;
+  Downstream *downstream;
+  // The time when timer was started or reset last time
+  ev_tstamp last_reset;
+  ev_tstamp timeout;
+};
 
 class Downstream {
 public:
   Downstream(Upstream *upstream, int32_t stream_id, int32_t priority);
   ~Downstream();
+  // Downstream is allocated from per thread free list.
+  static void *operator new(size_t n);
+  static void operator delete(void *p, size_t n);
   void reset_upstream(Upstream *upstream);
   Upstream *get_upstream() const;
   void set_stream_id(int32_t stream_id);
@@ -92,12 +110,14 @@ public:
   // Returns true if the request is HTTP Upgrade for HTTP/2
   bool get_http2_upgrade_request() const;
   // Returns the value of HTTP2-Settings request header field.
-  const std::string &get_http2_settings() const;
+  StringRef get_http2_settings() const;
   // downstream request API
-  const Headers &get_request_headers() const;
+  const HeaderRefs &get_request_headers() const;
   // Crumbles (split cookie by ";") in request_headers_ and returns
-  // them.  Headers::no_index is inherited.
-  Headers crumble_request_cookie();
+  // them.  HeaderRef::no_index is inherited.  The returned headers
+  // refer to the request header values, so their values are not
+  // NULL-terminated.  Do not call c_str() on them.
+  HeaderRefs crumble_request_cookie();
   void assemble_request_cookie();
   const std::string &get_assembled_request_cookie() const;
   // Lower the request header field names and indexes request headers.
@@ -108,12 +128,15 @@ public:
   // multiple header have |name| as name, return last occurrence from
   // the beginning.  If no such header is found, returns nullptr.
   // This function must be called after headers are indexed
-  const Headers::value_type *get_request_header(int token) const;
+  const HeaderRefs::value_type *get_request_header(int token) const;
   // Returns pointer to the request header with the name |name|.  If
   // no such header is found, returns nullptr.
-  const Headers::value_type *get_request_header(const std::string &name) const;
-  void add_request_header(std::string name, std::string value);
-  void set_last_request_header_value(std::string value);
+  const HeaderRefs::value_type *
+  get_request_header(const std::string &name) const;
+  // Header field name and value are copied into the memory owned by
+  // this object.
+  void add_request_header(const StringRef &name, const StringRef &value);
+  void set_last_request_header_value(const char *data, size_t len);
 
   void add_request_header(const uint8_t *name, size_t namelen,
                           const uint8_t *value, size_t valuelen, bool no_index,
@@ -134,6 +157,10 @@ public:
   set_request_start_time(std::chrono::high_resolution_clock::time_point time);
   const std::chrono::high_resolution_clock::time_point &
   get_request_start_time() const;
+  // Returns the time when response header was received.  If it has
+  // not been received, returns the epoch of the clock.
+  const std::chrono::high_resolution_clock::time_point &
+  get_response_header_time() const;
   void append_request_path(const char *data, size_t len);
   // Returns request path. For HTTP/1.1, this is request-target. For
   // HTTP/2, this is :path header field value.
@@ -183,7 +210,7 @@ public:
   int get_request_state() const;
   DefaultMemchunks *get_request_buf();
   // downstream response API
-  const Headers &get_response_headers() const;
+  const HeaderRefs &get_response_headers() const;
   // Lower the response header field names and indexes response
   // headers.  If there are invalid headers (e.g., multiple
   // Content-Length with different values), returns -1.
@@ -192,12 +219,12 @@ public:
   // multiple header have |name| as name, return last occurrence from
   // the beginning.  If no such header is found, returns nullptr.
   // This function must be called after response headers are indexed.
-  const Headers::value_type *get_response_header(int token) const;
+  const HeaderRefs::value_type *get_response_header(int token) const;
   // Rewrites the location response header field.
   void rewrite_location_response_header(const std::string &upstream_scheme,
                                         uint16_t upstream_port);
-  void add_response_header(std::string name, std::string value);
-  void set_last_response_header_value(std::string value);
+  void add_response_header(const StringRef &name, const StringRef &value);
+  void set_last_response_header_value(const char *data, size_t len);
 
   void add_response_header(const uint8_t *name, size_t namelen,
                            const uint8_t *value, size_t valuelen, bool no_index,
@@ -222,6 +249,13 @@ public:
   void set_chunked_response(bool f);
   bool get_response_connection_close() const;
   void set_response_connection_close(bool f);
+  int64_t get_request_bodylen() const;
+  // Sets the index of Config::downstream_addrs this request is sent
+  // to.
+  void set_downstream_addr_idx(ssize_t idx);
+  // Returns the index of Config::downstream_addrs this request is
+  // sent to, or -1 if it has not been sent to backend.
+  ssize_t get_downstream_addr_idx() const;
   void set_response_state(int state);
   int get_response_state() const;
   DefaultMemchunks *get_response_buf();
@@ -289,31 +323,63 @@ public:
   // Returns true if accesslog can be written for this downstream.
   bool accesslog_ready() const;
 
+  // Sets the key of response cache.  It is set only if the response
+  // to this request may be stored.
+  void set_cache_key(std::string key);
+  const std::string &get_cache_key() const;
+  // Sets the response being stored in cache.  Response body is
+  // appended to it by add_cache_body().
+  void set_cache_entry(std::unique_ptr<CacheEntry> ent);
+  std::unique_ptr<CacheEntry> pop_cache_entry();
+  // Appends response body to the entry being stored in cache.  If
+  // the body gets larger than the limit, the entry is discarded, and
+  // the requests waiting for this response are resumed.
+  void add_cache_body(const uint8_t *data, size_t len);
+  // State of request collapsing.  See HttpCache.
+  enum {
+    CACHE_NONE,
+    // Fetching the response from backend, and other requests with
+    // the same cache key may be waiting for it.
+    CACHE_LEADER,
+    // Waiting for the leader to finish.
+    CACHE_FOLLOWER,
+    // Resumed after the leader finished.  It never waits again.
+    CACHE_RELEASED,
+  };
+  void set_cache_state(int state);
+  int get_cache_state() const;
+
   enum {
     EVENT_ERROR = 0x1,
     EVENT_TIMEOUT = 0x2,
   };
 
 private:
-  Headers request_headers_;
-  Headers response_headers_;
+  // Stores header field names and values, and other strings which
+  // live as long as this object.
+  BlockAllocator balloc_;
+
+  HeaderRefs request_headers_;
+  HeaderRefs response_headers_;
 
   std::chrono::high_resolution_clock::time_point request_start_time_;
+  std::chrono::high_resolution_clock::time_point response_header_time_;
 
   std::string request_method_;
   std::string request_path_;
   std::string request_http2_scheme_;
   std::string request_http2_authority_;
   std::string assembled_request_cookie_;
+  std::string cache_key_;
 
   DefaultMemchunks request_buf_;
   DefaultMemchunks response_buf_;
 
-  ev_timer upstream_rtimer_;
-  ev_timer upstream_wtimer_;
+  StreamTimer upstream_rtimer_;
+  StreamTimer upstream_wtimer_;
 
-  ev_timer downstream_rtimer_;
-  ev_timer downstream_wtimer_;
+  StreamTimer downstream_rtimer_;
+  StreamTimer downstream_wtimer_;
 
   // the length of request body received so far
   int64_t request_bodylen_;
@@ -327,9 +393,12 @@ private:
   int64_t request_content_length_;
   // content-length of response body, -1 if it is unknown.
   int64_t response_content_length_;
+  // index of Config::downstream_addrs, -1 if not sent to backend.
+  ssize_t downstream_addr_idx_;
 
   Upstream *upstream_;
   std::unique_ptr<DownstreamConnection> dconn_;
+  std::unique_ptr<CacheEntry> cache_entry_;
 
   size_t request_headers_sum_;
   size_t response_headers_sum_;
@@ -352,6 +421,7 @@ private:
 
   int response_state_;
   unsigned int response_http_status_;
+  int cache_state_;
   int response_major_;
   int response_minor_;
 
@@ -60,6 +60,13 @@ public:
   virtual void on_upstream_change(Upstream *uptream) = 0;
   virtual int on_priority_change(int32_t pri) = 0;
 
+  // Returns true if tunneled bytes can be relayed by splice(2)
+  // between this connection and client.
+  virtual bool get_splice_allowed() const { return false; }
+  // Returns the index of Config::downstream_addrs this connection is
+  // made to.  DownstreamConnectionPool uses this as key.
+  virtual size_t get_addr_idx() const { return 0; }
+
   void set_client_handler(ClientHandler *client_handler);
   ClientHandler *get_client_handler();
   Downstream *get_downstream();
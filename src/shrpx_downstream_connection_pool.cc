@@ -23,38 +23,75 @@
  * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 #include "shrpx_downstream_connection_pool.h"
+
+#include <algorithm>
+
 #include "shrpx_downstream_connection.h"
+#include "shrpx_config.h"
 
 namespace shrpx {
 
 DownstreamConnectionPool::DownstreamConnectionPool() {}
 
 DownstreamConnectionPool::~DownstreamConnectionPool() {
-  for (auto dconn : pool_) {
-    delete dconn;
+  for (auto &pool : pools_) {
+    for (auto dconn : pool) {
+      delete dconn;
+    }
   }
 }
 
 void DownstreamConnectionPool::add_downstream_connection(
     std::unique_ptr<DownstreamConnection> dconn) {
-  pool_.insert(dconn.release());
+  auto max_idle = get_config()->downstream_max_idle_connections;
+  if (max_idle == 0) {
+    return;
+  }
+
+  auto addr_idx = dconn->get_addr_idx();
+  if (pools_.size() <= addr_idx) {
+    pools_.resize(addr_idx + 1);
+  }
+
+  auto &pool = pools_[addr_idx];
+  if (pool.size() >= max_idle) {
+    delete pool.front();
+    pool.pop_front();
+  }
+
+  pool.push_back(dconn.release());
 }
 
 std::unique_ptr<DownstreamConnection>
-DownstreamConnectionPool::pop_downstream_connection() {
-  if (pool_.empty()) {
+DownstreamConnectionPool::pop_downstream_connection(size_t addr_idx) {
+  if (pools_.size() <= addr_idx || pools_[addr_idx].empty()) {
     return nullptr;
   }
 
-  auto dconn = std::unique_ptr<DownstreamConnection>(*std::begin(pool_));
-  pool_.erase(std::begin(pool_));
+  auto &pool = pools_[addr_idx];
+  auto dconn = std::unique_ptr<DownstreamConnection>(pool.back());
+  pool.pop_back();
   return dconn;
 }
 
 void DownstreamConnectionPool::remove_downstream_connection(
     DownstreamConnection *dconn) {
-  pool_.erase(dconn);
+  auto addr_idx = dconn->get_addr_idx();
+  if (addr_idx < pools_.size()) {
+    auto &pool = pools_[addr_idx];
+    auto it = std::find(std::begin(pool), std::end(pool), dconn);
+    if (it != std::end(pool)) {
+      pool.erase(it);
+    }
+  }
   delete dconn;
 }
 
+size_t DownstreamConnectionPool::get_num_idle(size_t addr_idx) const {
+  if (pools_.size() <= addr_idx) {
+    return 0;
+  }
+  return pools_[addr_idx].size();
+}
+
 } // namespace shrpx
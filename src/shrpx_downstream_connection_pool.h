@@ -28,23 +28,43 @@
 #include "shrpx.h"
 
 #include <memory>
-#include <set>
+#include <vector>
+#include <deque>
 
 namespace shrpx {
 
 class DownstreamConnection;
 
+// DownstreamConnectionPool keeps idle HTTP/1 backend connections of
+// a worker, which are shared by all frontend connections on it.
+// Connections are keyed by the index of Config::downstream_addrs
+// they are connected to, and the most recently used one is reused
+// first.  Each connection is removed from the pool by itself when it
+// becomes idle for Config::downstream_idle_read_timeout or is closed
+// by backend.
 class DownstreamConnectionPool {
 public:
   DownstreamConnectionPool();
   ~DownstreamConnectionPool();
 
+  // Adds |dconn| to the pool of backend address it is connected to.
+  // If the pool already has Config::downstream_max_idle_connections
+  // connections, the one which has been idle for the longest time is
+  // closed.
   void add_downstream_connection(std::unique_ptr<DownstreamConnection> dconn);
-  std::unique_ptr<DownstreamConnection> pop_downstream_connection();
+  // Returns the most recently pooled connection to backend address
+  // |addr_idx|, or nullptr if there is none.
+  std::unique_ptr<DownstreamConnection>
+  pop_downstream_connection(size_t addr_idx);
   void remove_downstream_connection(DownstreamConnection *dconn);
+  // Returns the number of idle connections to backend address
+  // |addr_idx|.
+  size_t get_num_idle(size_t addr_idx) const;
 
 private:
-  std::set<DownstreamConnection *> pool_;
+  // Idle connections for each backend address.  The most recently
+  // pooled one is at the back.
+  std::vector<std::deque<DownstreamConnection *>> pools_;
 };
 
 } // namespace shrpx
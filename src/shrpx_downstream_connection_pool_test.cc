@@ -0,0 +1,104 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_downstream_connection_pool_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include <ev.h>
+
+#include "shrpx_downstream_connection_pool.h"
+#include "shrpx_http_downstream_connection.h"
+#include "shrpx_config.h"
+
+namespace shrpx {
+
+namespace {
+DownstreamConnection *add(DownstreamConnectionPool &pool, size_t addr_idx) {
+  auto dconn = new HttpDownstreamConnection(&pool, EV_DEFAULT, addr_idx);
+  pool.add_downstream_connection(std::unique_ptr<DownstreamConnection>(dconn));
+  return dconn;
+}
+} // namespace
+
+void test_shrpx_downstream_connection_pool(void) {
+  auto max_idle = get_config()->downstream_max_idle_connections;
+  mod_config()->downstream_max_idle_connections = 2;
+
+  {
+    DownstreamConnectionPool pool;
+
+    CU_ASSERT(nullptr == pool.pop_downstream_connection(0));
+
+    add(pool, 0);
+    auto b = add(pool, 0);
+    auto c = add(pool, 1);
+
+    CU_ASSERT(2 == pool.get_num_idle(0));
+    CU_ASSERT(1 == pool.get_num_idle(1));
+    CU_ASSERT(0 == pool.get_num_idle(2));
+
+    // Most recently pooled connection is reused first.
+    auto dconn = pool.pop_downstream_connection(0);
+    CU_ASSERT(b == dconn.get());
+
+    // Connections to the other backend are not returned.
+    CU_ASSERT(nullptr == pool.pop_downstream_connection(2));
+    dconn = pool.pop_downstream_connection(1);
+    CU_ASSERT(c == dconn.get());
+    CU_ASSERT(nullptr == pool.pop_downstream_connection(1));
+
+    // Pool becomes full; the oldest connection is closed.
+    auto d = add(pool, 0);
+    auto e = add(pool, 0);
+
+    CU_ASSERT(2 == pool.get_num_idle(0));
+
+    dconn = pool.pop_downstream_connection(0);
+    CU_ASSERT(e == dconn.get());
+    dconn = pool.pop_downstream_connection(0);
+    CU_ASSERT(d == dconn.get());
+    CU_ASSERT(nullptr == pool.pop_downstream_connection(0));
+
+    auto f = add(pool, 0);
+    add(pool, 0);
+    pool.remove_downstream_connection(f);
+
+    CU_ASSERT(1 == pool.get_num_idle(0));
+  }
+
+  mod_config()->downstream_max_idle_connections = 0;
+
+  {
+    DownstreamConnectionPool pool;
+
+    add(pool, 0);
+
+    CU_ASSERT(0 == pool.get_num_idle(0));
+  }
+
+  mod_config()->downstream_max_idle_connections = max_idle;
+}
+
+} // namespace shrpx
@@ -0,0 +1,370 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_health_monitor.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+
+#include "shrpx_config.h"
+#include "shrpx_log.h"
+#include "util.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+namespace {
+void probe_connectcb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto probe = static_cast<HealthProbe *>(w->data);
+  if (probe->on_connect() != 0) {
+    probe->done(false);
+  }
+}
+} // namespace
+
+namespace {
+void probe_writecb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto probe = static_cast<HealthProbe *>(w->data);
+  if (probe->on_write() != 0) {
+    probe->done(false);
+  }
+}
+} // namespace
+
+namespace {
+void probe_readcb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto probe = static_cast<HealthProbe *>(w->data);
+  if (probe->on_read() != 0) {
+    probe->done(false);
+  }
+}
+} // namespace
+
+namespace {
+void probe_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto probe = static_cast<HealthProbe *>(w->data);
+  probe->done(false);
+}
+} // namespace
+
+namespace {
+int htp_hdrs_completecb(http_parser *htp) {
+  auto probe = static_cast<HealthProbe *>(htp->data);
+  probe->on_response_header(htp->status_code);
+  // We are not interested in response body.
+  return 1;
+}
+} // namespace
+
+namespace {
+http_parser_settings htp_hooks = {
+    nullptr,             // http_cb on_message_begin;
+    nullptr,             // http_data_cb on_url;
+    nullptr,             // http_data_cb on_status;
+    nullptr,             // http_data_cb on_header_field;
+    nullptr,             // http_data_cb on_header_value;
+    htp_hdrs_completecb, // http_cb on_headers_complete;
+    nullptr,             // http_data_cb on_body;
+    nullptr              // http_cb on_message_complete;
+};
+} // namespace
+
+HealthProbe::HealthProbe(HealthMonitor *monitor, struct ev_loop *loop,
+                         size_t addr_idx)
+    : htp_{0}, monitor_(monitor), loop_(loop), addr_idx_(addr_idx),
+      request_written_(0), status_code_(0), fd_(-1) {
+  ev_io_init(&wev_, probe_connectcb, 0, EV_WRITE);
+  ev_io_init(&rev_, probe_readcb, 0, EV_READ);
+
+  wev_.data = this;
+  rev_.data = this;
+
+  // Health check must finish before next one starts.
+  ev_timer_init(&timeout_, probe_timeoutcb, 0.,
+                get_config()->downstream_health_check_interval);
+
+  timeout_.data = this;
+
+  auto &addr = get_config()->downstream_addrs[addr_idx_];
+
+  if (get_config()->downstream_proto == PROTO_HTTP &&
+      get_config()->downstream_health_check_path) {
+    request_ = "GET ";
+    request_ += get_config()->downstream_health_check_path.get();
+    request_ += " HTTP/1.1\r\nHost: ";
+    request_ += addr.hostport.get();
+    request_ += "\r\nUser-Agent: nghttpx\r\nConnection: close\r\n\r\n";
+  }
+}
+
+HealthProbe::~HealthProbe() { disconnect(); }
+
+void HealthProbe::disconnect() {
+  ev_timer_stop(loop_, &timeout_);
+  ev_io_stop(loop_, &rev_);
+  ev_io_stop(loop_, &wev_);
+
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+void HealthProbe::start() {
+  if (fd_ != -1) {
+    return;
+  }
+
+  auto &addr = get_config()->downstream_addrs[addr_idx_];
+
+  fd_ = util::create_nonblock_socket(addr.addr.storage.ss_family);
+  if (fd_ == -1) {
+    auto error = errno;
+    LOG(WARN) << "Health check: socket() failed; errno=" << error;
+    // This is not a fault of backend.
+    return;
+  }
+
+  auto rv = connect(fd_, const_cast<sockaddr *>(&addr.addr.sa), addr.addrlen);
+  if (rv != 0 && errno != EINPROGRESS) {
+    done(false);
+    return;
+  }
+
+  request_written_ = 0;
+  status_code_ = 0;
+
+  ev_io_set(&wev_, fd_, EV_WRITE);
+  ev_io_set(&rev_, fd_, EV_READ);
+
+  ev_set_cb(&wev_, probe_connectcb);
+
+  ev_io_start(loop_, &wev_);
+  ev_timer_again(loop_, &timeout_);
+}
+
+int HealthProbe::on_connect() {
+  if (!util::check_socket_connected(fd_)) {
+    return -1;
+  }
+
+  if (request_.empty()) {
+    done(true);
+    return 0;
+  }
+
+  http_parser_init(&htp_, HTTP_RESPONSE);
+  htp_.data = this;
+
+  ev_set_cb(&wev_, probe_writecb);
+  ev_io_start(loop_, &rev_);
+
+  return on_write();
+}
+
+int HealthProbe::on_write() {
+  while (request_written_ < request_.size()) {
+    ssize_t nwrite;
+    while ((nwrite = write(fd_, request_.c_str() + request_written_,
+                           request_.size() - request_written_)) == -1 &&
+           errno == EINTR)
+      ;
+    if (nwrite == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      return -1;
+    }
+    request_written_ += nwrite;
+  }
+
+  ev_io_stop(loop_, &wev_);
+
+  return 0;
+}
+
+int HealthProbe::on_read() {
+  uint8_t buf[4096];
+
+  for (;;) {
+    ssize_t nread;
+    while ((nread = read(fd_, buf, sizeof(buf))) == -1 && errno == EINTR)
+      ;
+    if (nread == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      return -1;
+    }
+
+    if (nread == 0) {
+      return -1;
+    }
+
+    http_parser_execute(&htp_, &htp_hooks, reinterpret_cast<char *>(buf),
+                        nread);
+
+    if (status_code_ != 0) {
+      done(status_code_ >= 200 && status_code_ < 400);
+      return 0;
+    }
+
+    if (HTTP_PARSER_ERRNO(&htp_) != HPE_OK) {
+      return -1;
+    }
+  }
+}
+
+void HealthProbe::on_response_header(unsigned int status_code) {
+  status_code_ = status_code;
+}
+
+void HealthProbe::done(bool success) {
+  disconnect();
+
+  monitor_->on_probe_result(addr_idx_, success);
+}
+
+namespace {
+void health_check_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto monitor = static_cast<HealthMonitor *>(w->data);
+  monitor->probe();
+}
+} // namespace
+
+HealthMonitor::HealthMonitor(struct ev_loop *loop, const HealthMonitor *prev)
+    : streaks_(get_config()->downstream_addrs.size()),
+      ejected_(get_config()->downstream_addrs.size()), num_healthy_(0),
+      generation_(0), loop_(loop) {
+  auto &addrs = get_config()->downstream_addrs;
+
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    if (addrs[i].removed) {
+      ejected_[i] = true;
+      probes_.push_back(nullptr);
+      continue;
+    }
+
+    if (prev && i < prev->probes_.size() && prev->probes_[i]) {
+      streaks_[i] = prev->streaks_[i];
+      ejected_[i] = prev->ejected_[i].load(std::memory_order_relaxed);
+    } else {
+      ejected_[i] = false;
+    }
+
+    if (!ejected_[i]) {
+      ++num_healthy_;
+    }
+
+    probes_.push_back(util::make_unique<HealthProbe>(this, loop_, i));
+  }
+
+  ev_timer_init(&timer_, health_check_cb, 0.,
+                get_config()->downstream_health_check_interval);
+  timer_.data = this;
+}
+
+HealthMonitor::~HealthMonitor() { ev_timer_stop(loop_, &timer_); }
+
+void HealthMonitor::start() {
+  probe();
+
+  ev_timer_again(loop_, &timer_);
+}
+
+void HealthMonitor::stop() {
+  ev_timer_stop(loop_, &timer_);
+
+  for (auto &probe : probes_) {
+    if (probe) {
+      probe->disconnect();
+    }
+  }
+}
+
+void HealthMonitor::probe() {
+  for (auto &probe : probes_) {
+    if (probe) {
+      probe->start();
+    }
+  }
+}
+
+bool HealthMonitor::healthy(size_t addr_idx) const {
+  return !ejected_[addr_idx].load(std::memory_order_relaxed);
+}
+
+size_t HealthMonitor::get_num_healthy() const {
+  return num_healthy_.load(std::memory_order_relaxed);
+}
+
+size_t HealthMonitor::get_generation() const {
+  return generation_.load(std::memory_order_relaxed);
+}
+
+void HealthMonitor::on_probe_result(size_t addr_idx, bool success) {
+  auto &addr = get_config()->downstream_addrs[addr_idx];
+  auto ejected = ejected_[addr_idx].load(std::memory_order_relaxed);
+
+  if (success != ejected) {
+    // Result agrees with current state.
+    streaks_[addr_idx] = 0;
+    return;
+  }
+
+  if (ejected) {
+    if (++streaks_[addr_idx] < get_config()->downstream_health_check_rise) {
+      return;
+    }
+
+    LOG(NOTICE) << "Health check: backend " << addr.hostport.get()
+                << " is healthy again; readmitted";
+
+    ejected_[addr_idx].store(false, std::memory_order_relaxed);
+    ++num_healthy_;
+  } else {
+    if (LOG_ENABLED(INFO)) {
+      LOG(INFO) << "Health check: backend " << addr.hostport.get()
+                << " failed";
+    }
+
+    if (++streaks_[addr_idx] < get_config()->downstream_health_check_fall) {
+      return;
+    }
+
+    LOG(WARN) << "Health check: backend " << addr.hostport.get()
+              << " is unhealthy; ejected";
+
+    ejected_[addr_idx].store(true, std::memory_order_relaxed);
+    --num_healthy_;
+  }
+
+  streaks_[addr_idx] = 0;
+  ++generation_;
+}
+
+} // namespace shrpx
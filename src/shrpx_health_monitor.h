@@ -0,0 +1,125 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_HEALTH_MONITOR_H
+#define SHRPX_HEALTH_MONITOR_H
+
+#include "shrpx.h"
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <string>
+
+#include <ev.h>
+
+#include "http-parser/http_parser.h"
+
+namespace shrpx {
+
+class HealthMonitor;
+
+// Out-of-band health check of one backend address.  It makes TCP
+// connection, and optionally sends HTTP/1.1 GET request and waits
+// for response header.
+class HealthProbe {
+public:
+  HealthProbe(HealthMonitor *monitor, struct ev_loop *loop, size_t addr_idx);
+  ~HealthProbe();
+  // Starts health check.  If previous one is still in progress, this
+  // function does nothing.
+  void start();
+  int on_connect();
+  int on_write();
+  int on_read();
+  void on_response_header(unsigned int status_code);
+  // Finishes health check with result |success|.
+  void done(bool success);
+  // Cancels health check in progress without reporting result.
+  void disconnect();
+
+private:
+
+  ev_io wev_;
+  ev_io rev_;
+  ev_timer timeout_;
+  http_parser htp_;
+  std::string request_;
+  HealthMonitor *monitor_;
+  struct ev_loop *loop_;
+  size_t addr_idx_;
+  // The number of bytes of request_ written so far
+  size_t request_written_;
+  // The status code of response; 0 if not received yet
+  unsigned int status_code_;
+  int fd_;
+};
+
+// HealthMonitor runs health check of all backend addresses in
+// Config::downstream_addrs periodically, and keeps the results.  The
+// results are shared by all workers; healthy() and get_num_healthy()
+// are thread safe.
+class HealthMonitor {
+public:
+  // If |prev| is not nullptr, the results of addresses which |prev|
+  // also checks are taken over from it.  It is used when
+  // configuration is reloaded.  Address removed by reload is always
+  // ejected, and not checked.
+  HealthMonitor(struct ev_loop *loop, const HealthMonitor *prev);
+  ~HealthMonitor();
+  // Starts periodic health check.
+  void start();
+  // Stops health check.  The results are still available.
+  void stop();
+  // Returns true if backend address |addr_idx| is healthy.
+  bool healthy(size_t addr_idx) const;
+  // Returns the number of healthy backend addresses.
+  size_t get_num_healthy() const;
+  // Returns the number which is incremented whenever address is
+  // ejected or readmitted.
+  size_t get_generation() const;
+  // Called when health check of backend address |addr_idx| finished
+  // with result |success|.  After
+  // Config::downstream_health_check_fall consecutive failures, the
+  // address is ejected.  After Config::downstream_health_check_rise
+  // consecutive successes, ejected address is readmitted.
+  void on_probe_result(size_t addr_idx, bool success);
+  void probe();
+
+private:
+  // Probe for each address.  nullptr if the address is removed.
+  std::vector<std::unique_ptr<HealthProbe>> probes_;
+  // The number of consecutive failures for healthy address, or
+  // consecutive successes for ejected address.
+  std::vector<size_t> streaks_;
+  std::vector<std::atomic<bool>> ejected_;
+  std::atomic<size_t> num_healthy_;
+  std::atomic<size_t> generation_;
+  ev_timer timer_;
+  struct ev_loop *loop_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_HEALTH_MONITOR_H
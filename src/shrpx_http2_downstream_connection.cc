@@ -95,6 +95,14 @@ Http2DownstreamConnection::~Http2DownstreamConnection() {
   }
 }
 
+void *Http2DownstreamConnection::operator new(size_t n) {
+  return worker_config->http2_dconn_pool.allocate(n);
+}
+
+void Http2DownstreamConnection::operator delete(void *p, size_t n) {
+  worker_config->http2_dconn_pool.deallocate(p, n);
+}
+
 int Http2DownstreamConnection::attach_downstream(Downstream *downstream) {
   if (LOG_ENABLED(INFO)) {
     DCLOG(INFO, this) << "Attaching to DOWNSTREAM:" << downstream;
@@ -106,6 +114,7 @@ int Http2DownstreamConnection::attach_downstream(Downstream *downstream) {
 
   downstream_ = downstream;
   downstream_->reset_downstream_rtimer();
+  downstream_->set_downstream_addr_idx(http2session_->get_addr_idx());
 
   return 0;
 }
@@ -234,7 +243,7 @@ int Http2DownstreamConnection::push_request_headers() {
   }
   size_t nheader = downstream_->get_request_headers().size();
 
-  Headers cookies;
+  HeaderRefs cookies;
   if (!get_config()->http2_no_cookie_crumbling) {
     cookies = downstream_->crumble_request_cookie();
   }
@@ -358,7 +367,7 @@ int Http2DownstreamConnection::push_request_headers() {
   auto xff = downstream_->get_request_header(http2::HD_X_FORWARDED_FOR);
   if (get_config()->add_x_forwarded_for) {
     if (xff && !get_config()->strip_incoming_x_forwarded_for) {
-      xff_value = (*xff).value;
+      xff_value.assign((*xff).value.c_str(), (*xff).value.size());
       xff_value += ", ";
     }
     xff_value +=
@@ -389,7 +398,7 @@ int Http2DownstreamConnection::push_request_headers() {
     }
   } else {
     if (via) {
-      via_value = (*via).value;
+      via_value.assign((*via).value.c_str(), (*via).value.size());
       via_value += ", ";
     }
     via_value += http::create_via_header_value(
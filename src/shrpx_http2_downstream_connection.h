@@ -44,6 +44,9 @@ public:
   Http2DownstreamConnection(DownstreamConnectionPool *dconn_pool,
                             Http2Session *http2session);
   virtual ~Http2DownstreamConnection();
+  // Allocated from per thread free list.
+  static void *operator new(size_t n);
+  static void operator delete(void *p, size_t n);
   virtual int attach_downstream(Downstream *downstream);
   virtual void detach_downstream(Downstream *downstream);
 
@@ -40,6 +40,8 @@
 #include "shrpx_ssl.h"
 #include "shrpx_http.h"
 #include "shrpx_worker_config.h"
+#include "shrpx_http_cache.h"
+#include "shrpx_worker.h"
 #include "http2.h"
 #include "util.h"
 #include "base64.h"
@@ -131,11 +133,15 @@ void wrschedcb(struct ev_loop *loop, ev_prepare *w, int revents) {
 }
 } // namespace
 
-Http2Session::Http2Session(struct ev_loop *loop, SSL_CTX *ssl_ctx)
+Http2Session::Http2Session(struct ev_loop *loop, SSL_CTX *ssl_ctx,
+                           size_t addr_idx, WorkerStat *worker_stat)
     : loop_(loop), ssl_ctx_(ssl_ctx), ssl_(nullptr), session_(nullptr),
+      worker_stat_(worker_stat), connect_start_(0.), addr_idx_(addr_idx),
       data_pending_(nullptr), data_pendinglen_(0), fd_(-1),
       state_(DISCONNECTED), connection_check_state_(CONNECTION_CHECK_NONE),
-      flow_control_(false), write_requested_(false) {
+      flow_control_(false), write_requested_(false),
+      connect_initiated_(false), settings_received_(false),
+      goaway_received_(false) {
   // We do not know fd yet, so just set dummy fd 0
   ev_io_init(&wev_, writecb, 0, EV_WRITE);
   ev_io_init(&rev_, readcb, 0, EV_READ);
@@ -169,7 +175,11 @@ Http2Session::Http2Session(struct ev_loop *loop, SSL_CTX *ssl_ctx)
   ev_prepare_start(loop_, &wrsched_prep_);
 }
 
-Http2Session::~Http2Session() { disconnect(); }
+Http2Session::~Http2Session() {
+  disconnect();
+
+  ev_prepare_stop(loop_, &wrsched_prep_);
+}
 
 int Http2Session::disconnect(bool hard) {
   if (LOG_ENABLED(INFO)) {
@@ -216,6 +226,7 @@ int Http2Session::disconnect(bool hard) {
 
   connection_check_state_ = CONNECTION_CHECK_NONE;
   state_ = DISCONNECTED;
+  settings_received_ = false;
 
   // Delete all client handler associated to Downstream. When deleting
   // Http2DownstreamConnection, it calls this object's
@@ -255,6 +266,9 @@ int Http2Session::check_cert() { return ssl::check_cert(ssl_); }
 
 int Http2Session::initiate_connection() {
   int rv = 0;
+
+  connect_initiated_ = true;
+
   if (get_config()->downstream_http_proxy_host && state_ == DISCONNECTED) {
     if (LOG_ENABLED(INFO)) {
       SSLOG(INFO, this) << "Connecting to the proxy "
@@ -318,7 +332,7 @@ int Http2Session::initiate_connection() {
       if (get_config()->backend_tls_sni_name) {
         sni_name = get_config()->backend_tls_sni_name.get();
       } else {
-        sni_name = get_config()->downstream_addrs[0].host.get();
+        sni_name = get_config()->downstream_addrs[addr_idx_].host.get();
       }
 
       if (sni_name && !util::numeric_host(sni_name)) {
@@ -333,19 +347,20 @@ int Http2Session::initiate_connection() {
         assert(fd_ == -1);
 
         fd_ = util::create_nonblock_socket(
-            get_config()->downstream_addrs[0].addr.storage.ss_family);
+            get_config()->downstream_addrs[addr_idx_].addr.storage.ss_family);
         if (fd_ == -1) {
           return -1;
         }
 
-        rv = connect(
-            fd_,
-            // TODO maybe not thread-safe?
-            const_cast<sockaddr *>(&get_config()->downstream_addrs[0].addr.sa),
-            get_config()->downstream_addrs[0].addrlen);
+        auto &addr = get_config()->downstream_addrs[addr_idx_];
+
+        // TODO maybe not thread-safe?
+        rv = connect(fd_, const_cast<sockaddr *>(&addr.addr.sa), addr.addrlen);
         if (rv != 0 && errno != EINPROGRESS) {
           return -1;
         }
+
+        connect_start_ = ev_now(loop_);
       }
 
       if (SSL_set_fd(ssl_, fd_) == 0) {
@@ -359,18 +374,20 @@ int Http2Session::initiate_connection() {
         assert(fd_ == -1);
 
         fd_ = util::create_nonblock_socket(
-            get_config()->downstream_addrs[0].addr.storage.ss_family);
+            get_config()->downstream_addrs[addr_idx_].addr.storage.ss_family);
 
         if (fd_ == -1) {
           return -1;
         }
 
-        rv = connect(fd_, const_cast<sockaddr *>(
-                              &get_config()->downstream_addrs[0].addr.sa),
-                     get_config()->downstream_addrs[0].addrlen);
+        auto &addr = get_config()->downstream_addrs[addr_idx_];
+
+        rv = connect(fd_, const_cast<sockaddr *>(&addr.addr.sa), addr.addrlen);
         if (rv != 0 && errno != EINPROGRESS) {
           return -1;
         }
+
+        connect_start_ = ev_now(loop_);
       } else {
         // Without TLS but with proxy.  Connection already
         // established.
@@ -489,9 +506,9 @@ int Http2Session::downstream_connect_proxy() {
     SSLOG(INFO, this) << "Connected to the proxy";
   }
   std::string req = "CONNECT ";
-  req += get_config()->downstream_addrs[0].hostport.get();
+  req += get_config()->downstream_addrs[addr_idx_].hostport.get();
   req += " HTTP/1.1\r\nHost: ";
-  req += get_config()->downstream_addrs[0].host.get();
+  req += get_config()->downstream_addrs[addr_idx_].host.get();
   req += "\r\n";
   if (get_config()->downstream_http_proxy_userinfo) {
     req += "Proxy-Authorization: Basic ";
@@ -854,7 +871,8 @@ int on_response_headers(Http2Session *http2session, Downstream *downstream,
       // Otherwise, use chunked encoding to keep upstream connection
       // open.  In HTTP2, we are supporsed not to receive
       // transfer-encoding.
-      downstream->add_response_header("transfer-encoding", "chunked");
+      downstream->add_response_header(StringRef::from_lit("transfer-encoding"),
+                                      StringRef::from_lit("chunked"));
       downstream->set_chunked_response(true);
     }
   }
@@ -879,6 +897,9 @@ int on_response_headers(Http2Session *http2session, Downstream *downstream,
     // stream to stall.
     downstream->end_upload_data();
   }
+
+  http_cache_begin_store(downstream);
+
   rv = upstream->on_downstream_header_complete(downstream);
   if (rv != 0) {
     http2session->submit_rst_stream(frame->hd.stream_id,
@@ -1008,10 +1029,14 @@ int on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame *frame,
   }
   case NGHTTP2_SETTINGS:
     if ((frame->hd.flags & NGHTTP2_FLAG_ACK) == 0) {
+      http2session->settings_received();
       break;
     }
     http2session->stop_settings_timer();
     break;
+  case NGHTTP2_GOAWAY:
+    http2session->goaway_received();
+    break;
   case NGHTTP2_PUSH_PROMISE:
     if (LOG_ENABLED(INFO)) {
       SSLOG(INFO, http2session)
@@ -1075,6 +1100,7 @@ int on_data_chunk_recv_callback(nghttp2_session *session, uint8_t flags,
   downstream->reset_downstream_rtimer();
 
   downstream->add_response_bodylen(len);
+  downstream->add_cache_body(data, len);
 
   auto upstream = downstream->get_upstream();
   rv = upstream->on_downstream_body(downstream, data, len, false);
@@ -1525,6 +1551,14 @@ int Http2Session::connected() {
     SSLOG(INFO, this) << "Connection established";
   }
 
+  // connect_start_ is 0 if connection is made to the proxy, or tunnel
+  // has been established through the proxy.
+  if (connect_start_ != 0.) {
+    worker_stat_->metrics.backend_connect_time.record(
+        std::max(0., ev_now(loop_) - connect_start_) * 1000000);
+    connect_start_ = 0.;
+  }
+
   ev_io_start(loop_, &rev_);
 
   if (ssl_) {
@@ -1795,4 +1829,35 @@ bool Http2Session::should_hard_fail() const {
   }
 }
 
+size_t Http2Session::get_num_dconns() const { return dconns_.size(); }
+
+uint32_t Http2Session::get_max_concurrent_streams() const {
+  if (!session_ || !settings_received_) {
+    return 0;
+  }
+
+  return nghttp2_session_get_remote_settings(
+      session_, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+}
+
+void Http2Session::settings_received() { settings_received_ = true; }
+
+void Http2Session::goaway_received() { goaway_received_ = true; }
+
+bool Http2Session::get_goaway_received() const { return goaway_received_; }
+
+bool Http2Session::is_dead() const {
+  return connect_initiated_ && state_ == DISCONNECTED && dconns_.empty();
+}
+
+size_t Http2Session::get_addr_idx() const { return addr_idx_; }
+
+int32_t Http2Session::get_remote_window_size() const {
+  if (!session_) {
+    return NGHTTP2_INITIAL_CONNECTION_WINDOW_SIZE;
+  }
+
+  return nghttp2_session_get_remote_window_size(session_);
+}
+
 } // namespace shrpx
@@ -45,6 +45,7 @@ using namespace nghttp2;
 namespace shrpx {
 
 class Http2DownstreamConnection;
+struct WorkerStat;
 
 struct StreamData {
   Http2DownstreamConnection *dconn;
@@ -52,7 +53,10 @@ struct StreamData {
 
 class Http2Session {
 public:
-  Http2Session(struct ev_loop *loop, SSL_CTX *ssl_ctx);
+  // |addr_idx| is the index of Config::downstream_addrs this session
+  // connects to.
+  Http2Session(struct ev_loop *loop, SSL_CTX *ssl_ctx, size_t addr_idx,
+               WorkerStat *worker_stat);
   ~Http2Session();
 
   int check_cert();
@@ -140,6 +144,33 @@ public:
 
   bool should_hard_fail() const;
 
+  // Returns the number of Http2DownstreamConnection objects attached
+  // to this session, that is the number of active and pending
+  // requests.
+  size_t get_num_dconns() const;
+  // Returns the peer's SETTINGS_MAX_CONCURRENT_STREAMS.  If session
+  // has not been established, or the peer's SETTINGS has not been
+  // received yet, this returns 0, so that requests are not piled up
+  // on a session whose limit is still unknown.
+  uint32_t get_max_concurrent_streams() const;
+  // Called when the peer's SETTINGS (not ACK) is received.
+  void settings_received();
+  // Called when GOAWAY is received.
+  void goaway_received();
+  // Returns true if GOAWAY has been received.  New streams must not
+  // be assigned to this session.
+  bool get_goaway_received() const;
+  // Returns true if this session has been disconnected after a
+  // connection attempt, and no Http2DownstreamConnection is attached
+  // to it.  Such session should be removed from Http2SessionPool.
+  bool is_dead() const;
+  // Returns connection level remote window size.  If session has not
+  // been established, this returns the initial value.
+  int32_t get_remote_window_size() const;
+  // Returns the index of Config::downstream_addrs this session
+  // connects to.
+  size_t get_addr_idx() const;
+
   enum {
     // Disconnected
     DISCONNECTED,
@@ -190,6 +221,11 @@ private:
   SSL_CTX *ssl_ctx_;
   SSL *ssl_;
   nghttp2_session *session_;
+  WorkerStat *worker_stat_;
+  // The time when connect() to backend was called
+  ev_tstamp connect_start_;
+  // Index of Config::downstream_addrs this session connects to
+  size_t addr_idx_;
   const uint8_t *data_pending_;
   size_t data_pendinglen_;
   // fd_ is used for proxy connection and no TLS connection. For
@@ -201,6 +237,12 @@ private:
   int connection_check_state_;
   bool flow_control_;
   bool write_requested_;
+  // true if initiate_connection() has been called
+  bool connect_initiated_;
+  // true if the peer's SETTINGS has been received
+  bool settings_received_;
+  // true if GOAWAY has been received
+  bool goaway_received_;
   WriteBuf wb_;
   ReadBuf rb_;
 };
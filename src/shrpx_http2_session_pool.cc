@@ -0,0 +1,216 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_http2_session_pool.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "shrpx_http2_session.h"
+#include "shrpx_config.h"
+#include "shrpx_worker.h"
+#include "util.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+namespace {
+void dead_sessions_timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto pool = static_cast<Http2SessionPool *>(w->data);
+  pool->delete_dead_sessions();
+}
+} // namespace
+
+Http2SessionPool::Http2SessionPool(struct ev_loop *loop, SSL_CTX *ssl_ctx,
+                                   WorkerStat *worker_stat)
+    : loop_(loop), ssl_ctx_(ssl_ctx), worker_stat_(worker_stat),
+      next_addr_(0) {
+  ev_timer_init(&dead_sessions_timer_, dead_sessions_timeoutcb, 0., 0.);
+  dead_sessions_timer_.data = this;
+
+  // Connect to each backend at least once, if the limit allows.
+  // Session does not connect until the first request is made.
+  auto n = std::min(get_config()->downstream_addrs.size(),
+                    get_config()->downstream_http2_connections_per_worker);
+  for (size_t i = 0; i < n; ++i) {
+    add_session();
+  }
+}
+
+Http2SessionPool::~Http2SessionPool() {
+  ev_timer_stop(loop_, &dead_sessions_timer_);
+}
+
+void Http2SessionPool::remove_dead_sessions() {
+  auto it = std::stable_partition(
+      std::begin(sessions_), std::end(sessions_),
+      [](const std::unique_ptr<Http2Session> &s) { return !s->is_dead(); });
+
+  if (it == std::end(sessions_)) {
+    return;
+  }
+
+  std::move(it, std::end(sessions_), std::back_inserter(dead_sessions_));
+  sessions_.erase(it, std::end(sessions_));
+
+  ev_timer_start(loop_, &dead_sessions_timer_);
+}
+
+void Http2SessionPool::delete_dead_sessions() { dead_sessions_.clear(); }
+
+size_t Http2SessionPool::get_num_usable_sessions() const {
+  return std::count_if(std::begin(sessions_), std::end(sessions_),
+                       [](const std::unique_ptr<Http2Session> &s) {
+                         return !s->get_goaway_received();
+                       });
+}
+
+Http2Session *Http2SessionPool::add_session() {
+  auto naddrs = get_config()->downstream_addrs.size();
+
+  // Skip the addresses ejected by health check
+  for (size_t i = 0; i < naddrs && !downstream_addr_usable(next_addr_); ++i) {
+    next_addr_ = (next_addr_ + 1) % naddrs;
+  }
+
+  auto addr_idx = next_addr_;
+
+  if (++next_addr_ == naddrs) {
+    next_addr_ = 0;
+  }
+
+  return add_session(addr_idx);
+}
+
+Http2Session *Http2SessionPool::add_session(size_t addr_idx) {
+  sessions_.push_back(
+      util::make_unique<Http2Session>(loop_, ssl_ctx_, addr_idx, worker_stat_));
+
+  return sessions_.back().get();
+}
+
+namespace {
+// Returns true if new stream should be assigned to |a| rather than
+// |b|.
+bool less_loaded(Http2Session *a, Http2Session *b) {
+  auto na = a->get_num_dconns();
+  auto nb = b->get_num_dconns();
+
+  if (na != nb) {
+    return na < nb;
+  }
+
+  return a->get_remote_window_size() > b->get_remote_window_size();
+}
+} // namespace
+
+Http2Session *Http2SessionPool::select() {
+  Http2Session *best = nullptr;
+  Http2Session *least_loaded = nullptr;
+
+  remove_dead_sessions();
+
+  for (auto &session : sessions_) {
+    auto s = session.get();
+
+    if (s->get_goaway_received()) {
+      continue;
+    }
+
+    auto nstreams = s->get_num_dconns();
+
+    if (!least_loaded || nstreams < least_loaded->get_num_dconns()) {
+      least_loaded = s;
+    }
+
+    if (nstreams >= s->get_max_concurrent_streams() ||
+        !downstream_addr_usable(s->get_addr_idx())) {
+      continue;
+    }
+
+    if (!best || less_loaded(s, best)) {
+      best = s;
+    }
+  }
+
+  if (best) {
+    return best;
+  }
+
+  if (!least_loaded ||
+      get_num_usable_sessions() <
+          get_config()->downstream_http2_connections_per_worker) {
+    return add_session();
+  }
+
+  // All sessions are full.  The request is queued in the least loaded
+  // session until the peer allows more streams.
+  return least_loaded;
+}
+
+Http2Session *Http2SessionPool::select(size_t addr_idx) {
+  Http2Session *best = nullptr;
+  Http2Session *least_loaded = nullptr;
+
+  remove_dead_sessions();
+
+  for (auto &session : sessions_) {
+    auto s = session.get();
+
+    if (s->get_addr_idx() != addr_idx || s->get_goaway_received()) {
+      continue;
+    }
+
+    auto nstreams = s->get_num_dconns();
+
+    if (!least_loaded || nstreams < least_loaded->get_num_dconns()) {
+      least_loaded = s;
+    }
+
+    if (nstreams >= s->get_max_concurrent_streams()) {
+      continue;
+    }
+
+    if (!best || less_loaded(s, best)) {
+      best = s;
+    }
+  }
+
+  if (best) {
+    return best;
+  }
+
+  if (!least_loaded ||
+      get_num_usable_sessions() <
+          get_config()->downstream_http2_connections_per_worker) {
+    return add_session(addr_idx);
+  }
+
+  return least_loaded;
+}
+
+size_t Http2SessionPool::size() const { return sessions_.size(); }
+
+} // namespace shrpx
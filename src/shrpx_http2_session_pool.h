@@ -0,0 +1,91 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_HTTP2_SESSION_POOL_H
+#define SHRPX_HTTP2_SESSION_POOL_H
+
+#include "shrpx.h"
+
+#include <vector>
+#include <memory>
+
+#include <openssl/ssl.h>
+
+#include <ev.h>
+
+namespace shrpx {
+
+class Http2Session;
+struct WorkerStat;
+
+// Set of HTTP/2 backend sessions shared by frontend connections in a
+// thread.  Sessions are spread across backend addresses in round
+// robin fashion.  At most
+// Config::downstream_http2_connections_per_worker sessions are
+// created.  Sessions which have received GOAWAY are not chosen for
+// new streams, and are not counted toward the limit.  Sessions which
+// have been disconnected are removed from the pool.
+class Http2SessionPool {
+public:
+  Http2SessionPool(struct ev_loop *loop, SSL_CTX *ssl_ctx,
+                   WorkerStat *worker_stat);
+  ~Http2SessionPool();
+  // Returns Http2Session to which new stream should be assigned.
+  // Among the sessions which have not reached the peer's
+  // SETTINGS_MAX_CONCURRENT_STREAMS, the one with the least number of
+  // active streams is chosen.  The ties are broken by the larger
+  // connection level remote window.  If all sessions are full, new
+  // session is created if the limit allows.
+  Http2Session *select();
+  // Returns Http2Session connected to backend address |addr_idx|,
+  // chosen in the same way as select().  If there is no session to
+  // |addr_idx|, new session is created even if it exceeds the limit.
+  Http2Session *select(size_t addr_idx);
+  size_t size() const;
+  // Deletes sessions removed from the pool.
+  void delete_dead_sessions();
+
+private:
+  Http2Session *add_session();
+  Http2Session *add_session(size_t addr_idx);
+  // Removes dead sessions from sessions_.  They are deleted later
+  // from dead_sessions_timer_, because select() may be called while
+  // the session is disconnecting.
+  void remove_dead_sessions();
+  // Returns the number of sessions which can take new streams.
+  size_t get_num_usable_sessions() const;
+
+  std::vector<std::unique_ptr<Http2Session>> sessions_;
+  std::vector<std::unique_ptr<Http2Session>> dead_sessions_;
+  ev_timer dead_sessions_timer_;
+  struct ev_loop *loop_;
+  SSL_CTX *ssl_ctx_;
+  WorkerStat *worker_stat_;
+  // Index of Config::downstream_addrs used for the next session
+  size_t next_addr_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_HTTP2_SESSION_POOL_H
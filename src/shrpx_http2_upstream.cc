@@ -26,8 +26,11 @@
 
 #include <netinet/tcp.h>
 #include <assert.h>
+#include <unistd.h>
+
 #include <cerrno>
 #include <sstream>
+#include <atomic>
 
 #include "shrpx_client_handler.h"
 #include "shrpx_https_upstream.h"
@@ -36,6 +39,7 @@
 #include "shrpx_config.h"
 #include "shrpx_http.h"
 #include "shrpx_worker_config.h"
+#include "shrpx_http_cache.h"
 #include "http2.h"
 #include "util.h"
 #include "base64.h"
@@ -105,7 +109,7 @@ int on_stream_close_callback(nghttp2_session *session, int32_t stream_id,
 int Http2Upstream::upgrade_upstream(HttpsUpstream *http) {
   int rv;
 
-  auto http2_settings = http->get_downstream()->get_http2_settings();
+  auto http2_settings = http->get_downstream()->get_http2_settings().str();
   util::to_base64(http2_settings);
 
   auto settings_payload =
@@ -119,6 +123,10 @@ int Http2Upstream::upgrade_upstream(HttpsUpstream *http) {
                      << nghttp2_strerror(rv);
     return -1;
   }
+  // The recorded bytes cannot be replayed without HTTP Upgrade
+  // request.
+  record_ = false;
+
   pre_upstream_.reset(http);
   auto downstream = http->pop_downstream();
   downstream->reset_upstream(this);
@@ -353,6 +361,21 @@ int on_request_headers(Http2Upstream *upstream, Downstream *downstream,
 } // namespace
 
 void Http2Upstream::start_downstream(Downstream *downstream) {
+  if (downstream->get_request_state() == Downstream::MSG_COMPLETE) {
+    auto rv = http_cache_lookup(downstream);
+    if (rv < 0) {
+      rst_stream(downstream, NGHTTP2_INTERNAL_ERROR);
+      return;
+    }
+    if (rv > 0) {
+      // Response has been served from cache, or this request waits
+      // for the same request in flight.  Downstream stays in pending
+      // list until the stream is closed or it is resumed by
+      // on_collapsed_request_ready().
+      return;
+    }
+  }
+
   auto next_downstream =
       downstream_queue_.pop_pending(downstream->get_stream_id());
   assert(next_downstream);
@@ -371,7 +394,7 @@ Http2Upstream::initiate_downstream(std::unique_ptr<Downstream> downstream) {
   int rv;
 
   rv = downstream->attach_downstream_connection(
-      handler_->get_downstream_connection());
+      handler_->get_downstream_connection(downstream.get()));
   if (rv != 0) {
     // downstream connection fails, send error page
     if (error_reply(downstream.get(), 503) != 0) {
@@ -617,6 +640,13 @@ void settings_timeout_cb(struct ev_loop *loop, ev_timer *w, int revents) {
 }
 } // namespace
 
+namespace {
+void record_timeout_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto upstream = static_cast<Http2Upstream *>(w->data);
+  upstream->flush_record_file();
+}
+} // namespace
+
 namespace {
 void shutdown_timeout_cb(struct ev_loop *loop, ev_timer *w, int revents) {
   auto upstream = static_cast<Http2Upstream *>(w->data);
@@ -665,8 +695,10 @@ Http2Upstream::Http2Upstream(ClientHandler *handler)
                     ? get_config()->downstream_connections_per_frontend
                     : 0,
           !get_config()->http2_proxy),
-      handler_(handler), session_(nullptr), data_pending_(nullptr),
-      data_pendinglen_(0), shutdown_handled_(false) {
+      handler_(handler), session_(nullptr), record_file_(nullptr),
+      data_pending_(nullptr),
+      data_pendinglen_(0), shutdown_handled_(false),
+      record_(get_config()->http2_upstream_record_dir != nullptr) {
 
   int rv;
 
@@ -765,6 +797,12 @@ Http2Upstream::Http2Upstream(ClientHandler *handler)
   ev_timer_init(&shutdown_timer_, shutdown_timeout_cb, 2., 0);
   shutdown_timer_.data = this;
 
+  // Recorded bytes are written at most every second, or when
+  // record_buf_ gets large, so that we do not block event loop for
+  // each read.
+  ev_timer_init(&record_timer_, record_timeout_cb, 0., 1.);
+  record_timer_.data = this;
+
   ev_prepare_init(&prep_, prepare_cb);
   prep_.data = this;
   ev_prepare_start(handler_->get_loop(), &prep_);
@@ -775,7 +813,71 @@ Http2Upstream::Http2Upstream(ClientHandler *handler)
   handler_->signal_write();
 }
 
+namespace {
+std::atomic<uint64_t> record_serial;
+} // namespace
+
+void Http2Upstream::open_record_file() {
+  auto path = std::string(get_config()->http2_upstream_record_dir.get());
+  path += "/h2-";
+  path += util::utos(getpid());
+  path += "-";
+  path += util::utos(record_serial++);
+  path += ".bin";
+
+  record_file_ = open_file_for_write(path.c_str());
+  if (record_file_ == nullptr) {
+    record_ = false;
+    return;
+  }
+
+  // We do our own buffering in record_buf_.
+  setvbuf(record_file_, nullptr, _IONBF, 0);
+
+  ev_timer_again(handler_->get_loop(), &record_timer_);
+
+  if (LOG_ENABLED(INFO)) {
+    ULOG(INFO, this) << "Recording incoming bytes to " << path;
+  }
+}
+
+void Http2Upstream::flush_record_file() {
+  if (record_file_ == nullptr || record_buf_.empty()) {
+    return;
+  }
+
+  if (fwrite(record_buf_.data(), 1, record_buf_.size(), record_file_) !=
+      record_buf_.size()) {
+    ULOG(WARN, this) << "Could not record incoming bytes; stop recording";
+    record_buf_.clear();
+    record_ = false;
+    close_record_file();
+    return;
+  }
+
+  record_buf_.clear();
+}
+
+void Http2Upstream::close_record_file() {
+  if (record_file_ == nullptr) {
+    return;
+  }
+
+  flush_record_file();
+
+  // flush_record_file() closes the file on error.
+  if (record_file_ == nullptr) {
+    return;
+  }
+
+  ev_timer_stop(handler_->get_loop(), &record_timer_);
+
+  fclose(record_file_);
+  record_file_ = nullptr;
+}
+
 Http2Upstream::~Http2Upstream() {
+  close_record_file();
   nghttp2_session_del(session_);
   ev_prepare_stop(handler_->get_loop(), &prep_);
   ev_timer_stop(handler_->get_loop(), &shutdown_timer_);
@@ -794,6 +896,20 @@ int Http2Upstream::on_read() {
       break;
     }
 
+    // The file is opened here, rather than in constructor, so that
+    // the connection upgraded from HTTP/1.1 does not leave an empty
+    // file.
+    if (record_ && !record_file_) {
+      open_record_file();
+    }
+
+    if (record_file_) {
+      record_buf_.append(static_cast<const char *>(data), nread);
+      if (record_buf_.size() >= 64 * 1024) {
+        flush_record_file();
+      }
+    }
+
     rv = nghttp2_session_mem_recv(
         session_, reinterpret_cast<const uint8_t *>(data), nread);
     if (rv < 0) {
@@ -1252,7 +1368,7 @@ int Http2Upstream::on_downstream_header_complete(Downstream *downstream) {
     }
   } else {
     if (via) {
-      via_value = (*via).value;
+      via_value.assign((*via).value.c_str(), (*via).value.size());
       via_value += ", ";
     }
     via_value += http::create_via_header_value(
@@ -1439,7 +1555,7 @@ int Http2Upstream::on_downstream_reset(bool no_retry) {
     // downstream connection.
 
     rv = downstream->attach_downstream_connection(
-        handler_->get_downstream_connection());
+        handler_->get_downstream_connection(downstream));
     if (rv != 0) {
       rst_stream(downstream, NGHTTP2_INTERNAL_ERROR);
       downstream->pop_downstream_connection();
@@ -1452,6 +1568,14 @@ int Http2Upstream::on_downstream_reset(bool no_retry) {
   return 0;
 }
 
+int Http2Upstream::on_collapsed_request_ready(Downstream *downstream) {
+  start_downstream(downstream);
+
+  handler_->signal_write();
+
+  return 0;
+}
+
 MemchunkPool *Http2Upstream::get_mcpool() { return &mcpool_; }
 
 } // namespace shrpx
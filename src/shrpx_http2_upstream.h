@@ -81,6 +81,7 @@ public:
 
   virtual void on_handler_delete();
   virtual int on_downstream_reset(bool no_retry);
+  virtual int on_collapsed_request_ready(Downstream *downstream);
 
   virtual MemchunkPool *get_mcpool();
 
@@ -100,6 +101,13 @@ public:
   void submit_goaway();
   void check_shutdown();
 
+  // Opens file to record incoming bytes.  Called when the first
+  // bytes are read if --frontend-http2-record-dir is given.
+  void open_record_file();
+  // Writes buffered incoming bytes to the record file.
+  void flush_record_file();
+  void close_record_file();
+
 private:
   // must be put before downstream_queue_
   std::unique_ptr<HttpsUpstream> pre_upstream_;
@@ -107,13 +115,22 @@ private:
   DownstreamQueue downstream_queue_;
   ev_timer settings_timer_;
   ev_timer shutdown_timer_;
+  // Periodically writes record_buf_ to record_file_.
+  ev_timer record_timer_;
   ev_prepare prep_;
   ClientHandler *handler_;
   nghttp2_session *session_;
+  // Incoming bytes which are not written to record_file_ yet.
+  std::string record_buf_;
+  // File where incoming bytes are recorded, or nullptr.
+  FILE *record_file_;
   const uint8_t *data_pending_;
   size_t data_pendinglen_;
   bool flow_control_;
   bool shutdown_handled_;
+  // true if incoming bytes should be recorded.  It becomes false
+  // when HTTP Upgrade is used, or recording fails.
+  bool record_;
 };
 
 } // namespace shrpx
@@ -0,0 +1,747 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_http_cache.h"
+
+#include <algorithm>
+
+#include "shrpx_downstream.h"
+#include "shrpx_upstream.h"
+#include "shrpx_client_handler.h"
+#include "shrpx_worker.h"
+#include "shrpx_worker_config.h"
+#include "shrpx_config.h"
+#include "util.h"
+
+namespace shrpx {
+
+size_t CacheEntry::size() const {
+  auto n = sizeof(*this) + key.size() + body.size();
+  for (auto &hd : headers) {
+    n += hd.name.size() + hd.value.size();
+  }
+  for (auto &hd : vary) {
+    n += hd.name.size() + hd.value.size();
+  }
+  return n;
+}
+
+CacheControl::CacheControl()
+    : max_age(-1), s_maxage(-1), no_store(false), no_cache(false),
+      private_(false) {}
+
+namespace {
+bool ows(char c) { return c == ' ' || c == '\t'; }
+} // namespace
+
+namespace {
+// Calls |f| with each element of comma separated list |value|, with
+// surrounding white spaces removed.  Empty elements are skipped.
+template <typename F>
+void for_each_element(const char *value, size_t len, F f) {
+  auto last = value + len;
+  for (auto first = value; first != last;) {
+    auto end = std::find(first, last, ',');
+    auto p = first;
+    auto q = end;
+    for (; p != q && ows(*p); ++p)
+      ;
+    for (; q != p && ows(*(q - 1)); --q)
+      ;
+    if (p != q) {
+      f(p, q);
+    }
+    first = end == last ? last : end + 1;
+  }
+}
+} // namespace
+
+void parse_cache_control(CacheControl &cc, const char *value, size_t len) {
+  for_each_element(value, len, [&cc](const char *first, const char *last) {
+    auto eq = std::find(first, last, '=');
+    auto namelen = eq - first;
+
+    if (util::strieq("no-store", first, namelen)) {
+      cc.no_store = true;
+      return;
+    }
+    // no-cache and private with field names are treated as if they
+    // are applied to the whole response.
+    if (util::strieq("no-cache", first, namelen)) {
+      cc.no_cache = true;
+      return;
+    }
+    if (util::strieq("private", first, namelen)) {
+      cc.private_ = true;
+      return;
+    }
+
+    int64_t *dest;
+    if (util::strieq("max-age", first, namelen)) {
+      dest = &cc.max_age;
+    } else if (util::strieq("s-maxage", first, namelen)) {
+      dest = &cc.s_maxage;
+    } else {
+      return;
+    }
+
+    if (eq == last) {
+      return;
+    }
+
+    auto p = eq + 1;
+    auto q = last;
+    if (q - p >= 2 && *p == '"' && *(q - 1) == '"') {
+      ++p;
+      --q;
+    }
+
+    *dest = util::parse_uint(reinterpret_cast<const uint8_t *>(p), q - p);
+  });
+}
+
+namespace {
+void readycb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto cache = static_cast<HttpCache *>(w->data);
+  cache->resume_followers();
+}
+} // namespace
+
+namespace {
+void waitcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto cache = static_cast<HttpCache *>(w->data);
+  cache->expire_followers();
+}
+} // namespace
+
+HttpCache::HttpCache(struct ev_loop *loop, size_t max_size,
+                     size_t max_object_size, ev_tstamp collapse_timeout)
+    : loop_(loop), collapse_timeout_(collapse_timeout), size_(0),
+      max_size_(max_size), max_object_size_(max_object_size) {
+  ev_timer_init(&readyev_, readycb, 0., 0.);
+  readyev_.data = this;
+  ev_timer_init(&waitev_, waitcb, 0., 0.);
+  waitev_.data = this;
+}
+
+HttpCache::~HttpCache() {
+  ev_timer_stop(loop_, &readyev_);
+  ev_timer_stop(loop_, &waitev_);
+}
+
+const CacheEntry *HttpCache::lookup(const std::string &key,
+                                    const Downstream *downstream,
+                                    ev_tstamp now) {
+  auto it = entries_.find(key);
+  if (it == std::end(entries_)) {
+    return nullptr;
+  }
+
+  auto ent = (*(*it).second).get();
+
+  if (ent->expires <= now) {
+    size_ -= ent->size();
+    lru_.erase((*it).second);
+    entries_.erase(it);
+    return nullptr;
+  }
+
+  for (auto &hd : ent->vary) {
+    auto req_hd = downstream->get_request_header(hd.name);
+    if (!req_hd) {
+      if (!hd.value.empty()) {
+        return nullptr;
+      }
+      continue;
+    }
+    if ((*req_hd).value != hd.value) {
+      return nullptr;
+    }
+  }
+
+  lru_.splice(std::begin(lru_), lru_, (*it).second);
+
+  return ent;
+}
+
+void HttpCache::store(std::unique_ptr<CacheEntry> ent) {
+  if (ent->body.size() > max_object_size_) {
+    return;
+  }
+
+  auto n = ent->size();
+  if (n > max_size_) {
+    return;
+  }
+
+  remove(ent->key);
+  evict(n);
+
+  auto key = ent->key;
+  lru_.push_front(std::move(ent));
+  entries_.emplace(std::move(key), std::begin(lru_));
+  size_ += n;
+}
+
+void HttpCache::remove(const std::string &key) {
+  auto it = entries_.find(key);
+  if (it == std::end(entries_)) {
+    return;
+  }
+  size_ -= (*(*it).second)->size();
+  lru_.erase((*it).second);
+  entries_.erase(it);
+}
+
+void HttpCache::evict(size_t needed) {
+  while (!lru_.empty() && size_ + needed > max_size_) {
+    auto &ent = lru_.back();
+    size_ -= ent->size();
+    entries_.erase(ent->key);
+    lru_.pop_back();
+  }
+}
+
+size_t HttpCache::get_size() const { return size_; }
+
+size_t HttpCache::get_num_entries() const { return entries_.size(); }
+
+size_t HttpCache::get_max_object_size() const { return max_object_size_; }
+
+void HttpCache::add_leader(const std::string &key) {
+  in_flight_.emplace(key, std::vector<Follower>());
+}
+
+void HttpCache::remove_leader(const std::string &key) {
+  auto it = in_flight_.find(key);
+  if (it == std::end(in_flight_)) {
+    return;
+  }
+
+  for (auto &f : (*it).second) {
+    ready_.push_back(f.downstream);
+  }
+  in_flight_.erase(it);
+
+  schedule_resume();
+}
+
+void HttpCache::schedule_resume() {
+  if (!ready_.empty() && !ev_is_active(&readyev_)) {
+    ev_timer_start(loop_, &readyev_);
+  }
+}
+
+bool HttpCache::in_flight(const std::string &key) const {
+  return in_flight_.find(key) != std::end(in_flight_);
+}
+
+size_t HttpCache::get_num_followers(const std::string &key) const {
+  auto it = in_flight_.find(key);
+  if (it == std::end(in_flight_)) {
+    return 0;
+  }
+
+  return (*it).second.size();
+}
+
+bool HttpCache::add_follower(Downstream *downstream) {
+  auto it = in_flight_.find(downstream->get_cache_key());
+  if (it == std::end(in_flight_)) {
+    return false;
+  }
+
+  (*it).second.push_back({downstream, ev_now(loop_) + collapse_timeout_});
+
+  // Followers are added in the order of their deadline, so the timer
+  // is already set for an earlier one if it is active.
+  if (collapse_timeout_ > 0. && !ev_is_active(&waitev_)) {
+    ev_timer_set(&waitev_, collapse_timeout_, 0.);
+    ev_timer_start(loop_, &waitev_);
+  }
+
+  return true;
+}
+
+void HttpCache::remove_follower(Downstream *downstream) {
+  auto it = in_flight_.find(downstream->get_cache_key());
+  if (it != std::end(in_flight_)) {
+    auto &followers = (*it).second;
+    followers.erase(std::remove_if(std::begin(followers), std::end(followers),
+                                   [downstream](const Follower &f) {
+                                     return f.downstream == downstream;
+                                   }),
+                    std::end(followers));
+  }
+
+  ready_.erase(std::remove(std::begin(ready_), std::end(ready_), downstream),
+               std::end(ready_));
+}
+
+void HttpCache::resume_followers() {
+  // Upstream may delete other followers, so take them one by one.
+  while (!ready_.empty()) {
+    auto downstream = ready_.front();
+    ready_.pop_front();
+
+    downstream->set_cache_state(Downstream::CACHE_RELEASED);
+
+    auto upstream = downstream->get_upstream();
+    if (upstream->on_collapsed_request_ready(downstream) != 0) {
+      delete upstream->get_client_handler();
+    }
+  }
+}
+
+void HttpCache::expire_followers() {
+  auto now = ev_now(loop_);
+  ev_tstamp next = 0.;
+
+  for (auto &kv : in_flight_) {
+    auto &followers = kv.second;
+    auto it = std::stable_partition(
+        std::begin(followers), std::end(followers),
+        [now](const Follower &f) { return f.deadline > now; });
+
+    for (auto i = it; i != std::end(followers); ++i) {
+      if (LOG_ENABLED(INFO)) {
+        DLOG(INFO, (*i).downstream)
+            << "Waited too long for the request in flight: " << kv.first;
+      }
+      ready_.push_back((*i).downstream);
+    }
+    followers.erase(it, std::end(followers));
+
+    if (!followers.empty() &&
+        (next == 0. || followers.front().deadline < next)) {
+      next = followers.front().deadline;
+    }
+  }
+
+  schedule_resume();
+
+  if (next > 0.) {
+    ev_timer_set(&waitev_, next - now, 0.);
+    ev_timer_start(loop_, &waitev_);
+  }
+}
+
+std::string create_cache_key(const Downstream *downstream) {
+  std::string key = "GET ";
+
+  auto &authority = downstream->get_request_http2_authority();
+  if (!authority.empty()) {
+    key += authority;
+  } else {
+    auto host = downstream->get_request_header(http2::HD_HOST);
+    if (host) {
+      key.append((*host).value.c_str(), (*host).value.size());
+    }
+  }
+
+  key += " ";
+  key += downstream->get_request_path();
+
+  return key;
+}
+
+namespace {
+HttpCache *get_http_cache(const Downstream *downstream) {
+  if (get_config()->cache_size == 0) {
+    return nullptr;
+  }
+
+  auto &cache = worker_config->http_cache;
+  if (!cache) {
+    cache = util::make_unique<HttpCache>(
+        downstream->get_upstream()->get_client_handler()->get_loop(),
+        get_config()->cache_size, get_config()->cache_max_object_size,
+        get_config()->cache_collapse_timeout);
+  }
+
+  return cache.get();
+}
+} // namespace
+
+namespace {
+ev_tstamp get_now(const Downstream *downstream) {
+  return ev_now(downstream->get_upstream()->get_client_handler()->get_loop());
+}
+} // namespace
+
+namespace {
+// Returns true if the response to the request of |downstream| may be
+// stored.  |use_cached| is set to false if the request does not
+// allow stored response to be used without validation.
+bool request_cacheable(const Downstream *downstream, bool &use_cached) {
+  auto &method = downstream->get_request_method();
+  if (method != "GET" && method != "HEAD") {
+    return false;
+  }
+
+  if (downstream->get_upgrade_request() ||
+      downstream->get_chunked_request() ||
+      downstream->get_request_content_length() > 0 ||
+      downstream->get_request_http2_expect_body()) {
+    return false;
+  }
+
+  use_cached = true;
+
+  CacheControl cc;
+  for (auto &hd : downstream->get_request_headers()) {
+    if (hd.name == "authorization") {
+      return false;
+    }
+    if (hd.name == "cache-control") {
+      parse_cache_control(cc, hd.value.c_str(), hd.value.size());
+      continue;
+    }
+    // We do not evaluate conditional and range requests against
+    // stored response.  Just forward them to backend.
+    if (hd.name == "pragma" || hd.name == "if-none-match" ||
+        hd.name == "if-modified-since" || hd.name == "if-match" ||
+        hd.name == "if-unmodified-since" || hd.name == "range") {
+      use_cached = false;
+    }
+  }
+
+  if (cc.no_store) {
+    return false;
+  }
+
+  if (cc.no_cache || cc.max_age == 0) {
+    use_cached = false;
+  }
+
+  return true;
+}
+} // namespace
+
+namespace {
+int send_cached_response(Downstream *downstream, const CacheEntry *ent,
+                         ev_tstamp now) {
+  auto upstream = downstream->get_upstream();
+
+  for (auto &hd : ent->headers) {
+    downstream->add_response_header(StringRef(hd.name), StringRef(hd.value));
+  }
+
+  auto age = util::utos(ent->initial_age +
+                        static_cast<int64_t>(now - ent->stored_at));
+  downstream->add_response_header(StringRef::from_lit("age"), StringRef(age));
+
+  downstream->set_response_http_status(ent->status);
+  downstream->set_response_major(1);
+  downstream->set_response_minor(1);
+
+  if (downstream->index_response_headers() != 0) {
+    return -1;
+  }
+
+  downstream->set_response_state(Downstream::HEADER_COMPLETE);
+
+  if (upstream->on_downstream_header_complete(downstream) != 0) {
+    return -1;
+  }
+
+  if (downstream->expect_response_body() && !ent->body.empty()) {
+    downstream->add_response_bodylen(ent->body.size());
+
+    if (upstream->on_downstream_body(
+            downstream, reinterpret_cast<const uint8_t *>(ent->body.c_str()),
+            ent->body.size(), true) != 0) {
+      return -1;
+    }
+  }
+
+  downstream->set_response_state(Downstream::MSG_COMPLETE);
+
+  if (upstream->on_downstream_body_complete(downstream) != 0) {
+    return -1;
+  }
+
+  return 1;
+}
+} // namespace
+
+int http_cache_lookup(Downstream *downstream) {
+  auto cache = get_http_cache(downstream);
+  if (!cache) {
+    return 0;
+  }
+
+  bool use_cached;
+  if (!request_cacheable(downstream, use_cached)) {
+    return 0;
+  }
+
+  auto key = create_cache_key(downstream);
+  auto &metrics =
+      downstream->get_upstream()->get_client_handler()->get_worker_stat()
+          ->metrics;
+
+  if (use_cached) {
+    auto now = get_now(downstream);
+    auto ent = cache->lookup(key, downstream, now);
+    if (ent) {
+      if (LOG_ENABLED(INFO)) {
+        DLOG(INFO, downstream) << "Cache hit: " << key;
+      }
+
+      metrics.cache_hits.add();
+
+      return send_cached_response(downstream, ent, now);
+    }
+
+    // Followers resumed by their leader never wait again, so that
+    // they are not serialized if the response is not cacheable.
+    if (downstream->get_cache_state() == Downstream::CACHE_NONE &&
+        cache->in_flight(key)) {
+      if (LOG_ENABLED(INFO)) {
+        DLOG(INFO, downstream) << "Waiting for the request in flight: "
+                               << key;
+      }
+
+      metrics.cache_collapsed.add();
+
+      downstream->set_cache_key(std::move(key));
+      downstream->set_cache_state(Downstream::CACHE_FOLLOWER);
+      cache->add_follower(downstream);
+
+      return 2;
+    }
+  }
+
+  metrics.cache_misses.add();
+
+  if (downstream->get_request_method() == "GET") {
+    if (downstream->get_cache_state() == Downstream::CACHE_NONE &&
+        !cache->in_flight(key)) {
+      cache->add_leader(key);
+      downstream->set_cache_state(Downstream::CACHE_LEADER);
+    }
+    downstream->set_cache_key(std::move(key));
+  }
+
+  return 0;
+}
+
+namespace {
+// Resumes the followers of |downstream| if it is a leader.
+void release_leader(Downstream *downstream) {
+  if (downstream->get_cache_state() != Downstream::CACHE_LEADER) {
+    return;
+  }
+
+  downstream->set_cache_state(Downstream::CACHE_NONE);
+
+  // This may be called from the destructor of Downstream.  Don't
+  // create cache here.
+  auto &cache = worker_config->http_cache;
+  if (cache) {
+    cache->remove_leader(downstream->get_cache_key());
+  }
+}
+} // namespace
+
+namespace {
+bool cacheable_status(unsigned int status) {
+  switch (status) {
+  case 200:
+  case 203:
+  case 204:
+  case 300:
+  case 301:
+  case 404:
+  case 410:
+    return true;
+  default:
+    return false;
+  }
+}
+} // namespace
+
+namespace {
+// Returns new CacheEntry without response body if the response of
+// |downstream| is cacheable.  Otherwise returns nullptr.
+std::unique_ptr<CacheEntry> create_cache_entry(Downstream *downstream) {
+  if (downstream->get_cache_key().empty() ||
+      !cacheable_status(downstream->get_response_http_status()) ||
+      downstream->get_upgraded()) {
+    return nullptr;
+  }
+
+  auto cache = get_http_cache(downstream);
+  if (!cache) {
+    return nullptr;
+  }
+
+  if (downstream->get_response_content_length() >
+      static_cast<int64_t>(cache->get_max_object_size())) {
+    return nullptr;
+  }
+
+  CacheControl cc;
+  int64_t age = 0;
+  std::vector<std::string> vary;
+
+  for (auto &hd : downstream->get_response_headers()) {
+    if (hd.name == "set-cookie") {
+      return nullptr;
+    }
+    if (hd.name == "cache-control") {
+      parse_cache_control(cc, hd.value.c_str(), hd.value.size());
+      continue;
+    }
+    if (hd.name == "age") {
+      age = util::parse_uint(hd.value.byte(), hd.value.size());
+      if (age < 0) {
+        age = 0;
+      }
+      continue;
+    }
+    if (hd.name == "vary") {
+      for_each_element(hd.value.c_str(), hd.value.size(),
+                       [&vary](const char *first, const char *last) {
+        vary.emplace_back(first, last);
+        util::inp_strlower(vary.back());
+      });
+    }
+  }
+
+  if (cc.no_store || cc.no_cache || cc.private_) {
+    return nullptr;
+  }
+
+  auto ttl = cc.s_maxage != -1 ? cc.s_maxage : cc.max_age;
+  if (ttl <= age) {
+    return nullptr;
+  }
+
+  auto ent = util::make_unique<CacheEntry>();
+
+  for (auto &name : vary) {
+    if (name == "*") {
+      return nullptr;
+    }
+    ent->vary.emplace_back(
+        name, http2::value_to_str(downstream->get_request_header(name)));
+  }
+
+  for (auto &hd : downstream->get_response_headers()) {
+    if (hd.name.empty() || hd.name[0] == ':' || hd.name == "age") {
+      continue;
+    }
+    switch (http2::lookup_token(hd.name.byte(), hd.name.size())) {
+    case http2::HD_CONNECTION:
+    case http2::HD_CONTENT_LENGTH:
+    case http2::HD_KEEP_ALIVE:
+    case http2::HD_PROXY_CONNECTION:
+    case http2::HD_TE:
+    case http2::HD_TRAILER:
+    case http2::HD_TRANSFER_ENCODING:
+    case http2::HD_UPGRADE:
+      continue;
+    }
+    ent->headers.emplace_back(hd.name.str(), hd.value.str(), hd.no_index);
+  }
+
+  auto now = get_now(downstream);
+
+  ent->key = downstream->get_cache_key();
+  ent->stored_at = now;
+  ent->expires = now + (ttl - age);
+  ent->initial_age = age;
+  ent->status = downstream->get_response_http_status();
+
+  return ent;
+}
+} // namespace
+
+void http_cache_begin_store(Downstream *downstream) {
+  auto ent = create_cache_entry(downstream);
+  if (!ent) {
+    // Followers do not have to wait for the response which is not
+    // stored.
+    release_leader(downstream);
+    return;
+  }
+
+  downstream->set_cache_entry(std::move(ent));
+}
+
+void http_cache_end_store(Downstream *downstream) {
+  auto ent = downstream->pop_cache_entry();
+  if (!ent || !downstream->validate_response_bodylen()) {
+    release_leader(downstream);
+    return;
+  }
+
+  auto cache = get_http_cache(downstream);
+  if (!cache) {
+    return;
+  }
+
+  if (ent->status != 204) {
+    ent->headers.emplace_back("content-length", util::utos(ent->body.size()));
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    DLOG(INFO, downstream) << "Cache store: " << ent->key
+                           << ", size=" << ent->size();
+  }
+
+  cache->store(std::move(ent));
+
+  release_leader(downstream);
+}
+
+void http_cache_abort_store(Downstream *downstream) {
+  if (LOG_ENABLED(INFO)) {
+    DLOG(INFO, downstream) << "Response is too large to store: "
+                           << downstream->get_cache_key();
+  }
+
+  downstream->pop_cache_entry();
+
+  release_leader(downstream);
+}
+
+void http_cache_detach(Downstream *downstream) {
+  switch (downstream->get_cache_state()) {
+  case Downstream::CACHE_LEADER:
+    release_leader(downstream);
+    break;
+  case Downstream::CACHE_FOLLOWER: {
+    auto &cache = worker_config->http_cache;
+    if (cache) {
+      cache->remove_follower(downstream);
+    }
+    break;
+  }
+  }
+}
+
+} // namespace shrpx
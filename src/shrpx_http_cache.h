@@ -0,0 +1,208 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_HTTP_CACHE_H
+#define SHRPX_HTTP_CACHE_H
+
+#include "shrpx.h"
+
+#include <string>
+#include <list>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include <ev.h>
+
+#include "http2.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+class Downstream;
+
+// Response stored in HttpCache.
+struct CacheEntry {
+  // The number of bytes this entry accounts for in the cache.
+  size_t size() const;
+
+  std::string key;
+  // Response header fields, excluding hop-by-hop header fields and
+  // age.  content-length is recomputed from body.
+  Headers headers;
+  // Request header fields nominated by vary response header field,
+  // and their values in the request which produced this response.
+  Headers vary;
+  std::string body;
+  // The time when this entry was stored.
+  ev_tstamp stored_at;
+  // The time when this entry becomes stale.
+  ev_tstamp expires;
+  // The value of age header field received from backend.
+  int64_t initial_age;
+  unsigned int status;
+};
+
+// Parsed Cache-Control header field.  max_age and s_maxage are -1 if
+// they are not present.
+struct CacheControl {
+  CacheControl();
+
+  int64_t max_age;
+  int64_t s_maxage;
+  bool no_store;
+  bool no_cache;
+  bool private_;
+};
+
+// Parses the value of Cache-Control header field |value|, and adds
+// found directives to |cc|.  Unknown directives are ignored.
+void parse_cache_control(CacheControl &cc, const char *value, size_t len);
+
+// Per worker in-memory response cache.  Entries are evicted in least
+// recently used order so that the sum of their size() does not exceed
+// |max_size|.  HttpCache is not thread safe.
+//
+// HttpCache also collapses concurrent requests for the same key.
+// While a leader request is fetching the response from backend,
+// followers wait for it instead of going to backend.  When the
+// leader finishes, followers are resumed in the next event loop
+// iteration, and they are served from cache if the response has been
+// stored.  A follower which has waited for |collapse_timeout| seconds
+// is resumed without waiting for the leader any longer.  0 disables
+// this limit.
+class HttpCache {
+public:
+  HttpCache(struct ev_loop *loop, size_t max_size, size_t max_object_size,
+            ev_tstamp collapse_timeout);
+  ~HttpCache();
+  // Returns fresh entry for |key| whose vary header fields match the
+  // request of |downstream|, or nullptr.  Stale entry is removed.
+  const CacheEntry *lookup(const std::string &key, const Downstream *downstream,
+                           ev_tstamp now);
+  // Stores |ent|, replacing existing entry with the same key.  If
+  // |ent| is larger than max_object_size, it is discarded.
+  void store(std::unique_ptr<CacheEntry> ent);
+  void remove(const std::string &key);
+  size_t get_size() const;
+  size_t get_num_entries() const;
+  size_t get_max_object_size() const;
+
+  // Marks that the response for |key| is being fetched from backend.
+  void add_leader(const std::string &key);
+  // Removes the mark added by add_leader(), and schedules the
+  // followers waiting for |key| to be resumed.
+  void remove_leader(const std::string &key);
+  // Returns true if the response for |key| is being fetched from
+  // backend.
+  bool in_flight(const std::string &key) const;
+  // Returns the number of followers waiting for the response for
+  // |key|.
+  size_t get_num_followers(const std::string &key) const;
+  // Adds |downstream| as a follower of the leader fetching the
+  // response for its cache key.  Returns false if there is no such
+  // leader.
+  bool add_follower(Downstream *downstream);
+  // Removes |downstream| from the followers, either waiting or
+  // scheduled to be resumed.
+  void remove_follower(Downstream *downstream);
+  // Resumes the followers scheduled by remove_leader().
+  void resume_followers();
+  // Schedules the followers which have waited for collapse_timeout
+  // to be resumed.
+  void expire_followers();
+
+private:
+  typedef std::list<std::unique_ptr<CacheEntry>> EntryList;
+
+  struct Follower {
+    Downstream *downstream;
+    // The time when |downstream| stops waiting for the leader.
+    ev_tstamp deadline;
+  };
+
+  void evict(size_t needed);
+  void schedule_resume();
+
+  // Followers waiting for the leader, indexed by cache key.
+  std::unordered_map<std::string, std::vector<Follower>> in_flight_;
+  // Followers whose leader has finished, or which have waited too
+  // long.
+  std::deque<Downstream *> ready_;
+  ev_timer readyev_;
+  // Fires when the oldest follower reaches its deadline.
+  ev_timer waitev_;
+  struct ev_loop *loop_;
+  ev_tstamp collapse_timeout_;
+
+  // Most recently used entry comes first.
+  EntryList lru_;
+  std::unordered_map<std::string, EntryList::iterator> entries_;
+  size_t size_;
+  size_t max_size_;
+  size_t max_object_size_;
+};
+
+// Returns the cache key of the request of |downstream|.  HEAD request
+// shares the entry with GET request.
+std::string create_cache_key(const Downstream *downstream);
+
+// Looks up the response to the request of |downstream| in the worker
+// cache.  If it is found, the response is sent through upstream, and
+// this function returns 1.  If the same request is being fetched from
+// backend, |downstream| becomes its follower, and this function
+// returns 2.  Upstream must not send the request to backend, and
+// wait for Upstream::on_collapsed_request_ready() to be called.
+// Otherwise returns 0, and the request should be sent to backend.  If
+// the request is cacheable, its cache key is remembered in
+// |downstream| so that its response can be stored.  Returns -1 if
+// sending the response failed.  The request header fields must be
+// indexed and the request must have been completely received.
+int http_cache_lookup(Downstream *downstream);
+
+// Called when response header fields of |downstream| are received
+// from backend.  If the response is cacheable, starts collecting
+// response body in |downstream|.
+void http_cache_begin_store(Downstream *downstream);
+
+// Stores the response collected in |downstream| in the worker cache.
+// Called when the response has been completely received.  If
+// |downstream| is a leader, its followers are resumed.
+void http_cache_end_store(Downstream *downstream);
+
+// Discards the response collected in |downstream| without storing
+// it.  Called when the response body exceeds the size limit.  If
+// |downstream| is a leader, its followers are resumed so that they
+// go to backend instead of waiting for the whole response.
+void http_cache_abort_store(Downstream *downstream);
+
+// Removes |downstream| from request collapsing.  Called when
+// |downstream| is deleted.
+void http_cache_detach(Downstream *downstream);
+
+} // namespace shrpx
+
+#endif // SHRPX_HTTP_CACHE_H
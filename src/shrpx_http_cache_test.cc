@@ -0,0 +1,228 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_http_cache_test.h"
+
+#include <unistd.h>
+
+#include <cstring>
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_http_cache.h"
+#include "shrpx_downstream.h"
+#include "shrpx_config.h"
+#include "shrpx_worker_config.h"
+#include "util.h"
+
+namespace shrpx {
+
+namespace {
+CacheControl parse(const char *s) {
+  CacheControl cc;
+  parse_cache_control(cc, s, strlen(s));
+  return cc;
+}
+} // namespace
+
+void test_shrpx_http_cache_parse_cache_control(void) {
+  auto cc = parse("public, max-age=60");
+
+  CU_ASSERT(60 == cc.max_age);
+  CU_ASSERT(-1 == cc.s_maxage);
+  CU_ASSERT(!cc.no_store);
+  CU_ASSERT(!cc.no_cache);
+  CU_ASSERT(!cc.private_);
+
+  cc = parse(" S-MaxAge=\"120\" ,,no-cache=\"set-cookie\", Private ");
+
+  CU_ASSERT(-1 == cc.max_age);
+  CU_ASSERT(120 == cc.s_maxage);
+  CU_ASSERT(cc.no_cache);
+  CU_ASSERT(cc.private_);
+
+  cc = parse("no-store,max-age=foo");
+
+  CU_ASSERT(cc.no_store);
+  CU_ASSERT(-1 == cc.max_age);
+}
+
+namespace {
+std::unique_ptr<CacheEntry> make_entry(std::string key, size_t bodylen,
+                                       ev_tstamp expires) {
+  auto ent = util::make_unique<CacheEntry>();
+  ent->key = std::move(key);
+  ent->body.assign(bodylen, 'a');
+  ent->stored_at = 0.;
+  ent->expires = expires;
+  ent->initial_age = 0;
+  ent->status = 200;
+  return ent;
+}
+} // namespace
+
+void test_shrpx_http_cache(void) {
+  Downstream d(nullptr, 0, 0);
+  auto entlen = make_entry("a", 100, 10.)->size();
+
+  HttpCache cache(EV_DEFAULT, entlen * 2, 100, 0.);
+
+  cache.store(make_entry("a", 100, 10.));
+  cache.store(make_entry("b", 100, 10.));
+
+  CU_ASSERT(2 == cache.get_num_entries());
+  CU_ASSERT(entlen * 2 == cache.get_size());
+
+  // "a" becomes the most recently used, so "b" is evicted.
+  CU_ASSERT(nullptr != cache.lookup("a", &d, 1.));
+
+  cache.store(make_entry("c", 100, 10.));
+
+  CU_ASSERT(2 == cache.get_num_entries());
+  CU_ASSERT(nullptr == cache.lookup("b", &d, 1.));
+  CU_ASSERT(nullptr != cache.lookup("a", &d, 1.));
+  CU_ASSERT(nullptr != cache.lookup("c", &d, 1.));
+
+  // Entry larger than max_object_size is not stored.
+  cache.store(make_entry("d", 101, 10.));
+
+  CU_ASSERT(nullptr == cache.lookup("d", &d, 1.));
+
+  // Stale entry is removed.
+  CU_ASSERT(nullptr == cache.lookup("a", &d, 10.));
+  CU_ASSERT(1 == cache.get_num_entries());
+  CU_ASSERT(entlen == cache.get_size());
+
+  // Vary
+  auto ent = make_entry("e", 0, 10.);
+  ent->vary.emplace_back("accept-encoding", "gzip");
+  ent->vary.emplace_back("accept-language", "");
+  cache.store(std::move(ent));
+
+  CU_ASSERT(nullptr == cache.lookup("e", &d, 1.));
+
+  d.add_request_header("Accept-Encoding", "gzip");
+  d.index_request_headers();
+
+  CU_ASSERT(nullptr != cache.lookup("e", &d, 1.));
+
+  d.add_request_header("accept-language", "en");
+  d.index_request_headers();
+
+  CU_ASSERT(nullptr == cache.lookup("e", &d, 1.));
+
+  cache.remove("e");
+
+  CU_ASSERT(1 == cache.get_num_entries());
+}
+
+void test_shrpx_http_cache_collapse(void) {
+  HttpCache cache(EV_DEFAULT, 4096, 1024, 0.);
+  Downstream d(nullptr, 0, 0);
+
+  d.set_cache_key("a");
+
+  CU_ASSERT(!cache.in_flight("a"));
+  CU_ASSERT(!cache.add_follower(&d));
+
+  cache.add_leader("a");
+
+  CU_ASSERT(cache.in_flight("a"));
+  CU_ASSERT(cache.add_follower(&d));
+
+  cache.remove_follower(&d);
+  cache.remove_leader("a");
+
+  CU_ASSERT(!cache.in_flight("a"));
+  CU_ASSERT(!cache.add_follower(&d));
+}
+
+void test_shrpx_http_cache_collapse_timeout(void) {
+  HttpCache cache(EV_DEFAULT, 4096, 1024, 0.01);
+  Downstream d(nullptr, 0, 0);
+
+  d.set_cache_key("a");
+
+  cache.add_leader("a");
+
+  CU_ASSERT(cache.add_follower(&d));
+  CU_ASSERT(1 == cache.get_num_followers("a"));
+
+  cache.expire_followers();
+
+  CU_ASSERT(1 == cache.get_num_followers("a"));
+
+  usleep(20000);
+  ev_now_update(EV_DEFAULT);
+
+  cache.expire_followers();
+
+  // The follower stops waiting, while the leader is still in flight.
+  CU_ASSERT(0 == cache.get_num_followers("a"));
+  CU_ASSERT(cache.in_flight("a"));
+
+  cache.remove_follower(&d);
+  cache.remove_leader("a");
+}
+
+void test_shrpx_http_cache_collapse_too_large(void) {
+  auto max_object_size = get_config()->cache_max_object_size;
+  mod_config()->cache_max_object_size = 10;
+
+  auto &cache = worker_config->http_cache;
+  cache = util::make_unique<HttpCache>(EV_DEFAULT, 4096, 10, 0.);
+
+  Downstream leader(nullptr, 0, 0), follower(nullptr, 0, 0);
+
+  leader.set_cache_key("a");
+  leader.set_cache_state(Downstream::CACHE_LEADER);
+  cache->add_leader("a");
+
+  follower.set_cache_key("a");
+  follower.set_cache_state(Downstream::CACHE_FOLLOWER);
+  CU_ASSERT(cache->add_follower(&follower));
+
+  leader.set_cache_entry(util::make_unique<CacheEntry>());
+  leader.add_cache_body(reinterpret_cast<const uint8_t *>("0123456789"), 10);
+
+  CU_ASSERT(cache->in_flight("a"));
+  CU_ASSERT(1 == cache->get_num_followers("a"));
+
+  // Body exceeds the limit.  Followers must not wait for the rest of
+  // response.
+  leader.add_cache_body(reinterpret_cast<const uint8_t *>("x"), 1);
+
+  CU_ASSERT(!cache->in_flight("a"));
+  CU_ASSERT(Downstream::CACHE_NONE == leader.get_cache_state());
+  CU_ASSERT(!leader.pop_cache_entry());
+
+  // follower has no upstream to resume.
+  cache->remove_follower(&follower);
+  follower.set_cache_state(Downstream::CACHE_NONE);
+
+  cache.reset();
+  mod_config()->cache_max_object_size = max_object_size;
+}
+
+} // namespace shrpx
@@ -31,6 +31,7 @@
 #include "shrpx_error.h"
 #include "shrpx_http.h"
 #include "shrpx_worker_config.h"
+#include "shrpx_http_cache.h"
 #include "shrpx_connect_blocker.h"
 #include "shrpx_downstream_connection_pool.h"
 #include "shrpx_worker.h"
@@ -56,6 +57,8 @@ void timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
   // Do this so that dconn is not pooled
   downstream->set_response_connection_close(true);
 
+  dconn->penalize_latency();
+
   if (upstream->downstream_error(dconn, Downstream::EVENT_TIMEOUT) != 0) {
     delete handler;
   }
@@ -105,9 +108,12 @@ void connectcb(struct ev_loop *loop, ev_io *w, int revents) {
 } // namespace
 
 HttpDownstreamConnection::HttpDownstreamConnection(
-    DownstreamConnectionPool *dconn_pool, struct ev_loop *loop)
+    DownstreamConnectionPool *dconn_pool, struct ev_loop *loop,
+    size_t addr_idx)
     : DownstreamConnection(dconn_pool), rlimit_(loop, &rev_, 0, 0),
-      ioctrl_(&rlimit_), response_htp_{0}, loop_(loop), fd_(-1) {
+      ioctrl_(&rlimit_), response_htp_{0}, loop_(loop), worker_stat_(nullptr),
+      request_start_(0.), connect_start_(0.), addr_idx_(addr_idx), fd_(-1),
+      inflight_(false) {
   // We do not know fd yet, so just set dummy fd 0
   ev_io_init(&wev_, connectcb, 0, EV_WRITE);
   ev_io_init(&rev_, readcb, 0, EV_READ);
@@ -128,6 +134,8 @@ HttpDownstreamConnection::~HttpDownstreamConnection() {
   ev_io_stop(loop_, &rev_);
   ev_io_stop(loop_, &wev_);
 
+  finish_inflight();
+
   if (fd_ != -1) {
     shutdown(fd_, SHUT_WR);
     close(fd_);
@@ -139,11 +147,21 @@ HttpDownstreamConnection::~HttpDownstreamConnection() {
   }
 }
 
+void *HttpDownstreamConnection::operator new(size_t n) {
+  return worker_config->http_dconn_pool.allocate(n);
+}
+
+void HttpDownstreamConnection::operator delete(void *p, size_t n) {
+  worker_config->http_dconn_pool.deallocate(p, n);
+}
+
 int HttpDownstreamConnection::attach_downstream(Downstream *downstream) {
   if (LOG_ENABLED(INFO)) {
     DCLOG(INFO, this) << "Attaching to DOWNSTREAM:" << downstream;
   }
 
+  auto worker_stat = client_handler_->get_worker_stat();
+
   if (fd_ == -1) {
     auto connect_blocker = client_handler_->get_http1_connect_blocker();
 
@@ -155,12 +173,14 @@ int HttpDownstreamConnection::attach_downstream(Downstream *downstream) {
       return -1;
     }
 
-    auto worker_stat = client_handler_->get_worker_stat();
-    auto end = worker_stat->next_downstream;
-    for (;;) {
-      auto i = worker_stat->next_downstream;
-      ++worker_stat->next_downstream;
-      worker_stat->next_downstream %= get_config()->downstream_addrs.size();
+    auto naddrs = get_config()->downstream_addrs.size();
+    auto first = addr_idx_;
+    for (size_t n = 0; n < naddrs; ++n) {
+      auto i = (first + n) % naddrs;
+
+      if (n > 0 && !downstream_addr_usable(i)) {
+        continue;
+      }
 
       fd_ = util::create_nonblock_socket(
           get_config()->downstream_addrs[i].addr.storage.ss_family);
@@ -183,13 +203,12 @@ int HttpDownstreamConnection::attach_downstream(Downstream *downstream) {
         DCLOG(WARN, this) << "connect() failed; errno=" << error;
 
         connect_blocker->on_failure();
+        auto now = ev_now(loop_);
+        penalize_downstream_latency(&worker_stat->downstream_addr_stats[i],
+                                    now, now);
         close(fd_);
         fd_ = -1;
 
-        if (end == worker_stat->next_downstream) {
-          return SHRPX_ERR_NETWORK;
-        }
-
         // Try again with the next downstream server
         continue;
       }
@@ -203,16 +222,31 @@ int HttpDownstreamConnection::attach_downstream(Downstream *downstream) {
 
       ev_io_start(loop_, &wev_);
 
+      worker_stat_ = worker_stat;
+      addr_idx_ = i;
+      connect_start_ = ev_now(loop_);
+
       break;
     }
+
+    if (fd_ == -1) {
+      return SHRPX_ERR_NETWORK;
+    }
   }
 
   downstream_ = downstream;
+  downstream_->set_downstream_addr_idx(addr_idx_);
+
+  ++worker_stat_->downstream_addr_stats[addr_idx_].num_inflight;
+  inflight_ = true;
+  request_start_ = ev_now(loop_);
 
   http_parser_init(&response_htp_, HTTP_RESPONSE);
   response_htp_.data = downstream_;
 
   ev_set_cb(&rev_, readcb);
+  // Pooled connection has idle timeout callback
+  ev_set_cb(&rt_, timeoutcb);
 
   rt_.repeat = get_config()->downstream_read_timeout;
   ev_timer_again(loop_, &rt_);
@@ -290,14 +324,14 @@ int HttpDownstreamConnection::push_request_headers() {
   if (get_config()->add_x_forwarded_for) {
     hdrs += "X-Forwarded-For: ";
     if (xff && !get_config()->strip_incoming_x_forwarded_for) {
-      hdrs += (*xff).value;
+      hdrs.append((*xff).value.c_str(), (*xff).value.size());
       hdrs += ", ";
     }
     hdrs += client_handler_->get_ipaddr();
     hdrs += "\r\n";
   } else if (xff && !get_config()->strip_incoming_x_forwarded_for) {
     hdrs += "X-Forwarded-For: ";
-    hdrs += (*xff).value;
+    hdrs.append((*xff).value.c_str(), (*xff).value.size());
     hdrs += "\r\n";
   }
   if (!get_config()->http2_proxy && !get_config()->client_proxy &&
@@ -315,20 +349,20 @@ int HttpDownstreamConnection::push_request_headers() {
   auto expect = downstream_->get_request_header(http2::HD_EXPECT);
   if (expect && !util::strifind((*expect).value.c_str(), "100-continue")) {
     hdrs += "Expect: ";
-    hdrs += (*expect).value;
+    hdrs.append((*expect).value.c_str(), (*expect).value.size());
     hdrs += "\r\n";
   }
   auto via = downstream_->get_request_header(http2::HD_VIA);
   if (get_config()->no_via) {
     if (via) {
       hdrs += "Via: ";
-      hdrs += (*via).value;
+      hdrs.append((*via).value.c_str(), (*via).value.size());
       hdrs += "\r\n";
     }
   } else {
     hdrs += "Via: ";
     if (via) {
-      hdrs += (*via).value;
+      hdrs.append((*via).value.c_str(), (*via).value.size());
       hdrs += ", ";
     }
     hdrs += http::create_via_header_value(downstream_->get_request_major(),
@@ -420,6 +454,8 @@ void HttpDownstreamConnection::detach_downstream(Downstream *downstream) {
   if (LOG_ENABLED(INFO)) {
     DCLOG(INFO, this) << "Detaching from DOWNSTREAM:" << downstream;
   }
+  finish_inflight();
+
   downstream_ = nullptr;
   ioctrl_.force_resume_read();
 
@@ -435,6 +471,42 @@ void HttpDownstreamConnection::detach_downstream(Downstream *downstream) {
   ev_timer_again(loop_, &rt_);
 }
 
+void HttpDownstreamConnection::finish_inflight() {
+  if (!inflight_) {
+    return;
+  }
+
+  inflight_ = false;
+  request_start_ = 0.;
+
+  --worker_stat_->downstream_addr_stats[addr_idx_].num_inflight;
+}
+
+void HttpDownstreamConnection::update_latency() {
+  if (request_start_ == 0. ||
+      downstream_->get_response_state() == Downstream::INITIAL) {
+    return;
+  }
+
+  auto now = ev_now(loop_);
+
+  update_downstream_latency(&worker_stat_->downstream_addr_stats[addr_idx_],
+                            now - request_start_, now);
+
+  request_start_ = 0.;
+}
+
+void HttpDownstreamConnection::penalize_latency() {
+  if (request_start_ == 0.) {
+    return;
+  }
+
+  penalize_downstream_latency(&worker_stat_->downstream_addr_stats[addr_idx_],
+                              request_start_, ev_now(loop_));
+
+  request_start_ = 0.;
+}
+
 void HttpDownstreamConnection::pause_read(IOCtrlReason reason) {
   ioctrl_.pause_read(reason);
 }
@@ -499,6 +571,9 @@ int htp_hdrs_completecb(http_parser *htp) {
   if (downstream->get_upgraded()) {
     downstream->set_response_connection_close(true);
   }
+
+  http_cache_begin_store(downstream);
+
   if (upstream->on_downstream_header_complete(downstream) != 0) {
     return -1;
   }
@@ -542,7 +617,7 @@ int htp_hdr_keycb(http_parser *htp, const char *data, size_t len) {
   if (downstream->get_response_header_key_prev()) {
     downstream->append_last_response_header_key(data, len);
   } else {
-    downstream->add_response_header(std::string(data, len), "");
+    downstream->add_response_header(StringRef(data, len), StringRef());
   }
   if (downstream->get_response_headers_sum() > Downstream::MAX_HEADERS_SUM) {
     if (LOG_ENABLED(INFO)) {
@@ -563,7 +638,7 @@ int htp_hdr_valcb(http_parser *htp, const char *data, size_t len) {
     return 0;
   }
   if (downstream->get_response_header_key_prev()) {
-    downstream->set_last_response_header_value(std::string(data, len));
+    downstream->set_last_response_header_value(data, len);
   } else {
     downstream->append_last_response_header_value(data, len);
   }
@@ -583,6 +658,7 @@ int htp_bodycb(http_parser *htp, const char *data, size_t len) {
   auto downstream = static_cast<Downstream *>(htp->data);
 
   downstream->add_response_bodylen(len);
+  downstream->add_cache_body(reinterpret_cast<const uint8_t *>(data), len);
 
   return downstream->get_upstream()->on_downstream_body(
       downstream, reinterpret_cast<const uint8_t *>(data), len, true);
@@ -627,6 +703,10 @@ int HttpDownstreamConnection::on_read() {
   int rv;
 
   if (downstream_->get_upgraded()) {
+    if (client_handler_->get_wpipe()) {
+      return read_splice();
+    }
+
     // For upgraded connection, just pass data to the upstream.
     for (;;) {
       ssize_t nread;
@@ -664,10 +744,12 @@ int HttpDownstreamConnection::on_read() {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
         return 0;
       }
+      penalize_latency();
       return DownstreamConnection::ERR_NET;
     }
 
     if (nread == 0) {
+      penalize_latency();
       return DownstreamConnection::ERR_EOF;
     }
 
@@ -678,6 +760,7 @@ int HttpDownstreamConnection::on_read() {
       if (LOG_ENABLED(INFO)) {
         DCLOG(INFO, this) << "nproc != nread";
       }
+      penalize_latency();
       return -1;
     }
 
@@ -690,9 +773,12 @@ int HttpDownstreamConnection::on_read() {
                           << http_errno_description(htperr);
       }
 
+      penalize_latency();
       return -1;
     }
 
+    update_latency();
+
     if (downstream_->response_buf_full()) {
       downstream_->pause_read(SHRPX_NO_BUFFER);
       return 0;
@@ -711,6 +797,10 @@ int HttpDownstreamConnection::on_read() {
 int HttpDownstreamConnection::on_write() {
   ev_timer_again(loop_, &rt_);
 
+  if (client_handler_->get_rpipe()) {
+    return write_splice();
+  }
+
   auto upstream = downstream_->get_upstream();
   auto input = downstream_->get_request_buf();
 
@@ -728,6 +818,7 @@ int HttpDownstreamConnection::on_write() {
         ev_timer_again(loop_, &wt_);
         goto end;
       }
+      penalize_latency();
       return DownstreamConnection::ERR_NET;
     }
     input->drain(nwrite);
@@ -750,6 +841,53 @@ end:
   return 0;
 }
 
+int HttpDownstreamConnection::read_splice() {
+  auto wpipe = client_handler_->get_wpipe();
+
+  for (;;) {
+    if (wpipe->full()) {
+      // Resumed when client consumed pipe.
+      downstream_->pause_read(SHRPX_NO_BUFFER);
+      return 0;
+    }
+
+    auto nread = wpipe->read_from(fd_, SIZE_MAX);
+    if (nread == 0) {
+      return 0;
+    }
+    if (nread == SHRPX_ERR_EOF) {
+      return DownstreamConnection::ERR_EOF;
+    }
+    if (nread < 0) {
+      return DownstreamConnection::ERR_NET;
+    }
+
+    downstream_->add_response_sent_bodylen(nread);
+  }
+}
+
+int HttpDownstreamConnection::write_splice() {
+  auto rpipe = client_handler_->get_rpipe();
+
+  while (rpipe->rleft() > 0) {
+    auto nwrite = rpipe->write_to(fd_, rpipe->rleft());
+    if (nwrite < 0) {
+      return DownstreamConnection::ERR_NET;
+    }
+    if (nwrite == 0) {
+      ev_io_start(loop_, &wev_);
+      ev_timer_again(loop_, &wt_);
+      return 0;
+    }
+  }
+
+  ev_io_stop(loop_, &wev_);
+  ev_timer_stop(loop_, &wt_);
+
+  return downstream_->get_upstream()->resume_read(SHRPX_NO_BUFFER,
+                                                  downstream_, 0);
+}
+
 int HttpDownstreamConnection::on_connect() {
   auto connect_blocker = client_handler_->get_http1_connect_blocker();
 
@@ -760,11 +898,15 @@ int HttpDownstreamConnection::on_connect() {
       DLOG(INFO, this) << "downstream connect failed";
     }
     connect_blocker->on_failure();
+    penalize_latency();
     return -1;
   }
 
   connect_blocker->on_success();
 
+  worker_stat_->metrics.backend_connect_time.record(
+      std::max(0., ev_now(loop_) - connect_start_) * 1000000);
+
   ev_io_start(loop_, &rev_);
   ev_set_cb(&wev_, writecb);
 
@@ -35,12 +35,18 @@
 namespace shrpx {
 
 class DownstreamConnectionPool;
+struct WorkerStat;
 
 class HttpDownstreamConnection : public DownstreamConnection {
 public:
+  // |addr_idx| is the index of Config::downstream_addrs to connect
+  // to.  If connection to it fails, other addresses are tried.
   HttpDownstreamConnection(DownstreamConnectionPool *dconn_pool,
-                           struct ev_loop *loop);
+                           struct ev_loop *loop, size_t addr_idx);
   virtual ~HttpDownstreamConnection();
+  // Allocated from per thread free list.
+  static void *operator new(size_t n);
+  static void operator delete(void *p, size_t n);
   virtual int attach_downstream(Downstream *downstream);
   virtual void detach_downstream(Downstream *downstream);
 
@@ -57,11 +63,25 @@ public:
 
   virtual void on_upstream_change(Upstream *upstream);
   virtual int on_priority_change(int32_t pri) { return 0; }
+  virtual bool get_splice_allowed() const { return true; }
+  virtual size_t get_addr_idx() const { return addr_idx_; }
 
   int on_connect();
   void signal_write();
+  // Records the failure of current request before response header
+  // is received as penalty sample of backend latency.
+  void penalize_latency();
 
 private:
+  // Updates backend address statistics when request to it is
+  // finished or response header is received.
+  void finish_inflight();
+  void update_latency();
+  // Performs I/O through pipes of ClientHandler after upgraded
+  // connection is switched to splice(2) based relay.
+  int read_splice();
+  int write_splice();
+
   ev_io wev_;
   ev_io rev_;
   ev_timer wt_;
@@ -70,7 +90,18 @@ private:
   IOControl ioctrl_;
   http_parser response_htp_;
   struct ev_loop *loop_;
+  WorkerStat *worker_stat_;
+  // The time when current request was attached, or 0 if response
+  // header has been received.
+  ev_tstamp request_start_;
+  // The time when connect() to backend was called
+  ev_tstamp connect_start_;
+  // Index of Config::downstream_addrs this connection is made to
+  size_t addr_idx_;
   int fd_;
+  // true if request is counted in
+  // DownstreamAddrStat::num_inflight.
+  bool inflight_;
 };
 
 } // namespace shrpx
@@ -36,6 +36,7 @@
 #include "shrpx_config.h"
 #include "shrpx_error.h"
 #include "shrpx_worker_config.h"
+#include "shrpx_http_cache.h"
 #include "http2.h"
 #include "util.h"
 
@@ -89,7 +90,7 @@ int htp_hdr_keycb(http_parser *htp, const char *data, size_t len) {
   if (downstream->get_request_header_key_prev()) {
     downstream->append_last_request_header_key(data, len);
   } else {
-    downstream->add_request_header(std::string(data, len), "");
+    downstream->add_request_header(StringRef(data, len), StringRef());
   }
   if (downstream->get_request_headers_sum() > Downstream::MAX_HEADERS_SUM) {
     if (LOG_ENABLED(INFO)) {
@@ -111,7 +112,7 @@ int htp_hdr_valcb(http_parser *htp, const char *data, size_t len) {
     return 0;
   }
   if (downstream->get_request_header_key_prev()) {
-    downstream->set_last_request_header_value(std::string(data, len));
+    downstream->set_last_request_header_value(data, len);
   } else {
     downstream->append_last_request_header_value(data, len);
   }
@@ -176,8 +177,21 @@ int htp_hdrs_completecb(http_parser *htp) {
     }
   }
 
+  rv = http_cache_lookup(downstream);
+  if (rv < 0) {
+    return -1;
+  }
+  if (rv > 0) {
+    // Response has been served from cache, or will be after the same
+    // request in flight finishes.  We have no downstream connection
+    // for this request.
+    downstream->set_request_state(Downstream::HEADER_COMPLETE);
+
+    return 0;
+  }
+
   rv = downstream->attach_downstream_connection(
-      upstream->get_client_handler()->get_downstream_connection());
+      upstream->get_client_handler()->get_downstream_connection(downstream));
 
   if (rv != 0) {
     downstream->set_request_state(Downstream::CONNECT_FAIL);
@@ -220,9 +234,12 @@ int htp_msg_completecb(http_parser *htp) {
   }
   auto downstream = upstream->get_downstream();
   downstream->set_request_state(Downstream::MSG_COMPLETE);
-  rv = downstream->end_upload_data();
-  if (rv != 0) {
-    return -1;
+  // No downstream connection if the request is served from cache.
+  if (downstream->get_downstream_connection()) {
+    rv = downstream->end_upload_data();
+    if (rv != 0) {
+      return -1;
+    }
   }
   // Stop further processing to complete this request
   http_parser_pause(htp, 1);
@@ -254,6 +271,10 @@ int HttpsUpstream::on_read() {
   // downstream can be nullptr here, because it is initialized in the
   // callback chain called by http_parser_execute()
   if (downstream && downstream->get_upgraded()) {
+    if (handler_->get_rpipe()) {
+      return on_splice_read(downstream);
+    }
+
     for (;;) {
       std::tie(data, datalen) = rb->get();
       if (datalen == 0) {
@@ -317,8 +338,24 @@ int HttpsUpstream::on_read() {
       assert(downstream->get_request_state() == Downstream::MSG_COMPLETE);
 
       if (downstream->get_downstream_connection() == nullptr) {
-        // Error response has already be sent
+        if (downstream->get_cache_state() == Downstream::CACHE_FOLLOWER) {
+          // Wait for on_collapsed_request_ready().
+          pause_read(SHRPX_MSG_BLOCK);
+
+          return 0;
+        }
+
+        // Error response or cached response has already be sent
         assert(downstream->get_response_state() == Downstream::MSG_COMPLETE);
+
+        if (downstream->get_response_buf()->rleft() > 0) {
+          // Downstream gets deleted after response is written.
+          pause_read(SHRPX_MSG_BLOCK);
+          handler_->signal_write();
+
+          return 0;
+        }
+
         delete_downstream();
 
         return 0;
@@ -384,6 +421,9 @@ int HttpsUpstream::on_write() {
   if (!downstream) {
     return 0;
   }
+  if (downstream->get_upgraded()) {
+    start_splice(downstream);
+  }
   auto dconn = downstream->get_downstream_connection();
   auto wb = handler_->get_wb();
   if (wb->rleft() == 0 && dconn &&
@@ -420,7 +460,18 @@ int HttpsUpstream::on_write() {
     // We need this if response ends before request.
     if (downstream->get_request_state() == Downstream::MSG_COMPLETE) {
       delete_downstream();
-      return resume_read(SHRPX_MSG_BLOCK, nullptr, 0);
+      if (resume_read(SHRPX_MSG_BLOCK, nullptr, 0) != 0) {
+        return -1;
+      }
+      // Pipelined request may have been served from cache already.
+      // Write it now, since signal_write() does not take effect
+      // while we are called from the write loop.
+      downstream = get_downstream();
+      if (downstream && !downstream->get_downstream_connection() &&
+          downstream->get_response_buf()->rleft() > 0) {
+        return on_write();
+      }
+      return 0;
     }
   }
 
@@ -442,6 +493,9 @@ int HttpsUpstream::resume_read(IOCtrlReason reason, Downstream *downstream,
   if (downstream && downstream->request_buf_full()) {
     return 0;
   }
+  if (downstream && downstream->get_upgraded()) {
+    start_splice(downstream);
+  }
   if (ioctrl_.resume_read(reason)) {
     // Process remaining data in input buffer here because these bytes
     // are not notified by readcb until new data arrive.
@@ -452,6 +506,56 @@ int HttpsUpstream::resume_read(IOCtrlReason reason, Downstream *downstream,
   return 0;
 }
 
+void HttpsUpstream::start_splice(Downstream *downstream) {
+  if (handler_->get_rpipe() || !handler_->get_splice_allowed()) {
+    return;
+  }
+
+  auto dconn = downstream->get_downstream_connection();
+  if (!dconn || !dconn->get_splice_allowed()) {
+    return;
+  }
+
+  // Everything buffered so far must be flushed before the bytes
+  // start bypassing buffers.
+  if (downstream->get_response_state() != Downstream::HEADER_COMPLETE ||
+      handler_->get_rb()->rleft() || handler_->get_wb()->rleft() ||
+      downstream->get_request_buf()->rleft() ||
+      downstream->get_response_buf()->rleft()) {
+    return;
+  }
+
+  // If this fails, we just continue with the ordinary relay.
+  handler_->start_splice();
+}
+
+int HttpsUpstream::on_splice_read(Downstream *downstream) {
+  auto rpipe = handler_->get_rpipe();
+
+  if (rpipe->rleft() == 0) {
+    return 0;
+  }
+
+  auto dconn = downstream->get_downstream_connection();
+  if (!dconn) {
+    // Backend has already gone.
+    return -1;
+  }
+
+  if (downstream_write(dconn) != 0) {
+    return -1;
+  }
+
+  if (rpipe->rleft()) {
+    if (LOG_ENABLED(INFO)) {
+      ULOG(INFO, this) << "Downstream is not writable";
+    }
+    pause_read(SHRPX_NO_BUFFER);
+  }
+
+  return 0;
+}
+
 int HttpsUpstream::downstream_read(DownstreamConnection *dconn) {
   auto downstream = dconn->get_downstream();
   int rv;
@@ -711,7 +815,7 @@ int HttpsUpstream::on_downstream_header_complete(Downstream *downstream) {
     auto server = downstream->get_response_header(http2::HD_SERVER);
     if (server) {
       hdrs += "Server: ";
-      hdrs += (*server).value;
+      hdrs.append((*server).value.c_str(), (*server).value.size());
       hdrs += "\r\n";
     }
   }
@@ -720,13 +824,13 @@ int HttpsUpstream::on_downstream_header_complete(Downstream *downstream) {
   if (get_config()->no_via) {
     if (via) {
       hdrs += "Via: ";
-      hdrs += (*via).value;
+      hdrs.append((*via).value.c_str(), (*via).value.size());
       hdrs += "\r\n";
     }
   } else {
     hdrs += "Via: ";
     if (via) {
-      hdrs += (*via).value;
+      hdrs.append((*via).value.c_str(), (*via).value.size());
       hdrs += ", ";
     }
     hdrs += http::create_via_header_value(downstream->get_response_major(),
@@ -796,6 +900,34 @@ int HttpsUpstream::on_downstream_body_complete(Downstream *downstream) {
   return 0;
 }
 
+int HttpsUpstream::on_collapsed_request_ready(Downstream *downstream) {
+  int rv;
+
+  rv = http_cache_lookup(downstream);
+  if (rv < 0) {
+    return -1;
+  }
+
+  if (rv == 0) {
+    rv = downstream->attach_downstream_connection(
+        handler_->get_downstream_connection(downstream));
+    if (rv == 0) {
+      rv = downstream->push_request_headers();
+    }
+    if (rv == 0) {
+      rv = downstream->end_upload_data();
+    }
+    if (rv != 0) {
+      downstream->pop_downstream_connection();
+      error_reply(503);
+    }
+  }
+
+  handler_->signal_write();
+
+  return 0;
+}
+
 int HttpsUpstream::on_downstream_abort_request(Downstream *downstream,
                                                unsigned int status_code) {
   error_reply(status_code);
@@ -841,7 +973,7 @@ int HttpsUpstream::on_downstream_reset(bool no_retry) {
   downstream_->pop_downstream_connection();
 
   rv = downstream_->attach_downstream_connection(
-      handler_->get_downstream_connection());
+      handler_->get_downstream_connection(downstream_.get()));
   if (rv != 0) {
     return -1;
   }
@@ -75,12 +75,19 @@ public:
 
   virtual void on_handler_delete();
   virtual int on_downstream_reset(bool no_retry);
+  virtual int on_collapsed_request_ready(Downstream *downstream);
 
   virtual MemchunkPool *get_mcpool();
 
   void reset_current_header_length();
   void log_response_headers(const std::string &hdrs) const;
 
+  // Switches upgraded connection to splice(2) based relay if both
+  // ends are plain TCP and nothing is left in buffers.
+  void start_splice(Downstream *downstream);
+  // Writes bytes read from client into pipe to backend.
+  int on_splice_read(Downstream *downstream);
+
 private:
   ClientHandler *handler_;
   http_parser htp_;
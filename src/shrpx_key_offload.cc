@@ -0,0 +1,427 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_key_offload.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+
+#ifndef NOTHREADS
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#endif // !NOTHREADS
+
+#include <openssl/err.h>
+#include <openssl/rsa.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+#include <openssl/async.h>
+#endif // OPENSSL_VERSION_NUMBER >= 0x10100000L
+
+#include "shrpx_log.h"
+#include "util.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+namespace ssl {
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(NOTHREADS)
+
+namespace {
+// KeyOffloadSignal wakes up event loop which waits for the private
+// key operations of one SSL object.  It is shared by offload threads
+// and ASYNC_WAIT_CTX of SSL object, which may be freed while
+// operation is still in progress.
+struct KeyOffloadSignal {
+  KeyOffloadSignal(int rfd, int wfd) : rfd(rfd), wfd(wfd) {}
+  std::mutex mu;
+  // The read end of pipe is watched by event loop.  Both ends are -1
+  // after ASYNC_WAIT_CTX is freed.
+  int rfd;
+  int wfd;
+};
+} // namespace
+
+namespace {
+enum {
+  KEY_OFFLOAD_PRIV_ENC,
+  KEY_OFFLOAD_PRIV_DEC,
+};
+} // namespace
+
+namespace {
+struct KeyOffloadOp {
+  KeyOffloadOp() : rsa(nullptr) {}
+  ~KeyOffloadOp() {
+    if (rsa) {
+      RSA_free(rsa);
+    }
+  }
+  // Input and output are copied, since caller's buffers are gone if
+  // SSL object is freed before the operation completes.
+  std::vector<uint8_t> from;
+  std::vector<uint8_t> to;
+  std::shared_ptr<KeyOffloadSignal> signal;
+  // For the same reason, we hold a reference to the key, which may
+  // be freed with its SSL_CTX on reload.
+  RSA *rsa;
+  int type;
+  int padding;
+  int rv;
+  std::atomic<bool> done;
+};
+} // namespace
+
+namespace {
+class KeyOffloadPool {
+public:
+  KeyOffloadPool(size_t nthreads);
+  ~KeyOffloadPool();
+  void submit(std::shared_ptr<KeyOffloadOp> op);
+
+private:
+  void run();
+
+  std::vector<std::thread> threads_;
+  std::deque<std::shared_ptr<KeyOffloadOp>> queue_;
+  std::mutex mu_;
+  std::condition_variable cond_;
+  bool stop_;
+};
+} // namespace
+
+namespace {
+std::unique_ptr<KeyOffloadPool> key_offload_pool;
+RSA_METHOD *key_offload_rsa_meth;
+// The address of this variable is used as a key to find
+// KeyOffloadSignal in ASYNC_WAIT_CTX.
+int key_offload_wait_key;
+} // namespace
+
+namespace {
+int do_rsa_op(int type, int flen, const unsigned char *from, unsigned char *to,
+              RSA *rsa, int padding) {
+  auto meth = RSA_PKCS1_OpenSSL();
+  if (type == KEY_OFFLOAD_PRIV_ENC) {
+    return RSA_meth_get_priv_enc(meth)(flen, from, to, rsa, padding);
+  }
+  return RSA_meth_get_priv_dec(meth)(flen, from, to, rsa, padding);
+}
+} // namespace
+
+KeyOffloadPool::KeyOffloadPool(size_t nthreads) : stop_(false) {
+  for (size_t i = 0; i < nthreads; ++i) {
+    threads_.emplace_back([this]() { run(); });
+  }
+}
+
+KeyOffloadPool::~KeyOffloadPool() {
+  {
+    std::lock_guard<std::mutex> g(mu_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto &t : threads_) {
+    t.join();
+  }
+}
+
+void KeyOffloadPool::submit(std::shared_ptr<KeyOffloadOp> op) {
+  {
+    std::lock_guard<std::mutex> g(mu_);
+    queue_.push_back(std::move(op));
+  }
+  cond_.notify_one();
+}
+
+void KeyOffloadPool::run() {
+  for (;;) {
+    std::shared_ptr<KeyOffloadOp> op;
+    {
+      std::unique_lock<std::mutex> ulk(mu_);
+      cond_.wait(ulk, [this]() { return stop_ || !queue_.empty(); });
+      if (stop_) {
+        return;
+      }
+      op = std::move(queue_.front());
+      queue_.pop_front();
+    }
+
+    op->rv = do_rsa_op(op->type, op->from.size(), op->from.data(),
+                       op->to.data(), op->rsa, op->padding);
+    if (op->rv < 0) {
+      ERR_clear_error();
+    }
+    op->done.store(true, std::memory_order_release);
+
+    auto &signal = op->signal;
+    std::lock_guard<std::mutex> g(signal->mu);
+    if (signal->wfd == -1) {
+      continue;
+    }
+    uint8_t b = 0;
+    while (write(signal->wfd, &b, 1) == -1 && errno == EINTR)
+      ;
+  }
+}
+
+namespace {
+void key_offload_signal_cleanup(ASYNC_WAIT_CTX *waitctx, const void *key,
+                                OSSL_ASYNC_FD fd, void *data) {
+  auto p = static_cast<std::shared_ptr<KeyOffloadSignal> *>(data);
+  auto &signal = *p;
+  {
+    std::lock_guard<std::mutex> g(signal->mu);
+    close(signal->rfd);
+    close(signal->wfd);
+    signal->rfd = signal->wfd = -1;
+  }
+  delete p;
+}
+} // namespace
+
+namespace {
+// Returns KeyOffloadSignal associated to |waitctx|, creating it if
+// it does not exist yet.  This function returns nullptr if pipe
+// cannot be created.
+std::shared_ptr<KeyOffloadSignal> get_signal(ASYNC_WAIT_CTX *waitctx) {
+  OSSL_ASYNC_FD fd;
+  void *data;
+  if (ASYNC_WAIT_CTX_get_fd(waitctx, &key_offload_wait_key, &fd, &data)) {
+    return *static_cast<std::shared_ptr<KeyOffloadSignal> *>(data);
+  }
+
+  int pfd[2];
+  if (pipe(pfd) == -1) {
+    auto error = errno;
+    LOG(WARN) << "Could not create pipe for private key offload: errno="
+              << error;
+    return nullptr;
+  }
+  for (auto i = 0; i < 2; ++i) {
+    util::make_socket_nonblocking(pfd[i]);
+    util::make_socket_closeonexec(pfd[i]);
+  }
+
+  auto p = new std::shared_ptr<KeyOffloadSignal>(
+      std::make_shared<KeyOffloadSignal>(pfd[0], pfd[1]));
+  if (!ASYNC_WAIT_CTX_set_wait_fd(waitctx, &key_offload_wait_key, pfd[0], p,
+                                  key_offload_signal_cleanup)) {
+    close(pfd[0]);
+    close(pfd[1]);
+    delete p;
+    return nullptr;
+  }
+
+  return *p;
+}
+} // namespace
+
+namespace {
+int offload_rsa_op(int type, int flen, const unsigned char *from,
+                   unsigned char *to, RSA *rsa, int padding) {
+  auto job = ASYNC_get_current_job();
+  if (job == nullptr) {
+    // Not called from asynchronous job, for example, by
+    // SSL_CTX_check_private_key().
+    return do_rsa_op(type, flen, from, to, rsa, padding);
+  }
+
+  auto waitctx = ASYNC_get_wait_ctx(job);
+  auto signal = waitctx ? get_signal(waitctx) : nullptr;
+  if (!signal) {
+    return do_rsa_op(type, flen, from, to, rsa, padding);
+  }
+
+  auto op = std::make_shared<KeyOffloadOp>();
+  op->from.assign(from, from + flen);
+  op->to.resize(RSA_size(rsa));
+  op->signal = signal;
+  RSA_up_ref(rsa);
+  op->rsa = rsa;
+  op->type = type;
+  op->padding = padding;
+  op->rv = -1;
+  op->done.store(false, std::memory_order_relaxed);
+
+  key_offload_pool->submit(op);
+
+  // The job may be resumed before the operation completes, for
+  // example, if the connection becomes readable in the meantime.
+  for (;;) {
+    ASYNC_pause_job();
+
+    uint8_t buf[16];
+    while (read(signal->rfd, buf, sizeof(buf)) > 0)
+      ;
+
+    if (op->done.load(std::memory_order_acquire)) {
+      break;
+    }
+  }
+
+  if (op->rv > 0) {
+    std::copy_n(std::begin(op->to), op->rv, to);
+  }
+
+  return op->rv;
+}
+} // namespace
+
+namespace {
+int offload_rsa_priv_enc(int flen, const unsigned char *from,
+                         unsigned char *to, RSA *rsa, int padding) {
+  return offload_rsa_op(KEY_OFFLOAD_PRIV_ENC, flen, from, to, rsa, padding);
+}
+} // namespace
+
+namespace {
+int offload_rsa_priv_dec(int flen, const unsigned char *from,
+                         unsigned char *to, RSA *rsa, int padding) {
+  return offload_rsa_op(KEY_OFFLOAD_PRIV_DEC, flen, from, to, rsa, padding);
+}
+} // namespace
+
+int start_key_offload(size_t nthreads) {
+  auto meth = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+  if (meth == nullptr) {
+    return -1;
+  }
+
+  RSA_meth_set1_name(meth, "nghttpx key offload");
+  RSA_meth_set_priv_enc(meth, offload_rsa_priv_enc);
+  RSA_meth_set_priv_dec(meth, offload_rsa_priv_dec);
+
+  key_offload_rsa_meth = meth;
+  key_offload_pool = util::make_unique<KeyOffloadPool>(nthreads);
+
+  return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+namespace {
+// OpenSSL 3 performs RSA decryption of RSA key exchange with padding
+// mode which RSA_METHOD does not support.  Remove RSA key exchange
+// from cipher suites of |ssl_ctx|; private key is still used for
+// signing in (EC)DHE key exchange.
+int disable_rsa_key_exchange(SSL_CTX *ssl_ctx) {
+  std::string ciphers;
+  auto sk = SSL_CTX_get_ciphers(ssl_ctx);
+  for (int i = 0; i < sk_SSL_CIPHER_num(sk); ++i) {
+    auto cipher = sk_SSL_CIPHER_value(sk, i);
+    auto kx = SSL_CIPHER_get_kx_nid(cipher);
+    // NID_kx_any is used by TLSv1.3 cipher suites, which are not
+    // configured by SSL_CTX_set_cipher_list().
+    if (kx == NID_kx_rsa || kx == NID_kx_any) {
+      continue;
+    }
+    if (!ciphers.empty()) {
+      ciphers += ':';
+    }
+    ciphers += SSL_CIPHER_get_name(cipher);
+  }
+
+  if (ciphers.empty()) {
+    LOG(ERROR) << "No cipher suite is left after removing RSA key exchange, "
+                  "which private key offload does not support";
+    return -1;
+  }
+
+  if (SSL_CTX_set_cipher_list(ssl_ctx, ciphers.c_str()) == 0) {
+    return -1;
+  }
+
+  return 0;
+}
+} // namespace
+#endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+int enable_key_offload(SSL_CTX *ssl_ctx) {
+  if (!key_offload_rsa_meth) {
+    return 0;
+  }
+
+  auto pkey = SSL_CTX_get0_privatekey(ssl_ctx);
+  if (pkey == nullptr || EVP_PKEY_base_id(pkey) != EVP_PKEY_RSA) {
+    return 0;
+  }
+
+  auto rsa = EVP_PKEY_get1_RSA(pkey);
+  if (rsa == nullptr) {
+    return -1;
+  }
+
+  if (RSA_set_method(rsa, key_offload_rsa_meth) != 1) {
+    RSA_free(rsa);
+    return -1;
+  }
+
+  auto new_pkey = EVP_PKEY_new();
+  if (new_pkey == nullptr) {
+    RSA_free(rsa);
+    return -1;
+  }
+
+  // new_pkey takes ownership of rsa.
+  EVP_PKEY_assign_RSA(new_pkey, rsa);
+
+  auto rv = SSL_CTX_use_PrivateKey(ssl_ctx, new_pkey);
+  EVP_PKEY_free(new_pkey);
+  if (rv != 1) {
+    return -1;
+  }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  if (disable_rsa_key_exchange(ssl_ctx) != 0) {
+    return -1;
+  }
+#endif // OPENSSL_VERSION_NUMBER >= 0x30000000L
+
+  SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ASYNC);
+
+  return 0;
+}
+
+#else // !(OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(NOTHREADS))
+
+int start_key_offload(size_t nthreads) { return -1; }
+
+int enable_key_offload(SSL_CTX *ssl_ctx) { return 0; }
+
+#endif // !(OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(NOTHREADS))
+
+} // namespace ssl
+
+} // namespace shrpx
@@ -0,0 +1,58 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_KEY_OFFLOAD_H
+#define SHRPX_KEY_OFFLOAD_H
+
+#include "shrpx.h"
+
+#include <openssl/ssl.h>
+
+namespace shrpx {
+
+namespace ssl {
+
+// Starts |nthreads| threads which perform RSA private key operations
+// (signing and decryption) on behalf of worker threads, so that
+// expensive operations in TLS handshake do not block event loop.
+// This function must be called before any SSL_CTX is passed to
+// enable_key_offload().  It returns 0 if it succeeds, or -1 if
+// OpenSSL lacks asynchronous mode, or threads are not available.
+int start_key_offload(size_t nthreads);
+
+// Replaces RSA private key of |ssl_ctx| with the one which performs
+// its private key operations in offload threads, and enables
+// asynchronous mode of |ssl_ctx|.  SSL_do_handshake() then returns
+// SSL_ERROR_WANT_ASYNC while operation is in progress, and the file
+// descriptor obtained by SSL_get_all_async_fds() becomes readable
+// when it is done.  This function does nothing if
+// start_key_offload() has not succeeded or private key is not RSA.
+// It returns 0 if it succeeds, or -1.
+int enable_key_offload(SSL_CTX *ssl_ctx);
+
+} // namespace ssl
+
+} // namespace shrpx
+
+#endif // SHRPX_KEY_OFFLOAD_H
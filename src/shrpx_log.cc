@@ -34,10 +34,12 @@
 #include <ctime>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 
 #include "shrpx_config.h"
 #include "shrpx_downstream.h"
 #include "shrpx_worker_config.h"
+#include "http2.h"
 #include "util.h"
 
 using namespace nghttp2;
@@ -149,12 +151,269 @@ Log::~Log() {
 }
 
 namespace {
-template <typename OutputIterator>
-std::pair<OutputIterator, size_t> copy(const char *src, size_t avail,
-                                       OutputIterator oitr) {
-  auto nwrite = std::min(strlen(src), avail);
-  auto noitr = std::copy_n(src, nwrite, oitr);
-  return std::make_pair(noitr, avail - nwrite);
+// Names of log variables used as keys in JSON mode, indexed by
+// LogFragmentType.
+const char *LOGF_NAMES[] = {
+    "",                   // SHRPX_LOGF_NONE
+    "",                   // SHRPX_LOGF_LITERAL
+    "remote_addr",        // SHRPX_LOGF_REMOTE_ADDR
+    "time_local",         // SHRPX_LOGF_TIME_LOCAL
+    "time_iso8601",       // SHRPX_LOGF_TIME_ISO8601
+    "request",            // SHRPX_LOGF_REQUEST
+    "status",             // SHRPX_LOGF_STATUS
+    "body_bytes_sent",    // SHRPX_LOGF_BODY_BYTES_SENT
+    "http_",              // SHRPX_LOGF_HTTP
+    "remote_port",        // SHRPX_LOGF_REMOTE_PORT
+    "server_port",        // SHRPX_LOGF_SERVER_PORT
+    "request_time",       // SHRPX_LOGF_REQUEST_TIME
+    "pid",                // SHRPX_LOGF_PID
+    "alpn",               // SHRPX_LOGF_ALPN
+    "request_body_bytes", // SHRPX_LOGF_REQUEST_BODY_BYTES
+    "ttfb",               // SHRPX_LOGF_TTFB
+    "backend_addr",       // SHRPX_LOGF_BACKEND_ADDR
+    "backend_proto",      // SHRPX_LOGF_BACKEND_PROTO
+};
+} // namespace
+
+namespace {
+// LogWriter writes one access log record into fixed size buffer in
+// the format of shrpx_accesslog_mode.  In text mode, the record is truncated
+// if it does not fit in the buffer.  In JSON and binary mode,
+// truncated record cannot be parsed, and end_record() fails instead.
+class LogWriter {
+public:
+  LogWriter(shrpx_accesslog_mode mode, char *buf, size_t buflen)
+      : mode_(mode), first_(buf), last_(buf + buflen), p_(buf),
+        str_start_(nullptr), nfields_(0), overflow_(false) {}
+
+  void begin_record() {
+    switch (mode_) {
+    case ACCESSLOG_MODE_TEXT:
+      break;
+    case ACCESSLOG_MODE_JSON:
+      raw("{", 1);
+      break;
+    case ACCESSLOG_MODE_BINARY:
+      // Filled in end_record()
+      raw("\0\0\0\0", 4);
+      break;
+    }
+  }
+
+  // Finishes record.  Returns the length of record, or -1 if it did
+  // not fit in the buffer in JSON or binary mode.  In text and JSON
+  // mode, the record ends with new line.
+  ssize_t end_record() {
+    switch (mode_) {
+    case ACCESSLOG_MODE_TEXT:
+      if (p_ == last_) {
+        // Make room for new line
+        --p_;
+      }
+      *p_++ = '\n';
+      return p_ - first_;
+    case ACCESSLOG_MODE_JSON:
+      raw("}\n", 2);
+      break;
+    case ACCESSLOG_MODE_BINARY:
+      put_be(first_, p_ - first_ - 4, 4);
+      break;
+    }
+
+    if (overflow_) {
+      return -1;
+    }
+
+    return p_ - first_;
+  }
+
+  void literal(const LogFragment &lf) {
+    if (mode_ == ACCESSLOG_MODE_TEXT) {
+      raw(lf.value.get(), lf.valuelen);
+    }
+  }
+
+  // Starts the value of variable |lf|.  In JSON mode, this writes its
+  // key.
+  void begin_field(const LogFragment &lf) {
+    if (mode_ != ACCESSLOG_MODE_JSON) {
+      return;
+    }
+
+    if (nfields_++) {
+      raw(",", 1);
+    }
+
+    raw("\"", 1);
+    raw(LOGF_NAMES[lf.type], strlen(LOGF_NAMES[lf.type]));
+    if (lf.type == SHRPX_LOGF_HTTP) {
+      for (size_t i = 0; i < lf.valuelen; ++i) {
+        auto c = lf.value[i] == '-' ? '_' : lf.value[i];
+        raw(&c, 1);
+      }
+    }
+    raw("\":", 2);
+  }
+
+  // String value is written by begin_str(), followed by any number of
+  // str() calls, and end_str().
+  void begin_str() {
+    switch (mode_) {
+    case ACCESSLOG_MODE_TEXT:
+      break;
+    case ACCESSLOG_MODE_JSON:
+      raw("\"", 1);
+      break;
+    case ACCESSLOG_MODE_BINARY:
+      str_start_ = p_;
+      raw("\0\0", 2);
+      break;
+    }
+  }
+
+  void str(const char *s, size_t len) {
+    if (mode_ != ACCESSLOG_MODE_JSON) {
+      raw(s, len);
+      return;
+    }
+
+    for (auto end = s + len; s != end; ++s) {
+      auto c = static_cast<uint8_t>(*s);
+      if (c == '"' || c == '\\') {
+        char esc[] = {'\\', *s};
+        raw(esc, sizeof(esc));
+      } else if (c < 0x20 || c >= 0x80) {
+        // Bytes which may not form valid UTF-8 are escaped as code
+        // points U+0000 to U+00FF, so that output is always valid JSON.
+        char esc[] = {'\\', 'u', '0', '0', util::UPPER_XDIGITS[c >> 4],
+                      util::UPPER_XDIGITS[c & 0xf]};
+        raw(esc, sizeof(esc));
+      } else {
+        raw(s, 1);
+      }
+    }
+  }
+
+  void str(const char *s) { str(s, strlen(s)); }
+
+  // Writes |n| in decimal as a part of string.
+  void str_uint(uint64_t n) { raw_uint(n); }
+
+  void end_str() {
+    switch (mode_) {
+    case ACCESSLOG_MODE_TEXT:
+      break;
+    case ACCESSLOG_MODE_JSON:
+      raw("\"", 1);
+      break;
+    case ACCESSLOG_MODE_BINARY:
+      if (!overflow_) {
+        auto len = p_ - str_start_ - 2;
+        if (len > 0xffff) {
+          overflow_ = true;
+          break;
+        }
+        put_be(str_start_, len, 2);
+      }
+      break;
+    }
+  }
+
+  void str_field(const char *s, size_t len) {
+    begin_str();
+    str(s, len);
+    end_str();
+  }
+
+  void str_field(const char *s) { str_field(s, strlen(s)); }
+
+  void str_field(const std::string &s) { str_field(s.c_str(), s.size()); }
+
+  void uint_field(uint64_t n) {
+    if (mode_ == ACCESSLOG_MODE_BINARY) {
+      put_uint64(n);
+      return;
+    }
+
+    raw_uint(n);
+  }
+
+  // Writes duration |msec| in milliseconds.  In text and JSON mode,
+  // it is written in seconds with milliseconds resolution.
+  void msec_field(uint64_t msec) {
+    if (mode_ == ACCESSLOG_MODE_BINARY) {
+      put_uint64(msec);
+      return;
+    }
+
+    raw_uint(msec / 1000);
+
+    char frac[] = {'.', static_cast<char>('0' + msec / 100 % 10),
+                   static_cast<char>('0' + msec / 10 % 10),
+                   static_cast<char>('0' + msec % 10)};
+    raw(frac, sizeof(frac));
+  }
+
+  // Writes unavailable value.
+  void null_field() {
+    switch (mode_) {
+    case ACCESSLOG_MODE_TEXT:
+      raw("-", 1);
+      break;
+    case ACCESSLOG_MODE_JSON:
+      raw("null", 4);
+      break;
+    case ACCESSLOG_MODE_BINARY:
+      raw("\0\0", 2);
+      break;
+    }
+  }
+
+private:
+  void raw(const char *s, size_t len) {
+    auto n = std::min(len, static_cast<size_t>(last_ - p_));
+    if (n < len) {
+      overflow_ = true;
+    }
+    p_ = std::copy_n(s, n, p_);
+  }
+
+  void raw_uint(uint64_t n) {
+    char buf[20];
+    auto p = buf + sizeof(buf);
+    do {
+      *--p = '0' + n % 10;
+      n /= 10;
+    } while (n);
+    raw(p, buf + sizeof(buf) - p);
+  }
+
+  void put_uint64(uint64_t n) {
+    char buf[8];
+    put_be(buf, n, sizeof(buf));
+    raw(buf, sizeof(buf));
+  }
+
+  static void put_be(char *dest, uint64_t n, size_t len) {
+    for (size_t i = len; i > 0; --i) {
+      dest[i - 1] = n & 0xff;
+      n >>= 8;
+    }
+  }
+
+  shrpx_accesslog_mode mode_;
+  char *first_, *last_, *p_;
+  // Position of the current string length in binary mode
+  char *str_start_;
+  size_t nfields_;
+  bool overflow_;
+};
+} // namespace
+
+namespace {
+uint64_t to_msec(const std::chrono::high_resolution_clock::duration &d) {
+  auto t = std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+  return std::max(t, static_cast<decltype(t)>(0));
 }
 } // namespace
 
@@ -169,102 +428,210 @@ void upstream_accesslog(const std::vector<LogFragment> &lfv, LogSpec *lgsp) {
 
   auto downstream = lgsp->downstream;
 
-  auto p = buf;
-  auto avail = sizeof(buf) - 2;
+  LogWriter w(get_config()->accesslog_mode, buf, sizeof(buf));
 
   wconf->update_tstamp(lgsp->time_now);
   auto &time_local = wconf->time_local_str;
   auto &time_iso8601 = wconf->time_iso8601_str;
 
+  w.begin_record();
+
   for (auto &lf : lfv) {
+    if (lf.type == SHRPX_LOGF_LITERAL) {
+      w.literal(lf);
+      continue;
+    }
+
+    if (lf.type == SHRPX_LOGF_NONE) {
+      continue;
+    }
+
+    w.begin_field(lf);
+
     switch (lf.type) {
-    case SHRPX_LOGF_LITERAL:
-      std::tie(p, avail) = copy(lf.value.get(), avail, p);
-      break;
     case SHRPX_LOGF_REMOTE_ADDR:
-      std::tie(p, avail) = copy(lgsp->remote_addr, avail, p);
+      w.str_field(lgsp->remote_addr);
       break;
     case SHRPX_LOGF_TIME_LOCAL:
-      std::tie(p, avail) = copy(time_local.c_str(), avail, p);
+      w.str_field(time_local);
       break;
     case SHRPX_LOGF_TIME_ISO8601:
-      std::tie(p, avail) = copy(time_iso8601.c_str(), avail, p);
+      w.str_field(time_iso8601);
       break;
     case SHRPX_LOGF_REQUEST:
-      std::tie(p, avail) = copy(lgsp->method, avail, p);
-      std::tie(p, avail) = copy(" ", avail, p);
-      std::tie(p, avail) = copy(lgsp->path, avail, p);
-      std::tie(p, avail) = copy(" HTTP/", avail, p);
-      std::tie(p, avail) = copy(util::utos(lgsp->major).c_str(), avail, p);
-      std::tie(p, avail) = copy(".", avail, p);
-      std::tie(p, avail) = copy(util::utos(lgsp->minor).c_str(), avail, p);
+      w.begin_str();
+      w.str(lgsp->method);
+      w.str(" ", 1);
+      w.str(lgsp->path);
+      w.str(" HTTP/", 6);
+      w.str_uint(lgsp->major);
+      w.str(".", 1);
+      w.str_uint(lgsp->minor);
+      w.end_str();
       break;
     case SHRPX_LOGF_STATUS:
-      std::tie(p, avail) = copy(util::utos(lgsp->status).c_str(), avail, p);
+      w.uint_field(lgsp->status);
       break;
     case SHRPX_LOGF_BODY_BYTES_SENT:
-      std::tie(p, avail) =
-          copy(util::utos(lgsp->body_bytes_sent).c_str(), avail, p);
+      w.uint_field(lgsp->body_bytes_sent);
       break;
-    case SHRPX_LOGF_HTTP:
+    case SHRPX_LOGF_HTTP: {
+      const HeaderRefs::value_type *hd = nullptr;
       if (downstream) {
-        auto hd = downstream->get_request_header(lf.value.get());
-        if (hd) {
-          std::tie(p, avail) = copy((*hd).value.c_str(), avail, p);
-          break;
+        if (lf.token != -1) {
+          hd = downstream->get_request_header(lf.token);
+        } else {
+          hd = http2::get_header(downstream->get_request_headers(),
+                                 lf.value.get());
         }
       }
 
-      std::tie(p, avail) = copy("-", avail, p);
+      if (hd) {
+        w.str_field(hd->value.c_str(), hd->value.size());
+      } else {
+        w.null_field();
+      }
 
       break;
+    }
     case SHRPX_LOGF_REMOTE_PORT:
-      std::tie(p, avail) = copy(lgsp->remote_port, avail, p);
+      w.str_field(lgsp->remote_port);
       break;
     case SHRPX_LOGF_SERVER_PORT:
-      std::tie(p, avail) =
-          copy(util::utos(lgsp->server_port).c_str(), avail, p);
+      w.uint_field(lgsp->server_port);
+      break;
+    case SHRPX_LOGF_REQUEST_TIME:
+      w.msec_field(
+          to_msec(lgsp->request_end_time - lgsp->request_start_time));
       break;
-    case SHRPX_LOGF_REQUEST_TIME: {
-      auto t = std::chrono::duration_cast<std::chrono::milliseconds>(
-                   lgsp->request_end_time - lgsp->request_start_time).count();
-
-      auto frac = util::utos(t % 1000);
-      auto sec = util::utos(t / 1000);
-      if (frac.size() < 3) {
-        frac = std::string(3 - frac.size(), '0') + frac;
-      }
-      sec += ".";
-      sec += frac;
-
-      std::tie(p, avail) = copy(sec.c_str(), avail, p);
-    } break;
     case SHRPX_LOGF_PID:
-      std::tie(p, avail) = copy(util::utos(lgsp->pid).c_str(), avail, p);
+      w.uint_field(lgsp->pid);
       break;
     case SHRPX_LOGF_ALPN:
-      std::tie(p, avail) = copy(lgsp->alpn, avail, p);
+      w.str_field(lgsp->alpn);
       break;
-    case SHRPX_LOGF_NONE:
+    case SHRPX_LOGF_REQUEST_BODY_BYTES:
+      w.uint_field(downstream ? downstream->get_request_bodylen() : 0);
+      break;
+    case SHRPX_LOGF_TTFB: {
+      // If response header was not received from backend, response
+      // was generated by nghttpx at the end of request.
+      auto t = lgsp->request_end_time;
+      if (downstream &&
+          downstream->get_response_header_time() !=
+              std::chrono::high_resolution_clock::time_point()) {
+        t = downstream->get_response_header_time();
+      }
+      w.msec_field(to_msec(t - lgsp->request_start_time));
+      break;
+    }
+    case SHRPX_LOGF_BACKEND_ADDR:
+      if (downstream && downstream->get_downstream_addr_idx() != -1) {
+        auto idx = downstream->get_downstream_addr_idx();
+        w.str_field(get_config()->downstream_addrs[idx].hostport.get());
+      } else {
+        w.null_field();
+      }
+      break;
+    case SHRPX_LOGF_BACKEND_PROTO:
+      if (downstream && downstream->get_downstream_addr_idx() != -1) {
+        w.str_field(get_config()->downstream_proto == PROTO_HTTP2 ? "h2"
+                                                                  : "http/1.1");
+      } else {
+        w.null_field();
+      }
       break;
     default:
+      w.null_field();
       break;
     }
   }
 
-  *p = '\0';
+  auto nwrite = w.end_record();
+
+  if (nwrite == -1) {
+    // JSON or binary record which does not fit in buffer
+    ++wconf->accesslog_dropped;
+    return;
+  }
 
   if (get_config()->accesslog_syslog) {
-    syslog(LOG_INFO, "%s", buf);
+    // Strip new line
+    syslog(LOG_INFO, "%.*s", static_cast<int>(nwrite - 1), buf);
+
+    return;
+  }
 
+  if (get_config()->accesslog_buffer_size == 0) {
+    ssize_t rv;
+    while ((rv = write(wconf->accesslog_fd, buf, nwrite)) == -1 &&
+           errno == EINTR)
+      ;
+    if (rv == -1) {
+      ++wconf->accesslog_dropped;
+    }
     return;
   }
 
-  *p++ = '\n';
+  auto &logbuf = wconf->accesslog_buf;
 
-  auto nwrite = p - buf;
-  while (write(wconf->accesslog_fd, buf, nwrite) == -1 && errno == EINTR)
-    ;
+  if (logbuf.capacity() < get_config()->accesslog_buffer_size) {
+    logbuf.reserve(get_config()->accesslog_buffer_size);
+  }
+
+  if (logbuf.size() + nwrite > get_config()->accesslog_buffer_size) {
+    flush_accesslog();
+  }
+
+  logbuf.append(buf, nwrite);
+}
+
+void flush_accesslog() {
+  auto wconf = worker_config;
+  auto &logbuf = wconf->accesslog_buf;
+
+  if (logbuf.empty()) {
+    return;
+  }
+
+  auto p = logbuf.c_str();
+  auto end = p + logbuf.size();
+
+  while (p != end && wconf->accesslog_fd != -1) {
+    ssize_t nwrite;
+    while ((nwrite = write(wconf->accesslog_fd, p, end - p)) == -1 &&
+           errno == EINTR)
+      ;
+    if (nwrite == -1) {
+      break;
+    }
+    p += nwrite;
+  }
+
+  if (p != end) {
+    // Count partially written record as dropped.
+    uint64_t ndropped = 0;
+    if (get_config()->accesslog_mode == ACCESSLOG_MODE_BINARY) {
+      for (auto q = logbuf.c_str(); q < end;) {
+        auto len = (static_cast<uint32_t>(static_cast<uint8_t>(q[0])) << 24) |
+                   (static_cast<uint8_t>(q[1]) << 16) |
+                   (static_cast<uint8_t>(q[2]) << 8) |
+                   static_cast<uint8_t>(q[3]);
+        q += 4 + len;
+        if (q > p) {
+          ++ndropped;
+        }
+      }
+    } else {
+      ndropped = std::count(p, end, '\n');
+    }
+    wconf->accesslog_dropped += ndropped;
+
+    LOG(WARN) << "Failed to write access log; dropped " << ndropped
+              << " records (" << wconf->accesslog_dropped << " in total)";
+  }
+
+  logbuf.clear();
 }
 
 int reopen_log_files() {
@@ -272,6 +639,8 @@ int reopen_log_files() {
 
   auto wconf = worker_config;
 
+  flush_accesslog();
+
   if (wconf->accesslog_fd != -1) {
     close(wconf->accesslog_fd);
     wconf->accesslog_fd = -1;
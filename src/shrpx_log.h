@@ -84,6 +84,7 @@ public:
     return *this;
   }
   static void set_severity_level(int severity);
+  static int get_severity_level() { return severity_thres_; }
   static int set_severity_level_by_name(const char *name);
   static bool log_enabled(int severity) { return severity >= severity_thres_; }
 
@@ -113,11 +114,20 @@ enum LogFragmentType {
   SHRPX_LOGF_REQUEST_TIME,
   SHRPX_LOGF_PID,
   SHRPX_LOGF_ALPN,
+  SHRPX_LOGF_REQUEST_BODY_BYTES,
+  SHRPX_LOGF_TTFB,
+  SHRPX_LOGF_BACKEND_ADDR,
+  SHRPX_LOGF_BACKEND_PROTO,
 };
 
 struct LogFragment {
   LogFragmentType type;
   std::unique_ptr<char[]> value;
+  // The length of value
+  size_t valuelen;
+  // For SHRPX_LOGF_HTTP, token of header field name in value, or -1
+  // if it has no token.
+  int token;
 };
 
 struct LogSpec {
@@ -139,6 +149,9 @@ struct LogSpec {
 
 void upstream_accesslog(const std::vector<LogFragment> &lf, LogSpec *lgsp);
 
+// Writes access log buffered in this thread.
+void flush_accesslog();
+
 int reopen_log_files();
 
 } // namespace shrpx
@@ -0,0 +1,103 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_log_test.h"
+
+#include <unistd.h>
+
+#include <string>
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_log.h"
+#include "shrpx_config.h"
+#include "shrpx_worker_config.h"
+
+namespace shrpx {
+
+namespace {
+// Writes one access log record of |format| in |mode|, and returns
+// the bytes written.
+std::string write_accesslog(shrpx_accesslog_mode mode, const char *format) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return "";
+  }
+
+  mod_config()->accesslog_mode = mode;
+  worker_config->accesslog_fd = fds[1];
+
+  LogSpec lgsp{};
+  lgsp.remote_addr = "127.0.0.1";
+  lgsp.method = "GET";
+  lgsp.path = "/caf\xc3\xa9\"\xff";
+  lgsp.alpn = "h2";
+  lgsp.time_now = std::chrono::system_clock::now();
+  lgsp.major = 1;
+  lgsp.minor = 1;
+  lgsp.status = 200;
+  lgsp.remote_port = "50000";
+
+  upstream_accesslog(parse_log_format(format), &lgsp);
+
+  worker_config->accesslog_fd = -1;
+  mod_config()->accesslog_mode = ACCESSLOG_MODE_TEXT;
+
+  close(fds[1]);
+
+  std::string res;
+  char buf[4096];
+  ssize_t nread;
+  while ((nread = read(fds[0], buf, sizeof(buf))) > 0) {
+    res.append(buf, nread);
+  }
+
+  close(fds[0]);
+
+  return res;
+}
+} // namespace
+
+void test_shrpx_log_accesslog_json(void) {
+  auto res = write_accesslog(ACCESSLOG_MODE_JSON,
+                             "$remote_addr - $status \"$request\" $alpn");
+
+  CU_ASSERT("{\"remote_addr\":\"127.0.0.1\",\"status\":200,"
+            "\"request\":\"GET /caf\\u00C3\\u00A9\\\"\\u00FF HTTP/1.1\","
+            "\"alpn\":\"h2\"}\n" == res);
+}
+
+void test_shrpx_log_accesslog_binary(void) {
+  auto res = write_accesslog(ACCESSLOG_MODE_BINARY, "$status $remote_port");
+
+  // 4 bytes record length, 8 bytes status, and 2 bytes string length
+  // followed by remote_port.
+  CU_ASSERT(std::string("\x00\x00\x00\x0f"
+                        "\x00\x00\x00\x00\x00\x00\x00\xc8"
+                        "\x00\x05"
+                        "50000",
+                        19) == res);
+}
+
+} // namespace shrpx
@@ -0,0 +1,258 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_metrics.h"
+
+#include <cmath>
+
+#include "util.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+size_t histogram_bucket(uint64_t v) {
+  if (v >= (1ULL << HISTOGRAM_MAX_BITS)) {
+    v = (1ULL << HISTOGRAM_MAX_BITS) - 1;
+  }
+
+  if (v < (1 << HISTOGRAM_SUB_BITS)) {
+    return v;
+  }
+
+  // The position of the most significant bit
+  size_t msb = 63 - __builtin_clzll(v);
+  auto shift = msb - HISTOGRAM_SUB_BITS;
+
+  return ((shift + 1) << HISTOGRAM_SUB_BITS) |
+         ((v >> shift) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+uint64_t histogram_bucket_max(size_t idx) {
+  if (idx < (1 << HISTOGRAM_SUB_BITS)) {
+    return idx;
+  }
+
+  auto shift = (idx >> HISTOGRAM_SUB_BITS) - 1;
+  auto top = (idx & ((1 << HISTOGRAM_SUB_BITS) - 1)) |
+             (1 << HISTOGRAM_SUB_BITS);
+
+  return ((static_cast<uint64_t>(top) + 1) << shift) - 1;
+}
+
+uint64_t HistogramSnapshot::value_at_percentile(double p) const {
+  if (count == 0) {
+    return 0;
+  }
+
+  // Nearest rank; the number of values at or below the percentile,
+  // rounded up
+  auto rank = static_cast<uint64_t>(ceil(p / 100. * count));
+  if (rank == 0) {
+    rank = 1;
+  }
+
+  uint64_t n = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    n += counts[i];
+    if (n >= rank) {
+      return histogram_bucket_max(i);
+    }
+  }
+
+  return histogram_bucket_max(counts.size() - 1);
+}
+
+void Histogram::record(uint64_t v) {
+  counts_[histogram_bucket(v)].add();
+  sum_.add(v);
+}
+
+void Histogram::merge_to(HistogramSnapshot *dest) const {
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    auto n = counts_[i].get();
+    dest->counts[i] += n;
+    dest->count += n;
+  }
+  dest->sum += sum_.get();
+}
+
+void merge_metrics(MetricsSnapshot *dest, const WorkerMetrics &metrics) {
+  for (size_t i = 0; i < metrics.requests.size(); ++i) {
+    dest->requests[i] += metrics.requests[i].get();
+  }
+  dest->frontend_bytes_in += metrics.frontend_bytes_in.get();
+  dest->frontend_bytes_out += metrics.frontend_bytes_out.get();
+  dest->spliced_bytes += metrics.spliced_bytes.get();
+  dest->active_streams += metrics.active_streams.get();
+  dest->pool_hits += metrics.pool_hits.get();
+  dest->pool_misses += metrics.pool_misses.get();
+  dest->cache_hits += metrics.cache_hits.get();
+  dest->cache_misses += metrics.cache_misses.get();
+  dest->cache_collapsed += metrics.cache_collapsed.get();
+  dest->tls_handshakes += metrics.tls_handshakes.get();
+  dest->tls_resumptions += metrics.tls_resumptions.get();
+  dest->tls_records += metrics.tls_records.get();
+  metrics.backend_connect_time.merge_to(&dest->backend_connect_time);
+  metrics.ttfb.merge_to(&dest->ttfb);
+  metrics.request_time.merge_to(&dest->request_time);
+  metrics.tls_records_per_response.merge_to(&dest->tls_records_per_response);
+}
+
+namespace {
+// Returns |usec| microseconds in seconds.
+std::string format_sec(uint64_t usec) {
+  auto frac = util::utos(usec % 1000000);
+  return util::utos(usec / 1000000) + "." +
+         std::string(6 - frac.size(), '0') + frac;
+}
+} // namespace
+
+namespace {
+std::string format_count(uint64_t n) { return util::utos(n); }
+} // namespace
+
+namespace {
+void add_header(std::string &out, const char *name, const char *type,
+                const char *help) {
+  out += "# HELP ";
+  out += name;
+  out += " ";
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += " ";
+  out += type;
+  out += "\n";
+}
+} // namespace
+
+namespace {
+void add_counter(std::string &out, const char *name, const char *type,
+                 const char *help, uint64_t value) {
+  add_header(out, name, type, help);
+  out += name;
+  out += " ";
+  out += util::utos(value);
+  out += "\n";
+}
+} // namespace
+
+namespace {
+// Adds summary of |hist|.  Recorded values and their sum are
+// formatted by |format|.
+void add_summary(std::string &out, const char *name, const char *help,
+                 const HistogramSnapshot &hist,
+                 std::string (*format)(uint64_t)) {
+  add_header(out, name, "summary", help);
+
+  static const std::pair<const char *, double> quantiles[] = {
+      {"0.5", 50.}, {"0.9", 90.}, {"0.99", 99.}, {"0.999", 99.9}};
+
+  for (auto &q : quantiles) {
+    out += name;
+    out += "{quantile=\"";
+    out += q.first;
+    out += "\"} ";
+    out += format(hist.value_at_percentile(q.second));
+    out += "\n";
+  }
+
+  out += name;
+  out += "_sum ";
+  out += format(hist.sum);
+  out += "\n";
+  out += name;
+  out += "_count ";
+  out += util::utos(hist.count);
+  out += "\n";
+}
+} // namespace
+
+std::string format_metrics(const MetricsSnapshot &snapshot) {
+  std::string out;
+
+  add_header(out, "nghttpx_requests_total", "counter",
+             "The number of finished requests by response status code.");
+  for (size_t i = 0; i < snapshot.requests.size(); ++i) {
+    out += "nghttpx_requests_total{code=\"";
+    out += i == 0 ? "other" : util::utos(i) + "xx";
+    out += "\"} ";
+    out += util::utos(snapshot.requests[i]);
+    out += "\n";
+  }
+
+  add_counter(out, "nghttpx_frontend_bytes_received_total", "counter",
+              "The number of bytes received from clients.",
+              snapshot.frontend_bytes_in);
+  add_counter(out, "nghttpx_frontend_bytes_sent_total", "counter",
+              "The number of bytes sent to clients.",
+              snapshot.frontend_bytes_out);
+  add_counter(out, "nghttpx_spliced_bytes_total", "counter",
+              "The number of tunneled bytes relayed by splice(2).",
+              snapshot.spliced_bytes);
+  add_counter(out, "nghttpx_active_streams", "gauge",
+              "The number of requests in progress.", snapshot.active_streams);
+  add_counter(out, "nghttpx_backend_pool_hits_total", "counter",
+              "The number of HTTP/1 backend connections reused from pool.",
+              snapshot.pool_hits);
+  add_counter(out, "nghttpx_backend_pool_misses_total", "counter",
+              "The number of HTTP/1 backend connections newly created.",
+              snapshot.pool_misses);
+  add_counter(out, "nghttpx_cache_hits_total", "counter",
+              "The number of responses served from response cache.",
+              snapshot.cache_hits);
+  add_counter(out, "nghttpx_cache_misses_total", "counter",
+              "The number of cacheable requests not found in cache.",
+              snapshot.cache_misses);
+  add_counter(out, "nghttpx_cache_collapsed_total", "counter",
+              "The number of requests which waited for the same request "
+              "in flight.",
+              snapshot.cache_collapsed);
+  add_counter(out, "nghttpx_tls_handshakes_total", "counter",
+              "The number of completed frontend TLS handshakes.",
+              snapshot.tls_handshakes);
+  add_counter(out, "nghttpx_tls_resumptions_total", "counter",
+              "The number of frontend TLS handshakes which resumed session.",
+              snapshot.tls_resumptions);
+  add_counter(out, "nghttpx_tls_records_total", "counter",
+              "The number of TLS records written to clients.",
+              snapshot.tls_records);
+
+  add_summary(out, "nghttpx_backend_connect_seconds",
+              "Time to establish TCP connection to backend.",
+              snapshot.backend_connect_time, format_sec);
+  add_summary(out, "nghttpx_ttfb_seconds",
+              "Time until response header is received from backend.",
+              snapshot.ttfb, format_sec);
+  add_summary(out, "nghttpx_request_seconds", "Request processing time.",
+              snapshot.request_time, format_sec);
+  add_summary(out, "nghttpx_tls_records_per_response",
+              "The number of TLS records written for each response.",
+              snapshot.tls_records_per_response, format_count);
+
+  return out;
+}
+
+} // namespace shrpx
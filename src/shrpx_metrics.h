@@ -0,0 +1,170 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_METRICS_H
+#define SHRPX_METRICS_H
+
+#include "shrpx.h"
+
+#include <atomic>
+#include <array>
+#include <string>
+
+namespace shrpx {
+
+// Counter updated by one worker thread, and read by any thread.
+// Since there is only one writer, increment is done by plain atomic
+// load and store, which avoids locked instructions.
+class Counter {
+public:
+  Counter() : v_(0) {}
+  void add(uint64_t n = 1) {
+    v_.store(v_.load(std::memory_order_relaxed) + n,
+             std::memory_order_relaxed);
+  }
+  void sub(uint64_t n = 1) {
+    v_.store(v_.load(std::memory_order_relaxed) - n,
+             std::memory_order_relaxed);
+  }
+  uint64_t get() const { return v_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> v_;
+};
+
+enum {
+  // The number of sub-buckets per power of 2 is 1 << HISTOGRAM_SUB_BITS.
+  // The relative error of recorded value is at most 1 /
+  // (1 << HISTOGRAM_SUB_BITS).
+  HISTOGRAM_SUB_BITS = 4,
+  // Values larger than or equal to 1 << HISTOGRAM_MAX_BITS are
+  // recorded as (1 << HISTOGRAM_MAX_BITS) - 1.
+  HISTOGRAM_MAX_BITS = 40,
+  HISTOGRAM_NBUCKETS =
+      (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS,
+};
+
+// Returns the bucket index of |v| in histogram.
+size_t histogram_bucket(uint64_t v);
+
+// Returns the largest value which falls in bucket |idx|.
+uint64_t histogram_bucket_max(size_t idx);
+
+struct HistogramSnapshot {
+  HistogramSnapshot() : counts{}, count(0), sum(0) {}
+  // Returns the value at percentile |p| (0 < p <= 100).  The value
+  // is the largest value of the bucket in which percentile falls.
+  // Returns 0 if no value is recorded.
+  uint64_t value_at_percentile(double p) const;
+
+  std::array<uint64_t, HISTOGRAM_NBUCKETS> counts;
+  uint64_t count;
+  uint64_t sum;
+};
+
+// Histogram with log-linear buckets like HdrHistogram.  Like Counter,
+// only one thread records values.
+class Histogram {
+public:
+  void record(uint64_t v);
+  // Adds recorded values to |dest|.
+  void merge_to(HistogramSnapshot *dest) const;
+
+private:
+  std::array<Counter, HISTOGRAM_NBUCKETS> counts_;
+  Counter sum_;
+};
+
+// The number of classes of response status code; 1xx to 5xx, and
+// others at index 0.
+enum { METRICS_NUM_STATUS_CLASSES = 6 };
+
+// Runtime metrics of a worker.  Durations are recorded in
+// microseconds.
+struct WorkerMetrics {
+  // Finished requests, indexed by status code / 100.
+  std::array<Counter, METRICS_NUM_STATUS_CLASSES> requests;
+  // The number of bytes received from and sent to clients.
+  Counter frontend_bytes_in, frontend_bytes_out;
+  // The number of bytes relayed between client and backend by
+  // splice(2), without being copied to user space.
+  Counter spliced_bytes;
+  // The number of requests which are not finished yet.
+  Counter active_streams;
+  // The number of HTTP/1 backend connections taken from connection
+  // pool, and newly created.
+  Counter pool_hits, pool_misses;
+  // The number of requests served from response cache, and the
+  // number of cacheable requests which were not found in it.
+  Counter cache_hits, cache_misses;
+  // The number of requests which waited for the same request being
+  // fetched from backend.
+  Counter cache_collapsed;
+  // The number of completed frontend TLS handshakes, and the number
+  // of them which resumed session.
+  Counter tls_handshakes, tls_resumptions;
+  // The number of TLS records written to clients.
+  Counter tls_records;
+  // Time to establish TCP connection to backend.
+  Histogram backend_connect_time;
+  // Time from the beginning of request until the response header
+  // is received from backend.
+  Histogram ttfb;
+  // Time from the beginning of request until the end of response.
+  Histogram request_time;
+  // The number of TLS records written for each response.
+  Histogram tls_records_per_response;
+};
+
+// Metrics aggregated from WorkerMetrics of all workers.
+struct MetricsSnapshot {
+  MetricsSnapshot()
+      : requests{}, frontend_bytes_in(0), frontend_bytes_out(0),
+        spliced_bytes(0), active_streams(0), pool_hits(0), pool_misses(0),
+        cache_hits(0), cache_misses(0), cache_collapsed(0),
+        tls_handshakes(0), tls_resumptions(0), tls_records(0) {}
+
+  std::array<uint64_t, METRICS_NUM_STATUS_CLASSES> requests;
+  uint64_t frontend_bytes_in, frontend_bytes_out;
+  uint64_t spliced_bytes;
+  uint64_t active_streams;
+  uint64_t pool_hits, pool_misses;
+  uint64_t cache_hits, cache_misses, cache_collapsed;
+  uint64_t tls_handshakes, tls_resumptions;
+  uint64_t tls_records;
+  HistogramSnapshot backend_connect_time;
+  HistogramSnapshot ttfb;
+  HistogramSnapshot request_time;
+  HistogramSnapshot tls_records_per_response;
+};
+
+// Adds values of |metrics| to |dest|.
+void merge_metrics(MetricsSnapshot *dest, const WorkerMetrics &metrics);
+
+// Returns |snapshot| in Prometheus text exposition format.
+std::string format_metrics(const MetricsSnapshot &snapshot);
+
+} // namespace shrpx
+
+#endif // SHRPX_METRICS_H
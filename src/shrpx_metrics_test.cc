@@ -0,0 +1,121 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_metrics_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_metrics.h"
+
+namespace shrpx {
+
+void test_shrpx_metrics_histogram(void) {
+  // Small values have their own buckets.
+  for (uint64_t v = 0; v < 16; ++v) {
+    CU_ASSERT(v == histogram_bucket(v));
+    CU_ASSERT(v == histogram_bucket_max(histogram_bucket(v)));
+  }
+
+  CU_ASSERT(16 == histogram_bucket(16));
+  CU_ASSERT(31 == histogram_bucket(31));
+  CU_ASSERT(32 == histogram_bucket(32));
+  CU_ASSERT(32 == histogram_bucket(33));
+  CU_ASSERT(33 == histogram_bucket(34));
+  CU_ASSERT(HISTOGRAM_NBUCKETS - 1 == histogram_bucket(UINT64_MAX));
+
+  // Relative error is bounded.
+  for (uint64_t v = 1; v < 1000000000; v = v * 3 + 1) {
+    auto max = histogram_bucket_max(histogram_bucket(v));
+    CU_ASSERT(max >= v);
+    CU_ASSERT(max - v <= v / 16);
+  }
+
+  Histogram hist;
+  for (uint64_t v = 1; v <= 1000; ++v) {
+    hist.record(v);
+  }
+
+  HistogramSnapshot snapshot;
+  hist.merge_to(&snapshot);
+  hist.merge_to(&snapshot);
+
+  CU_ASSERT(2000 == snapshot.count);
+  CU_ASSERT(2 * 500500 == snapshot.sum);
+
+  auto p50 = snapshot.value_at_percentile(50.);
+  CU_ASSERT(500 <= p50 && p50 <= 500 + 500 / 16);
+  auto p99 = snapshot.value_at_percentile(99.);
+  CU_ASSERT(990 <= p99 && p99 <= 990 + 990 / 16);
+  CU_ASSERT(1000 <= snapshot.value_at_percentile(100.));
+
+  CU_ASSERT(0 == HistogramSnapshot().value_at_percentile(50.));
+
+  // Nearest rank: 34th percentile of {1, 2, 3} is the 2nd value.
+  Histogram small;
+  for (uint64_t v = 1; v <= 3; ++v) {
+    small.record(v);
+  }
+
+  HistogramSnapshot small_snapshot;
+  small.merge_to(&small_snapshot);
+
+  CU_ASSERT(1 == small_snapshot.value_at_percentile(33.));
+  CU_ASSERT(2 == small_snapshot.value_at_percentile(34.));
+  CU_ASSERT(3 == small_snapshot.value_at_percentile(100.));
+}
+
+void test_shrpx_metrics_format(void) {
+  WorkerMetrics metrics;
+
+  metrics.requests[2].add(3);
+  metrics.requests[0].add();
+  metrics.active_streams.add(2);
+  metrics.active_streams.sub();
+  metrics.ttfb.record(1500);
+  metrics.tls_records_per_response.record(7);
+
+  MetricsSnapshot snapshot;
+  merge_metrics(&snapshot, metrics);
+  merge_metrics(&snapshot, metrics);
+
+  CU_ASSERT(6 == snapshot.requests[2]);
+  CU_ASSERT(2 == snapshot.active_streams);
+
+  auto out = format_metrics(snapshot);
+
+  CU_ASSERT(std::string::npos !=
+            out.find("nghttpx_requests_total{code=\"2xx\"} 6\n"));
+  CU_ASSERT(std::string::npos !=
+            out.find("nghttpx_requests_total{code=\"other\"} 2\n"));
+  CU_ASSERT(std::string::npos != out.find("nghttpx_active_streams 2\n"));
+  CU_ASSERT(std::string::npos !=
+            out.find("nghttpx_ttfb_seconds_sum 0.003000\n"));
+  CU_ASSERT(std::string::npos != out.find("nghttpx_ttfb_seconds_count 2\n"));
+  CU_ASSERT(std::string::npos !=
+            out.find("# TYPE nghttpx_request_seconds summary\n"));
+  CU_ASSERT(std::string::npos !=
+            out.find("nghttpx_tls_records_per_response_sum 14\n"));
+}
+
+} // namespace shrpx
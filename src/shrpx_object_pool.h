@@ -0,0 +1,303 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_OBJECT_POOL_H
+#define SHRPX_OBJECT_POOL_H
+
+#include "shrpx.h"
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "string_ref.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+// Free list of memory blocks of sizeof(T) bytes.  Released blocks
+// are kept for the next allocation instead of being returned to the
+// system allocator, up to |max_free| blocks.  ObjectPool is not
+// thread safe.  Each thread has its own instance in WorkerConfig, so
+// that there is no allocator contention between workers.
+template <typename T> class ObjectPool {
+public:
+  ObjectPool(size_t max_free)
+      : freelist_(nullptr), nfree_(0), max_free_(max_free) {}
+  ~ObjectPool() {
+    for (auto b = freelist_; b;) {
+      auto next = b->next;
+      ::operator delete(b);
+      b = next;
+    }
+  }
+  ObjectPool(const ObjectPool &) = delete;
+  ObjectPool &operator=(const ObjectPool &) = delete;
+
+  // Returns memory block for T.  If |n| is not sizeof(T), which
+  // happens when the class deriving T does not define its own
+  // operator new, falls back to global operator new.
+  void *allocate(size_t n) {
+    if (n != sizeof(T) || !freelist_) {
+      return ::operator new(n);
+    }
+    auto b = freelist_;
+    freelist_ = b->next;
+    --nfree_;
+    return b;
+  }
+  // Releases memory block |p| of |n| bytes previously obtained by
+  // allocate().
+  void deallocate(void *p, size_t n) {
+    if (!p) {
+      return;
+    }
+    if (n != sizeof(T) || nfree_ >= max_free_) {
+      ::operator delete(p);
+      return;
+    }
+    static_assert(sizeof(Block) <= sizeof(T), "T is too small");
+    auto b = static_cast<Block *>(p);
+    b->next = freelist_;
+    freelist_ = b;
+    ++nfree_;
+  }
+  // Returns the number of blocks in free list.
+  size_t get_free_count() const { return nfree_; }
+
+private:
+  struct Block {
+    Block *next;
+  };
+
+  Block *freelist_;
+  size_t nfree_;
+  size_t max_free_;
+};
+
+// Keeps cleared containers (std::string, std::vector, etc) so that
+// the next user inherits their reserved capacity, which saves
+// allocations while they grow again.  Containers whose capacity
+// exceeds |max_capacity| are not kept, so that one large request
+// does not pin memory forever.  Like ObjectPool, this is not thread
+// safe.
+template <typename T> class CapacityPool {
+public:
+  CapacityPool(size_t max_items, size_t max_capacity)
+      : max_items_(max_items), max_capacity_(max_capacity) {}
+
+  // Moves pooled container, if any, into |dst|.  |dst| must be
+  // empty.
+  void get(T &dst) {
+    if (items_.empty()) {
+      return;
+    }
+    dst = std::move(items_.back());
+    items_.pop_back();
+  }
+  // Clears |src| and keeps its storage for later get() call.
+  void put(T &src) {
+    if (src.capacity() == 0 || src.capacity() > max_capacity_ ||
+        items_.size() >= max_items_) {
+      return;
+    }
+    src.clear();
+    items_.push_back(std::move(src));
+  }
+  size_t size() const { return items_.size(); }
+
+private:
+  std::vector<T> items_;
+  size_t max_items_;
+  size_t max_capacity_;
+};
+
+// Memory block used by BlockAllocator.
+struct ArenaBlock {
+  uint8_t data[4096];
+};
+
+// Bump pointer allocator.  Memory is carved out of ArenaBlock
+// obtained from |pool|, and all of it is released at once when
+// BlockAllocator is destroyed.  Allocations larger than a quarter of
+// ArenaBlock get their own memory so that they do not waste the rest
+// of the current block.  The returned memory is not aligned; this
+// allocator is meant for byte strings.
+class BlockAllocator {
+public:
+  BlockAllocator(ObjectPool<ArenaBlock> *pool)
+      : pool_(pool), head_(nullptr), last_(nullptr), end_(nullptr),
+        allocated_(0) {}
+  ~BlockAllocator() { reset(); }
+  BlockAllocator(const BlockAllocator &) = delete;
+  BlockAllocator &operator=(const BlockAllocator &) = delete;
+
+  // Releases all memory allocated so far.
+  void reset() {
+    for (auto b = head_; b;) {
+      auto next = b->next;
+      if (b->pooled) {
+        pool_->deallocate(b, sizeof(ArenaBlock));
+      } else {
+        ::operator delete(b);
+      }
+      b = next;
+    }
+    head_ = nullptr;
+    last_ = end_ = nullptr;
+    allocated_ = 0;
+  }
+
+  // Allocates |size| bytes.
+  uint8_t *alloc(size_t size) {
+    if (size > sizeof(ArenaBlock) / 4) {
+      return reinterpret_cast<uint8_t *>(new_block(size) + 1);
+    }
+
+    if (static_cast<size_t>(end_ - last_) < size) {
+      new_pooled_block();
+    }
+
+    auto p = last_;
+    last_ += size;
+    return p;
+  }
+
+  // Allocates |size| bytes which can be grown in place by extend()
+  // up to |capacity| bytes, unless other allocation is made in the
+  // meantime.
+  uint8_t *alloc_extensible(size_t size, size_t capacity) {
+    if (static_cast<size_t>(end_ - last_) < capacity) {
+      if (capacity > sizeof(ArenaBlock) / 4) {
+        auto b = new_block(capacity);
+        last_ = reinterpret_cast<uint8_t *>(b + 1);
+        end_ = last_ + capacity;
+      } else {
+        new_pooled_block();
+      }
+    }
+
+    auto p = last_;
+    last_ += size;
+    return p;
+  }
+
+  // Grows memory |p| of |len| bytes by |n| bytes in place, and
+  // returns true.  This is only possible if |p| is the most recent
+  // allocation, and current block has enough room.  Otherwise,
+  // returns false.
+  bool extend(const uint8_t *p, size_t len, size_t n) {
+    if (p + len != last_ || static_cast<size_t>(end_ - last_) < n) {
+      return false;
+    }
+    last_ += n;
+    return true;
+  }
+
+  // Returns the number of bytes of memory obtained so far, including
+  // unused part of blocks.
+  size_t get_allocated() const { return allocated_; }
+
+private:
+  struct Block {
+    Block *next;
+    bool pooled;
+  };
+
+  // Allocates a block which has |size| bytes after its header.
+  Block *new_block(size_t size) {
+    auto b = static_cast<Block *>(::operator new(sizeof(Block) + size));
+    b->pooled = false;
+    b->next = head_;
+    head_ = b;
+    allocated_ += sizeof(Block) + size;
+    return b;
+  }
+
+  // Takes ArenaBlock from |pool_|, and makes it current.
+  void new_pooled_block() {
+    auto b = static_cast<Block *>(pool_->allocate(sizeof(ArenaBlock)));
+    b->pooled = true;
+    b->next = head_;
+    head_ = b;
+    last_ = reinterpret_cast<uint8_t *>(b + 1);
+    end_ = reinterpret_cast<uint8_t *>(b) + sizeof(ArenaBlock);
+    allocated_ += sizeof(ArenaBlock);
+  }
+
+  ObjectPool<ArenaBlock> *pool_;
+  // All blocks allocated, most recent first.
+  Block *head_;
+  // Free region of the current block.
+  uint8_t *last_, *end_;
+  // The number of bytes of all blocks
+  size_t allocated_;
+};
+
+// Copies |len| bytes from |src| into the memory allocated by
+// |balloc|, and returns the reference to it.  The copy is
+// NULL-terminated.
+inline StringRef make_string_ref(BlockAllocator &balloc, const char *src,
+                                 size_t len) {
+  auto dst = balloc.alloc(len + 1);
+  memcpy(dst, src, len);
+  dst[len] = '\0';
+  return StringRef(dst, len);
+}
+
+inline StringRef make_string_ref(BlockAllocator &balloc,
+                                 const std::string &src) {
+  return make_string_ref(balloc, src.c_str(), src.size());
+}
+
+// Returns the reference to |s| followed by |len| bytes from |data|.
+// |s| must be allocated by |balloc|.  If |s| is the most recent
+// allocation, it is grown in place, otherwise the concatenation is
+// copied to the new memory.  The new memory has twice as large
+// capacity so that the string built by many calls is copied only
+// logarithmic times.
+inline StringRef concat_string_ref(BlockAllocator &balloc, const StringRef &s,
+                                   const char *data, size_t len) {
+  if (balloc.extend(s.byte(), s.size() + 1, len)) {
+    // The memory is owned by balloc, and writable.
+    auto dst = const_cast<char *>(s.data());
+    memcpy(dst + s.size(), data, len);
+    dst[s.size() + len] = '\0';
+    return StringRef(dst, s.size() + len);
+  }
+
+  auto dst = balloc.alloc_extensible(s.size() + len + 1,
+                                     (s.size() + len + 1) * 2);
+  memcpy(dst, s.data(), s.size());
+  memcpy(dst + s.size(), data, len);
+  dst[s.size() + len] = '\0';
+  return StringRef(dst, s.size() + len);
+}
+
+} // namespace shrpx
+
+#endif // SHRPX_OBJECT_POOL_H
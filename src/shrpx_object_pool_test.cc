@@ -0,0 +1,177 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_object_pool_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_object_pool.h"
+
+namespace shrpx {
+
+namespace {
+struct Obj {
+  uint64_t a, b;
+};
+} // namespace
+
+void test_shrpx_object_pool(void) {
+  ObjectPool<Obj> pool(2);
+
+  auto p1 = pool.allocate(sizeof(Obj));
+  auto p2 = pool.allocate(sizeof(Obj));
+  auto p3 = pool.allocate(sizeof(Obj));
+
+  pool.deallocate(p1, sizeof(Obj));
+  pool.deallocate(p2, sizeof(Obj));
+
+  CU_ASSERT(2 == pool.get_free_count());
+
+  // Free list is full; p3 goes back to the system allocator.
+  pool.deallocate(p3, sizeof(Obj));
+
+  CU_ASSERT(2 == pool.get_free_count());
+
+  // Most recently released block is reused first.
+  CU_ASSERT(p2 == pool.allocate(sizeof(Obj)));
+  CU_ASSERT(1 == pool.get_free_count());
+
+  // Other sizes bypass the free list.
+  auto q = pool.allocate(sizeof(Obj) * 2);
+
+  CU_ASSERT(q != p1);
+  CU_ASSERT(1 == pool.get_free_count());
+
+  pool.deallocate(q, sizeof(Obj) * 2);
+
+  CU_ASSERT(1 == pool.get_free_count());
+
+  pool.deallocate(p2, sizeof(Obj));
+
+  CU_ASSERT(2 == pool.get_free_count());
+}
+
+void test_shrpx_capacity_pool(void) {
+  CapacityPool<std::vector<int>> pool(2, 100);
+
+  std::vector<int> v;
+  v.reserve(50);
+  v.push_back(1);
+
+  pool.put(v);
+
+  CU_ASSERT(1 == pool.size());
+
+  std::vector<int> w;
+  pool.get(w);
+
+  CU_ASSERT(0 == pool.size());
+  CU_ASSERT(w.empty());
+  CU_ASSERT(w.capacity() >= 50);
+
+  // Too large or empty containers are not kept.
+  std::vector<int> large;
+  large.reserve(200);
+  pool.put(large);
+
+  std::vector<int> empty;
+  pool.put(empty);
+
+  CU_ASSERT(0 == pool.size());
+
+  // Getting from empty pool leaves destination untouched.
+  std::vector<int> x;
+  pool.get(x);
+
+  CU_ASSERT(0 == x.capacity());
+}
+
+void test_shrpx_block_allocator(void) {
+  ObjectPool<ArenaBlock> pool(16);
+
+  {
+    BlockAllocator balloc(&pool);
+
+    auto a = make_string_ref(balloc, "alpha", 5);
+
+    CU_ASSERT("alpha" == a);
+    CU_ASSERT('\0' == a.c_str()[a.size()]);
+
+    // The most recent allocation grows in place.
+    auto b = concat_string_ref(balloc, a, "bravo", 5);
+
+    CU_ASSERT("alphabravo" == b);
+    CU_ASSERT(a.c_str() == b.c_str());
+    CU_ASSERT('\0' == b.c_str()[b.size()]);
+
+    auto c = make_string_ref(balloc, "charlie", 7);
+
+    // b is no longer the last one, and is copied.
+    auto d = concat_string_ref(balloc, b, "delta", 5);
+
+    CU_ASSERT("alphabravodelta" == d);
+    CU_ASSERT(b.c_str() != d.c_str());
+    CU_ASSERT("charlie" == c);
+
+    // Large allocation does not take block from the pool.
+    std::string large(sizeof(ArenaBlock), 'x');
+    auto e = make_string_ref(balloc, large);
+
+    CU_ASSERT(large == e);
+
+    // Fill the first block to make balloc take another one.
+    for (size_t i = 0; i < sizeof(ArenaBlock) / 512; ++i) {
+      make_string_ref(balloc, large.c_str(), 511);
+    }
+
+    CU_ASSERT(0 == pool.get_free_count());
+  }
+
+  // Blocks are returned to the pool.
+  CU_ASSERT(2 == pool.get_free_count());
+
+  {
+    BlockAllocator balloc(&pool);
+
+    // Long header value received in small fragments, with another
+    // header field name in between.
+    constexpr size_t N = 64 * 1024;
+    auto name = make_string_ref(balloc, "name", 4);
+    auto value = make_string_ref(balloc, "", 0);
+    name = concat_string_ref(balloc, name, "x", 1);
+    for (size_t i = 0; i < N / 16; ++i) {
+      value = concat_string_ref(balloc, value, "0123456789abcdef", 16);
+    }
+
+    CU_ASSERT(N == value.size());
+    CU_ASSERT('\0' == value.c_str()[N]);
+    CU_ASSERT("0123456789abcdef" == StringRef(value.c_str() + N - 16, 16));
+    CU_ASSERT("namex" == name);
+
+    // Memory used is linear to the length of value.
+    CU_ASSERT(balloc.get_allocated() < N * 5);
+  }
+}
+
+} // namespace shrpx
@@ -0,0 +1,260 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_ocsp.h"
+
+#include <sys/stat.h>
+
+#include <fstream>
+#include <iterator>
+
+#include <openssl/ocsp.h>
+#include <openssl/pem.h>
+#include <openssl/err.h>
+
+#include "shrpx_config.h"
+#include "shrpx_log.h"
+#include "util.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+namespace {
+// Reads server certificate and its issuer certificate, which must
+// follow it, from PEM file |path|.  This function returns 0 if it
+// succeeds, or -1.  On success, the caller must free *|cert| and
+// *|issuer| with X509_free().
+int read_cert_and_issuer(X509 **cert, X509 **issuer, const char *path) {
+  auto bio = BIO_new_file(path, "r");
+  if (bio == nullptr) {
+    LOG(WARN) << "Could not open certificate file " << path;
+    return -1;
+  }
+  auto bio_del = util::defer(bio, BIO_free);
+
+  *cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+  if (*cert == nullptr) {
+    LOG(WARN) << "Could not read certificate from " << path;
+    return -1;
+  }
+
+  *issuer = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+  if (*issuer == nullptr || X509_check_issued(*issuer, *cert) != X509_V_OK) {
+    LOG(WARN) << "Issuer certificate must follow the certificate in "
+              << path << " to staple OCSP response";
+    X509_free(*issuer);
+    X509_free(*cert);
+    return -1;
+  }
+
+  ERR_clear_error();
+
+  return 0;
+}
+} // namespace
+
+namespace {
+// Returns the earliest nextUpdate of single responses for |cert|
+// issued by |issuer| in DER encoded |data| of length |len|, or 0 if
+// none of them has it.  This function returns -1 if |data| is not a
+// successful OCSP response, or it has no response for |cert|.
+time_t get_next_update(const uint8_t *data, size_t len, X509 *cert,
+                       X509 *issuer) {
+  auto resp = d2i_OCSP_RESPONSE(nullptr, &data, len);
+  if (resp == nullptr) {
+    return -1;
+  }
+  auto resp_del = util::defer(resp, OCSP_RESPONSE_free);
+
+  if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+    return -1;
+  }
+
+  auto bs = OCSP_response_get1_basic(resp);
+  if (bs == nullptr) {
+    return -1;
+  }
+  auto bs_del = util::defer(bs, OCSP_BASICRESP_free);
+
+  auto found = false;
+  time_t next_update = 0;
+  auto now = time(nullptr);
+
+  // Responders identify certificate by either SHA-1 or SHA-256 hash
+  // of issuer name and key.
+  for (auto md : {EVP_sha1(), EVP_sha256()}) {
+    auto id = OCSP_cert_to_id(md, cert, issuer);
+    if (id == nullptr) {
+      continue;
+    }
+    auto id_del = util::defer(id, OCSP_CERTID_free);
+
+    for (auto i = OCSP_resp_find(bs, id, -1); i >= 0;
+         i = OCSP_resp_find(bs, id, i)) {
+      auto single = OCSP_resp_get0(bs, i);
+
+      int reason;
+      ASN1_GENERALIZEDTIME *rev, *thisupd, *nextupd = nullptr;
+      if (OCSP_single_get0_status(single, &reason, &rev, &thisupd,
+                                  &nextupd) == -1) {
+        continue;
+      }
+
+      found = true;
+
+      if (nextupd == nullptr) {
+        continue;
+      }
+
+      int day, sec;
+      if (ASN1_TIME_diff(&day, &sec, nullptr, nextupd) != 1) {
+        return -1;
+      }
+
+      auto t = now + day * 86400 + sec;
+      if (next_update == 0 || t < next_update) {
+        next_update = t;
+      }
+    }
+  }
+
+  if (!found) {
+    return -1;
+  }
+
+  return next_update;
+}
+} // namespace
+
+OCSPEntry::OCSPEntry(std::string cert_file)
+    : cert_file_(std::move(cert_file)), path_(cert_file_ + ".ocsp"),
+      mtime_(0), cert_mtime_(0) {}
+
+int OCSPEntry::load() {
+  struct stat st, cert_st;
+  if (stat(path_.c_str(), &st) != 0 ||
+      stat(cert_file_.c_str(), &cert_st) != 0) {
+    if (LOG_ENABLED(INFO)) {
+      LOG(INFO) << "OCSP response " << path_ << " is not available";
+    }
+    std::lock_guard<std::mutex> g(mu_);
+    resp_ = nullptr;
+    mtime_ = 0;
+    cert_mtime_ = 0;
+    return -1;
+  }
+
+  if (st.st_mtime == mtime_ && cert_st.st_mtime == cert_mtime_) {
+    return 0;
+  }
+
+  std::ifstream f(path_.c_str(), std::ios::binary);
+  auto resp = std::make_shared<OCSPResponse>();
+  resp->data.assign(std::istreambuf_iterator<char>(f),
+                    std::istreambuf_iterator<char>());
+
+  if (!f || resp->data.empty()) {
+    LOG(WARN) << "Could not read OCSP response " << path_;
+    return -1;
+  }
+
+  X509 *cert, *issuer;
+  if (read_cert_and_issuer(&cert, &issuer, cert_file_.c_str()) != 0) {
+    resp->next_update = -1;
+  } else {
+    resp->next_update = get_next_update(resp->data.data(), resp->data.size(),
+                                        cert, issuer);
+    X509_free(issuer);
+    X509_free(cert);
+  }
+
+  if (resp->next_update == -1) {
+    LOG(WARN) << "OCSP response " << path_ << " is invalid, or not for "
+              << cert_file_;
+    resp = nullptr;
+  } else {
+    LOG(NOTICE) << "Loaded OCSP response " << path_;
+  }
+
+  std::lock_guard<std::mutex> g(mu_);
+  resp_ = std::move(resp);
+  mtime_ = st.st_mtime;
+  cert_mtime_ = cert_st.st_mtime;
+
+  return resp_ ? 0 : -1;
+}
+
+std::shared_ptr<const OCSPResponse> OCSPEntry::get(time_t now) {
+  std::shared_ptr<const OCSPResponse> resp;
+  {
+    std::lock_guard<std::mutex> g(mu_);
+    resp = resp_;
+  }
+
+  if (!resp || (resp->next_update != 0 && resp->next_update < now)) {
+    return nullptr;
+  }
+
+  return resp;
+}
+
+void OCSPStore::add(const std::string &cert_file) {
+  if (entries_.count(cert_file)) {
+    return;
+  }
+
+  auto entry = util::make_unique<OCSPEntry>(cert_file);
+  entry->load();
+
+  entries_.emplace(cert_file, std::move(entry));
+}
+
+OCSPEntry *OCSPStore::find(const std::string &cert_file) const {
+  auto it = entries_.find(cert_file);
+  if (it == std::end(entries_)) {
+    return nullptr;
+  }
+
+  return (*it).second.get();
+}
+
+void OCSPStore::update() {
+  for (auto &kv : entries_) {
+    kv.second->load();
+  }
+}
+
+std::unique_ptr<OCSPStore> create_ocsp_store() {
+  auto ocsp_store = util::make_unique<OCSPStore>();
+
+  ocsp_store->add(get_config()->cert_file.get());
+  for (auto &keycert : get_config()->subcerts) {
+    ocsp_store->add(keycert.second);
+  }
+
+  return ocsp_store;
+}
+
+} // namespace shrpx
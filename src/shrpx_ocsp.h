@@ -0,0 +1,98 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_OCSP_H
+#define SHRPX_OCSP_H
+
+#include "shrpx.h"
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace shrpx {
+
+struct OCSPResponse {
+  // DER encoded OCSP response
+  std::vector<uint8_t> data;
+  // The earliest nextUpdate of single responses for the
+  // certificate, or 0 if none of them has it.
+  time_t next_update;
+};
+
+// OCSPEntry is OCSP response stapled for one certificate.  It is
+// loaded by the main thread, and read by worker threads in TLS
+// handshake.
+class OCSPEntry {
+public:
+  // |cert_file| is PEM file which contains the certificate followed
+  // by its issuer certificate.  Response is read from the file named
+  // after |cert_file| with ".ocsp" suffix.
+  OCSPEntry(std::string cert_file);
+  // Reads response from file if it or certificate file has been
+  // modified since last load.  If file is missing or invalid, or
+  // response is not for the certificate, response is removed.  This
+  // function returns 0 if it succeeds, or -1.
+  int load();
+  // Returns response which is still valid at |now|, or nullptr.
+  std::shared_ptr<const OCSPResponse> get(time_t now);
+
+private:
+  std::mutex mu_;
+  std::shared_ptr<const OCSPResponse> resp_;
+  std::string cert_file_;
+  std::string path_;
+  // Modification time of response and certificate files when they
+  // were last loaded.
+  time_t mtime_;
+  time_t cert_mtime_;
+};
+
+// OCSPStore holds OCSPEntry for each server certificate.  Response
+// for certificate is read from the file named after certificate file
+// with ".ocsp" suffix, which external program keeps updated.
+class OCSPStore {
+public:
+  // Adds entry for |cert_file| and loads its response.  This must be
+  // called before worker threads start.
+  void add(const std::string &cert_file);
+  // Returns entry for |cert_file|, or nullptr.
+  OCSPEntry *find(const std::string &cert_file) const;
+  // Reloads responses whose files have been modified.
+  void update();
+
+private:
+  std::map<std::string, std::unique_ptr<OCSPEntry>> entries_;
+};
+
+// Creates OCSPStore which has entries for the certificate and
+// --subcert certificates in get_config().
+std::unique_ptr<OCSPStore> create_ocsp_store();
+
+} // namespace shrpx
+
+#endif // SHRPX_OCSP_H
@@ -0,0 +1,344 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_session_cache.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+namespace shrpx {
+
+namespace {
+constexpr uint32_t SESSION_CACHE_MAGIC = 0x6e677363;
+// The number of shards.  Sessions are spread over shards by the hash
+// of session ID, so that threads and processes rarely contend for
+// the same lock.
+constexpr uint32_t SESSION_CACHE_NUM_SHARDS = 16;
+// The number of consecutive slots a session ID can be stored in
+constexpr uint32_t SESSION_CACHE_PROBE_LEN = 8;
+// Alignment of header and shards, so that locks of different shards
+// do not share a cache line.
+constexpr size_t SESSION_CACHE_ALIGN = 64;
+} // namespace
+
+struct SessionCacheHeader {
+  uint32_t magic;
+  uint32_t nshards;
+  // The number of slots in each shard
+  uint32_t nslots;
+  // The number of bytes occupied by each shard, including its slots
+  uint32_t shard_size;
+};
+
+struct SessionCacheShard {
+  pthread_mutex_t mu;
+};
+
+struct SessionCacheSlot {
+  // The time when session expires, or 0 if slot is not used.
+  int64_t expiry;
+  uint32_t hash;
+  uint16_t idlen;
+  uint16_t datalen;
+  uint8_t id[SESSION_CACHE_MAX_IDLEN];
+  uint8_t data[SESSION_CACHE_MAX_DATALEN];
+};
+
+namespace {
+size_t align_up(size_t n) {
+  return (n + SESSION_CACHE_ALIGN - 1) & ~(SESSION_CACHE_ALIGN - 1);
+}
+} // namespace
+
+namespace {
+size_t shard_offset(size_t idx, size_t shard_size) {
+  return align_up(sizeof(SessionCacheHeader)) + idx * shard_size;
+}
+} // namespace
+
+namespace {
+// FNV-1a hash of |id| of length |idlen|
+uint32_t hash_id(const uint8_t *id, size_t idlen) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < idlen; ++i) {
+    h ^= id[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+} // namespace
+
+namespace {
+int create_shm_fd(size_t len) {
+  int fd;
+#ifdef HAVE_MEMFD_CREATE
+  fd = memfd_create("nghttpx-session-cache", 0);
+#else  // !HAVE_MEMFD_CREATE
+  char path[] = "/tmp/nghttpx-session-cache-XXXXXX";
+  fd = mkstemp(path);
+  if (fd != -1) {
+    unlink(path);
+  }
+#endif // !HAVE_MEMFD_CREATE
+  if (fd == -1) {
+    return -1;
+  }
+
+  if (ftruncate(fd, len) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+} // namespace
+
+SessionCache::SessionCache() : header_(nullptr), len_(0), fd_(-1) {}
+
+SessionCache::~SessionCache() {
+  if (header_) {
+    munmap(header_, len_);
+  }
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+int SessionCache::map(int fd, size_t len) {
+  auto p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    return -1;
+  }
+
+  header_ = static_cast<SessionCacheHeader *>(p);
+  len_ = len;
+  fd_ = fd;
+
+  return 0;
+}
+
+int SessionCache::init(size_t size) {
+  auto nslots = std::max(static_cast<size_t>(SESSION_CACHE_PROBE_LEN),
+                         size / sizeof(SessionCacheSlot) /
+                             SESSION_CACHE_NUM_SHARDS);
+  auto shard_size = align_up(align_up(sizeof(SessionCacheShard)) +
+                             nslots * sizeof(SessionCacheSlot));
+  auto len = shard_offset(SESSION_CACHE_NUM_SHARDS, shard_size);
+
+  auto fd = create_shm_fd(len);
+  if (fd == -1) {
+    return -1;
+  }
+
+  if (map(fd, len) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  // If a process dies while holding lock, the next owner gets
+  // EOWNERDEAD instead of waiting forever.
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+
+  header_->nshards = SESSION_CACHE_NUM_SHARDS;
+  header_->nslots = nslots;
+  header_->shard_size = shard_size;
+
+  for (size_t i = 0; i < SESSION_CACHE_NUM_SHARDS; ++i) {
+    auto shard = reinterpret_cast<SessionCacheShard *>(
+        reinterpret_cast<uint8_t *>(header_) + shard_offset(i, shard_size));
+    pthread_mutex_init(&shard->mu, &attr);
+  }
+
+  pthread_mutexattr_destroy(&attr);
+
+  header_->magic = SESSION_CACHE_MAGIC;
+
+  return 0;
+}
+
+int SessionCache::attach(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(SessionCacheHeader)) {
+    return -1;
+  }
+
+  if (map(fd, st.st_size) != 0) {
+    return -1;
+  }
+
+  if (header_->magic != SESSION_CACHE_MAGIC || header_->nshards == 0 ||
+      header_->nslots < SESSION_CACHE_PROBE_LEN ||
+      shard_offset(header_->nshards, header_->shard_size) != len_) {
+    munmap(header_, len_);
+    header_ = nullptr;
+    len_ = 0;
+    fd_ = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+int SessionCache::get_fd() const { return fd_; }
+
+size_t SessionCache::get_capacity() const {
+  return static_cast<size_t>(header_->nshards) * header_->nslots;
+}
+
+SessionCacheSlot *SessionCache::get_slot(SessionCacheShard *shard,
+                                         size_t idx) {
+  auto slots = reinterpret_cast<SessionCacheSlot *>(
+      reinterpret_cast<uint8_t *>(shard) +
+      align_up(sizeof(SessionCacheShard)));
+  return &slots[idx % header_->nslots];
+}
+
+SessionCacheShard *SessionCache::lock_shard(const uint8_t *id, size_t idlen,
+                                            uint32_t *hash) {
+  *hash = hash_id(id, idlen);
+
+  auto shard = reinterpret_cast<SessionCacheShard *>(
+      reinterpret_cast<uint8_t *>(header_) +
+      shard_offset(*hash % header_->nshards, header_->shard_size));
+
+  if (pthread_mutex_lock(&shard->mu) == EOWNERDEAD) {
+    // Previous owner died in the middle of update.  Drop all sessions
+    // in this shard since they may be broken.
+    for (size_t i = 0; i < header_->nslots; ++i) {
+      get_slot(shard, i)->expiry = 0;
+    }
+    pthread_mutex_consistent(&shard->mu);
+  }
+
+  return shard;
+}
+
+void SessionCache::unlock_shard(SessionCacheShard *shard) {
+  pthread_mutex_unlock(&shard->mu);
+}
+
+SessionCacheSlot *SessionCache::find_slot(SessionCacheShard *shard,
+                                          uint32_t hash, const uint8_t *id,
+                                          size_t idlen) {
+  auto base = hash / header_->nshards;
+  for (size_t i = 0; i < SESSION_CACHE_PROBE_LEN; ++i) {
+    auto slot = get_slot(shard, base + i);
+    if (slot->expiry != 0 && slot->hash == hash && slot->idlen == idlen &&
+        memcmp(slot->id, id, idlen) == 0) {
+      return slot;
+    }
+  }
+  return nullptr;
+}
+
+int SessionCache::store(const uint8_t *id, size_t idlen, const uint8_t *data,
+                        size_t datalen, time_t expiry) {
+  if (idlen > SESSION_CACHE_MAX_IDLEN || datalen > SESSION_CACHE_MAX_DATALEN) {
+    return -1;
+  }
+
+  uint32_t hash;
+  auto shard = lock_shard(id, idlen, &hash);
+
+  auto slot = find_slot(shard, hash, id, idlen);
+  if (!slot) {
+    // Evict the session which expires first.  Unused slot has
+    // expiry 0, so it is always chosen first.
+    auto base = hash / header_->nshards;
+    slot = get_slot(shard, base);
+    for (size_t i = 1; i < SESSION_CACHE_PROBE_LEN; ++i) {
+      auto s = get_slot(shard, base + i);
+      if (s->expiry < slot->expiry) {
+        slot = s;
+      }
+    }
+  }
+
+  slot->expiry = expiry;
+  slot->hash = hash;
+  slot->idlen = idlen;
+  slot->datalen = datalen;
+  memcpy(slot->id, id, idlen);
+  memcpy(slot->data, data, datalen);
+
+  unlock_shard(shard);
+
+  return 0;
+}
+
+ssize_t SessionCache::lookup(uint8_t *out, const uint8_t *id, size_t idlen,
+                             time_t now) {
+  if (idlen > SESSION_CACHE_MAX_IDLEN) {
+    return -1;
+  }
+
+  uint32_t hash;
+  auto shard = lock_shard(id, idlen, &hash);
+
+  ssize_t rv = -1;
+
+  auto slot = find_slot(shard, hash, id, idlen);
+  if (slot) {
+    if (slot->expiry <= now) {
+      slot->expiry = 0;
+    } else {
+      memcpy(out, slot->data, slot->datalen);
+      rv = slot->datalen;
+    }
+  }
+
+  unlock_shard(shard);
+
+  return rv;
+}
+
+void SessionCache::remove(const uint8_t *id, size_t idlen) {
+  if (idlen > SESSION_CACHE_MAX_IDLEN) {
+    return;
+  }
+
+  uint32_t hash;
+  auto shard = lock_shard(id, idlen, &hash);
+
+  auto slot = find_slot(shard, hash, id, idlen);
+  if (slot) {
+    slot->expiry = 0;
+  }
+
+  unlock_shard(shard);
+}
+
+} // namespace shrpx
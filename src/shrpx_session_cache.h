@@ -0,0 +1,99 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_SESSION_CACHE_H
+#define SHRPX_SESSION_CACHE_H
+
+#include "shrpx.h"
+
+#include <sys/types.h>
+#include <ctime>
+
+namespace shrpx {
+
+// Maximum length of TLS session ID
+constexpr size_t SESSION_CACHE_MAX_IDLEN = 32;
+// Maximum length of serialized session.  Larger sessions are not
+// cached.
+constexpr size_t SESSION_CACHE_MAX_DATALEN = 1024;
+
+struct SessionCacheHeader;
+struct SessionCacheShard;
+struct SessionCacheSlot;
+
+// SessionCache is a TLS session cache keyed by session ID, which
+// lives in shared memory.  The memory is shared by all worker
+// threads, and by the new process started by executing new binary,
+// which inherits it as a file descriptor.  Sessions are stored in
+// fixed size slots, and slots are split into shards, each of them
+// guarded by its own process-shared mutex.
+class SessionCache {
+public:
+  SessionCache();
+  ~SessionCache();
+  // Creates shared memory which holds as many sessions as fit in
+  // |size| bytes.  This function returns 0 if it succeeds, or -1.
+  int init(size_t size);
+  // Maps shared memory created by another process and inherited as
+  // |fd|.  On success, this object takes ownership of |fd|.  This
+  // function returns 0 if it succeeds, or -1.
+  int attach(int fd);
+  // Returns file descriptor of shared memory.
+  int get_fd() const;
+  // Stores serialized session |data| of length |datalen| under
+  // session ID |id| of length |idlen|.  The session expires at
+  // |expiry|.  This function returns 0 if it succeeds, or -1 if
+  // session is too large to be cached.
+  int store(const uint8_t *id, size_t idlen, const uint8_t *data,
+            size_t datalen, time_t expiry);
+  // Copies serialized session for |id| of length |idlen| into |out|,
+  // which must be at least SESSION_CACHE_MAX_DATALEN bytes long.
+  // This function returns the length of session, or -1 if session is
+  // not found or expired at |now|.
+  ssize_t lookup(uint8_t *out, const uint8_t *id, size_t idlen, time_t now);
+  // Removes session for |id| of length |idlen|.
+  void remove(const uint8_t *id, size_t idlen);
+  // Returns the number of sessions this cache can hold.
+  size_t get_capacity() const;
+
+private:
+  // Locks shard for |id| of length |idlen|, and returns it.
+  SessionCacheShard *lock_shard(const uint8_t *id, size_t idlen,
+                                uint32_t *hash);
+  void unlock_shard(SessionCacheShard *shard);
+  SessionCacheSlot *get_slot(SessionCacheShard *shard, size_t idx);
+  // Returns slot which holds |id| of length |idlen| in |shard|, or
+  // nullptr.
+  SessionCacheSlot *find_slot(SessionCacheShard *shard, uint32_t hash,
+                              const uint8_t *id, size_t idlen);
+  int map(int fd, size_t len);
+
+  SessionCacheHeader *header_;
+  size_t len_;
+  int fd_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_SESSION_CACHE_H
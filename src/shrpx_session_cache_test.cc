@@ -0,0 +1,96 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_session_cache_test.h"
+
+#include <unistd.h>
+
+#include <cstring>
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_session_cache.h"
+
+namespace shrpx {
+
+void test_shrpx_session_cache(void) {
+  SessionCache cache;
+  uint8_t buf[SESSION_CACHE_MAX_DATALEN];
+  const uint8_t id1[] = "session-id-1";
+  const uint8_t id2[] = "session-id-2";
+  const uint8_t data1[] = "alpha";
+  const uint8_t data2[] = "bravo";
+
+  CU_ASSERT(0 == cache.init(64 * 1024));
+  CU_ASSERT(cache.get_capacity() >= 16);
+
+  CU_ASSERT(-1 == cache.lookup(buf, id1, sizeof(id1), 100));
+
+  CU_ASSERT(0 == cache.store(id1, sizeof(id1), data1, sizeof(data1), 200));
+  CU_ASSERT(0 == cache.store(id2, sizeof(id2), data2, sizeof(data2), 200));
+
+  CU_ASSERT(static_cast<ssize_t>(sizeof(data1)) ==
+            cache.lookup(buf, id1, sizeof(id1), 100));
+  CU_ASSERT(0 == memcmp(data1, buf, sizeof(data1)));
+
+  // Overwrite
+  CU_ASSERT(0 == cache.store(id1, sizeof(id1), data2, sizeof(data2), 200));
+  CU_ASSERT(static_cast<ssize_t>(sizeof(data2)) ==
+            cache.lookup(buf, id1, sizeof(id1), 100));
+  CU_ASSERT(0 == memcmp(data2, buf, sizeof(data2)));
+
+  // Expired
+  CU_ASSERT(-1 == cache.lookup(buf, id2, sizeof(id2), 200));
+
+  cache.remove(id1, sizeof(id1));
+  CU_ASSERT(-1 == cache.lookup(buf, id1, sizeof(id1), 100));
+
+  // Too large
+  uint8_t large[SESSION_CACHE_MAX_DATALEN + 1]{};
+  CU_ASSERT(-1 == cache.store(id1, sizeof(id1), large, sizeof(large), 200));
+
+  // Another mapping of the same memory, which new binary gets,
+  // shares sessions.
+  CU_ASSERT(0 == cache.store(id1, sizeof(id1), data1, sizeof(data1), 200));
+
+  SessionCache other;
+  CU_ASSERT(0 == other.attach(dup(cache.get_fd())));
+  CU_ASSERT(cache.get_capacity() == other.get_capacity());
+  CU_ASSERT(static_cast<ssize_t>(sizeof(data1)) ==
+            other.lookup(buf, id1, sizeof(id1), 100));
+  CU_ASSERT(0 == memcmp(data1, buf, sizeof(data1)));
+
+  other.remove(id1, sizeof(id1));
+  CU_ASSERT(-1 == cache.lookup(buf, id1, sizeof(id1), 100));
+
+  // Not a session cache
+  int fds[2];
+  CU_ASSERT(0 == pipe(fds));
+  SessionCache bad;
+  CU_ASSERT(-1 == bad.attach(fds[0]));
+  close(fds[0]);
+  close(fds[1]);
+}
+
+} // namespace shrpx
@@ -166,7 +166,8 @@ void on_ctrl_recv_callback(spdylay_session *session, spdylay_frame_type type,
     }
 
     for (size_t i = 0; nv[i]; i += 2) {
-      downstream->add_request_header(nv[i], nv[i + 1]);
+      downstream->add_request_header(StringRef(nv[i], strlen(nv[i])),
+                                     StringRef(nv[i + 1], strlen(nv[i + 1])));
     }
 
     if (downstream->index_request_headers() != 0) {
@@ -187,13 +188,13 @@ void on_ctrl_recv_callback(spdylay_session *session, spdylay_frame_type type,
       return;
     }
 
-    downstream->set_request_method(method->value);
+    downstream->set_request_method(method->value.str());
     if (is_connect) {
-      downstream->set_request_http2_authority(path->value);
+      downstream->set_request_http2_authority(path->value.str());
     } else {
-      downstream->set_request_http2_scheme(scheme->value);
-      downstream->set_request_http2_authority(host->value);
-      downstream->set_request_path(path->value);
+      downstream->set_request_http2_scheme(scheme->value.str());
+      downstream->set_request_http2_authority(host->value.str());
+      downstream->set_request_path(path->value.str());
     }
 
     if (!(frame->syn_stream.hd.flags & SPDYLAY_CTRL_FLAG_FIN)) {
@@ -239,7 +240,7 @@ void SpdyUpstream::start_downstream(Downstream *downstream) {
 
 void SpdyUpstream::initiate_downstream(std::unique_ptr<Downstream> downstream) {
   int rv = downstream->attach_downstream_connection(
-      handler_->get_downstream_connection());
+      handler_->get_downstream_connection(downstream.get()));
   if (rv != 0) {
     // If downstream connection fails, issue RST_STREAM.
     rst_stream(downstream.get(), SPDYLAY_INTERNAL_ERROR);
@@ -858,7 +859,7 @@ int SpdyUpstream::on_downstream_header_complete(Downstream *downstream) {
     if (hd.name.empty() || hd.name.c_str()[0] == ':') {
       continue;
     }
-    auto token = http2::lookup_token(hd.name);
+    auto token = http2::lookup_token(hd.name.byte(), hd.name.size());
     switch (token) {
     case http2::HD_CONNECTION:
     case http2::HD_KEEP_ALIVE:
@@ -887,7 +888,7 @@ int SpdyUpstream::on_downstream_header_complete(Downstream *downstream) {
   if (!get_config()->no_via) {
     auto via = downstream->get_response_header(http2::HD_VIA);
     if (via) {
-      via_value = via->value;
+      via_value.assign(via->value.c_str(), via->value.size());
       via_value += ", ";
     }
     via_value += http::create_via_header_value(
@@ -1054,7 +1055,7 @@ int SpdyUpstream::on_downstream_reset(bool no_retry) {
     // downstream connection.
 
     rv = downstream->attach_downstream_connection(
-        handler_->get_downstream_connection());
+        handler_->get_downstream_connection(downstream));
     if (rv != 0) {
       rst_stream(downstream, SPDYLAY_INTERNAL_ERROR);
       downstream->pop_downstream_connection();
@@ -1067,6 +1068,12 @@ int SpdyUpstream::on_downstream_reset(bool no_retry) {
   return 0;
 }
 
+int SpdyUpstream::on_collapsed_request_ready(Downstream *downstream) {
+  // SPDY frontend does not use response cache, and its requests are
+  // never collapsed.
+  return 0;
+}
+
 MemchunkPool *SpdyUpstream::get_mcpool() { return &mcpool_; }
 
 } // namespace shrpx
@@ -76,6 +76,7 @@ public:
 
   virtual void on_handler_delete();
   virtual int on_downstream_reset(bool no_retry);
+  virtual int on_collapsed_request_ready(Downstream *downstream);
 
   virtual MemchunkPool *get_mcpool();
 
@@ -0,0 +1,146 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_splice.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cerrno>
+#include <algorithm>
+
+#include "shrpx_error.h"
+
+namespace shrpx {
+
+namespace {
+// Default pipe capacity on Linux
+constexpr size_t DEFAULT_PIPE_CAPACITY = 65536;
+} // namespace
+
+SplicePipe::SplicePipe()
+    : len_(0), capacity_(DEFAULT_PIPE_CAPACITY), rfd_(-1), wfd_(-1),
+      full_(false) {}
+
+SplicePipe::~SplicePipe() {
+  if (rfd_ != -1) {
+    close(rfd_);
+  }
+  if (wfd_ != -1) {
+    close(wfd_);
+  }
+}
+
+#ifdef HAVE_SPLICE
+int SplicePipe::init() {
+  int fds[2];
+
+  if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+    return -1;
+  }
+
+  rfd_ = fds[0];
+  wfd_ = fds[1];
+
+#ifdef F_GETPIPE_SZ
+  auto n = fcntl(wfd_, F_GETPIPE_SZ);
+  if (n > 0) {
+    capacity_ = n;
+  }
+#endif // F_GETPIPE_SZ
+
+  return 0;
+}
+
+ssize_t SplicePipe::read_from(int fd, size_t max) {
+  if (full()) {
+    return 0;
+  }
+
+  auto n = std::min(max, capacity_ - len_);
+  if (n == 0) {
+    return 0;
+  }
+
+  ssize_t nread;
+  while ((nread = splice(fd, nullptr, wfd_, nullptr, n,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) == -1 &&
+         errno == EINTR)
+    ;
+  if (nread == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // We cannot tell whether socket or pipe would block.  Assume
+      // the latter if pipe has data so that caller stops reading
+      // until it is drained.
+      full_ = len_ > 0;
+      return 0;
+    }
+    return SHRPX_ERR_NETWORK;
+  }
+
+  if (nread == 0) {
+    return SHRPX_ERR_EOF;
+  }
+
+  len_ += nread;
+
+  return nread;
+}
+
+ssize_t SplicePipe::write_to(int fd, size_t max) {
+  auto n = std::min(max, len_);
+  if (n == 0) {
+    return 0;
+  }
+
+  ssize_t nwrite;
+  while ((nwrite = splice(rfd_, nullptr, fd, nullptr, n,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) == -1 &&
+         errno == EINTR)
+    ;
+  if (nwrite == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
+    return SHRPX_ERR_NETWORK;
+  }
+
+  len_ -= nwrite;
+  full_ = false;
+
+  return nwrite;
+}
+#else  // !HAVE_SPLICE
+int SplicePipe::init() { return -1; }
+
+ssize_t SplicePipe::read_from(int fd, size_t max) { return SHRPX_ERR_NETWORK; }
+
+ssize_t SplicePipe::write_to(int fd, size_t max) { return SHRPX_ERR_NETWORK; }
+#endif // !HAVE_SPLICE
+
+size_t SplicePipe::rleft() const { return len_; }
+
+bool SplicePipe::full() const { return full_ || len_ >= capacity_; }
+
+} // namespace shrpx
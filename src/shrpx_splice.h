@@ -0,0 +1,68 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_SPLICE_H
+#define SHRPX_SPLICE_H
+
+#include "shrpx.h"
+
+#include <sys/types.h>
+
+namespace shrpx {
+
+// SplicePipe is a kernel pipe used to relay bytes between two
+// sockets with splice(2), so that they are never copied to user
+// space.  It is only functional if the system has splice(2).
+class SplicePipe {
+public:
+  SplicePipe();
+  ~SplicePipe();
+  // Creates underlying pipe.  This function returns 0 if it
+  // succeeds, or -1.
+  int init();
+  // Moves at most |max| bytes from socket |fd| into the pipe.  This
+  // function returns the number of bytes moved, which is 0 if |fd|
+  // has no data or pipe is full.  It returns SHRPX_ERR_EOF if peer
+  // closed connection, or SHRPX_ERR_NETWORK on other error.
+  ssize_t read_from(int fd, size_t max);
+  // Moves at most |max| bytes from the pipe to socket |fd|.  This
+  // function returns the number of bytes moved, which is 0 if |fd|
+  // is not writable, or SHRPX_ERR_NETWORK.
+  ssize_t write_to(int fd, size_t max);
+  // Returns the number of bytes buffered in the pipe.
+  size_t rleft() const;
+  // Returns true if no more bytes can be moved into the pipe.
+  bool full() const;
+
+private:
+  size_t len_;
+  size_t capacity_;
+  int rfd_, wfd_;
+  // true if splice(2) into pipe would block while it is not empty.
+  bool full_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_SPLICE_H
@@ -0,0 +1,169 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_splice_test.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_splice.h"
+#include "shrpx_error.h"
+
+namespace shrpx {
+
+void test_shrpx_splice_pipe(void) {
+  SplicePipe pipe;
+  if (pipe.init() != 0) {
+    // splice(2) is not available
+    return;
+  }
+
+  int in[2], out[2];
+  CU_ASSERT(0 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, in));
+  CU_ASSERT(0 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, out));
+
+  char buf[16];
+  const char msg[] = "hello world";
+
+  CU_ASSERT(11 == write(in[0], msg, 11));
+
+  CU_ASSERT(11 == pipe.read_from(in[1], sizeof(buf)));
+  CU_ASSERT(11 == pipe.rleft());
+  CU_ASSERT(!pipe.full());
+
+  // Socket has no data.  Since pipe is not empty, it is regarded as
+  // full until something is written.
+  CU_ASSERT(0 == pipe.read_from(in[1], sizeof(buf)));
+  CU_ASSERT(pipe.full());
+
+  CU_ASSERT(5 == pipe.write_to(out[0], 5));
+  CU_ASSERT(6 == pipe.rleft());
+  CU_ASSERT(!pipe.full());
+
+  CU_ASSERT(6 == pipe.write_to(out[0], sizeof(buf)));
+  CU_ASSERT(0 == pipe.rleft());
+  CU_ASSERT(0 == pipe.write_to(out[0], sizeof(buf)));
+
+  CU_ASSERT(11 == read(out[1], buf, sizeof(buf)));
+  CU_ASSERT(0 == memcmp(msg, buf, 11));
+
+  // Bytes sent before EOF are moved first, and remain in pipe after
+  // EOF is reported.
+  CU_ASSERT(3 == write(in[0], "foo", 3));
+  CU_ASSERT(0 == shutdown(in[0], SHUT_WR));
+
+  CU_ASSERT(3 == pipe.read_from(in[1], sizeof(buf)));
+  CU_ASSERT(SHRPX_ERR_EOF == pipe.read_from(in[1], sizeof(buf)));
+  CU_ASSERT(3 == pipe.rleft());
+
+  CU_ASSERT(3 == pipe.write_to(out[0], sizeof(buf)));
+  CU_ASSERT(0 == pipe.rleft());
+
+  CU_ASSERT(3 == read(out[1], buf, sizeof(buf)));
+  CU_ASSERT(0 == memcmp("foo", buf, 3));
+
+  close(in[0]);
+  close(in[1]);
+  close(out[0]);
+  close(out[1]);
+}
+
+void test_shrpx_splice_pipe_full(void) {
+  SplicePipe pipe;
+  if (pipe.init() != 0) {
+    // splice(2) is not available
+    return;
+  }
+
+  int in[2], out[2];
+  CU_ASSERT(0 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, in));
+  CU_ASSERT(0 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, out));
+
+  // More than default pipe capacity, so that socket still has data
+  // when pipe becomes full.
+  std::vector<uint8_t> data(256 * 1024);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = i * 31;
+  }
+
+  size_t nsent = 0;
+  while (nsent < data.size()) {
+    auto n = write(in[0], data.data() + nsent, data.size() - nsent);
+    if (n <= 0) {
+      break;
+    }
+    nsent += n;
+  }
+
+  CU_ASSERT(nsent > 0);
+
+  size_t nread = 0;
+  while (!pipe.full()) {
+    auto n = pipe.read_from(in[1], SIZE_MAX);
+    CU_ASSERT(n >= 0);
+    if (n <= 0) {
+      break;
+    }
+    nread += n;
+  }
+
+  CU_ASSERT(pipe.full());
+  CU_ASSERT(nread > 0);
+  CU_ASSERT(nread == pipe.rleft());
+  CU_ASSERT(0 == pipe.read_from(in[1], SIZE_MAX));
+  CU_ASSERT(nread == pipe.rleft());
+
+  std::vector<uint8_t> got;
+  uint8_t buf[16384];
+
+  while (pipe.rleft() > 0) {
+    auto n = pipe.write_to(out[0], SIZE_MAX);
+    CU_ASSERT(n > 0);
+    if (n <= 0) {
+      break;
+    }
+    CU_ASSERT(!pipe.full());
+
+    ssize_t m;
+    while ((m = read(out[1], buf, sizeof(buf))) > 0) {
+      got.insert(std::end(got), buf, buf + m);
+    }
+  }
+
+  CU_ASSERT(nread == got.size());
+  CU_ASSERT(0 == memcmp(data.data(), got.data(), got.size()));
+
+  close(in[0]);
+  close(in[1]);
+  close(out[0]);
+  close(out[1]);
+}
+
+} // namespace shrpx
@@ -49,6 +49,9 @@
 #include "shrpx_worker.h"
 #include "shrpx_worker_config.h"
 #include "shrpx_downstream_connection_pool.h"
+#include "shrpx_session_cache.h"
+#include "shrpx_key_offload.h"
+#include "shrpx_ocsp.h"
 #include "util.h"
 #include "ssl.h"
 
@@ -287,12 +290,105 @@ long int create_tls_proto_mask(const std::vector<char *> &tls_proto_list) {
   return res;
 }
 
+namespace {
+int tls_session_new_cb(SSL *ssl, SSL_SESSION *session) {
+  auto session_cache = worker_config->session_cache;
+  if (!session_cache) {
+    return 0;
+  }
+
+  unsigned int idlen;
+  auto id = SSL_SESSION_get_id(session, &idlen);
+
+  auto len = i2d_SSL_SESSION(session, nullptr);
+  if (len <= 0 || static_cast<size_t>(len) > SESSION_CACHE_MAX_DATALEN) {
+    return 0;
+  }
+
+  uint8_t buf[SESSION_CACHE_MAX_DATALEN];
+  auto p = buf;
+  i2d_SSL_SESSION(session, &p);
+
+  auto expiry =
+      SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session);
+
+  session_cache->store(id, idlen, buf, len, expiry);
+
+  // We do not keep reference to |session|.
+  return 0;
+}
+} // namespace
+
+namespace {
+SSL_SESSION *tls_session_get_cb(SSL *ssl,
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+                                const unsigned char *id,
+#else  // OPENSSL_VERSION_NUMBER < 0x10100000L
+                                unsigned char *id,
+#endif // OPENSSL_VERSION_NUMBER < 0x10100000L
+                                int idlen, int *copy) {
+  *copy = 0;
+
+  auto session_cache = worker_config->session_cache;
+  if (!session_cache) {
+    return nullptr;
+  }
+
+  uint8_t buf[SESSION_CACHE_MAX_DATALEN];
+  auto len = session_cache->lookup(buf, id, idlen, time(nullptr));
+  if (len == -1) {
+    if (LOG_ENABLED(INFO)) {
+      LOG(INFO) << "TLS session not found in cache";
+    }
+    return nullptr;
+  }
+
+  const unsigned char *p = buf;
+  return d2i_SSL_SESSION(nullptr, &p, len);
+}
+} // namespace
+
+namespace {
+void tls_session_remove_cb(SSL_CTX *ssl_ctx, SSL_SESSION *session) {
+  auto session_cache = worker_config->session_cache;
+  if (!session_cache) {
+    return;
+  }
+
+  unsigned int idlen;
+  auto id = SSL_SESSION_get_id(session, &idlen);
+
+  session_cache->remove(id, idlen);
+}
+} // namespace
+
+namespace {
+int ocsp_resp_cb(SSL *ssl, void *arg) {
+  auto entry = static_cast<OCSPEntry *>(arg);
+  auto resp = entry->get(time(nullptr));
+  if (!resp) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+
+  // OpenSSL takes ownership of buf.
+  auto buf = static_cast<uint8_t *>(OPENSSL_malloc(resp->data.size()));
+  if (buf == nullptr) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  std::copy(std::begin(resp->data), std::end(resp->data), buf);
+
+  SSL_set_tlsext_status_ocsp_resp(ssl, buf, resp->data.size());
+
+  return SSL_TLSEXT_ERR_OK;
+}
+} // namespace
+
 SSL_CTX *create_ssl_context(const char *private_key_file,
                             const char *cert_file) {
   auto ssl_ctx = SSL_CTX_new(SSLv23_server_method());
   if (!ssl_ctx) {
-    LOG(FATAL) << ERR_error_string(ERR_get_error(), nullptr);
-    DIE();
+    LOG(ERROR) << ERR_error_string(ERR_get_error(), nullptr);
+    return nullptr;
   }
 
   SSL_CTX_set_options(
@@ -304,7 +400,17 @@ SSL_CTX *create_ssl_context(const char *private_key_file,
 
   const unsigned char sid_ctx[] = "shrpx";
   SSL_CTX_set_session_id_context(ssl_ctx, sid_ctx, sizeof(sid_ctx) - 1);
-  SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
+
+  if (get_config()->tls_session_cache_size > 0) {
+    // Sessions are shared by all SSL_CTX through shared memory.
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER |
+                                                SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, tls_session_new_cb);
+    SSL_CTX_sess_set_get_cb(ssl_ctx, tls_session_get_cb);
+    SSL_CTX_sess_set_remove_cb(ssl_ctx, tls_session_remove_cb);
+  } else {
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER);
+  }
 
   const char *ciphers;
   if (get_config()->ciphers) {
@@ -314,9 +420,10 @@ SSL_CTX *create_ssl_context(const char *private_key_file,
   }
 
   if (SSL_CTX_set_cipher_list(ssl_ctx, ciphers) == 0) {
-    LOG(FATAL) << "SSL_CTX_set_cipher_list " << ciphers
+    LOG(ERROR) << "SSL_CTX_set_cipher_list " << ciphers
                << " failed: " << ERR_error_string(ERR_get_error(), nullptr);
-    DIE();
+    SSL_CTX_free(ssl_ctx);
+    return nullptr;
   }
 
 #ifndef OPENSSL_NO_EC
@@ -331,9 +438,10 @@ SSL_CTX *create_ssl_context(const char *private_key_file,
   // writing.
   auto ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
   if (ecdh == nullptr) {
-    LOG(FATAL) << "EC_KEY_new_by_curv_name failed: "
+    LOG(ERROR) << "EC_KEY_new_by_curv_name failed: "
                << ERR_error_string(ERR_get_error(), nullptr);
-    DIE();
+    SSL_CTX_free(ssl_ctx);
+    return nullptr;
   }
   SSL_CTX_set_tmp_ecdh(ssl_ctx, ecdh);
   EC_KEY_free(ecdh);
@@ -345,19 +453,21 @@ SSL_CTX *create_ssl_context(const char *private_key_file,
     // Read DH parameters from file
     auto bio = BIO_new_file(get_config()->dh_param_file.get(), "r");
     if (bio == nullptr) {
-      LOG(FATAL) << "BIO_new_file() failed: "
+      LOG(ERROR) << "BIO_new_file() failed: "
                  << ERR_error_string(ERR_get_error(), nullptr);
-      DIE();
+      SSL_CTX_free(ssl_ctx);
+      return nullptr;
     }
     auto dh = PEM_read_bio_DHparams(bio, nullptr, nullptr, nullptr);
+    BIO_free(bio);
     if (dh == nullptr) {
-      LOG(FATAL) << "PEM_read_bio_DHparams() failed: "
+      LOG(ERROR) << "PEM_read_bio_DHparams() failed: "
                  << ERR_error_string(ERR_get_error(), nullptr);
-      DIE();
+      SSL_CTX_free(ssl_ctx);
+      return nullptr;
     }
     SSL_CTX_set_tmp_dh(ssl_ctx, dh);
     DH_free(dh);
-    BIO_free(bio);
   }
 
   SSL_CTX_set_mode(ssl_ctx, SSL_MODE_AUTO_RETRY);
@@ -368,19 +478,36 @@ SSL_CTX *create_ssl_context(const char *private_key_file,
   }
   if (SSL_CTX_use_PrivateKey_file(ssl_ctx, private_key_file,
                                   SSL_FILETYPE_PEM) != 1) {
-    LOG(FATAL) << "SSL_CTX_use_PrivateKey_file failed: "
+    LOG(ERROR) << "SSL_CTX_use_PrivateKey_file failed: "
                << ERR_error_string(ERR_get_error(), nullptr);
-    DIE();
+    SSL_CTX_free(ssl_ctx);
+    return nullptr;
   }
   if (SSL_CTX_use_certificate_chain_file(ssl_ctx, cert_file) != 1) {
-    LOG(FATAL) << "SSL_CTX_use_certificate_file failed: "
+    LOG(ERROR) << "SSL_CTX_use_certificate_file failed: "
                << ERR_error_string(ERR_get_error(), nullptr);
-    DIE();
+    SSL_CTX_free(ssl_ctx);
+    return nullptr;
   }
   if (SSL_CTX_check_private_key(ssl_ctx) != 1) {
-    LOG(FATAL) << "SSL_CTX_check_private_key failed: "
+    LOG(ERROR) << "SSL_CTX_check_private_key failed: "
                << ERR_error_string(ERR_get_error(), nullptr);
-    DIE();
+    SSL_CTX_free(ssl_ctx);
+    return nullptr;
+  }
+  if (get_config()->tls_key_offload_threads > 0 &&
+      enable_key_offload(ssl_ctx) != 0) {
+    LOG(ERROR) << "Could not enable private key offload: "
+               << ERR_error_string(ERR_get_error(), nullptr);
+    SSL_CTX_free(ssl_ctx);
+    return nullptr;
+  }
+  if (worker_config->ocsp_store) {
+    auto entry = worker_config->ocsp_store->find(cert_file);
+    if (entry) {
+      SSL_CTX_set_tlsext_status_cb(ssl_ctx, ocsp_resp_cb);
+      SSL_CTX_set_tlsext_status_arg(ssl_ctx, entry);
+    }
   }
   if (get_config()->verify_client) {
     if (get_config()->verify_client_cacert) {
@@ -388,10 +515,11 @@ SSL_CTX *create_ssl_context(const char *private_key_file,
               ssl_ctx, get_config()->verify_client_cacert.get(), nullptr) !=
           1) {
 
-        LOG(FATAL) << "Could not load trusted ca certificates from "
+        LOG(ERROR) << "Could not load trusted ca certificates from "
                    << get_config()->verify_client_cacert.get() << ": "
                    << ERR_error_string(ERR_get_error(), nullptr);
-        DIE();
+        SSL_CTX_free(ssl_ctx);
+        return nullptr;
       }
       // It is heard that SSL_CTX_load_verify_locations() may leave
       // error even though it returns success. See
@@ -400,10 +528,11 @@ SSL_CTX *create_ssl_context(const char *private_key_file,
       auto list =
           SSL_load_client_CA_file(get_config()->verify_client_cacert.get());
       if (!list) {
-        LOG(FATAL) << "Could not load ca certificates from "
+        LOG(ERROR) << "Could not load ca certificates from "
                    << get_config()->verify_client_cacert.get() << ": "
                    << ERR_error_string(ERR_get_error(), nullptr);
-        DIE();
+        SSL_CTX_free(ssl_ctx);
+        return nullptr;
       }
       SSL_CTX_set_client_CA_list(ssl_ctx, list);
     }
@@ -942,37 +1071,121 @@ bool check_http2_requirement(SSL *ssl) {
   return true;
 }
 
-SSL_CTX *setup_server_ssl_context() {
+ServerSSLContext::ServerSSLContext()
+    : ssl_ctx(nullptr), cert_tree(nullptr) {}
+
+ServerSSLContext::~ServerSSLContext() {
+  if (cert_tree) {
+    for (auto ctx : cert_tree->certs) {
+      SSL_CTX_free(ctx);
+    }
+    cert_lookup_tree_del(cert_tree);
+  }
+  if (ssl_ctx) {
+    SSL_CTX_free(ssl_ctx);
+  }
+}
+
+std::shared_ptr<ServerSSLContext> setup_server_ssl_context() {
   if (get_config()->upstream_no_tls) {
     return nullptr;
   }
 
+  auto sv_ssl_ctx = std::make_shared<ServerSSLContext>();
+
   auto ssl_ctx = ssl::create_ssl_context(get_config()->private_key_file.get(),
                                          get_config()->cert_file.get());
+  if (!ssl_ctx) {
+    return nullptr;
+  }
+  sv_ssl_ctx->ssl_ctx = ssl_ctx;
 
   auto cert_tree =
       get_config()->subcerts.empty() ? nullptr : cert_lookup_tree_new();
-  worker_config->cert_tree = cert_tree;
+  sv_ssl_ctx->cert_tree = cert_tree;
 
   for (auto &keycert : get_config()->subcerts) {
     auto ssl_ctx =
         ssl::create_ssl_context(keycert.first.c_str(), keycert.second.c_str());
+    if (!ssl_ctx) {
+      return nullptr;
+    }
+    cert_tree->certs.push_back(ssl_ctx);
     if (ssl::cert_lookup_tree_add_cert_from_file(
             cert_tree, ssl_ctx, keycert.second.c_str()) == -1) {
-      LOG(FATAL) << "Failed to add sub certificate.";
-      DIE();
+      LOG(ERROR) << "Failed to add sub certificate.";
+      return nullptr;
     }
   }
 
   if (cert_tree) {
     if (ssl::cert_lookup_tree_add_cert_from_file(
             cert_tree, ssl_ctx, get_config()->cert_file.get()) == -1) {
-      LOG(FATAL) << "Failed to add default certificate.";
-      DIE();
+      LOG(ERROR) << "Failed to add default certificate.";
+      return nullptr;
     }
   }
 
-  return ssl_ctx;
+  return sv_ssl_ctx;
+}
+
+namespace {
+int check_certificate(const char *private_key_file, const char *cert_file) {
+  auto ssl_ctx = SSL_CTX_new(SSLv23_server_method());
+  if (!ssl_ctx) {
+    LOG(ERROR) << "SSL_CTX_new() failed: "
+               << ERR_error_string(ERR_get_error(), nullptr);
+    return -1;
+  }
+
+  auto rv = -1;
+
+  if (get_config()->private_key_passwd) {
+    SSL_CTX_set_default_passwd_cb(ssl_ctx, ssl_pem_passwd_cb);
+    SSL_CTX_set_default_passwd_cb_userdata(ssl_ctx, (void *)get_config());
+  }
+  if (SSL_CTX_use_certificate_chain_file(ssl_ctx, cert_file) != 1) {
+    LOG(ERROR) << "Could not load certificate " << cert_file << ": "
+               << ERR_error_string(ERR_get_error(), nullptr);
+    goto fin;
+  }
+  if (SSL_CTX_use_PrivateKey_file(ssl_ctx, private_key_file,
+                                  SSL_FILETYPE_PEM) != 1) {
+    LOG(ERROR) << "Could not load private key " << private_key_file << ": "
+               << ERR_error_string(ERR_get_error(), nullptr);
+    goto fin;
+  }
+  if (SSL_CTX_check_private_key(ssl_ctx) != 1) {
+    LOG(ERROR) << "Private key " << private_key_file
+               << " does not match certificate " << cert_file << ": "
+               << ERR_error_string(ERR_get_error(), nullptr);
+    goto fin;
+  }
+
+  rv = 0;
+
+fin:
+  SSL_CTX_free(ssl_ctx);
+  ERR_clear_error();
+
+  return rv;
+}
+} // namespace
+
+int check_server_certificates() {
+  if (check_certificate(get_config()->private_key_file.get(),
+                        get_config()->cert_file.get()) != 0) {
+    return -1;
+  }
+
+  for (auto &keycert : get_config()->subcerts) {
+    if (check_certificate(keycert.first.c_str(), keycert.second.c_str()) !=
+        0) {
+      return -1;
+    }
+  }
+
+  return 0;
 }
 
 SSL_CTX *setup_client_ssl_context() {
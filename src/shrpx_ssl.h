@@ -28,6 +28,7 @@
 #include "shrpx.h"
 
 #include <vector>
+#include <memory>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -42,7 +43,8 @@ class DownstreamConnectionPool;
 
 namespace ssl {
 
-// Create server side SSL_CTX
+// Create server side SSL_CTX.  This function returns nullptr if it
+// fails.
 SSL_CTX *create_ssl_context(const char *private_key_file,
                             const char *cert_file);
 
@@ -99,6 +101,8 @@ struct CertNode {
 };
 
 struct CertLookupTree {
+  // SSL_CTXs of sub certificates, which are owned by
+  // ServerSSLContext.
   std::vector<SSL_CTX *> certs;
   std::vector<char *> hosts;
   CertNode *root;
@@ -141,11 +145,33 @@ long int create_tls_proto_mask(const std::vector<char *> &tls_proto_list);
 
 std::vector<unsigned char> set_alpn_prefs(const std::vector<char *> &protos);
 
+// ServerSSLContext is the set of server side SSL_CTX built from
+// configuration.  It is shared by worker threads, and replaced as a
+// whole when certificates are reloaded.  SSL object holds reference
+// to its SSL_CTX, so connections established with the old set are
+// not affected when it is freed.
+struct ServerSSLContext {
+  ServerSSLContext();
+  ~ServerSSLContext();
+  // The default SSL_CTX
+  SSL_CTX *ssl_ctx;
+  // Lookup tree of all certificates.  nullptr if there is no sub
+  // certificate.
+  CertLookupTree *cert_tree;
+};
+
 // Setups server side SSL_CTX.  This function inspects get_config()
 // and if upstream_no_tls is true, returns nullptr.  Otherwise
 // construct default SSL_CTX.  If subcerts are not empty, create
 // SSL_CTX for them.  All created SSL_CTX are added to CertLookupTree.
-SSL_CTX *setup_server_ssl_context();
+// This function also returns nullptr if it fails to create any of
+// them, so that the caller can keep using the current context.
+std::shared_ptr<ServerSSLContext> setup_server_ssl_context();
+
+// Checks that private keys and certificates given in configuration
+// can be loaded and match each other.  It returns 0 if it succeeds,
+// or -1.
+int check_server_certificates();
 
 // Setups client side SSL_CTX.  This function inspects get_config()
 // and if downstream_no_tls is true, returns nullptr.  Otherwise, only
@@ -0,0 +1,305 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_stats_server.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include "shrpx_connection_handler.h"
+#include "shrpx_metrics.h"
+#include "util.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+namespace {
+// The maximum size of request header
+const size_t MAX_REQUEST_LEN = 8192;
+// Timeout to read request and write response
+const ev_tstamp CONNECTION_TIMEOUT = 30.;
+// The maximum number of concurrent connections.  Accepting new
+// connection is suspended while this many connections are open.
+const size_t MAX_CONNECTIONS = 64;
+} // namespace
+
+namespace {
+void readcb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto conn = static_cast<StatsConnection *>(w->data);
+  if (conn->on_read() != 0) {
+    conn->get_server()->remove_connection(conn);
+  }
+}
+} // namespace
+
+namespace {
+void writecb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto conn = static_cast<StatsConnection *>(w->data);
+  if (conn->on_write() != 0) {
+    conn->get_server()->remove_connection(conn);
+  }
+}
+} // namespace
+
+namespace {
+void timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto conn = static_cast<StatsConnection *>(w->data);
+  conn->get_server()->remove_connection(conn);
+}
+} // namespace
+
+namespace {
+int htp_urlcb(http_parser *htp, const char *data, size_t len) {
+  auto conn = static_cast<StatsConnection *>(htp->data);
+  return conn->on_url(data, len);
+}
+} // namespace
+
+namespace {
+int htp_hdrs_completecb(http_parser *htp) {
+  auto conn = static_cast<StatsConnection *>(htp->data);
+  conn->on_request_header(htp->method);
+  // We are not interested in request body.
+  return 1;
+}
+} // namespace
+
+namespace {
+http_parser_settings htp_hooks = {
+    nullptr,             // http_cb on_message_begin;
+    htp_urlcb,           // http_data_cb on_url;
+    nullptr,             // http_data_cb on_status;
+    nullptr,             // http_data_cb on_header_field;
+    nullptr,             // http_data_cb on_header_value;
+    htp_hdrs_completecb, // http_cb on_headers_complete;
+    nullptr,             // http_data_cb on_body;
+    nullptr              // http_cb on_message_complete;
+};
+} // namespace
+
+StatsConnection::StatsConnection(StatsServer *server, struct ev_loop *loop,
+                                 int fd)
+    : htp_{0}, server_(server), loop_(loop), nread_(0), nwrite_(0),
+      method_(0), fd_(fd), request_header_done_(false) {
+  http_parser_init(&htp_, HTTP_REQUEST);
+  htp_.data = this;
+
+  ev_io_init(&rev_, readcb, fd_, EV_READ);
+  rev_.data = this;
+  ev_io_init(&wev_, writecb, fd_, EV_WRITE);
+  wev_.data = this;
+  ev_timer_init(&timer_, timeoutcb, CONNECTION_TIMEOUT, 0.);
+  timer_.data = this;
+
+  ev_io_start(loop_, &rev_);
+  ev_timer_start(loop_, &timer_);
+}
+
+StatsConnection::~StatsConnection() {
+  ev_timer_stop(loop_, &timer_);
+  ev_io_stop(loop_, &wev_);
+  ev_io_stop(loop_, &rev_);
+  close(fd_);
+}
+
+int StatsConnection::on_read() {
+  for (;;) {
+    char buf[4096];
+    ssize_t nread;
+    while ((nread = read(fd_, buf, sizeof(buf))) == -1 && errno == EINTR)
+      ;
+    if (nread == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      return -1;
+    }
+    if (nread == 0) {
+      return -1;
+    }
+
+    nread_ += nread;
+
+    http_parser_execute(&htp_, &htp_hooks, buf, nread);
+
+    if (request_header_done_) {
+      break;
+    }
+
+    if (HTTP_PARSER_ERRNO(&htp_) != HPE_OK || nread_ > MAX_REQUEST_LEN) {
+      return -1;
+    }
+  }
+
+  ev_io_stop(loop_, &rev_);
+
+  create_response();
+
+  ev_io_start(loop_, &wev_);
+
+  return on_write();
+}
+
+int StatsConnection::on_url(const char *data, size_t len) {
+  if (path_.size() + len > MAX_REQUEST_LEN) {
+    return -1;
+  }
+
+  path_.append(data, len);
+
+  return 0;
+}
+
+void StatsConnection::on_request_header(unsigned int method) {
+  method_ = method;
+  request_header_done_ = true;
+}
+
+int StatsConnection::on_write() {
+  while (nwrite_ < response_.size()) {
+    ssize_t nwrite;
+    while ((nwrite = write(fd_, response_.c_str() + nwrite_,
+                           response_.size() - nwrite_)) == -1 &&
+           errno == EINTR)
+      ;
+    if (nwrite == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      return -1;
+    }
+    nwrite_ += nwrite;
+  }
+
+  shutdown(fd_, SHUT_WR);
+
+  // All response is written.  Delete this connection.
+  return -1;
+}
+
+void StatsConnection::create_response() {
+  // Query is ignored.
+  auto path = path_.substr(0, path_.find('?'));
+
+  const char *status;
+  std::string body;
+
+  if (method_ != HTTP_GET) {
+    status = "405 Method Not Allowed";
+  } else if (path != "/" && path != "/metrics") {
+    status = "404 Not Found";
+  } else {
+    status = "200 OK";
+    body = server_->get_metrics();
+  }
+
+  response_ = "HTTP/1.1 ";
+  response_ += status;
+  response_ += "\r\nContent-Type: text/plain; version=0.0.4\r\n"
+               "Content-Length: ";
+  response_ += util::utos(body.size());
+  response_ += "\r\nConnection: close\r\n\r\n";
+  response_ += body;
+}
+
+StatsServer *StatsConnection::get_server() const { return server_; }
+
+namespace {
+void acceptcb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto server = static_cast<StatsServer *>(w->data);
+  server->accept_connection();
+}
+} // namespace
+
+StatsServer::StatsServer(struct ev_loop *loop, int fd,
+                         ConnectionHandler *conn_handler)
+    : loop_(loop), conn_handler_(conn_handler), fd_(fd) {
+  ev_io_init(&wev_, acceptcb, fd_, EV_READ);
+  wev_.data = this;
+  ev_io_start(loop_, &wev_);
+}
+
+StatsServer::~StatsServer() {
+  conns_.clear();
+
+  ev_io_stop(loop_, &wev_);
+  close(fd_);
+}
+
+void StatsServer::accept_connection() {
+  while (conns_.size() < MAX_CONNECTIONS) {
+#ifdef HAVE_ACCEPT4
+    auto cfd = accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else  // !HAVE_ACCEPT4
+    auto cfd = accept(fd_, nullptr, nullptr);
+#endif // !HAVE_ACCEPT4
+
+    if (cfd == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return;
+    }
+
+#ifndef HAVE_ACCEPT4
+    util::make_socket_nonblocking(cfd);
+    util::make_socket_closeonexec(cfd);
+#endif // !HAVE_ACCEPT4
+
+    conns_.push_back(util::make_unique<StatsConnection>(this, loop_, cfd));
+  }
+
+  // Pending connections are accepted when a connection is closed.
+  ev_io_stop(loop_, &wev_);
+}
+
+std::string StatsServer::get_metrics() const {
+  MetricsSnapshot snapshot;
+  conn_handler_->get_metrics(&snapshot);
+
+  return format_metrics(snapshot);
+}
+
+void StatsServer::remove_connection(StatsConnection *conn) {
+  auto it = std::find_if(std::begin(conns_), std::end(conns_),
+                         [conn](const std::unique_ptr<StatsConnection> &c) {
+                           return c.get() == conn;
+                         });
+  if (it != std::end(conns_)) {
+    conns_.erase(it);
+  }
+
+  ev_io_start(loop_, &wev_);
+}
+
+int StatsServer::get_fd() const { return fd_; }
+
+} // namespace shrpx
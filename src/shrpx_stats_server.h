@@ -0,0 +1,106 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_STATS_SERVER_H
+#define SHRPX_STATS_SERVER_H
+
+#include "shrpx.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ev.h>
+
+#include "http-parser/http_parser.h"
+
+namespace shrpx {
+
+class ConnectionHandler;
+class StatsServer;
+
+// Connection to StatsServer.  It reads one HTTP/1 request, and
+// closes connection after sending response.
+class StatsConnection {
+public:
+  StatsConnection(StatsServer *server, struct ev_loop *loop, int fd);
+  ~StatsConnection();
+  int on_read();
+  int on_write();
+  // Called by http-parser when a part of request URI is parsed.
+  // Returns 0 if it succeeds, or -1.
+  int on_url(const char *data, size_t len);
+  // Called by http-parser when request header is completely parsed.
+  void on_request_header(unsigned int method);
+  StatsServer *get_server() const;
+
+private:
+  // Prepares response to the request.
+  void create_response();
+
+  std::string path_;
+  std::string response_;
+  http_parser htp_;
+  ev_io rev_;
+  ev_io wev_;
+  ev_timer timer_;
+  StatsServer *server_;
+  struct ev_loop *loop_;
+  // The number of bytes of request read so far
+  size_t nread_;
+  // The number of bytes in response_ already written
+  size_t nwrite_;
+  // HTTP method of the request
+  unsigned int method_;
+  int fd_;
+  // true if request header has been parsed
+  bool request_header_done_;
+};
+
+// StatsServer serves metrics aggregated from all workers in
+// Prometheus text format on local HTTP/1 endpoint.  It runs in the
+// main event loop.
+class StatsServer {
+public:
+  // |fd| is the listening socket.
+  StatsServer(struct ev_loop *loop, int fd, ConnectionHandler *conn_handler);
+  ~StatsServer();
+  void accept_connection();
+  // Returns metrics in Prometheus text format.
+  std::string get_metrics() const;
+  // Closes and deletes |conn|.
+  void remove_connection(StatsConnection *conn);
+  int get_fd() const;
+
+private:
+  std::vector<std::unique_ptr<StatsConnection>> conns_;
+  ev_io wev_;
+  struct ev_loop *loop_;
+  ConnectionHandler *conn_handler_;
+  int fd_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_STATS_SERVER_H
@@ -61,6 +61,11 @@ public:
   // only used by Http2Session.  If |no_retry| is true, another
   // connection attempt using new DownstreamConnection is not allowed.
   virtual int on_downstream_reset(bool no_retry) = 0;
+  // Called when the leader of collapsed request |downstream| has
+  // finished.  Upstream should look up cache again, and send the
+  // request to backend if it is not found.  Returning nonzero value
+  // deletes ClientHandler.
+  virtual int on_collapsed_request_ready(Downstream *downstream) = 0;
 
   virtual void pause_read(IOCtrlReason reason) = 0;
   virtual int resume_read(IOCtrlReason reason, Downstream *downstream,
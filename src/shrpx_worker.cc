@@ -27,13 +27,16 @@
 #include <unistd.h>
 
 #include <memory>
+#include <cmath>
 
 #include "shrpx_ssl.h"
 #include "shrpx_log.h"
 #include "shrpx_client_handler.h"
-#include "shrpx_http2_session.h"
+#include "shrpx_http2_session_pool.h"
 #include "shrpx_worker_config.h"
 #include "shrpx_connect_blocker.h"
+#include "shrpx_accept_handler.h"
+#include "shrpx_health_monitor.h"
 #include "util.h"
 
 using namespace nghttp2;
@@ -47,26 +50,65 @@ void eventcb(struct ev_loop *loop, ev_async *w, int revents) {
 }
 } // namespace
 
-Worker::Worker(SSL_CTX *sv_ssl_ctx, SSL_CTX *cl_ssl_ctx,
-               ssl::CertLookupTree *cert_tree,
-               const std::shared_ptr<TicketKeys> &ticket_keys)
+namespace {
+void accesslog_flush_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+  flush_accesslog();
+}
+} // namespace
+
+Worker::Worker(const std::shared_ptr<ssl::ServerSSLContext> &sv_ssl_ctx,
+               SSL_CTX *cl_ssl_ctx,
+               const std::shared_ptr<TicketKeys> &ticket_keys,
+               const HealthMonitor *health_monitor,
+               SessionCache *session_cache, const OCSPStore *ocsp_store,
+               const WorkerListener &listener)
     : loop_(ev_loop_new(0)), sv_ssl_ctx_(sv_ssl_ctx), cl_ssl_ctx_(cl_ssl_ctx),
       worker_stat_(util::make_unique<WorkerStat>()) {
   ev_async_init(&w_, eventcb);
   w_.data = this;
   ev_async_start(loop_, &w_);
 
+  ev_timer_init(&accesslog_flush_timer_, accesslog_flush_cb, 0.,
+                get_config()->accesslog_flush_interval);
+  if (get_config()->accesslog_buffer_size > 0) {
+    ev_timer_again(loop_, &accesslog_flush_timer_);
+  }
+
+  if (listener.fd4 != -1) {
+    acceptor4_ = util::make_unique<AcceptHandler>(listener.fd4, this, loop_);
+  }
+
+  if (listener.fd6 != -1) {
+    acceptor6_ = util::make_unique<AcceptHandler>(listener.fd6, this, loop_);
+  }
+
 #ifndef NOTHREADS
-  fut_ = std::async(std::launch::async, [this, cert_tree, &ticket_keys] {
+  auto config = mod_config();
+  fut_ = std::async(std::launch::async, [this, &ticket_keys, config,
+                                          health_monitor, session_cache,
+                                          ocsp_store] {
+    // Worker keeps using this snapshot until configuration is
+    // reloaded.
+    set_config(config);
+
+    worker_config->health_monitor = health_monitor;
+    worker_config->session_cache = session_cache;
+    worker_config->ocsp_store = ocsp_store;
+
     if (get_config()->tls_ctx_per_worker) {
       sv_ssl_ctx_ = ssl::setup_server_ssl_context();
+      if (!get_config()->upstream_no_tls && !sv_ssl_ctx_) {
+        LOG(FATAL) << "Could not create server SSL/TLS context";
+        DIE();
+      }
       cl_ssl_ctx_ = ssl::setup_client_ssl_context();
-    } else {
-      worker_config->cert_tree = cert_tree;
     }
 
+    worker_config->cert_tree = sv_ssl_ctx_ ? sv_ssl_ctx_->cert_tree : nullptr;
+
     if (get_config()->downstream_proto == PROTO_HTTP2) {
-      http2session_ = util::make_unique<Http2Session>(loop_, cl_ssl_ctx_);
+      http2session_pool_ = util::make_unique<Http2SessionPool>(
+          loop_, cl_ssl_ctx_, worker_stat_.get());
     } else {
       http1_connect_blocker_ = util::make_unique<ConnectBlocker>(loop_);
     }
@@ -74,11 +116,19 @@ Worker::Worker(SSL_CTX *sv_ssl_ctx, SSL_CTX *cl_ssl_ctx,
     worker_config->ticket_keys = ticket_keys;
     (void)reopen_log_files();
     ev_run(loop_);
+
+    flush_accesslog();
   });
 #endif // !NOTHREADS
 }
 
-Worker::~Worker() { ev_async_stop(loop_, &w_); }
+Worker::~Worker() {
+  acceptor4_.reset();
+  acceptor6_.reset();
+
+  ev_async_stop(loop_, &w_);
+  ev_timer_stop(loop_, &accesslog_flush_timer_);
+}
 
 void Worker::wait() {
 #ifndef NOTHREADS
@@ -104,45 +154,16 @@ void Worker::process_events() {
   }
   for (auto &wev : q) {
     switch (wev.type) {
-    case NEW_CONNECTION: {
+    case NEW_CONNECTION:
       if (LOG_ENABLED(INFO)) {
         WLOG(INFO, this) << "WorkerEvent: client_fd=" << wev.client_fd
                          << ", addrlen=" << wev.client_addrlen;
       }
 
-      if (worker_stat_->num_connections >=
-          get_config()->worker_frontend_connections) {
-
-        if (LOG_ENABLED(INFO)) {
-          WLOG(INFO, this) << "Too many connections >= "
-                           << get_config()->worker_frontend_connections;
-        }
-
-        close(wev.client_fd);
-
-        break;
-      }
-
-      auto client_handler = ssl::accept_connection(
-          loop_, sv_ssl_ctx_, wev.client_fd, &wev.client_addr.sa,
-          wev.client_addrlen, worker_stat_.get(), &dconn_pool_);
-      if (!client_handler) {
-        if (LOG_ENABLED(INFO)) {
-          WLOG(ERROR, this) << "ClientHandler creation failed";
-        }
-        close(wev.client_fd);
-        break;
-      }
-
-      client_handler->set_http2_session(http2session_.get());
-      client_handler->set_http1_connect_blocker(http1_connect_blocker_.get());
-
-      if (LOG_ENABLED(INFO)) {
-        WLOG(INFO, this) << "CLIENT_HANDLER:" << client_handler << " created ";
-      }
+      handle_connection(wev.client_fd, &wev.client_addr.sa,
+                        wev.client_addrlen);
 
       break;
-    }
     case RENEW_TICKET_KEYS:
       if (LOG_ENABLED(INFO)) {
         WLOG(INFO, this) << "Renew ticket keys: worker_info(" << worker_config
@@ -151,6 +172,41 @@ void Worker::process_events() {
 
       worker_config->ticket_keys = wev.ticket_keys;
 
+      break;
+    case RELOAD_CONFIG:
+      if (LOG_ENABLED(INFO)) {
+        WLOG(INFO, this) << "Reload configuration: worker_info("
+                         << worker_config << ")";
+      }
+
+      // The old configuration is still referenced by established
+      // connections, and it is never freed.
+      set_config(wev.config);
+
+      worker_config->health_monitor = wev.health_monitor;
+      worker_config->ocsp_store = wev.ocsp_store;
+
+      reload_worker_stat(worker_stat_.get());
+
+      // The old context is freed when the last worker stops
+      // referencing it.  Established connections keep their own
+      // reference to SSL_CTX.
+      if (get_config()->tls_ctx_per_worker && !get_config()->client_mode &&
+          !get_config()->upstream_no_tls) {
+        auto sv_ssl_ctx = ssl::setup_server_ssl_context();
+        if (sv_ssl_ctx) {
+          sv_ssl_ctx_ = std::move(sv_ssl_ctx);
+        } else {
+          WLOG(ERROR, this) << "Could not create server SSL/TLS context; "
+                               "keep using the current certificates";
+        }
+      } else {
+        sv_ssl_ctx_ = wev.sv_ssl_ctx;
+      }
+      worker_config->cert_tree = sv_ssl_ctx_ ? sv_ssl_ctx_->cert_tree : nullptr;
+
+      reopen_log_files();
+
       break;
     case REOPEN_LOG:
       if (LOG_ENABLED(INFO)) {
@@ -166,6 +222,16 @@ void Worker::process_events() {
 
       worker_config->graceful_shutdown = true;
 
+      if (acceptor4_) {
+        acceptor4_->disable();
+        acceptor4_->accept_connection();
+      }
+
+      if (acceptor6_) {
+        acceptor6_->disable();
+        acceptor6_->accept_connection();
+      }
+
       if (worker_stat_->num_connections == 0) {
         ev_break(loop_);
 
@@ -181,4 +247,263 @@ void Worker::process_events() {
   }
 }
 
+namespace {
+// The time constant in seconds of the decay of peak EWMA
+constexpr double EWMA_DECAY = 10.;
+// The latency in seconds assumed for the address without sample
+constexpr double EWMA_DEFAULT_LATENCY = 0.1;
+// The minimum latency sample in seconds fed when request failed
+// before response header was received
+constexpr double EWMA_FAILURE_PENALTY = 10.;
+} // namespace
+
+void update_downstream_latency(DownstreamAddrStat *stat, double latency,
+                               ev_tstamp now) {
+  if (stat->ewma_last_update == 0. || latency > stat->ewma_latency) {
+    // Peak sensitive; latency spike is reflected immediately.
+    stat->ewma_latency = latency;
+  } else {
+    auto w = exp(-std::max(now - stat->ewma_last_update, 0.) / EWMA_DECAY);
+    stat->ewma_latency = stat->ewma_latency * w + latency * (1. - w);
+  }
+
+  stat->ewma_last_update = now;
+}
+
+void penalize_downstream_latency(DownstreamAddrStat *stat, ev_tstamp start,
+                                 ev_tstamp now) {
+  update_downstream_latency(
+      stat, std::max(now - start, EWMA_FAILURE_PENALTY), now);
+}
+
+double get_downstream_latency(const DownstreamAddrStat &stat, ev_tstamp now) {
+  if (stat.ewma_last_update == 0.) {
+    return EWMA_DEFAULT_LATENCY;
+  }
+
+  auto w = exp(-std::max(now - stat.ewma_last_update, 0.) / EWMA_DECAY);
+  return stat.ewma_latency * w + EWMA_DEFAULT_LATENCY * (1. - w);
+}
+
+namespace {
+// Returns true if address stat |a| is less loaded than |b|.
+bool less_inflight(const DownstreamAddrStat &a, const DownstreamAddrStat &b) {
+  if (a.num_inflight != b.num_inflight) {
+    return a.num_inflight < b.num_inflight;
+  }
+  return a.ewma_latency < b.ewma_latency;
+}
+} // namespace
+
+namespace {
+// Returns true if the expected latency of |a| is smaller than |b| at
+// |now|.
+bool less_ewma_cost(const DownstreamAddrStat &a, const DownstreamAddrStat &b,
+                    ev_tstamp now) {
+  auto acost = get_downstream_latency(a, now) * (a.num_inflight + 1);
+  auto bcost = get_downstream_latency(b, now) * (b.num_inflight + 1);
+  if (acost != bcost) {
+    return acost < bcost;
+  }
+  return a.num_inflight < b.num_inflight;
+}
+} // namespace
+
+bool downstream_addr_usable(size_t idx) {
+  if (get_config()->downstream_addrs[idx].removed) {
+    return false;
+  }
+
+  auto monitor = worker_config->health_monitor;
+
+  return !monitor || monitor->get_num_healthy() == 0 || monitor->healthy(idx);
+}
+
+void reload_worker_stat(WorkerStat *worker_stat) {
+  auto naddrs = get_config()->downstream_addrs.size();
+
+  if (worker_stat->downstream_addr_stats.size() < naddrs) {
+    worker_stat->downstream_addr_stats.resize(naddrs);
+  }
+
+  // Set of addresses may have changed.
+  worker_stat->maglev_table = MaglevTable();
+}
+
+namespace {
+// Returns the number of usable addresses among |n| addresses.
+size_t count_usable_addrs(size_t n) {
+  auto monitor = worker_config->health_monitor;
+
+  if (monitor && monitor->get_num_healthy() > 0) {
+    return monitor->get_num_healthy();
+  }
+
+  size_t nusable = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (!get_config()->downstream_addrs[i].removed) {
+      ++nusable;
+    }
+  }
+
+  return nusable;
+}
+} // namespace
+
+namespace {
+// Returns the index of |k|-th usable address, counting from |start|.
+size_t nth_usable_addr(size_t start, size_t k, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    auto idx = (start + i) % n;
+    if (!downstream_addr_usable(idx)) {
+      continue;
+    }
+    if (k-- == 0) {
+      return idx;
+    }
+  }
+
+  return start;
+}
+} // namespace
+
+int select_downstream_addr_by_hash(size_t *dest, WorkerStat *worker_stat,
+                                   const Downstream *downstream) {
+  uint64_t hash;
+
+  if (!downstream || hash_downstream(&hash, downstream) != 0) {
+    return -1;
+  }
+
+  auto monitor = worker_config->health_monitor;
+  auto generation = monitor ? monitor->get_generation() : 0;
+  auto &table = worker_stat->maglev_table;
+
+  if (table.empty() || worker_stat->maglev_generation != generation) {
+    auto &addrs = get_config()->downstream_addrs;
+    std::vector<std::string> names;
+    std::vector<bool> usable;
+
+    for (size_t i = 0; i < addrs.size(); ++i) {
+      names.emplace_back(addrs[i].hostport.get());
+      usable.push_back(downstream_addr_usable(i));
+    }
+
+    table.build(names, usable);
+    worker_stat->maglev_generation = generation;
+  }
+
+  auto idx = table.lookup(hash);
+  if (idx == MaglevTable::NO_BACKEND) {
+    return -1;
+  }
+
+  *dest = idx;
+
+  return 0;
+}
+
+size_t select_downstream_addr(WorkerStat *worker_stat,
+                              const Downstream *downstream) {
+  size_t addr_idx;
+
+  if (select_downstream_addr_by_hash(&addr_idx, worker_stat, downstream) ==
+      0) {
+    return addr_idx;
+  }
+
+  auto &stats = worker_stat->downstream_addr_stats;
+  auto n = stats.size();
+
+  // Start from next_downstream, so that ties are broken in round
+  // robin fashion.
+  auto start = nth_usable_addr(worker_stat->next_downstream, 0, n);
+  worker_stat->next_downstream = (start + 1) % n;
+
+  switch (get_config()->downstream_balancing) {
+  case BALANCING_ROUND_ROBIN:
+    return start;
+  case BALANCING_LEAST_INFLIGHT: {
+    auto best = start;
+    for (size_t i = 1; i < n; ++i) {
+      auto idx = (start + i) % n;
+      if (downstream_addr_usable(idx) &&
+          less_inflight(stats[idx], stats[best])) {
+        best = idx;
+      }
+    }
+    return best;
+  }
+  case BALANCING_PEAK_EWMA: {
+    auto now = ev_time();
+    auto best = start;
+    for (size_t i = 1; i < n; ++i) {
+      auto idx = (start + i) % n;
+      if (downstream_addr_usable(idx) &&
+          less_ewma_cost(stats[idx], stats[best], now)) {
+        best = idx;
+      }
+    }
+    return best;
+  }
+  case BALANCING_P2C: {
+    auto nusable = count_usable_addrs(n);
+    if (nusable == 1) {
+      return start;
+    }
+    std::uniform_int_distribution<size_t> dis(0, nusable - 1);
+    auto ka = dis(worker_stat->gen);
+    auto kb = dis(worker_stat->gen);
+    if (ka == kb) {
+      kb = (kb + 1) % nusable;
+    }
+    auto a = nth_usable_addr(0, ka, n);
+    auto b = nth_usable_addr(0, kb, n);
+    return less_inflight(stats[b], stats[a]) ? b : a;
+  }
+  }
+
+  return start;
+}
+
+int Worker::handle_connection(int fd, sockaddr *addr, int addrlen) {
+  if (worker_stat_->num_connections >=
+      get_config()->worker_frontend_connections) {
+
+    if (LOG_ENABLED(INFO)) {
+      WLOG(INFO, this) << "Too many connections >= "
+                       << get_config()->worker_frontend_connections;
+    }
+
+    close(fd);
+
+    return -1;
+  }
+
+  auto client_handler = ssl::accept_connection(
+      loop_, sv_ssl_ctx_ ? sv_ssl_ctx_->ssl_ctx : nullptr, fd, addr, addrlen,
+      worker_stat_.get(), &dconn_pool_);
+  if (!client_handler) {
+    if (LOG_ENABLED(INFO)) {
+      WLOG(ERROR, this) << "ClientHandler creation failed";
+    }
+    close(fd);
+
+    return -1;
+  }
+
+  client_handler->set_http2_session_pool(http2session_pool_.get());
+  client_handler->set_http1_connect_blocker(http1_connect_blocker_.get());
+
+  if (LOG_ENABLED(INFO)) {
+    WLOG(INFO, this) << "CLIENT_HANDLER:" << client_handler << " created ";
+  }
+
+  return 0;
+}
+
+const WorkerStat *Worker::get_worker_stat() const {
+  return worker_stat_.get();
+}
+
 } // namespace shrpx
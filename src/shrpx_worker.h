@@ -30,6 +30,8 @@
 #include <mutex>
 #include <deque>
 #include <thread>
+#include <vector>
+#include <random>
 #ifndef NOTHREADS
 #include <future>
 #endif // NOTHREADS
@@ -41,31 +43,116 @@
 
 #include "shrpx_config.h"
 #include "shrpx_downstream_connection_pool.h"
+#include "shrpx_consistent_hash.h"
+#include "shrpx_metrics.h"
 
 namespace shrpx {
 
-class Http2Session;
+class Http2SessionPool;
 class ConnectBlocker;
+class AcceptHandler;
+class HealthMonitor;
+class SessionCache;
+class OCSPStore;
 
 namespace ssl {
-struct CertLookupTree;
+struct ServerSSLContext;
 } // namespace ssl
 
-struct WorkerStat {
-  WorkerStat() : num_connections(0), next_downstream(0) {}
+// Statistics of backend address used for HTTP/1 load balancing
+struct DownstreamAddrStat {
+  DownstreamAddrStat()
+      : num_inflight(0), ewma_latency(0.), ewma_last_update(0.) {}
+  // The number of outstanding requests to this address
+  size_t num_inflight;
+  // Peak EWMA of the time until response header is received, in
+  // seconds.  Use get_downstream_latency() to get the current
+  // estimate.
+  double ewma_latency;
+  // The time when ewma_latency was last updated.  0 means no sample.
+  ev_tstamp ewma_last_update;
+};
 
+struct WorkerStat {
+  WorkerStat()
+      : downstream_addr_stats(get_config()->downstream_addrs.size()),
+        gen(std::random_device()()), maglev_generation(0), num_connections(0),
+        next_downstream(0) {}
+
+  // Statistics of each address in Config::downstream_addrs in the
+  // same order.
+  std::vector<DownstreamAddrStat> downstream_addr_stats;
+  std::mt19937 gen;
+  // Consistent hashing table, built lazily, and rebuilt when health
+  // check result changes.
+  MaglevTable maglev_table;
+  // HealthMonitor::get_generation() when maglev_table was built
+  size_t maglev_generation;
   size_t num_connections;
   // Next downstream index in Config::downstream_addrs.  For HTTP/2
   // downstream connections, this is always 0.  For HTTP/1, this is
   // used as load balancing.
   size_t next_downstream;
+  // Metrics read by StatsServer in the main thread
+  WorkerMetrics metrics;
 };
 
+// Returns the index of Config::downstream_addrs to which new HTTP/1
+// backend connection is made for |downstream|.  If consistent
+// hashing is enabled and the key is found in |downstream|, the
+// address is chosen by hashing.  Otherwise it is chosen according to
+// Config::downstream_balancing.  |downstream| may be nullptr.
+size_t select_downstream_addr(WorkerStat *worker_stat,
+                              const Downstream *downstream);
+
+// Chooses backend address for |downstream| by consistent hashing,
+// and assigns its index to |*dest|.  Returns 0 if it succeeds, or -1
+// if consistent hashing is disabled or the key is not found.
+int select_downstream_addr_by_hash(size_t *dest, WorkerStat *worker_stat,
+                                   const Downstream *downstream);
+
+// Returns true if backend address |idx| in Config::downstream_addrs
+// can be chosen.  Address ejected by health check is not usable,
+// unless all addresses are ejected.  Address removed by reload is
+// never usable.
+bool downstream_addr_usable(size_t idx);
+
+// Makes |worker_stat| follow Config::downstream_addrs of reloaded
+// configuration.  Statistics of the existing addresses are kept,
+// since reload does not change their indices.
+void reload_worker_stat(WorkerStat *worker_stat);
+
+// Feeds response latency |latency| in seconds observed at |now| into
+// the peak EWMA of |stat|.
+void update_downstream_latency(DownstreamAddrStat *stat, double latency,
+                               ev_tstamp now);
+
+// Feeds penalty sample into the peak EWMA of |stat| because the
+// request started at |start| failed at |now| before response header
+// was received.
+void penalize_downstream_latency(DownstreamAddrStat *stat, ev_tstamp start,
+                                 ev_tstamp now);
+
+// Returns the latency estimate of |stat| at |now|.  The address
+// without sample has the neutral default latency, and the estimate
+// returns to it while no sample arrives, so that the address
+// penalized once is tried again.
+double get_downstream_latency(const DownstreamAddrStat &stat, ev_tstamp now);
+
 enum WorkerEventType {
   NEW_CONNECTION = 0x01,
   REOPEN_LOG = 0x02,
   GRACEFUL_SHUTDOWN = 0x03,
   RENEW_TICKET_KEYS = 0x04,
+  RELOAD_CONFIG = 0x05,
+};
+
+// Listening sockets owned by a worker when --listener-reuseport is
+// used.  -1 means that the socket for the address family is not
+// available.
+struct WorkerListener {
+  int fd4;
+  int fd6;
 };
 
 struct WorkerEvent {
@@ -76,17 +163,32 @@ struct WorkerEvent {
     int client_fd;
   };
   std::shared_ptr<TicketKeys> ticket_keys;
+  // The following fields are for RELOAD_CONFIG.  New configuration
+  // which worker uses from now on.  It is never freed.
+  Config *config;
+  // New server SSL_CTX.  nullptr if Config::tls_ctx_per_worker is
+  // true, and worker creates its own.
+  std::shared_ptr<ssl::ServerSSLContext> sv_ssl_ctx;
+  // HealthMonitor and OCSPStore for config.  They are nullptr if the
+  // feature is disabled.
+  const HealthMonitor *health_monitor;
+  const OCSPStore *ocsp_store;
 };
 
 class Worker {
 public:
-  Worker(SSL_CTX *sv_ssl_ctx, SSL_CTX *cl_ssl_ctx,
-         ssl::CertLookupTree *cert_tree,
-         const std::shared_ptr<TicketKeys> &ticket_keys);
+  Worker(const std::shared_ptr<ssl::ServerSSLContext> &sv_ssl_ctx,
+         SSL_CTX *cl_ssl_ctx, const std::shared_ptr<TicketKeys> &ticket_keys,
+         const HealthMonitor *health_monitor, SessionCache *session_cache,
+         const OCSPStore *ocsp_store, const WorkerListener &listener);
   ~Worker();
   void wait();
   void process_events();
   void send(const WorkerEvent &event);
+  // Creates ClientHandler for accepted connection |fd|.  This must
+  // be called in the worker thread.  Returns 0 if it succeeds, or -1.
+  int handle_connection(int fd, sockaddr *addr, int addrlen);
+  const WorkerStat *get_worker_stat() const;
 
 private:
 #ifndef NOTHREADS
@@ -95,13 +197,16 @@ private:
   std::mutex m_;
   std::deque<WorkerEvent> q_;
   ev_async w_;
+  ev_timer accesslog_flush_timer_;
   DownstreamConnectionPool dconn_pool_;
   struct ev_loop *loop_;
-  SSL_CTX *sv_ssl_ctx_;
+  std::shared_ptr<ssl::ServerSSLContext> sv_ssl_ctx_;
   SSL_CTX *cl_ssl_ctx_;
-  std::unique_ptr<Http2Session> http2session_;
+  std::unique_ptr<Http2SessionPool> http2session_pool_;
   std::unique_ptr<ConnectBlocker> http1_connect_blocker_;
   std::unique_ptr<WorkerStat> worker_stat_;
+  std::unique_ptr<AcceptHandler> acceptor4_;
+  std::unique_ptr<AcceptHandler> acceptor6_;
 };
 
 } // namespace shrpx
@@ -30,8 +30,11 @@ using namespace nghttp2;
 namespace shrpx {
 
 WorkerConfig::WorkerConfig()
-    : cert_tree(nullptr), accesslog_fd(-1), errorlog_fd(-1),
-      errorlog_tty(false), graceful_shutdown(false) {}
+    : cert_tree(nullptr), health_monitor(nullptr), session_cache(nullptr),
+      ocsp_store(nullptr), accesslog_dropped(0), accesslog_fd(-1),
+      errorlog_fd(-1), errorlog_tty(false), graceful_shutdown(false),
+      downstream_pool(1024), http_dconn_pool(1024), http2_dconn_pool(1024),
+      arena_pool(1024), headers_pool(2048, 256), string_pool(2048, 4096) {}
 
 #ifndef NOTHREADS
 thread_local
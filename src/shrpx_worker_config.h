@@ -29,6 +29,12 @@
 
 #include <chrono>
 
+#include "shrpx_object_pool.h"
+#include "shrpx_http_cache.h"
+#include "http2.h"
+
+using namespace nghttp2;
+
 namespace shrpx {
 
 namespace ssl {
@@ -36,6 +42,12 @@ struct CertLookupTree;
 } // namespace ssl
 
 struct TicketKeys;
+class HealthMonitor;
+class SessionCache;
+class OCSPStore;
+class Downstream;
+class HttpDownstreamConnection;
+class Http2DownstreamConnection;
 
 struct WorkerConfig {
   std::shared_ptr<TicketKeys> ticket_keys;
@@ -43,11 +55,40 @@ struct WorkerConfig {
   std::string time_local_str;
   std::string time_iso8601_str;
   ssl::CertLookupTree *cert_tree;
+  // Shared backend health check results.  nullptr if health check
+  // is disabled.
+  const HealthMonitor *health_monitor;
+  // TLS session cache in shared memory.  nullptr if
+  // Config::tls_session_cache_size is 0.
+  SessionCache *session_cache;
+  // OCSP responses to staple.  nullptr if Config::ocsp_stapling is
+  // false.
+  const OCSPStore *ocsp_store;
+  // Access log records which are not written to accesslog_fd yet.
+  // Used if Config::accesslog_buffer_size > 0.
+  std::string accesslog_buf;
+  // The number of access log records dropped because write failed
+  // or they did not fit in the format buffer
+  uint64_t accesslog_dropped;
   int accesslog_fd;
   int errorlog_fd;
   // true if errorlog_fd is referring to a terminal.
   bool errorlog_tty;
   bool graceful_shutdown;
+  // Per thread free lists for the objects allocated for each
+  // request.
+  ObjectPool<Downstream> downstream_pool;
+  ObjectPool<HttpDownstreamConnection> http_dconn_pool;
+  ObjectPool<Http2DownstreamConnection> http2_dconn_pool;
+  // Memory blocks for Downstream::balloc_.
+  ObjectPool<ArenaBlock> arena_pool;
+  // Header fields and strings released by Downstream, retaining
+  // their reserved capacity.
+  CapacityPool<HeaderRefs> headers_pool;
+  CapacityPool<std::string> string_pool;
+  // Response cache, created on first use.  nullptr if
+  // Config::cache_size is 0.
+  std::unique_ptr<HttpCache> http_cache;
 
   WorkerConfig();
   void update_tstamp(const std::chrono::system_clock::time_point &now);
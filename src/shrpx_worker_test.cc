@@ -0,0 +1,289 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_worker_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_worker.h"
+#include "shrpx_config.h"
+#include "shrpx_worker_config.h"
+#include "shrpx_health_monitor.h"
+
+namespace shrpx {
+
+void test_shrpx_worker_select_downstream_addr(void) {
+  mod_config()->downstream_addrs.resize(3);
+
+  WorkerStat stat;
+  auto &addrs = stat.downstream_addr_stats;
+
+  CU_ASSERT(3 == addrs.size());
+
+  mod_config()->downstream_balancing = BALANCING_ROUND_ROBIN;
+
+  CU_ASSERT(0 == select_downstream_addr(&stat, nullptr));
+  CU_ASSERT(1 == select_downstream_addr(&stat, nullptr));
+  CU_ASSERT(2 == select_downstream_addr(&stat, nullptr));
+  CU_ASSERT(0 == select_downstream_addr(&stat, nullptr));
+
+  mod_config()->downstream_balancing = BALANCING_LEAST_INFLIGHT;
+
+  addrs[0].num_inflight = 2;
+  addrs[1].num_inflight = 1;
+  addrs[2].num_inflight = 3;
+
+  CU_ASSERT(1 == select_downstream_addr(&stat, nullptr));
+
+  // ties are broken by latency
+  addrs[0].num_inflight = 1;
+  addrs[0].ewma_latency = 0.5;
+  addrs[1].ewma_latency = 1.;
+
+  CU_ASSERT(0 == select_downstream_addr(&stat, nullptr));
+
+  mod_config()->downstream_balancing = BALANCING_PEAK_EWMA;
+
+  // cost: 0.5 * 2, 1. * 2, 0.1 * 4
+  addrs[2].ewma_latency = 0.1;
+  for (auto &a : addrs) {
+    a.ewma_last_update = ev_time();
+  }
+
+  CU_ASSERT(2 == select_downstream_addr(&stat, nullptr));
+
+  // Address without sample has the default latency, 0.1 * 3
+  addrs[1].ewma_latency = 0.;
+  addrs[1].ewma_last_update = 0.;
+  addrs[1].num_inflight = 2;
+
+  CU_ASSERT(1 == select_downstream_addr(&stat, nullptr));
+
+  mod_config()->downstream_balancing = BALANCING_P2C;
+
+  addrs[0].num_inflight = 0;
+  addrs[1].num_inflight = 100;
+  addrs[2].num_inflight = 100;
+
+  // Address 0 must be chosen whenever it is one of 2 candidates.
+  size_t nzero = 0;
+  for (size_t i = 0; i < 100; ++i) {
+    auto idx = select_downstream_addr(&stat, nullptr);
+    CU_ASSERT(idx < 3);
+    if (idx == 0) {
+      ++nzero;
+    }
+  }
+
+  CU_ASSERT(nzero > 0);
+
+  mod_config()->downstream_balancing = BALANCING_ROUND_ROBIN;
+  mod_config()->downstream_addrs.clear();
+}
+
+void test_shrpx_worker_update_downstream_latency(void) {
+  DownstreamAddrStat stat;
+
+  update_downstream_latency(&stat, 1., 100.);
+
+  CU_ASSERT(1. == stat.ewma_latency);
+  CU_ASSERT(100. == stat.ewma_last_update);
+
+  // Larger sample is taken immediately
+  update_downstream_latency(&stat, 2., 100.);
+
+  CU_ASSERT(2. == stat.ewma_latency);
+
+  // Smaller sample decays the value
+  update_downstream_latency(&stat, 1., 110.);
+
+  CU_ASSERT(stat.ewma_latency < 2.);
+  CU_ASSERT(stat.ewma_latency > 1.);
+  CU_ASSERT(110. == stat.ewma_last_update);
+
+  // The estimate returns to the default latency without sample
+  CU_ASSERT(get_downstream_latency(stat, 110.) == stat.ewma_latency);
+  CU_ASSERT(get_downstream_latency(stat, 1000.) < 0.11);
+
+  // Failure is recorded as large latency
+  penalize_downstream_latency(&stat, 1000., 1000.);
+
+  CU_ASSERT(stat.ewma_latency >= 10.);
+  CU_ASSERT(1000. == stat.ewma_last_update);
+
+  DownstreamAddrStat unsampled;
+
+  CU_ASSERT(get_downstream_latency(unsampled, 1000.) > 0.);
+}
+
+void test_shrpx_worker_health_monitor(void) {
+  mod_config()->downstream_addrs.resize(3);
+  mod_config()->downstream_health_check_fall = 2;
+  mod_config()->downstream_health_check_rise = 1;
+
+  auto loop = ev_loop_new(0);
+
+  {
+    HealthMonitor monitor(loop, nullptr);
+
+    CU_ASSERT(3 == monitor.get_num_healthy());
+
+    // Single failure does not eject address
+    monitor.on_probe_result(1, false);
+
+    CU_ASSERT(monitor.healthy(1));
+
+    // Success resets the streak
+    monitor.on_probe_result(1, true);
+    monitor.on_probe_result(1, false);
+
+    CU_ASSERT(monitor.healthy(1));
+
+    monitor.on_probe_result(1, false);
+
+    CU_ASSERT(!monitor.healthy(1));
+    CU_ASSERT(2 == monitor.get_num_healthy());
+
+    worker_config->health_monitor = &monitor;
+
+    CU_ASSERT(!downstream_addr_usable(1));
+
+    WorkerStat stat;
+
+    mod_config()->downstream_balancing = BALANCING_ROUND_ROBIN;
+
+    CU_ASSERT(0 == select_downstream_addr(&stat, nullptr));
+    CU_ASSERT(2 == select_downstream_addr(&stat, nullptr));
+    CU_ASSERT(0 == select_downstream_addr(&stat, nullptr));
+
+    mod_config()->downstream_balancing = BALANCING_LEAST_INFLIGHT;
+
+    stat.downstream_addr_stats[0].num_inflight = 1;
+    stat.downstream_addr_stats[2].num_inflight = 1;
+
+    CU_ASSERT(1 != select_downstream_addr(&stat, nullptr));
+
+    mod_config()->downstream_balancing = BALANCING_P2C;
+
+    for (size_t i = 0; i < 100; ++i) {
+      CU_ASSERT(1 != select_downstream_addr(&stat, nullptr));
+    }
+
+    // If all addresses are ejected, all of them are usable.
+    for (size_t i = 0; i < 3; ++i) {
+      monitor.on_probe_result(i, false);
+      monitor.on_probe_result(i, false);
+    }
+
+    CU_ASSERT(0 == monitor.get_num_healthy());
+    CU_ASSERT(downstream_addr_usable(1));
+
+    // Readmission
+    monitor.on_probe_result(1, true);
+
+    CU_ASSERT(monitor.healthy(1));
+    CU_ASSERT(1 == monitor.get_num_healthy());
+
+    worker_config->health_monitor = nullptr;
+  }
+
+  ev_loop_destroy(loop);
+
+  mod_config()->downstream_balancing = BALANCING_ROUND_ROBIN;
+  mod_config()->downstream_addrs.clear();
+}
+
+void test_shrpx_worker_reload(void) {
+  mod_config()->downstream_addrs.resize(2);
+  mod_config()->downstream_health_check_fall = 1;
+  mod_config()->downstream_health_check_rise = 1;
+
+  auto loop = ev_loop_new(0);
+
+  {
+    HealthMonitor monitor(loop, nullptr);
+
+    monitor.on_probe_result(1, false);
+
+    CU_ASSERT(!monitor.healthy(1));
+
+    WorkerStat stat;
+
+    stat.downstream_addr_stats[1].num_inflight = 7;
+
+    // Reload removes address 0, and adds address 2.
+    mod_config()->downstream_addrs[0].removed = true;
+    mod_config()->downstream_addrs.resize(3);
+
+    HealthMonitor new_monitor(loop, &monitor);
+    monitor.stop();
+
+    CU_ASSERT(!new_monitor.healthy(0));
+    CU_ASSERT(!new_monitor.healthy(1));
+    CU_ASSERT(new_monitor.healthy(2));
+    CU_ASSERT(1 == new_monitor.get_num_healthy());
+
+    worker_config->health_monitor = &new_monitor;
+
+    reload_worker_stat(&stat);
+
+    CU_ASSERT(3 == stat.downstream_addr_stats.size());
+    CU_ASSERT(7 == stat.downstream_addr_stats[1].num_inflight);
+
+    for (auto balancing : {BALANCING_ROUND_ROBIN, BALANCING_LEAST_INFLIGHT,
+                           BALANCING_PEAK_EWMA, BALANCING_P2C}) {
+      mod_config()->downstream_balancing = balancing;
+
+      for (size_t i = 0; i < 10; ++i) {
+        CU_ASSERT(2 == select_downstream_addr(&stat, nullptr));
+      }
+    }
+
+    // If all addresses are ejected, removed address is still not
+    // usable.
+    new_monitor.on_probe_result(2, false);
+
+    CU_ASSERT(0 == new_monitor.get_num_healthy());
+    CU_ASSERT(!downstream_addr_usable(0));
+    CU_ASSERT(downstream_addr_usable(1));
+    CU_ASSERT(downstream_addr_usable(2));
+
+    for (auto balancing : {BALANCING_ROUND_ROBIN, BALANCING_P2C}) {
+      mod_config()->downstream_balancing = balancing;
+
+      for (size_t i = 0; i < 10; ++i) {
+        CU_ASSERT(0 != select_downstream_addr(&stat, nullptr));
+      }
+    }
+
+    worker_config->health_monitor = nullptr;
+  }
+
+  ev_loop_destroy(loop);
+
+  mod_config()->downstream_balancing = BALANCING_ROUND_ROBIN;
+  mod_config()->downstream_addrs.clear();
+}
+
+} // namespace shrpx
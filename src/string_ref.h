@@ -0,0 +1,126 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef STRING_REF_H
+#define STRING_REF_H
+
+#include "nghttp2_config.h"
+
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <ostream>
+
+namespace nghttp2 {
+
+// StringRef is a non-owning reference to a sequence of characters.
+// The referenced memory must outlive StringRef.  c_str() returns
+// NULL-terminated string only if the referenced memory is
+// NULL-terminated at size().  All strings stored by BlockAllocator
+// are NULL-terminated, but a StringRef which refers to a part of
+// another string (e.g., crumbled cookie) is not.  Use data() and
+// size() unless the origin is known.
+class StringRef {
+public:
+  using const_iterator = const char *;
+
+  StringRef() : base(""), len(0) {}
+  StringRef(const char *s, size_t n) : base(s), len(n) {}
+  StringRef(const uint8_t *s, size_t n)
+      : base(reinterpret_cast<const char *>(s)), len(n) {}
+  explicit StringRef(const std::string &s) : base(s.c_str()), len(s.size()) {}
+  // |s| may be a character array whose content is shorter than the
+  // array, so the length is computed by strlen().
+  StringRef(const char *s) : base(s), len(strlen(s)) {}
+
+  // Returns StringRef which refers to string literal |s|.  The length
+  // is computed at compile time, so |s| must not be a character
+  // array which may contain NULL before its end.
+  template <size_t N> static StringRef from_lit(const char (&s)[N]) {
+    return StringRef(s, N - 1);
+  }
+
+  const char *c_str() const { return base; }
+  const char *data() const { return base; }
+  const uint8_t *byte() const {
+    return reinterpret_cast<const uint8_t *>(base);
+  }
+  size_t size() const { return len; }
+  bool empty() const { return len == 0; }
+  const_iterator begin() const { return base; }
+  const_iterator end() const { return base + len; }
+  char operator[](size_t n) const { return base[n]; }
+  std::string str() const { return std::string(base, len); }
+
+private:
+  const char *base;
+  size_t len;
+};
+
+inline bool operator==(const StringRef &lhs, const StringRef &rhs) {
+  return lhs.size() == rhs.size() &&
+         memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
+inline bool operator==(const StringRef &lhs, const std::string &rhs) {
+  return lhs == StringRef(rhs);
+}
+
+inline bool operator==(const std::string &lhs, const StringRef &rhs) {
+  return StringRef(lhs) == rhs;
+}
+
+inline bool operator==(const StringRef &lhs, const char *rhs) {
+  return lhs == StringRef(rhs, strlen(rhs));
+}
+
+inline bool operator==(const char *lhs, const StringRef &rhs) {
+  return rhs == lhs;
+}
+
+inline bool operator!=(const StringRef &lhs, const StringRef &rhs) {
+  return !(lhs == rhs);
+}
+
+inline bool operator!=(const StringRef &lhs, const std::string &rhs) {
+  return !(lhs == rhs);
+}
+
+inline bool operator!=(const StringRef &lhs, const char *rhs) {
+  return !(lhs == rhs);
+}
+
+inline bool operator<(const StringRef &lhs, const StringRef &rhs) {
+  auto n = std::min(lhs.size(), rhs.size());
+  auto rv = memcmp(lhs.data(), rhs.data(), n);
+  return rv < 0 || (rv == 0 && lhs.size() < rhs.size());
+}
+
+inline std::ostream &operator<<(std::ostream &o, const StringRef &s) {
+  return o.write(s.data(), s.size());
+}
+
+} // namespace nghttp2
+
+#endif // STRING_REF_H
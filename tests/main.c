@@ -94,6 +94,8 @@ int main(int argc _U_, char *argv[] _U_) {
                    test_nghttp2_session_recv_settings_header_table_size) ||
       !CU_add_test(pSuite, "session_recv_too_large_frame_length",
                    test_nghttp2_session_recv_too_large_frame_length) ||
+      !CU_add_test(pSuite, "session_mem_recvv",
+                   test_nghttp2_session_mem_recvv) ||
       !CU_add_test(pSuite, "session_continue", test_nghttp2_session_continue) ||
       !CU_add_test(pSuite, "session_add_frame",
                    test_nghttp2_session_add_frame) ||
@@ -133,6 +135,8 @@ int main(int argc _U_, char *argv[] _U_) {
                    test_nghttp2_session_send_rst_stream) ||
       !CU_add_test(pSuite, "session_send_push_promise",
                    test_nghttp2_session_send_push_promise) ||
+      !CU_add_test(pSuite, "session_send_control_item_reuse",
+                   test_nghttp2_session_send_control_item_reuse) ||
       !CU_add_test(pSuite, "session_is_my_stream_id",
                    test_nghttp2_session_is_my_stream_id) ||
       !CU_add_test(pSuite, "session_upgrade", test_nghttp2_session_upgrade) ||
@@ -261,6 +265,8 @@ int main(int argc _U_, char *argv[] _U_) {
                    test_nghttp2_frame_pack_headers_frame_too_large) ||
       !CU_add_test(pSuite, "frame_pack_headers_frame_smallest",
                    test_nghttp2_submit_data_read_length_smallest) ||
+      !CU_add_test(pSuite, "submit_data_max_data_frame_size",
+                   test_nghttp2_submit_data_max_data_frame_size) ||
       !CU_add_test(pSuite, "frame_pack_priority",
                    test_nghttp2_frame_pack_priority) ||
       !CU_add_test(pSuite, "frame_pack_rst_stream",
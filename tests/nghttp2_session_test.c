@@ -165,6 +165,20 @@ static int on_frame_recv_callback(nghttp2_session *session _U_,
   return 0;
 }
 
+static int on_goaway_recv_callback(nghttp2_session *session _U_,
+                                   const nghttp2_frame *frame,
+                                   void *user_data) {
+  my_user_data *ud = (my_user_data *)user_data;
+  ++ud->frame_recv_cb_called;
+  ud->recv_frame_type = frame->hd.type;
+  if (frame->hd.type == NGHTTP2_GOAWAY) {
+    memcpy(ud->acc->buf, frame->goaway.opaque_data,
+           frame->goaway.opaque_data_len);
+    ud->acc->length = frame->goaway.opaque_data_len;
+  }
+  return 0;
+}
+
 static int on_invalid_frame_recv_callback(nghttp2_session *session _U_,
                                           const nghttp2_frame *frame _U_,
                                           nghttp2_error_code error_code _U_,
@@ -182,6 +196,17 @@ static int on_frame_send_callback(nghttp2_session *session _U_,
   return 0;
 }
 
+static int data_length_on_frame_send_callback(nghttp2_session *session _U_,
+                                             const nghttp2_frame *frame,
+                                             void *user_data) {
+  my_user_data *ud = (my_user_data *)user_data;
+  if (frame->hd.type == NGHTTP2_DATA) {
+    ++ud->frame_send_cb_called;
+    ud->data_chunk_len = nghttp2_max(ud->data_chunk_len, frame->hd.length);
+  }
+  return 0;
+}
+
 static int on_frame_not_send_callback(nghttp2_session *session _U_,
                                       const nghttp2_frame *frame, int lib_error,
                                       void *user_data) {
@@ -1360,6 +1385,104 @@ void test_nghttp2_session_recv_too_large_frame_length(void) {
   nghttp2_session_del(session);
 }
 
+void test_nghttp2_session_mem_recvv(void) {
+  nghttp2_session *session;
+  nghttp2_session_callbacks callbacks;
+  my_user_data ud;
+  accumulator acc;
+  uint8_t buf[NGHTTP2_FRAME_HDLEN + 8 + 100];
+  uint8_t debug_data[100];
+  nghttp2_frame_hd hd;
+  nghttp2_vec vec[3];
+  ssize_t rv;
+
+  memset(&callbacks, 0, sizeof(nghttp2_session_callbacks));
+  callbacks.on_frame_recv_callback = on_goaway_recv_callback;
+
+  memset(debug_data, 'a', sizeof(debug_data));
+
+  nghttp2_frame_hd_init(&hd, 8 + sizeof(debug_data), NGHTTP2_GOAWAY,
+                        NGHTTP2_FLAG_NONE, 0);
+  nghttp2_frame_pack_frame_hd(buf, &hd);
+  nghttp2_put_uint32be(&buf[NGHTTP2_FRAME_HDLEN], 0);
+  nghttp2_put_uint32be(&buf[NGHTTP2_FRAME_HDLEN + 4], NGHTTP2_NO_ERROR);
+  memcpy(&buf[NGHTTP2_FRAME_HDLEN + 8], debug_data, sizeof(debug_data));
+
+  ud.acc = &acc;
+
+  /* GOAWAY debug data is contained in a single chunk */
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  ud.frame_recv_cb_called = 0;
+  acc.length = 0;
+
+  vec[0].base = buf;
+  vec[0].len = NGHTTP2_FRAME_HDLEN;
+  vec[1].base = buf + NGHTTP2_FRAME_HDLEN;
+  vec[1].len = sizeof(buf) - NGHTTP2_FRAME_HDLEN;
+
+  rv = nghttp2_session_mem_recvv(session, vec, 2);
+
+  CU_ASSERT(sizeof(buf) == rv);
+  CU_ASSERT(1 == ud.frame_recv_cb_called);
+  CU_ASSERT(NGHTTP2_GOAWAY == ud.recv_frame_type);
+  CU_ASSERT(sizeof(debug_data) == acc.length);
+  CU_ASSERT(0 == memcmp(debug_data, acc.buf, sizeof(debug_data)));
+
+  nghttp2_session_del(session);
+
+  /* GOAWAY debug data spans multiple chunks */
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  ud.frame_recv_cb_called = 0;
+  acc.length = 0;
+
+  vec[0].base = buf;
+  vec[0].len = NGHTTP2_FRAME_HDLEN + 8 + 10;
+  vec[1].base = NULL;
+  vec[1].len = 0;
+  vec[2].base = buf + vec[0].len;
+  vec[2].len = sizeof(buf) - vec[0].len;
+
+  rv = nghttp2_session_mem_recvv(session, vec, 3);
+
+  CU_ASSERT(sizeof(buf) == rv);
+  CU_ASSERT(1 == ud.frame_recv_cb_called);
+  CU_ASSERT(NGHTTP2_GOAWAY == ud.recv_frame_type);
+  CU_ASSERT(sizeof(debug_data) == acc.length);
+  CU_ASSERT(0 == memcmp(debug_data, acc.buf, sizeof(debug_data)));
+
+  nghttp2_session_del(session);
+
+  /* Pause on DATA chunk which ends exactly at the end of vec[0] */
+  memset(&callbacks, 0, sizeof(nghttp2_session_callbacks));
+  callbacks.on_data_chunk_recv_callback = pause_on_data_chunk_recv_callback;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                              &pri_spec_default, NGHTTP2_STREAM_OPENED, NULL);
+
+  memset(buf, 0, sizeof(buf));
+  nghttp2_frame_hd_init(&hd, 16, NGHTTP2_DATA, NGHTTP2_FLAG_NONE, 1);
+  nghttp2_frame_pack_frame_hd(buf, &hd);
+  nghttp2_frame_pack_frame_hd(buf + NGHTTP2_FRAME_HDLEN + 16, &hd);
+
+  ud.data_chunk_recv_cb_called = 0;
+
+  vec[0].base = buf;
+  vec[0].len = NGHTTP2_FRAME_HDLEN + 16;
+  vec[1].base = buf + vec[0].len;
+  vec[1].len = NGHTTP2_FRAME_HDLEN + 16;
+
+  rv = nghttp2_session_mem_recvv(session, vec, 2);
+
+  CU_ASSERT((ssize_t)vec[0].len == rv);
+  CU_ASSERT(1 == ud.data_chunk_recv_cb_called);
+
+  nghttp2_session_del(session);
+}
+
 void test_nghttp2_session_continue(void) {
   nghttp2_session *session;
   nghttp2_session_callbacks callbacks;
@@ -2874,6 +2997,50 @@ void test_nghttp2_session_send_push_promise(void) {
   nghttp2_session_del(session);
 }
 
+void test_nghttp2_session_send_control_item_reuse(void) {
+  nghttp2_session *session;
+  nghttp2_session_callbacks callbacks;
+  nghttp2_outbound_item *item, *cached_item;
+  size_t i;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  callbacks.send_callback = null_send_callback;
+
+  nghttp2_session_client_new(&session, &callbacks, NULL);
+
+  CU_ASSERT(0 == session->ob_item_cache_len);
+
+  CU_ASSERT(0 == nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL));
+  CU_ASSERT(0 == nghttp2_session_send(session));
+
+  /* the item used for PING is kept for reuse */
+  CU_ASSERT(1 == session->ob_item_cache_len);
+
+  cached_item = session->ob_item_cache[0];
+
+  CU_ASSERT(0 == nghttp2_submit_window_update(session, NGHTTP2_FLAG_NONE, 0,
+                                              4096));
+  CU_ASSERT(0 == session->ob_item_cache_len);
+
+  item = nghttp2_session_get_next_ob_item(session);
+
+  CU_ASSERT(cached_item == item);
+  CU_ASSERT(NGHTTP2_WINDOW_UPDATE == item->frame.hd.type);
+  CU_ASSERT(0 == nghttp2_session_send(session));
+  CU_ASSERT(1 == session->ob_item_cache_len);
+  CU_ASSERT(item == session->ob_item_cache[0]);
+
+  /* cache does not grow beyond its limit */
+  for (i = 0; i < NGHTTP2_OB_ITEM_CACHE_MAX + 1; ++i) {
+    CU_ASSERT(0 == nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL));
+  }
+
+  CU_ASSERT(0 == nghttp2_session_send(session));
+  CU_ASSERT(NGHTTP2_OB_ITEM_CACHE_MAX == session->ob_item_cache_len);
+
+  nghttp2_session_del(session);
+}
+
 void test_nghttp2_session_is_my_stream_id(void) {
   nghttp2_session *session;
   nghttp2_session_callbacks callbacks;
@@ -3228,6 +3395,76 @@ void test_nghttp2_submit_data_read_length_smallest(void) {
   nghttp2_session_del(session);
 }
 
+void test_nghttp2_submit_data_max_data_frame_size(void) {
+  nghttp2_session *session;
+  nghttp2_session_callbacks callbacks;
+  nghttp2_option *option;
+  nghttp2_data_provider data_prd;
+  my_user_data ud;
+  nghttp2_stream *stream;
+
+  memset(&callbacks, 0, sizeof(nghttp2_session_callbacks));
+  callbacks.send_callback = null_send_callback;
+  callbacks.on_frame_send_callback = data_length_on_frame_send_callback;
+
+  data_prd.read_callback = fixed_length_data_source_read_callback;
+
+  nghttp2_option_new(&option);
+  nghttp2_option_set_max_data_frame_size(option, NGHTTP2_MAX_FRAME_SIZE_MAX);
+
+  CU_ASSERT(0 ==
+            nghttp2_session_client_new2(&session, &callbacks, &ud, option));
+
+  session->remote_settings.max_frame_size = NGHTTP2_MAX_FRAME_SIZE_MAX;
+  session->remote_window_size = NGHTTP2_MAX_WINDOW_SIZE;
+
+  stream = nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                                       &pri_spec_default,
+                                       NGHTTP2_STREAM_OPENING, NULL);
+  stream->remote_window_size = NGHTTP2_MAX_WINDOW_SIZE;
+
+  ud.data_source_length = 256 * 1024;
+  ud.frame_send_cb_called = 0;
+  ud.data_chunk_len = 0;
+
+  CU_ASSERT(
+      0 == nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd));
+  CU_ASSERT(0 == nghttp2_session_send(session));
+
+  /* First 64KiB is sent in NGHTTP2_DATA_PAYLOADLEN (5 frames), then
+     frame size grows to the number of bytes sent so far (81875), and
+     the rest is sent in the last frame. */
+  CU_ASSERT(7 == ud.frame_send_cb_called);
+  CU_ASSERT(256 * 1024 - NGHTTP2_DATA_PAYLOADLEN * 10 == ud.data_chunk_len);
+
+  nghttp2_session_del(session);
+
+  /* Frame size never exceeds remote SETTINGS_MAX_FRAME_SIZE */
+  CU_ASSERT(0 ==
+            nghttp2_session_client_new2(&session, &callbacks, &ud, option));
+
+  session->remote_window_size = NGHTTP2_MAX_WINDOW_SIZE;
+
+  stream = nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                                       &pri_spec_default,
+                                       NGHTTP2_STREAM_OPENING, NULL);
+  stream->remote_window_size = NGHTTP2_MAX_WINDOW_SIZE;
+
+  ud.data_source_length = 256 * 1024;
+  ud.frame_send_cb_called = 0;
+  ud.data_chunk_len = 0;
+
+  CU_ASSERT(
+      0 == nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd));
+  CU_ASSERT(0 == nghttp2_session_send(session));
+
+  CU_ASSERT(NGHTTP2_MAX_FRAME_SIZE_MIN == ud.data_chunk_len);
+
+  nghttp2_session_del(session);
+
+  nghttp2_option_del(option);
+}
+
 static ssize_t submit_data_twice_data_source_read_callback(
     nghttp2_session *session _U_, int32_t stream_id _U_, uint8_t *buf _U_,
     size_t len, uint32_t *data_flags, nghttp2_data_source *source _U_,